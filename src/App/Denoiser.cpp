@@ -34,10 +34,12 @@ Denoiser::Denoiser(Node& node) : mNode(node) {
 
 void Denoiser::createPipelines(Device& device) {
 	const filesystem::path shaderPath = filesystem::path(*device.mInstance.findArgument("shaderKernelPath")) / "svgf";
-	mTemporalAccumulationPipeline = ComputePipelineCache(shaderPath / "temporal_accumulation.slang", "main"    , "cs_6_6");
-	mEstimateVariancePipeline     = ComputePipelineCache(shaderPath / "estimate_variance.slang"    , "main"    , "cs_6_6");
-	mAtrousPipeline               = ComputePipelineCache(shaderPath / "atrous.slang"               , "main"    , "cs_6_6");
-	mCopyRGBPipeline              = ComputePipelineCache(shaderPath / "atrous.slang"               , "copy_rgb", "cs_6_6");
+	mTemporalAccumulationPipeline   = ComputePipelineCache(shaderPath / "temporal_accumulation.slang", "main"                  , "cs_6_6");
+	mEstimateVariancePipeline       = ComputePipelineCache(shaderPath / "estimate_variance.slang"    , "main"                  , "cs_6_6");
+	mAtrousPipeline                 = ComputePipelineCache(shaderPath / "atrous.slang"               , "main"                  , "cs_6_6");
+	mCopyRGBPipeline                = ComputePipelineCache(shaderPath / "atrous.slang"               , "copy_rgb"              , "cs_6_6");
+	mAtrousTiledPipeline            = ComputePipelineCache(shaderPath / "atrous_tiled.slang"         , "main"                  , "cs_6_6");
+	mEstimateVarianceAtrousPipeline = ComputePipelineCache(shaderPath / "atrous_tiled.slang"         , "EstimateVarianceAtrous", "cs_6_6");
 }
 
 void Denoiser::drawGui() {
@@ -92,6 +94,9 @@ void Denoiser::drawGui() {
 			Gui::enumDropdown<FilterKernelType>("Filter", mFilterType, (uint32_t)FilterKernelType::eFilterKernelTypeCount);
 			ImGui::PushItemWidth(40);
 			ImGui::DragScalar("History tap iteration", ImGuiDataType_U32, &mHistoryTap, 0.1f);
+			ImGui::PopItemWidth();
+			ImGui::Checkbox("Tiled filter", &mTiledFilter);
+			ImGui::PushItemWidth(40);
 			ImGui::Unindent();
 		}
 		ImGui::PopItemWidth();
@@ -201,7 +206,7 @@ Image::View Denoiser::denoise(
 
 		if (mAtrousIterations > 0) {
 
-			{ // estimate variance
+			if (!mTiledFilter) { // estimate variance
 				temp[0].barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
 				accumColor.barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 				accumMoments.barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
@@ -223,19 +228,41 @@ Image::View Denoiser::denoise(
 				temp[0].barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 				temp[1].barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 
-				atrousPipeline->dispatchTiled(commandBuffer, extent, atrousDescriptorSets, {}, {
+				const uint32_t stepSize = 1 << i;
+				const PushConstants pushConstants {
 					{ "mViewCount", PushConstantValue((uint32_t)views.size()) },
 					{ "mSigmaLuminanceBoost", PushConstantValue(mSigmaLuminanceBoost) },
 					{ "mIteration", PushConstantValue(i) },
-					{ "mStepSize", PushConstantValue(1 << i) },
-				});
-
-				if (i+1 == mHistoryTap) {
+					{ "mStepSize", PushConstantValue(stepSize) },
+					{ "mHistoryLimit", PushConstantValue(mHistoryLimit) },
+					{ "mVarianceBoostLength", PushConstantValue(mVarianceBoostLength) },
+					{ "mHistoryTap", PushConstantValue(mHistoryTap) },
+				};
+
+				bool copyRgb = (i+1 == mHistoryTap);
+
+				if (mTiledFilter && stepSize <= 2) {
+					accumColor.barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+					if (i == 0) {
+						// variance estimation fused with the first iteration
+						accumMoments.barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+						auto pipeline = mEstimateVarianceAtrousPipeline.get(commandBuffer.mDevice, defines);
+						pipeline->dispatchTiled(commandBuffer, extent, mResourcePool.getDescriptorSets(*pipeline, "EstimateVarianceAtrousDescriptors", descriptors), {}, pushConstants);
+					} else {
+						// copies rgb to AccumColor itself. the fused kernel can't, since other groups may still be reading AccumColor.
+						auto pipeline = mAtrousTiledPipeline.get(commandBuffer.mDevice, defines);
+						pipeline->dispatchTiled(commandBuffer, extent, mResourcePool.getDescriptorSets(*pipeline, "AtrousTiledDescriptors", descriptors), {}, pushConstants);
+						copyRgb = false;
+					}
+				} else
+					atrousPipeline->dispatchTiled(commandBuffer, extent, atrousDescriptorSets, {}, pushConstants);
+
+				if (copyRgb) {
 					// copy rgb (not alpha channel) to AccumColor
 					temp[0].barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 					temp[1].barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
-					auto copyRgb = mCopyRGBPipeline.get(commandBuffer.mDevice, defines);
-					copyRgb->dispatchTiled(commandBuffer, extent, mResourcePool.getDescriptorSets(*copyRgb, "CopyRGBDescriptors", descriptors));
+					auto copyRgbPipeline = mCopyRGBPipeline.get(commandBuffer.mDevice, defines);
+					copyRgbPipeline->dispatchTiled(commandBuffer, extent, mResourcePool.getDescriptorSets(*copyRgbPipeline, "CopyRGBDescriptors", descriptors));
 				}
 			}
 			output = temp[mAtrousIterations%2];
@@ -47,6 +47,7 @@ private:
 	uint32_t mAccumulatedFrames = 0;
 	uint32_t mAtrousIterations = 0;
 	uint32_t mHistoryTap = 0;
+	bool mTiledFilter = true;
 	FilterKernelType mFilterType = FilterKernelType::eBox3;
 	DenoiserDebugMode mDebugMode = DenoiserDebugMode::eNone;
 	bool mResetAccumulation = false;
@@ -61,6 +62,8 @@ private:
 	ComputePipelineCache mEstimateVariancePipeline;
 	ComputePipelineCache mAtrousPipeline;
 	ComputePipelineCache mCopyRGBPipeline;
+	ComputePipelineCache mAtrousTiledPipeline;
+	ComputePipelineCache mEstimateVarianceAtrousPipeline;
 
 	DeviceResourcePool mResourcePool;
 
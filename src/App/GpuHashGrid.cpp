@@ -10,8 +10,9 @@ GpuHashGrid::GpuHashGrid(Device& device, const uint32_t elementSize, const uint3
 	mCellSize = cellSize;
 
 	const filesystem::path shaderPath = *device.mInstance.findArgument("shaderKernelPath");
-	mComputeIndicesPipeline = ComputePipelineCache(shaderPath / "hashgrid.slang", "ComputeIndices", "sm_6_6", { "-O3", "-matrix-layout-row-major", "-capability", "spirv_1_5" });
-	mSwizzlePipeline        = ComputePipelineCache(shaderPath / "hashgrid.slang", "Swizzle"       , "sm_6_6", { "-O3", "-matrix-layout-row-major", "-capability", "spirv_1_5" });
+	mDispatchArgsPipeline = ComputePipelineCache(shaderPath / "hashgrid.slang", "WriteSwizzleDispatchArgs", "sm_6_6", { "-O3", "-matrix-layout-row-major", "-capability", "spirv_1_5" });
+	mSwizzlePipeline      = ComputePipelineCache(shaderPath / "hashgrid.slang", "Swizzle"                 , "sm_6_6", { "-O3", "-matrix-layout-row-major", "-capability", "spirv_1_5" });
+	mPrefixScan = GpuPrefixScan(device);
 }
 
 GpuHashGrid::FrameData GpuHashGrid::init(CommandBuffer& commandBuffer, Descriptors& outputDescriptors, const string& name, const Metadata& md, const string& prevName) {
@@ -52,7 +53,7 @@ GpuHashGrid::FrameData GpuHashGrid::init(CommandBuffer& commandBuffer, Descripto
 	const unordered_map<string, Buffer::View<byte>> buffers {
 		{ "mChecksums"        , mResourcePool.getBuffer<uint32_t>          (commandBuffer.mDevice, name + ".mChecksums",         mCellCount,         vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, bufCount) },
 		{ "mCellCounters"     , mResourcePool.getBuffer<uint32_t>          (commandBuffer.mDevice, name + ".mCellCounters",      mCellCount,         vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, bufCount) },
-		{ "mOtherCounters"    , mResourcePool.getBuffer<uint32_t>          (commandBuffer.mDevice, name + ".mOtherCounters",     4,                  vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, bufCount) },
+		{ "mOtherCounters"    , mResourcePool.getBuffer<uint32_t>          (commandBuffer.mDevice, name + ".mOtherCounters",     4,                  vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eIndirectBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, bufCount) },
 		{ "mAppendDataIndices", mResourcePool.getBuffer<uint2>             (commandBuffer.mDevice, name + ".mAppendDataIndices", mSize,              vk::BufferUsageFlagBits::eStorageBuffer,                                       vk::MemoryPropertyFlagBits::eDeviceLocal, bufCount) },
 		{ "mAppendData"       , mResourcePool.getBuffer<byte>              (commandBuffer.mDevice, name + ".mAppendData",        mSize*mElementSize, vk::BufferUsageFlagBits::eStorageBuffer,                                       vk::MemoryPropertyFlagBits::eDeviceLocal, bufCount) },
 		{ "mDataIndices"      , mResourcePool.getBuffer<uint32_t>          (commandBuffer.mDevice, name + ".mDataIndices",       mSize,              vk::BufferUsageFlagBits::eStorageBuffer,                                       vk::MemoryPropertyFlagBits::eDeviceLocal, bufCount) },
@@ -83,26 +84,35 @@ void GpuHashGrid::clear(CommandBuffer& commandBuffer, const GpuHashGrid::FrameDa
 
 void GpuHashGrid::build(CommandBuffer& commandBuffer, const GpuHashGrid::FrameData& hashGridDescriptors) {
 	Defines defs { { "N", to_string(mElementSize/sizeof(float)) } };
-	const auto computeIndicesPipeline = mComputeIndicesPipeline.get(commandBuffer.mDevice, defs);
-	const auto swizzlePipeline        = mSwizzlePipeline       .get(commandBuffer.mDevice, defs);
+	const auto dispatchArgsPipeline = mDispatchArgsPipeline.get(commandBuffer.mDevice, defs);
+	const auto swizzlePipeline      = mSwizzlePipeline     .get(commandBuffer.mDevice, defs);
 
-	const auto descriptorSets = computeIndicesPipeline->getDescriptorSets(hashGridDescriptors);
+	const auto descriptorSets = swizzlePipeline->getDescriptorSets(hashGridDescriptors);
 
-	get<BufferDescriptor>(hashGridDescriptors.at({"gHashGrid.mCellCounters",0})).barrier(
-		commandBuffer,
+	const Buffer::View<uint32_t> cellCounters  = get<BufferDescriptor>(hashGridDescriptors.at({"gHashGrid.mCellCounters",0})).cast<uint32_t>();
+	const Buffer::View<uint32_t> indices       = get<BufferDescriptor>(hashGridDescriptors.at({"gHashGrid.mIndices",0})).cast<uint32_t>();
+	const Buffer::View<uint32_t> otherCounters = get<BufferDescriptor>(hashGridDescriptors.at({"gHashGrid.mOtherCounters",0})).cast<uint32_t>();
+
+	Buffer::barriers(commandBuffer, { cellCounters, otherCounters },
 		vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
-		vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+		vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+
+	// cell offsets are a deterministic prefix sum over the cell counters, so items of a cell are contiguous and cells are in order
+	mPrefixScan.exclusiveScan(commandBuffer, cellCounters, indices, mCellCount);
 
-	computeIndicesPipeline->dispatchTiled(commandBuffer, vk::Extent3D{1024, (mCellCount + 1023)/1024, 1}, descriptorSets);
+	// size the swizzle dispatch by the number of appended items, rather than the capacity
+	dispatchArgsPipeline->dispatch(commandBuffer, vk::Extent3D{1, 1, 1}, hashGridDescriptors);
 
 	Buffer::barriers(commandBuffer, {
-		get<BufferDescriptor>(hashGridDescriptors.at({"gHashGrid.mOtherCounters",0})),
-		get<BufferDescriptor>(hashGridDescriptors.at({"gHashGrid.mIndices",0})),
+		indices,
 		get<BufferDescriptor>(hashGridDescriptors.at({"gHashGrid.mAppendDataIndices",0})) },
 		vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
 		vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+	otherCounters.barrier(commandBuffer,
+		vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect|vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead|vk::AccessFlagBits::eShaderRead);
 
-	swizzlePipeline->dispatchTiled(commandBuffer, vk::Extent3D{1024, (mSize + 1023)/1024, 1}, descriptorSets);
+	swizzlePipeline->dispatchIndirect(commandBuffer, Buffer::View<vk::DispatchIndirectCommand>(otherCounters.buffer(), otherCounters.offset() + sizeof(uint32_t), 1), descriptorSets);
 
 	get<BufferDescriptor>(hashGridDescriptors.at({ "gHashGrid.mDataIndices", 0 })).barrier(
 		commandBuffer,
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Core/DeviceResourcePool.hpp>
+#include <Core/GpuPrefixScan.hpp>
 #include <Core/math.hpp>
 
 namespace stm2 {
@@ -15,7 +16,8 @@ struct GpuHashGrid {
 
 	using FrameData = Descriptors;
 
-	ComputePipelineCache mComputeIndicesPipeline, mSwizzlePipeline;
+	ComputePipelineCache mDispatchArgsPipeline, mSwizzlePipeline;
+	GpuPrefixScan mPrefixScan;
 	DeviceResourcePool mResourcePool;
 
 	GpuHashGrid() = default;
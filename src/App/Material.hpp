@@ -17,7 +17,26 @@ struct Material {
 	Image::View mBumpImage;
 	float mBumpStrength = 1;
 
-	bool alphaTest() { return (!mMinAlpha || mMinAlpha.buffer()->inFlight()) ? false : mMinAlpha[0] < 255; }
+	// Hash of everything store() writes. Images are compared by view, since TextureCache already shares identical images.
+	inline size_t contentHash() const {
+		auto imageHash = [](const Image::View& img) { return img ? hash<Image::View>()(img) : 0; };
+		size_t h = hashArgs(mMaterialData.mPackedData, mMaterialData.mEmissionScale, mAlphaCutoff, mBumpStrength, imageHash(mAlphaMask), imageHash(mBumpImage));
+		for (const Image::View& img : mImages)
+			h = hashCombine(h, imageHash(img));
+		return h;
+	}
+	// Compares everything contentHash covers, since a hash match alone doesn't make two materials identical
+	inline bool sameContent(const Material& m) const {
+		return (mMaterialData.mPackedData == m.mMaterialData.mPackedData).all() &&
+			mMaterialData.mEmissionScale == m.mMaterialData.mEmissionScale &&
+			mAlphaCutoff == m.mAlphaCutoff &&
+			mBumpStrength == m.mBumpStrength &&
+			mAlphaMask == m.mAlphaMask &&
+			mBumpImage == m.mBumpImage &&
+			mImages == m.mImages;
+	}
+
+	bool alphaTest() const { return (!mMinAlpha || mMinAlpha.buffer()->inFlight()) ? false : mMinAlpha[0] < 255; }
 
     inline void store(MaterialResources& resources) const {
 		resources.mMaterialData.AppendN(mMaterialData.mPackedData);
@@ -37,7 +37,7 @@ void RasterRenderer::createPipelines(Device& device, const vk::Format renderForm
 	gmd.mDynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
 
 	gmd.mDynamicRenderingState = GraphicsPipeline::DynamicRenderingState();
-	gmd.mDynamicRenderingState->mColorFormats = { renderFormat, vk::Format::eR32G32Uint };
+	gmd.mDynamicRenderingState->mColorFormats = { renderFormat, vk::Format::eR32G32B32A32Uint };
 	gmd.mDynamicRenderingState->mDepthFormat = vk::Format::eD32Sfloat;
 
 	gmd.mViewports = { vk::Viewport(0, 0, 0, 0, 0, 1) };
@@ -94,6 +94,14 @@ void RasterRenderer::createPipelines(Device& device, const vk::Format renderForm
 		{ vk::ShaderStageFlagBits::eVertex  , GraphicsPipelineCache::ShaderSourceInfo(rasterShaderPath, "vsmain", "sm_6_6") },
 		{ vk::ShaderStageFlagBits::eFragment, GraphicsPipelineCache::ShaderSourceInfo(rasterShaderPath, "fsmain", "sm_6_6") }
 	}, rasterArgs, gmd);
+	mMeshPipeline = GraphicsPipelineCache({
+		{ vk::ShaderStageFlagBits::eMeshEXT , GraphicsPipelineCache::ShaderSourceInfo(rasterShaderPath, "msmain", "sm_6_6") },
+		{ vk::ShaderStageFlagBits::eFragment, GraphicsPipelineCache::ShaderSourceInfo(rasterShaderPath, "fsmain", "sm_6_6") }
+	}, rasterArgs, gmd);
+
+	const filesystem::path cullShaderPath = shaderPath / "raster_cull.slang";
+	mCullPipeline = ComputePipelineCache(cullShaderPath, "Cull");
+	mHiZPipeline  = ComputePipelineCache(cullShaderPath, "BuildHiZ");
 }
 
 void RasterRenderer::drawGui() {
@@ -107,10 +115,23 @@ void RasterRenderer::drawGui() {
 		Device& device = *mNode.findAncestor<Device>();
 		device->waitIdle();
 		mRasterPipeline.clear();
+		mMeshPipeline.clear();
+		mCullPipeline.clear();
+		mHiZPipeline.clear();
 	}
 	ImGui::PopID();
 
 	ImGui::Checkbox("Alpha masks", &mAlphaMasks);
+	ImGui::Checkbox("GPU culling", &mGpuCulling);
+	if (mGpuCulling) {
+		ImGui::Indent();
+		ImGui::Checkbox("Occlusion culling", &mOcclusionCulling);
+		ImGui::Checkbox("Meshlet cone culling", &mConeCulling);
+		if (mNode.findAncestor<Device>()->meshShaderFeatures().meshShader)
+			ImGui::Checkbox("Mesh shaders", &mMeshShading);
+		ImGui::Text("%u draw candidates", (uint32_t)mDrawCandidates.size());
+		ImGui::Unindent();
+	}
 
 	if (auto tonemapper = mNode.getComponent<Tonemapper>(); tonemapper)
 		ImGui::Checkbox("Enable tonemapper", &mTonemap);
@@ -130,7 +151,7 @@ void RasterRenderer::render(CommandBuffer& commandBuffer, const Image::View& ren
 		if (it->first.buffer()->inFlight())
 			break;
 
-		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].instanceIndex();
+		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].mInstanceIndex;
 		if (shared_ptr<Inspector> inspector = mNode.root()->findDescendant<Inspector>()) {
 			if (selectedInstance == INVALID_INSTANCE || selectedInstance >= scene->frameData().mInstanceNodes.size())
 				inspector->select(nullptr);
@@ -177,23 +198,207 @@ void RasterRenderer::render(CommandBuffer& commandBuffer, const Image::View& ren
 		.mExtent = extent,
 		.mUsage = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eTransferSrc });
 	auto visibilityBuffer = mResourcePool.getImage(commandBuffer.mDevice, "VisibilityBuffer", Image::Metadata{
-		.mFormat = vk::Format::eR32G32Uint,
+		.mFormat = vk::Format::eR32G32B32A32Uint,
 		.mExtent = extent,
 		.mUsage = vk::ImageUsageFlagBits::eColorAttachment|vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eTransferSrc });
 	auto depthBuffer = mResourcePool.getImage(commandBuffer.mDevice, "DepthBuffer", Image::Metadata{
 		.mFormat = vk::Format::eD32Sfloat,
 		.mExtent = extent,
-		.mUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment });
+		.mUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment|vk::ImageUsageFlagBits::eSampled });
+
+	const bool gpuCulling = mGpuCulling && !views.empty() && commandBuffer.mDevice.extensions().contains(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	const bool occlusionCulling = gpuCulling && mOcclusionCulling;
+	const bool meshShading = gpuCulling && mMeshShading && commandBuffer.mDevice.meshShaderFeatures().meshShader;
+	// fragment shaders need the geometryShader feature for SV_PrimitiveID, see raster_scene.slang
+	const bool primitiveIdVarying = !commandBuffer.mDevice.features().geometryShader;
+
+	// cull
+
+	Buffer::View<vk::DrawIndexedIndirectCommand> drawCommands;
+	Buffer::View<uint32_t> drawCounts;
+	if (gpuCulling) {
+		if (scene->lastUpdate() != mDrawCandidatesUpdate || mAlphaMasks != mDrawCandidatesAlphaMasks || !mDrawCandidates.buffer()) {
+			vector<DrawCandidate> candidates;
+			const auto& instances = scene->frameData().mInstances;
+			const auto& instanceMeshlets = scene->frameData().mInstanceMeshlets;
+			const auto& instanceIndexRanges = scene->frameData().mInstanceIndexRanges;
+			for (uint32_t instanceIndex = 0; instanceIndex < instances.size(); instanceIndex++) {
+				const auto&[instanceData, material, transform] = instances[instanceIndex];
+				if (instanceData.getType() != InstanceType::eMesh) continue;
+				const auto[firstIndex, indexCount] = instanceIndexRanges[instanceIndex];
+				if (firstIndex == ~0u) continue;
+				const MeshInstanceData* instance = reinterpret_cast<const MeshInstanceData*>(&instanceData);
+				const uint32_t alphaMask = (mAlphaMasks && material->alphaTest()) ? 1u : 0u;
+
+				const auto&[meshlets, tablesIndex] = instanceMeshlets[instanceIndex];
+				if (!meshlets) {
+					candidates.emplace_back(DrawCandidate{
+						.mDraw = DrawData{
+							.mInstanceIndex = instanceIndex,
+							.mMaterialAddress = instance->getMaterialAddress(),
+							.mFirstTriangle = 0,
+							.mTriangleCount = indexCount/3,
+							.mMeshletTables = INVALID_MESHLET,
+							.mFirstIndex = firstIndex },
+						.mAlphaMask = alphaMask });
+					continue;
+				}
+
+				// one candidate per meshlet
+				const uint32_t tablesOffset = (uint32_t)meshlets->mTables.offset();
+				for (const MeshletInfo& meshlet : meshlets->mMeshlets)
+					candidates.emplace_back(DrawCandidate{
+						.mDraw = DrawData{
+							.mInstanceIndex = instanceIndex,
+							.mMaterialAddress = instance->getMaterialAddress(),
+							.mFirstTriangle = meshlet.mFirstTriangle,
+							.mTriangleCount = meshlet.triangleCount(),
+							.mMeshletTables = tablesIndex,
+							.mMeshletVertexOffset = tablesOffset + meshlet.mVertexOffset*(uint32_t)sizeof(uint32_t),
+							.mMeshletTriangleOffset = tablesOffset + (meshlets->mTriangleTableOffset + meshlet.mFirstTriangle)*(uint32_t)sizeof(uint32_t),
+							.mMeshletVertexCount = meshlet.vertexCount(),
+							.mFirstIndex = firstIndex },
+						.mAlphaMask = alphaMask,
+						.mSphere = float4(meshlet.mCenter[0], meshlet.mCenter[1], meshlet.mCenter[2], meshlet.mRadius),
+						.mCone = float4(meshlet.mConeAxis[0], meshlet.mConeAxis[1], meshlet.mConeAxis[2], meshlet.mConeCutoff) });
+			}
+			mDrawCapacity = (uint32_t)candidates.size();
+
+			// one candidate per instanced mesh, whose instances the culling pass tests using the bounds written
+			// when they were expanded
+			mBatchInstanceCounts.clear();
+			for (const Scene::FrameData::InstancedMesh& instancedMesh : scene->frameData().mInstancedMeshes) {
+				if (instancedMesh.mFirstIndex == ~0u) continue;
+				candidates.emplace_back(DrawCandidate{
+					.mDraw = DrawData{
+						.mInstanceIndex = instancedMesh.mFirstInstance,
+						.mMaterialAddress = instancedMesh.mMaterialAddress,
+						.mFirstTriangle = 0,
+						.mTriangleCount = instancedMesh.mIndexCount/3,
+						.mMeshletTables = INVALID_MESHLET,
+						.mFirstIndex = instancedMesh.mFirstIndex },
+					.mAlphaMask = (mAlphaMasks && instancedMesh.mMaterial->alphaTest()) ? 1u : 0u,
+					.mInstanceCount = (uint32_t)instancedMesh.mTransforms.size() });
+				mBatchInstanceCounts.emplace_back((uint32_t)instancedMesh.mTransforms.size());
+				mDrawCapacity += (uint32_t)instancedMesh.mTransforms.size();
+			}
+
+			// earlier frames may still be culling from the buffer, so it is written by a copy on the device
+			if (!mDrawCandidates.buffer() || mDrawCandidates.buffer()->size() < candidates.size()*sizeof(DrawCandidate))
+				mDrawCandidates = make_shared<Buffer>(commandBuffer.mDevice, "DrawCandidates", max<size_t>(candidates.size(), 1)*sizeof(DrawCandidate), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+			else
+				mDrawCandidates.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eTransferWrite);
+			mDrawCandidates = Buffer::View<DrawCandidate>(mDrawCandidates.buffer(), 0, candidates.size());
+			if (!candidates.empty()) {
+				Buffer::View<DrawCandidate> staging = mResourcePool.getBuffer<DrawCandidate>(commandBuffer.mDevice, "DrawCandidates (Staging)", candidates.size(), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, commandBuffer.mDevice.frameIndex() - commandBuffer.mDevice.lastFrameDone() - 1);
+				ranges::copy(candidates, staging.begin());
+				Buffer::copy(commandBuffer, Buffer::View<DrawCandidate>(staging, 0, candidates.size()), mDrawCandidates);
+				commandBuffer.trackResource(staging.buffer());
+				mDrawCandidates.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+			}
+			mDrawCandidatesUpdate = scene->lastUpdate();
+			mDrawCandidatesAlphaMasks = mAlphaMasks;
+		}
+
+		const vk::Extent3D hizExtent(max(extent.width/2, 1u), max(extent.height/2, 1u), 1);
+		if (!mHiZ || mHiZ.extent() != hizExtent) {
+			mHiZ = make_shared<Image>(commandBuffer.mDevice, "HiZ", Image::Metadata{
+				.mFormat = vk::Format::eR32Sfloat,
+				.mExtent = hizExtent,
+				.mLevels = Image::maxMipLevels(hizExtent),
+				.mUsage = vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled });
+			mHiZValid = false;
+		}
+
+		const uint32_t candidateCount = (uint32_t)(mDrawCandidates.size() - mBatchInstanceCounts.size());
+		drawCommands = mResourcePool.getBuffer<vk::DrawIndexedIndirectCommand>(commandBuffer.mDevice, "DrawCommands", max(2*mDrawCapacity, 1u), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eIndirectBuffer);
+		drawCounts = mResourcePool.getBuffer<uint32_t>(commandBuffer.mDevice, "DrawCounts", 4*RASTER_STREAM_COUNT, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eIndirectBuffer|vk::BufferUsageFlagBits::eTransferDst);
+		Buffer::View<DrawData> drawData = mResourcePool.getBuffer<DrawData>(commandBuffer.mDevice, "DrawData", max(RASTER_STREAM_COUNT*mDrawCapacity, 1u));
+		descriptors[{"gParams.mDrawData",0}] = drawData;
+
+		// each stream's count, followed by an empty VkDrawMeshTasksIndirectCommandEXT that the culling pass grows
+		array<uint32_t, 4*RASTER_STREAM_COUNT> initialCounts;
+		for (uint32_t i = 0; i < RASTER_STREAM_COUNT; i++)
+			ranges::copy(array<uint32_t,4>{ 0, 0, 1, 1 }, initialCounts.begin() + 4*i);
+		commandBuffer->updateBuffer<uint32_t>(**drawCounts.buffer(), drawCounts.absoluteOffset(), initialCounts);
+		drawCounts.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+
+		if (mDrawCapacity > 0) {
+			ProfilerScope ps("Cull", &commandBuffer);
+			const bool useHiZ = occlusionCulling && mHiZValid;
+			Descriptors cullDescriptors{
+				{ {"gCandidates",0}, mDrawCandidates },
+				{ {"gInstanceAabbs",0}, scene->frameData().mInstanceAabbBuffer },
+				{ {"gInstanceTransforms",0}, descriptors.at({"gScene.mInstanceTransforms",0}) },
+				{ {"gInstanceInverseTransforms",0}, descriptors.at({"gScene.mInstanceInverseTransforms",0}) },
+				{ {"gViews",0}, descriptors.at({"gParams.mViews",0}) },
+				{ {"gViewTransforms",0}, descriptors.at({"gParams.mViewTransforms",0}) },
+				{ {"gViewInverseTransforms",0}, descriptors.at({"gParams.mViewInverseTransforms",0}) },
+				{ {"gPrevViews",0}, mResourcePool.uploadData<ViewData>(commandBuffer, "PrevViews", mPrevView) },
+				{ {"gPrevViewInverseTransforms",0}, mResourcePool.uploadData<TransformData>(commandBuffer, "PrevViewInverseTransforms", mPrevViewInverseTransform) },
+				{ {"gHiZ",0}, ImageDescriptor{ mHiZ, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, {} } },
+				{ {"gDrawCommands",0}, drawCommands },
+				{ {"gDrawData",0}, drawData },
+				{ {"gDrawCounts",0}, drawCounts }
+			};
+			PushConstants cullPushConstants;
+			cullPushConstants["mCandidateCount"] = candidateCount;
+			cullPushConstants["mViewIndex"] = 0u;
+			cullPushConstants["mHiZLevels"] = useHiZ ? mHiZ.image()->levels() : 0u;
+			cullPushConstants["mHiZExtent"] = uint2(hizExtent.width, hizExtent.height);
+			cullPushConstants["mMeshShading"] = meshShading ? 1u : 0u;
+			cullPushConstants["mConeCulling"] = mConeCulling ? 1u : 0u;
+			cullPushConstants["mDrawCapacity"] = mDrawCapacity;
+			const shared_ptr<ComputePipeline> cullPipeline = mCullPipeline.get(commandBuffer.mDevice, primitiveIdVarying ? Defines{ { "gPrimitiveIdVarying", "1" } } : Defines{});
+			if (candidateCount > 0) {
+				cullPushConstants["mBatchCandidate"] = ~0u;
+				cullPipeline->dispatchTiled(commandBuffer, vk::Extent3D(candidateCount, 1, 1), cullDescriptors, {}, cullPushConstants);
+			}
+			// instanced meshes, one dispatch each, appending to the same streams
+			for (uint32_t i = 0; i < mBatchInstanceCounts.size(); i++) {
+				if (i > 0 || candidateCount > 0)
+					drawCounts.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+				cullPushConstants["mBatchCandidate"] = candidateCount + i;
+				cullPipeline->dispatchTiled(commandBuffer, vk::Extent3D(mBatchInstanceCounts[i], 1, 1), cullDescriptors, {}, cullPushConstants);
+			}
+		}
 
-	auto pipeline = mRasterPipeline.get(commandBuffer.mDevice, { { "NO_SCENE_ACCELERATION_STRUCTURE", "1" } });
+		drawCommands.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead);
+		const vk::PipelineStageFlags drawStages = meshShading ? vk::PipelineStageFlagBits::eVertexShader|vk::PipelineStageFlagBits::eMeshShaderEXT : vk::PipelineStageFlagBits::eVertexShader;
+		drawCounts.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader|vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eDrawIndirect|drawStages, vk::AccessFlagBits::eShaderWrite|vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eIndirectCommandRead|vk::AccessFlagBits::eShaderRead);
+		drawData.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, drawStages, vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+	}
+
+	Defines rasterDefines{ { "NO_SCENE_ACCELERATION_STRUCTURE", "1" } };
+	if (gpuCulling)
+		rasterDefines.emplace("gIndirect", "1");
+	if (primitiveIdVarying)
+		rasterDefines.emplace("gPrimitiveIdVarying", "1");
+	Defines alphaDefines = rasterDefines;
+	alphaDefines.emplace("gUseAlphaMask", "1");
+	auto pipeline = mRasterPipeline.get(commandBuffer.mDevice, rasterDefines);
 	auto descriptorSets = pipeline->getDescriptorSets(descriptors);
 
+	shared_ptr<GraphicsPipeline> meshPipeline;
+	shared_ptr<DescriptorSets> meshDescriptorSets;
+	if (meshShading) {
+		Descriptors meshDescriptors = descriptors;
+		meshDescriptors[{"gParams.mDrawCounts",0}] = drawCounts;
+		meshPipeline = mMeshPipeline.get(commandBuffer.mDevice, {
+			{ "NO_SCENE_ACCELERATION_STRUCTURE", "1" },
+			{ "gIndirect", "1" },
+			{ "gMeshShader", "1" }});
+		meshDescriptorSets = meshPipeline->getDescriptorSets(meshDescriptors);
+	}
+
 	// render
 
 	colorBuffer.barrier(commandBuffer, vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite);
 	visibilityBuffer.barrier(commandBuffer, vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite);
 	depthBuffer.barrier(commandBuffer, vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::PipelineStageFlagBits::eEarlyFragmentTests, vk::AccessFlagBits::eDepthStencilAttachmentRead|vk::AccessFlagBits::eDepthStencilAttachmentWrite);\
 	descriptorSets->transitionImages(commandBuffer);
+	if (meshDescriptorSets)
+		meshDescriptorSets->transitionImages(commandBuffer);
 
 	vector<vk::RenderingAttachmentInfo> colorAttachments{
 		{
@@ -201,18 +406,18 @@ void RasterRenderer::render(CommandBuffer& commandBuffer, const Image::View& ren
 			vk::ResolveModeFlagBits::eNone,	{}, vk::ImageLayout::eUndefined,
 			vk::AttachmentLoadOp::eClear,
 			vk::AttachmentStoreOp::eStore,
-			vk::ClearValue{vk::ClearColorValue{array<uint32_t,4>{~0u,0u,0u,0u}}} },
+			vk::ClearValue{vk::ClearColorValue{array<float,4>{0,0,0,0}}} },
 		{
 			*visibilityBuffer, vk::ImageLayout::eColorAttachmentOptimal,
 			vk::ResolveModeFlagBits::eNone,	{}, vk::ImageLayout::eUndefined,
 			vk::AttachmentLoadOp::eClear,
 			vk::AttachmentStoreOp::eStore,
-			vk::ClearValue{vk::ClearColorValue{array<float,4>{0,0,0,0}}} } };
+			vk::ClearValue{vk::ClearColorValue{array<uint32_t,4>{INVALID_INSTANCE,INVALID_PRIMITIVE,0u,0u}}} } };
 	vk::RenderingAttachmentInfo depthAttachment(
 		*depthBuffer, vk::ImageLayout::eDepthStencilAttachmentOptimal,
 		vk::ResolveModeFlagBits::eNone,	{}, vk::ImageLayout::eUndefined,
 		vk::AttachmentLoadOp::eClear,
-		vk::AttachmentStoreOp::eDontCare,
+		occlusionCulling ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare,
 		vk::ClearValue{vk::ClearDepthStencilValue{0,0}});
 	commandBuffer->beginRendering(vk::RenderingInfo(
 		vk::RenderingFlags{},
@@ -226,61 +431,156 @@ void RasterRenderer::render(CommandBuffer& commandBuffer, const Image::View& ren
 	descriptorSets->bind(commandBuffer);
 	commandBuffer.trackResource(descriptorSets);
 
-	const auto& instances = scene->frameData().mInstances;
-
-	vector<uint3> alphaMasked;
-	alphaMasked.reserve(instances.size());
-
-	struct PushConstants {
-		uint mViewIndex;
-		uint mInstanceIndex;
-		uint mMaterialAddress;
-	};
-	PushConstants pushConstants;
-
-	pushConstants.mViewIndex = 0;
+	// every mesh instance that is drawn has a range of the scene's index buffer
+	const Buffer::View<uint32_t>& indexBuffer = scene->frameData().mIndexBuffer;
+	if (indexBuffer && !primitiveIdVarying) {
+		commandBuffer->bindIndexBuffer(**indexBuffer.buffer(), indexBuffer.absoluteOffset(), vk::IndexType::eUint32);
+		commandBuffer.trackResource(indexBuffer.buffer());
+	}
 
-	for (uint32_t instanceIndex = 0; instanceIndex < instances.size(); instanceIndex++) {
-		const auto&[instanceData, material, transform] = instances[instanceIndex];
-		if (instanceData.getType() != InstanceType::eMesh) continue;
-		const MeshInstanceData* instance = reinterpret_cast<const MeshInstanceData*>(&instanceData);
+	if (gpuCulling) {
+		// opaque draws, then alpha-masked draws, as written by the culling pass
+		PushConstants pushConstants;
+		pushConstants["mViewIndex"] = 0u;
+		pipeline->pushConstants(commandBuffer, pushConstants);
+		// the culling pass writes indexed commands, which non-indexed draws read with the same stride
+		auto drawIndirect = [&](const uint32_t stream) {
+			const vk::DeviceSize commandOffset = drawCommands.absoluteOffset() + stream*mDrawCapacity*sizeof(vk::DrawIndexedIndirectCommand);
+			const vk::DeviceSize countOffset   = drawCounts.absoluteOffset() + 4*stream*sizeof(uint32_t);
+			if (primitiveIdVarying)
+				commandBuffer->drawIndirectCountKHR(**drawCommands.buffer(), commandOffset, **drawCounts.buffer(), countOffset, mDrawCapacity, sizeof(vk::DrawIndexedIndirectCommand));
+			else
+				commandBuffer->drawIndexedIndirectCountKHR(**drawCommands.buffer(), commandOffset, **drawCounts.buffer(), countOffset, mDrawCapacity, sizeof(vk::DrawIndexedIndirectCommand));
+		};
+		drawIndirect(0);
+
+		if (mAlphaMasks) {
+			auto alphaPipeline = mRasterPipeline.get(commandBuffer.mDevice, alphaDefines, pipeline->descriptorSetLayouts());
+
+			commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, ***alphaPipeline);
+			descriptorSets->bind(commandBuffer);
+			alphaPipeline->pushConstants(commandBuffer, pushConstants);
+			drawIndirect(1);
+		}
 
-		if (mAlphaMasks && material->alphaTest()) {
-			alphaMasked.emplace_back(instance->getMaterialAddress(), instance->primitiveCount()*3, instanceIndex);
-			continue;
+		// opaque meshlets, then alpha-masked meshlets, one mesh shader workgroup each
+		if (meshShading) {
+			for (uint32_t stream = 2; stream < (mAlphaMasks ? 4u : 3u); stream++) {
+				auto streamPipeline = stream == 2 ? meshPipeline : mMeshPipeline.get(commandBuffer.mDevice, {
+					{ "NO_SCENE_ACCELERATION_STRUCTURE", "1" },
+					{ "gIndirect", "1" },
+					{ "gMeshShader", "1" },
+					{ "gUseAlphaMask", "1" }},
+					meshPipeline->descriptorSetLayouts());
+				commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, ***streamPipeline);
+				meshDescriptorSets->bind(commandBuffer);
+				PushConstants meshPushConstants;
+				meshPushConstants["mViewIndex"] = 0u;
+				meshPushConstants["mDrawOffset"] = stream*mDrawCapacity;
+				meshPushConstants["mDrawCountIndex"] = 4*stream;
+				streamPipeline->pushConstants(commandBuffer, meshPushConstants);
+				commandBuffer->drawMeshTasksIndirectEXT(**drawCounts.buffer(), drawCounts.absoluteOffset() + (4*stream + 1)*sizeof(uint32_t), 1, sizeof(vk::DrawMeshTasksIndirectCommandEXT));
+			}
+			commandBuffer.trackResource(meshDescriptorSets);
+		}
+		commandBuffer.trackResource(drawCommands.buffer());
+		commandBuffer.trackResource(drawCounts.buffer());
+	} else {
+		const auto& instances = scene->frameData().mInstances;
+		const auto& instanceIndexRanges = scene->frameData().mInstanceIndexRanges;
+
+		// material address, first index, index count, instance index
+		vector<uint4> alphaMasked;
+		alphaMasked.reserve(instances.size());
+
+		struct PushConstants {
+			uint mViewIndex;
+			uint mInstanceIndex;
+			uint mMaterialAddress;
+		};
+		PushConstants pushConstants;
+
+		pushConstants.mViewIndex = 0;
+
+		auto draw = [&](const uint32_t firstIndex, const uint32_t indexCount, const uint32_t instanceIndex) {
+			if (primitiveIdVarying)
+				commandBuffer->draw(indexCount, 1, 0, instanceIndex);
+			else
+				commandBuffer->drawIndexed(indexCount, 1, firstIndex, 0, instanceIndex);
+		};
+
+		for (uint32_t instanceIndex = 0; instanceIndex < instances.size(); instanceIndex++) {
+			const auto&[instanceData, material, transform] = instances[instanceIndex];
+			if (instanceData.getType() != InstanceType::eMesh) continue;
+			const auto[firstIndex, indexCount] = instanceIndexRanges[instanceIndex];
+			if (firstIndex == ~0u) continue;
+			const MeshInstanceData* instance = reinterpret_cast<const MeshInstanceData*>(&instanceData);
+
+			if (mAlphaMasks && material->alphaTest()) {
+				alphaMasked.emplace_back(instance->getMaterialAddress(), firstIndex, indexCount, instanceIndex);
+				continue;
+			}
+			pushConstants.mInstanceIndex = instanceIndex;
+			pushConstants.mMaterialAddress = instance->getMaterialAddress();
+			pipeline->pushConstants(commandBuffer, { { "", pushConstants } });
+			draw(firstIndex, indexCount, instanceIndex);
+		}
+		for (const Scene::FrameData::InstancedMesh& instancedMesh : scene->frameData().mInstancedMeshes) {
+			if (instancedMesh.mFirstIndex == ~0u) continue;
+			for (uint32_t instanceIndex = instancedMesh.mFirstInstance; instanceIndex < instancedMesh.mFirstInstance + instancedMesh.mTransforms.size(); instanceIndex++) {
+				if (mAlphaMasks && instancedMesh.mMaterial->alphaTest()) {
+					alphaMasked.emplace_back(instancedMesh.mMaterialAddress, instancedMesh.mFirstIndex, instancedMesh.mIndexCount, instanceIndex);
+					continue;
+				}
+				pushConstants.mInstanceIndex = instanceIndex;
+				pushConstants.mMaterialAddress = instancedMesh.mMaterialAddress;
+				pipeline->pushConstants(commandBuffer, { { "", pushConstants } });
+				draw(instancedMesh.mFirstIndex, instancedMesh.mIndexCount, instanceIndex);
+			}
 		}
-		pushConstants.mInstanceIndex = instanceIndex;
-		pushConstants.mMaterialAddress = instance->getMaterialAddress();
-		pipeline->pushConstants(commandBuffer, { { "", pushConstants } });
-		commandBuffer->draw(instance->primitiveCount()*3, 1, 0, instanceIndex);
-	}
 
-	if (mAlphaMasks && !alphaMasked.empty()) {
-		auto alphaPipeline = mRasterPipeline.get(commandBuffer.mDevice, {
-			{ "NO_SCENE_ACCELERATION_STRUCTURE", "1" },
-			{ "gUseAlphaMask", "1" }},
-			pipeline->descriptorSetLayouts());
-
-		commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, ***alphaPipeline);
-		descriptorSets->bind(commandBuffer);
-		commandBuffer.trackResource(descriptorSets);
-		for (const auto& data : alphaMasked) {
-			pushConstants.mInstanceIndex = data[2];
-			pushConstants.mMaterialAddress = data[0];
-			alphaPipeline->pushConstants(commandBuffer, { { "", pushConstants } });
-			commandBuffer->draw(data[1], 1, 0, data[2]);
+		if (mAlphaMasks && !alphaMasked.empty()) {
+			auto alphaPipeline = mRasterPipeline.get(commandBuffer.mDevice, alphaDefines, pipeline->descriptorSetLayouts());
+
+			commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, ***alphaPipeline);
+			descriptorSets->bind(commandBuffer);
+			commandBuffer.trackResource(descriptorSets);
+			for (const auto& data : alphaMasked) {
+				pushConstants.mInstanceIndex = data[3];
+				pushConstants.mMaterialAddress = data[0];
+				alphaPipeline->pushConstants(commandBuffer, { { "", pushConstants } });
+				draw(data[1], data[2], data[3]);
+			}
 		}
 	}
 
-
 	commandBuffer->endRendering();
 
+	// build the pyramid that the next frame is culled against
+	if (occlusionCulling) {
+		ProfilerScope ps("Build HiZ", &commandBuffer);
+		Image::View input = depthBuffer;
+		for (uint32_t level = 0; level < mHiZ.image()->levels(); level++) {
+			const Image::View output(mHiZ.image(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1));
+			Descriptors hizDescriptors{
+				{ {"gHiZInput",0}, ImageDescriptor{ input, level == 0 ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderRead, {} } },
+				{ {"gHiZOutput",0}, ImageDescriptor{ output, vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} } }
+			};
+			mHiZPipeline.get(commandBuffer.mDevice)->dispatchTiled(commandBuffer, output.extent(), hizDescriptors);
+			input = output;
+		}
+		mHiZValid = true;
+		mPrevView = views[0];
+		mPrevViewInverseTransform = viewInverseTransforms[0];
+	} else
+		mHiZValid = false;
+
 	// copy VisibilityData for selected pixel for scene object picking
 	if (!ImGui::GetIO().WantCaptureMouse && ImGui::IsMouseClicked(ImGuiMouseButton_Left) && !ImGuizmo::IsUsing()) {
 		const ImVec2 c = ImGui::GetIO().MousePos;
 		for (const ViewData& view : views)
 			if (view.isInside(int2(c.x, c.y))) {
-				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(uint2), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(VisibilityData), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 				visibilityBuffer.barrier(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
 				selectionBuffer.copyFromImage(commandBuffer, visibilityBuffer.image(), visibilityBuffer.subresourceLayer(), vk::Offset3D{int(c.x), int(c.y), 0}, vk::Extent3D{1,1,1});
 				mSelectionData.push_back(make_pair(selectionBuffer, ImGui::GetIO().KeyShift));
@@ -3,6 +3,7 @@
 #include "Scene.hpp"
 
 #include <Shaders/compat/scene.h>
+#include <Shaders/compat/raster.h>
 
 namespace stm2 {
 
@@ -19,9 +20,34 @@ public:
 
 private:
 	GraphicsPipelineCache mRasterPipeline;
+	GraphicsPipelineCache mMeshPipeline;
+	ComputePipelineCache mCullPipeline;
+	ComputePipelineCache mHiZPipeline;
 
 	bool mAlphaMasks = true;
 	bool mTonemap = true;
+	// cull and draw with vkCmdDrawIndirectCount instead of one draw per instance
+	bool mGpuCulling = true;
+	bool mOcclusionCulling = true;
+	// skip meshlets that face away from the camera. off by default: the rasterizer doesn't cull back faces and materials
+	// carry no double-sided flag, so two-sided geometry seen from behind would be culled too.
+	bool mConeCulling = false;
+	// draw meshlets with the mesh shader pipeline, when VK_EXT_mesh_shader is available
+	bool mMeshShading = true;
+
+	// mesh instances and meshlets to cull, then one candidate per instanced mesh. rebuilt when the scene or mAlphaMasks
+	// changes, into a buffer that is only reallocated when it is too small
+	Buffer::View<DrawCandidate> mDrawCandidates;
+	vector<uint32_t> mBatchInstanceCounts; // instance counts of the instanced mesh candidates, which end mDrawCandidates
+	uint32_t mDrawCapacity = 0; // draws the culling pass may write to each stream
+	chrono::high_resolution_clock::time_point mDrawCandidatesUpdate;
+	bool mDrawCandidatesAlphaMasks = false;
+
+	// hierarchical-Z pyramid of the previous frame's depth buffer, and the view it was rendered with
+	Image::View mHiZ;
+	bool mHiZValid = false;
+	ViewData mPrevView;
+	TransformData mPrevViewInverseTransform;
 
 	DeviceResourcePool mResourcePool;
 	list<pair<Buffer::View<byte>, bool>> mSelectionData;
@@ -6,18 +6,22 @@
 
 #include <Core/Instance.hpp>
 #include <Core/Profiler.hpp>
+#include <Core/GpuStats.hpp>
 
 #include "Gui.hpp"
 #include <ImGuizmo.h>
 
 namespace stm2 {
 
+// size of the per-wave shift cache table in gi.slang, which is gMaxShiftCacheSamples^2 entries
+static constexpr uint32_t gMaxShiftCacheSamples = 16;
+
 ReSTIRPT::ReSTIRPT(Node& node) : mNode(node) {
 	if (shared_ptr<Inspector> inspector = mNode.root()->findDescendant<Inspector>())
 		inspector->setInspectCallback<ReSTIRPT>();
 
 	{
-		mDefines["gCountRays"]      = false;
+		mDefines["gGpuStats"]       = false;
 		mDefines["gAlphaTest"]      = false;
 		mDefines["gShadingNormals"] = true;
 		mDefines["gNormalMaps"]     = true;
@@ -42,6 +46,8 @@ ReSTIRPT::ReSTIRPT(Node& node) : mNode(node) {
 		mPushConstants["mGIReuseSamples"] = 3u;
 		mDefines["gReconnection"] = false;
 		mDefines["gTemporalReuse"] = false;
+		mDefines["gFullPrecisionReservoirs"] = false;
+		mDefines["gShiftCache"] = false;
 
 		mRasterPushConstants["mLineRadius"] = .0025f;
 		mRasterPushConstants["mLineLength"] = .02f;
@@ -86,18 +92,18 @@ void ReSTIRPT::drawGui() {
 
 	ImGui::PushID(this);
 
-	if (mDefines.at("gCountRays") && mRayCount.mBuffer) {
-		const auto[rps,rpsUnit] = formatNumber(mRayCount.mCurrentValue[0]/mCounterDt);
-		const auto[shift,shiftUnit] = formatNumber(mDebugCounters.mCurrentValue[0]/mCounterDt);
+	if (const shared_ptr<GpuStats> stats = mNode.findAncestor<GpuStats>(); stats && mDefines.at("gGpuStats")) {
+		const auto[rps,rpsUnit] = formatNumber(stats->rate(GpuStat::eRays));
+		const auto[shift,shiftUnit] = formatNumber(stats->rate(GpuStat::eShifts));
 
-		ImGui::Text("%.1f%s rays/s (%.1f%% occlusion)",
+		ImGui::Text("%.1f%s rays/s (%.1f%% shadow rays)",
 			rps, rpsUnit,
-			100*(mRayCount.mCurrentValue[1]/(float)mRayCount.mCurrentValue[0]));
+			100*(stats->rate(GpuStat::eShadowRays)/stats->rate(GpuStat::eRays)));
 		ImGui::Text("%.1f%s shifts/s (%.1f%% success, %.1f%% reconnections, %.1f%% stored)",
 			shift, shiftUnit,
-			100*(mDebugCounters.mCurrentValue[1]/(float)mDebugCounters.mCurrentValue[0]),
-			100*(mDebugCounters.mCurrentValue[2]/(float)mDebugCounters.mCurrentValue[0]),
-			100*(mDebugCounters.mCurrentValue[3]/(float)mDebugCounters.mCurrentValue[4]));
+			100*(1 - stats->rate(GpuStat::eReservoirRejections)/stats->rate(GpuStat::eShifts)),
+			100*(stats->rate(GpuStat::eShiftReconnections)/stats->rate(GpuStat::eShifts)),
+			100*(stats->rate(GpuStat::ePathReconnections)/stats->rate(GpuStat::ePaths)));
 	}
 
 	if (ImGui::Button("Clear resources")) {
@@ -155,7 +161,7 @@ void ReSTIRPT::drawGui() {
 		defineCheckbox("Debug NEE",          "gDebugNee");
 		defineCheckbox("Debug fast BRDF",    "gDebugFastBRDF");
 		defineCheckbox("Debug pixel (ctrl)", "gDebugPixel");
-		defineCheckbox("Count rays",         "gCountRays");
+		defineCheckbox("GPU stats",          "gGpuStats");
 		ImGui::Separator();
 
 		ImGui::Checkbox("Fix random seed", &mFixSeed);
@@ -178,8 +184,18 @@ void ReSTIRPT::drawGui() {
 						pushConstantField.operator()<float>   ("Max M", "mGIMaxM", 0, 10, .1f);
 					pushConstantField.operator()<float>   ("Reuse radius", "mGIReuseRadius", 0, 1000);
 					pushConstantField.operator()<uint32_t>("Reuse samples", "mGIReuseSamples", 0, 32);
+					if (ImGui::Checkbox("Full precision reservoirs", &mDefines.at("gFullPrecisionReservoirs"))) {
+						changed = true;
+						// previous reservoirs are stored in the other layout
+						ranges::fill(mPrevPathReservoirData, Image::View{});
+					}
 					if (Gui::scalarField<uint32_t>("MIS Type", &mMisType, 0, 2, 0.1))
 						changed = true;
+					if (mMisType != 0 && mDefines.at("gCoherentSpatialRNG")) {
+						ImGui::Indent();
+						defineCheckbox("Shift cache", "gShiftCache");
+						ImGui::Unindent();
+					}
 				}
 				ImGui::Unindent();
 			}
@@ -223,41 +239,6 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 
 	mResourcePool.clean();
 
-	if (!mRayCount.mBuffer) {
-		mRayCount = {
-			make_shared<Buffer>(commandBuffer.mDevice, "mRayCount", 2*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent),
-			vector<uint32_t>(2),
-			vector<uint32_t>(2) };
-		ranges::fill(mRayCount.mBuffer, 0);
-		ranges::fill(mRayCount.mLastValue, 0);
-	}
-	if (!mDebugCounters.mBuffer) {
-		mDebugCounters = {
-			make_shared<Buffer>(commandBuffer.mDevice, "mDebugCounters", 8*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent),
-			vector<uint32_t>(8),
-			vector<uint32_t>(8) };
-		ranges::fill(mDebugCounters.mBuffer, 0);
-		ranges::fill(mDebugCounters.mLastValue, 0);
-	}
-	if (mDefines.at("gCountRays")) {
-		const auto t1 = chrono::high_resolution_clock::now();
-		const auto dt = t1 - mCounterTimer;
-		if (dt > 1s) {
-			mCounterTimer = t1;
-			mCounterDt = chrono::duration_cast<chrono::duration<float>>(dt).count();
-
-			auto updateCounter = [](auto& c) {
-				for (uint32_t i = 0; i < c.mBuffer.size(); i++) {
-					if (c.mBuffer[i] >= c.mLastValue[i])
-						c.mCurrentValue[i] = c.mBuffer[i] - c.mLastValue[i];
-					c.mLastValue[i] = c.mBuffer[i];
-				}
-			};
-			updateCounter(mRayCount);
-			updateCounter(mDebugCounters);
-		}
-	}
-
 	vk::Extent3D extent = renderTarget.extent();
 	extent.width  = max<uint32_t>(1, extent.width * mRenderScale);
 	extent.height = max<uint32_t>(1, extent.height * mRenderScale);
@@ -271,7 +252,7 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 		if (it->first.buffer()->inFlight())
 			break;
 
-		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].instanceIndex();
+		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].mInstanceIndex;
 		if (shared_ptr<Inspector> inspector = mNode.root()->findDescendant<Inspector>()) {
 			if (selectedInstance == INVALID_INSTANCE || selectedInstance >= scene->frameData().mInstanceNodes.size())
 				inspector->select(nullptr);
@@ -310,7 +291,7 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 		.mUsage = vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc,
 	}, 0);
 	const Image::View visibilityImage = mResourcePool.getImage(commandBuffer.mDevice, "mVisibility", Image::Metadata{
-		.mFormat = vk::Format::eR32G32Uint,
+		.mFormat = vk::Format::eR32G32B32A32Uint,
 		.mExtent = extent,
 		.mUsage = vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc,
 	});
@@ -329,11 +310,16 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 	descriptors[{ "gPathTracer.mFramebuffer.mPrevUVs", 0 }]    = ImageDescriptor{ prevUVsImage   , vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} };
 	descriptors[{ "gPathTracer.mFramebuffer.mVisibility", 0 }] = ImageDescriptor{ visibilityImage, vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} };
 	descriptors[{ "gPathTracer.mFramebuffer.mDepth", 0 }]      = ImageDescriptor{ depthImage     , vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} };
-	descriptors[{ "gPathTracer.mFramebuffer.mDebugCounters", 0u }] = mDebugCounters.mBuffer;
-	descriptors[{ "gPathTracer.mScene.mRayCount", 0u }]            = mRayCount.mBuffer;
+	descriptors[{ "gPathTracer.mScene.mGpuStats", 0u }]            = mNode.findAncestor<GpuStats>()->counters(commandBuffer);
 
 	mPushConstants["mReservoirHistoryValid"] = ImGui::IsKeyDown(ImGuiKey_F5) || (mDenoise && denoiser && denoiser->accumulatedFrames() == 0) ? 0u : 1u;
+	// packed reservoirs use 5 images, see gi.slang
+	const uint32_t reservoirImageCount = mDefines.at("gFullPrecisionReservoirs") ? 6 : 5;
 	for (uint32_t i = 0; i < mPrevPathReservoirData.size(); i++) {
+		if (i >= reservoirImageCount) {
+			mPrevPathReservoirData[i] = {};
+			continue;
+		}
 		const string id = "mReservoirDataGI["+to_string(i)+"]";
 		const Image::View& prev = mPrevPathReservoirData[i];
 		const Image::View reservoirData = mResourcePool.getImage(commandBuffer.mDevice, id, Image::Metadata{
@@ -453,6 +439,11 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 		sphere.head<3>() = (sceneData.mAabbMax + sceneData.mAabbMin) / 2;
 		sphere[3] = length<float,3>(sceneData.mAabbMax - sphere.head<3>());
 		mPushConstants["mSceneSphere"] = sphere;
+		// packed reservoirs from the previous frame are decoded in the sphere they were quantized in
+		const float4 prevSphere = mPrevSceneSphere[3] > 0 ? mPrevSceneSphere : sphere;
+		mPushConstants["mPrevSceneSphere"] = prevSphere;
+		mRasterPushConstants["mPrevSceneSphere"] = prevSphere;
+		mPrevSceneSphere = sphere;
 
 		if (changed && !mFixSeed && mDenoise && denoiser && !denoiser->reprojection()) {
 			denoiser->resetAccumulation();
@@ -478,6 +469,18 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 			defines[define] = to_string(enabled);
 	defines.emplace("gMisTypeIndex", to_string(mMisType));
 
+	// the shift cache relies on a wave-uniform reuse pattern, and holds a fixed number of neighbors
+	if (mMisType == 0 || !mDefines.at("gCoherentSpatialRNG"))
+		defines.erase("gShiftCache");
+	if (defines.contains("gShiftCache")) {
+		defines.emplace("gMaxShiftCacheSamples", to_string(gMaxShiftCacheSamples));
+		uint32_t& reuseSamples = mPushConstants["mGIReuseSamples"].get<uint32_t>();
+		if (reuseSamples > gMaxShiftCacheSamples) {
+			cerr << "Warning: The shift cache holds at most " << gMaxShiftCacheSamples << " reuse samples. Clamping mGIReuseSamples from " << reuseSamples << endl;
+			reuseSamples = gMaxShiftCacheSamples;
+		}
+	}
+
 	if (hasMedia)
 		defines.emplace("gHasMedia", "true");
 	if (hasHeterogeneousMedia)
@@ -557,7 +560,7 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 		const int2 c = (float2(ImGui::GetIO().MousePos.x, ImGui::GetIO().MousePos.y) * mRenderScale).cast<int32_t>();
 		for (const ViewData& view : viewsBufferData)
 			if (view.isInside(c)) {
-				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(uint2), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(VisibilityData), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 				visibilityImage.barrier(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
 				selectionBuffer.copyFromImage(commandBuffer, visibilityImage.image(), visibilityImage.subresourceLayer(), vk::Offset3D{c[0], c[1], 0}, vk::Extent3D{1,1,1});
 				mSelectionData.push_back(make_pair(selectionBuffer, ImGui::GetIO().KeyShift));
@@ -660,7 +663,10 @@ void ReSTIRPT::render(CommandBuffer& commandBuffer, const Image::View& renderTar
 				.mFormat = vk::Format::eD32Sfloat,
 				.mExtent = extent,
 				.mUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment|vk::ImageUsageFlagBits::eTransferDst });
-		auto rasterPipeline = mRasterPipeline.get(commandBuffer.mDevice);
+		Defines rasterDefines;
+		if (mDefines.at("gFullPrecisionReservoirs"))
+			rasterDefines.emplace("gFullPrecisionReservoirs", "true");
+		auto rasterPipeline = mRasterPipeline.get(commandBuffer.mDevice, rasterDefines);
 		auto descriptorSets = rasterPipeline->getDescriptorSets(rasterDescriptors);
 
 		renderTarget.barrier     (commandBuffer, vk::ImageLayout::eColorAttachmentOptimal       , vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite);
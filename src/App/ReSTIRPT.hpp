@@ -45,15 +45,8 @@ private:
 	DeviceResourcePool mResourcePool;
 	list<pair<Buffer::View<byte>, bool>> mSelectionData;
 	vector<TransformData> mPrevViewTransforms;
-
-	struct CounterData {
-		Buffer::View<uint32_t> mBuffer;
-		vector<uint32_t> mLastValue;
-		vector<uint32_t> mCurrentValue;
-	};
-	CounterData mRayCount, mDebugCounters;
-	chrono::high_resolution_clock::time_point mCounterTimer;
-	float mCounterDt;
+	// scene sphere that the previous frame's packed reservoirs were quantized in
+	float4 mPrevSceneSphere = float4::Zero();
 };
 
 };
\ No newline at end of file
@@ -14,6 +14,17 @@
 
 namespace stm2 {
 
+// MeshVertexInfo encoding of a vertex attribute format, see Mesh::VertexPrecision
+uint32_t vertexFormatCode(const vk::Format format) {
+	switch (format) {
+	case vk::Format::eR16G16B16A16Snorm:
+	case vk::Format::eR16G16Snorm:  return VERTEX_FORMAT_SNORM16;
+	case vk::Format::eR16G16Unorm:  return VERTEX_FORMAT_UNORM16;
+	case vk::Format::eR16G16Sfloat: return VERTEX_FORMAT_HALF;
+	default:                        return VERTEX_FORMAT_FLOAT;
+	}
+}
+
 tuple<shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<byte>> buildAccelerationStructure(CommandBuffer& commandBuffer, const string& name, const vk::AccelerationStructureTypeKHR type, const vk::ArrayProxy<const vk::AccelerationStructureGeometryKHR>& geometries, const vk::ArrayProxy<const vk::AccelerationStructureBuildRangeInfoKHR>& buildRanges) {
 	vk::AccelerationStructureBuildGeometryInfoKHR buildGeometry(type, vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace, vk::BuildAccelerationStructureModeKHR::eBuild);
 	buildGeometry.setGeometries(geometries);
@@ -37,9 +48,10 @@ tuple<shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<byte>> buildA
 		commandBuffer.mDevice,
 		name + "/scratchData",
 		buildSizes.buildScratchSize,
-		vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer);
+		// scratch memory only needs storage usage, so it is sub-allocated by Device::allocateBuffer
+		vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer);
 
-	shared_ptr<vk::raii::AccelerationStructureKHR> accelerationStructure = make_shared<vk::raii::AccelerationStructureKHR>(*commandBuffer.mDevice, vk::AccelerationStructureCreateInfoKHR({}, **buffer.buffer(), buffer.offset(), buffer.sizeBytes(), type));
+	shared_ptr<vk::raii::AccelerationStructureKHR> accelerationStructure = make_shared<vk::raii::AccelerationStructureKHR>(*commandBuffer.mDevice, vk::AccelerationStructureCreateInfoKHR({}, **buffer.buffer(), buffer.absoluteOffset(), buffer.sizeBytes(), type));
 	commandBuffer.mDevice.setDebugName(**accelerationStructure, name);
 
 	buildGeometry.dstAccelerationStructure = **accelerationStructure;
@@ -76,7 +88,9 @@ Scene::Scene(Node& node): mNode(node) {
 		inspector->setInspectCallback<TransformData>();
 		inspector->setInspectCallback<Camera>();
 		inspector->setInspectCallback<MeshPrimitive>();
+		inspector->setInspectCallback<InstancedMeshPrimitive>();
 		inspector->setInspectCallback<SpherePrimitive>();
+		inspector->setInspectCallback<PointCloudPrimitive>();
 		inspector->setInspectCallback<Material>();
 		inspector->setInspectCallback<Medium>();
 		inspector->setInspectCallback<EnvironmentMap>();
@@ -101,6 +115,18 @@ Scene::Scene(Node& node): mNode(node) {
 	mConvertShininessToRoughnessPipeline = ComputePipelineCache(shaderPath / "convert_roughness.slang", "shininess_to_roughness");
 	mConvertPbrPipeline = ComputePipelineCache(shaderPath / "convert_material.slang", "from_gltf_pbr");
 	mConvertDiffuseSpecularPipeline = ComputePipelineCache(shaderPath / "convert_material.slang", "from_diffuse_specular");
+	mEncodeBC7Pipeline = ComputePipelineCache(shaderPath / "bc_encode.slang", "encode_bc7");
+	mExpandInstancesPipeline = ComputePipelineCache(shaderPath / "expand_instances.slang", "Expand");
+	mClassifyOpacityPipeline = ComputePipelineCache(shaderPath / "classify_opacity.slang", "Classify");
+
+	const Instance& instance = *mNode.findAncestor<Instance>();
+	mCompressMaterialImages = !instance.findArgument("noTextureCompression");
+	mTextureCache.setCompression(mCompressMaterialImages, instance.findArgument("noTextureCompressionCache") ? filesystem::path() : filesystem::temp_directory_path() / "stm2_bccache");
+	if (!instance.findArgument("noAccelerationStructureCache"))
+		mAccelerationStructureCache.setDirectory(filesystem::temp_directory_path() / "stm2_ascache");
+	if (!instance.findArgument("noSceneCache"))
+		mSceneCache.setDirectory(filesystem::temp_directory_path() / "stm2_scenecache");
+	mSceneCache.setBake(instance.findArgument("bakeScenes").has_value());
 
 	for (const string arg : mNode.findAncestor<Instance>()->findArguments("scene"))
 		mToLoad.emplace_back(arg);
@@ -108,14 +134,6 @@ Scene::Scene(Node& node): mNode(node) {
 
 
 shared_ptr<Node> Scene::loadEnvironmentMap(CommandBuffer& commandBuffer, const filesystem::path& filepath) {
-	filesystem::path path = filepath;
-	if (path.is_relative()) {
-		filesystem::path cur = filesystem::current_path();
-		filesystem::current_path(path.parent_path());
-		path = filesystem::absolute(path);
-		filesystem::current_path(cur);
-	}
-
 	Image::Metadata md = {};
 	shared_ptr<Buffer> pixels;
 	tie(pixels, md.mFormat, md.mExtent) = Image::loadFile(commandBuffer.mDevice, filepath, false);
@@ -192,6 +210,45 @@ ImageValue<1> Scene::shininessToRoughness(CommandBuffer& commandBuffer, const Im
 	return roughness;
 }
 
+Image::View Scene::encodeBC7(CommandBuffer& commandBuffer, const Image::View& image) {
+	const shared_ptr<Image> src = image.image();
+
+	Image::Metadata md;
+	md.mFormat = vk::Format::eBc7UnormBlock;
+	md.mExtent = src->extent();
+	md.mLevels = src->levels();
+	md.mUsage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+	const shared_ptr<Image> dst = make_shared<Image>(commandBuffer.mDevice, src->resourceName() + "/BC7", md);
+
+	// 16 bytes per block, levels packed back to back
+	vector<vk::BufferImageCopy> copies(md.mLevels);
+	vk::DeviceSize blockCount = 0;
+	for (uint32_t i = 0; i < md.mLevels; i++) {
+		const vk::Extent3D extent = src->extent(i);
+		copies[i] = vk::BufferImageCopy(blockCount*16, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, i, 0, 1), vk::Offset3D{0,0,0}, extent);
+		blockCount += ((extent.width + 3)/4) * ((extent.height + 3)/4);
+	}
+	Buffer::View<uint4> blocks = make_shared<Buffer>(commandBuffer.mDevice, "BC7 blocks", blockCount*16, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+
+	const shared_ptr<ComputePipeline> pipeline = mEncodeBC7Pipeline.get(commandBuffer.mDevice);
+	for (uint32_t i = 0; i < md.mLevels; i++) {
+		const vk::Extent3D extent = src->extent(i);
+		const uint2 levelBlocks((extent.width + 3)/4, (extent.height + 3)/4);
+		Descriptors descriptors;
+		descriptors[{ "gInput", 0 }] = ImageDescriptor{ Image::View(src, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, i, 1, 0, 1)), vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, {} };
+		descriptors[{ "gOutput", 0 }] = Buffer::View<uint4>(blocks.buffer(), copies[i].bufferOffset, levelBlocks.x()*levelBlocks.y());
+		pipeline->dispatchTiled(commandBuffer, vk::Extent3D(levelBlocks.x(), levelBlocks.y(), 1), descriptors, {}, PushConstants{ { "mBlockCount", PushConstantValue(levelBlocks) } });
+	}
+
+	blocks.barrier(commandBuffer,
+		vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer,
+		vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+	dst->barrier(commandBuffer, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, md.mLevels, 0, 1), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+	blocks.copyToImage(commandBuffer, dst, copies);
+	commandBuffer.trackResource(blocks.buffer());
+	return dst;
+}
+
 Material Scene::makeMetallicRoughnessMaterial(CommandBuffer& commandBuffer, const ImageValue<3>& baseColor, const ImageValue<4>& metallic_roughness, const ImageValue<3>& transmission, const float eta, const ImageValue<3>& emission) {
 	Material m;
 	m.mMaterialData.setBaseColor(baseColor.mValue);
@@ -260,9 +317,12 @@ Material Scene::makeMetallicRoughnessMaterial(CommandBuffer& commandBuffer, cons
 		descriptorSets->write(descriptors);
 		pipeline->dispatchTiled(commandBuffer, d.extent(), descriptorSets);
 
-		for (const Image::View& img : m.mImages)
-			if (img)
+		for (Image::View& img : m.mImages)
+			if (img) {
 				img.image()->generateMipMaps(commandBuffer);
+				if (mCompressMaterialImages && commandBuffer.mDevice.features().textureCompressionBC)
+					img = encodeBC7(commandBuffer, img);
+			}
 
 		if (m.mAlphaMask) {
 			m.mMinAlpha = make_shared<Buffer>(commandBuffer.mDevice, "mMinAlpha", sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
@@ -345,9 +405,12 @@ Material Scene::makeDiffuseSpecularMaterial(CommandBuffer& commandBuffer, const
 		descriptorSets->write(descriptors);
 		pipeline->dispatchTiled(commandBuffer, d.extent(), descriptorSets);
 
-		for (const Image::View& img : m.mImages)
-			if (img)
+		for (Image::View& img : m.mImages)
+			if (img) {
 				img.image()->generateMipMaps(commandBuffer);
+				if (mCompressMaterialImages && commandBuffer.mDevice.features().textureCompressionBC)
+					img = encodeBC7(commandBuffer, img);
+			}
 	}
 	return m;
 }
@@ -374,6 +437,9 @@ void Scene::update(CommandBuffer& commandBuffer, const float deltaTime) {
 			mToLoad.emplace_back(filepath);
 	}
 
+	if (commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure)
+		mAccelerationStructureCache.update(commandBuffer);
+
 	// load input files
 
 	bool update = mAlwaysUpdate || mUpdateOnce;
@@ -401,20 +467,50 @@ void Scene::update(CommandBuffer& commandBuffer, const float deltaTime) {
 		const filesystem::path filepath = file;
 		Device& device = commandBuffer.mDevice;
 		const uint32_t family = device.findQueueFamily(vk::QueueFlagBits::eTransfer|vk::QueueFlagBits::eCompute);
-		mLoading.emplace_back( move(async(launch::async, [&,filepath,family]() {
+		// loaders produce different scenes with these settings, so they key the scene cache
+		const size_t cacheSettings = hashArgs(mCompressMaterialImages);
+		mLoading.emplace_back( move(async(launch::async, [&,filepath,family,cacheSettings]() {
+			const auto t0 = chrono::high_resolution_clock::now();
+			const TextureCache::Stats textureStats = mTextureCache.stats();
+			const MeshCache::Stats meshStats = mMeshCache.stats();
+
 			shared_ptr<CommandBuffer> cb = make_shared<CommandBuffer>(device, "scene load", family);
 			(*cb)->begin(vk::CommandBufferBeginInfo{});
-			shared_ptr<Node> node = load(*cb, filepath);
+			shared_ptr<Node> node = mSceneCache.load(*cb, filepath, cacheSettings);
+			const bool cached = (bool)node;
+			SceneCache::takeDependencies();
+			if (!node) node = load(*cb, filepath);
+			const vector<filesystem::path> dependencies = SceneCache::takeDependencies();
+			vector<TriangleOpacityJob> opacityJobs;
+			if (node) opacityJobs = classifyTriangleOpacity(*cb, *node);
 			(*cb)->end();
 			device.submit(device->getQueue(family, 0), cb);
 			while (cb->fence()->getStatus() == vk::Result::eNotReady) {
 				this_thread::sleep_for(1ms);
 			}
+			mTextureCache.commandBufferCompleted(*cb);
+			if (node) {
+				collapseMeshes(*node);
+				applyTriangleOpacity(device, opacityJobs);
+				if (!cached && mSceneCache.bake())
+					mSceneCache.store(filepath, cacheSettings, dependencies, node);
+			}
+
+			const TextureCache::Stats s = mTextureCache.stats();
+			const MeshCache::Stats m = mMeshCache.stats();
+			cout << "Loaded " << filepath << (cached ? " from the scene cache" : "") << " in " << chrono::duration_cast<chrono::duration<float>>(chrono::high_resolution_clock::now() - t0).count() << "s"
+				<< " (" << (s.mDecoded - textureStats.mDecoded) << " textures decoded in " << (s.mDecodeTime - textureStats.mDecodeTime) << "s of worker time, "
+				<< (s.mPathHits + s.mContentHits + s.mImageHits) - (textureStats.mPathHits + textureStats.mContentHits + textureStats.mImageHits) << " deduplicated, "
+				<< (m.mHits - meshStats.mHits) << " duplicate meshes saving " << (m.mBytesSaved - meshStats.mBytesSaved) / float(1 << 20) << " MiB)" << endl;
 			return make_pair(node, cb);
 		})) );
 	}
 	mToLoad.clear();
 
+	// loaded scenes are read back by this thread, since their images may be shared with the scenes being drawn
+	if (mSceneCache.enabled())
+		mSceneCache.update(commandBuffer);
+
 	if (!update) return;
 
 	// Update scene data based on node graph
@@ -425,10 +521,150 @@ void Scene::update(CommandBuffer& commandBuffer, const float deltaTime) {
 	updateFrameData(commandBuffer);
 }
 
+void Scene::collapseMeshes(Node& node) {
+	// primitives often share a mesh, which only needs to be looked up once
+	unordered_map<const Mesh*, shared_ptr<Mesh>> interned;
+	auto intern = [&](const shared_ptr<Mesh>& mesh) {
+		auto it = interned.find(mesh.get());
+		if (it == interned.end())
+			it = interned.emplace(mesh.get(), mMeshCache.intern(mesh)).first;
+		return it->second;
+	};
+	node.forEachDescendant([&](Node& n) {
+		if (const shared_ptr<MeshPrimitive> prim = n.getComponent<MeshPrimitive>(); prim && prim->mMesh)
+			prim->mMesh = intern(prim->mMesh);
+		if (const shared_ptr<InstancedMeshPrimitive> prim = n.getComponent<InstancedMeshPrimitive>(); prim && prim->mMesh)
+			prim->mMesh = intern(prim->mMesh);
+		if (const shared_ptr<Mesh> mesh = n.getComponent<Mesh>()) {
+			n.removeComponent<Mesh>();
+			n.addComponent(intern(mesh));
+		}
+	});
+}
+
+vector<Scene::TriangleOpacityJob> Scene::classifyTriangleOpacity(CommandBuffer& commandBuffer, Node& node) {
+	// primitives often share a mesh and material, which only need to be classified once
+	map<pair<const Mesh*, const Material*>, TriangleOpacityJob> jobs;
+	auto addJob = [&](const shared_ptr<Mesh>& mesh, const shared_ptr<Material>& material, shared_ptr<TriangleOpacity>& opacity) {
+		if (!mesh || !material || !material->mAlphaMask || !material->alphaTest()) return;
+		if (mesh->topology() != vk::PrimitiveTopology::eTriangleList ||
+			(mesh->indexType() != vk::IndexType::eUint32 && mesh->indexType() != vk::IndexType::eUint16) ||
+			!mesh->vertices().find(Mesh::VertexAttributeType::eTexcoord))
+			return;
+		TriangleOpacityJob& job = jobs[make_pair(mesh.get(), material.get())];
+		job.mMesh = mesh;
+		job.mMaterial = material;
+		job.mPrimitives.emplace_back(&opacity);
+	};
+	node.forEachDescendant([&](Node& n) {
+		if (const shared_ptr<MeshPrimitive> prim = n.getComponent<MeshPrimitive>())
+			addJob(prim->mMesh, prim->mMaterial, prim->mTriangleOpacity);
+		if (const shared_ptr<InstancedMeshPrimitive> prim = n.getComponent<InstancedMeshPrimitive>())
+			addJob(prim->mMesh, prim->mMaterial, prim->mTriangleOpacity);
+	});
+	if (jobs.empty()) return {};
+
+	Device& device = commandBuffer.mDevice;
+
+	// meshes and alpha masks were just uploaded by the loader
+	commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer|vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {},
+		vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead), {}, {});
+
+	// the index buffer is vertex buffer 0 and the texcoords are vertex buffer 1, see classify_opacity.slang
+	Buffer::View<MeshVertexInfo> vertexInfos = make_shared<Buffer>(device, "TriangleOpacity/VertexInfo", jobs.size()*sizeof(MeshVertexInfo), vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	const shared_ptr<ComputePipeline> pipeline = mClassifyOpacityPipeline.get(device);
+	uint32_t jobIndex = 0;
+	for (auto&[key, job] : jobs) {
+		const Mesh& mesh = *job.mMesh;
+		const auto[texcoords, texcoordsDesc] = *mesh.vertices().find(Mesh::VertexAttributeType::eTexcoord);
+		const uint32_t triangleCount = mesh.indices().size() / (mesh.indices().stride() * 3);
+
+		vertexInfos[jobIndex] = MeshVertexInfo(
+			0, (uint32_t)mesh.indices().offset(), (uint32_t)mesh.indices().stride(),
+			0xFFFF, 0, 0,
+			0xFFFF, 0, 0,
+			1, (uint32_t)texcoords.offset() + texcoordsDesc.mOffset, texcoordsDesc.mStride,
+			VERTEX_FORMAT_FLOAT, VERTEX_FORMAT_FLOAT, vertexFormatCode(texcoordsDesc.mFormat));
+		job.mOutput = make_shared<Buffer>(device, "TriangleOpacity/Output", triangleCount*sizeof(uint4), vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+
+		Descriptors descriptors;
+		descriptors[{ "gVertexInfo", 0 }] = vertexInfos;
+		descriptors[{ "gIndices", 0 }] = Buffer::View<byte>(mesh.indices().buffer());
+		descriptors[{ "gTexcoords", 0 }] = Buffer::View<byte>(texcoords.buffer());
+		descriptors[{ "gAlphaMask", 0 }] = ImageDescriptor{ job.mMaterial->mAlphaMask, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, {} };
+		descriptors[{ "gOutput", 0 }] = job.mOutput;
+		pipeline->dispatchTiled(commandBuffer, vk::Extent3D(triangleCount, 1, 1), descriptors, {}, PushConstants{
+			{ "mVertexInfoIndex", PushConstantValue(jobIndex) },
+			{ "mTriangleCount", PushConstantValue(triangleCount) },
+			{ "mAlphaCutoff", PushConstantValue(job.mMaterial->mAlphaCutoff) },
+			{ "mMaxTexels", PushConstantValue(1u << 16) } });
+		jobIndex++;
+	}
+	commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead), {}, {});
+	commandBuffer.trackResource(vertexInfos.buffer());
+
+	vector<TriangleOpacityJob> result;
+	result.reserve(jobs.size());
+	for (auto&[key, job] : jobs)
+		result.emplace_back(move(job));
+	return result;
+}
+
+void Scene::applyTriangleOpacity(Device& device, const vector<TriangleOpacityJob>& jobs) {
+	if (jobs.empty()) return;
+
+	// triangles are split by class into separate BLAS geometries
+	uint32_t counts[3] = { 0, 0, 0 };
+	for (const TriangleOpacityJob& job : jobs) {
+		const span<const uint4> classes(job.mOutput.data(), job.mOutput.size());
+		const shared_ptr<TriangleOpacity> opacity = make_shared<TriangleOpacity>();
+		for (const uint4& c : classes) {
+			if      (c[3] == TRIANGLE_OPAQUE)      opacity->mOpaqueCount++;
+			else if (c[3] == TRIANGLE_TRANSPARENT) opacity->mTransparentCount++;
+			else                                   opacity->mAlphaTestedCount++;
+		}
+		counts[TRIANGLE_OPAQUE] += opacity->mOpaqueCount;
+		counts[TRIANGLE_TRANSPARENT] += opacity->mTransparentCount;
+		counts[TRIANGLE_ALPHA_TESTED] += opacity->mAlphaTestedCount;
+		// nothing to gain
+		if (opacity->mAlphaTestedCount == classes.size())
+			continue;
+
+		if (opacity->mTransparentCount < classes.size()) {
+			const uint32_t triangleCount = opacity->mAlphaTestedCount + opacity->mOpaqueCount;
+			opacity->mIndices = make_shared<Buffer>(device, "TriangleOpacity/Indices", triangleCount*3*sizeof(uint32_t),
+				vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR|vk::BufferUsageFlagBits::eShaderDeviceAddress,
+				vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+			opacity->mTriangles = make_shared<Buffer>(device, "TriangleOpacity/Triangles", triangleCount*sizeof(uint32_t),
+				vk::BufferUsageFlagBits::eStorageBuffer,
+				vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+			uint32_t alphaTested = 0;
+			uint32_t opaque = opacity->mAlphaTestedCount;
+			for (uint32_t i = 0; i < (uint32_t)classes.size(); i++) {
+				const uint4& c = classes[i];
+				if (c[3] == TRIANGLE_TRANSPARENT) continue;
+				uint32_t& dst = c[3] == TRIANGLE_OPAQUE ? opaque : alphaTested;
+				opacity->mIndices[3*dst + 0] = c[0];
+				opacity->mIndices[3*dst + 1] = c[1];
+				opacity->mIndices[3*dst + 2] = c[2];
+				opacity->mTriangles[dst] = i;
+				dst++;
+			}
+		}
+
+		for (shared_ptr<TriangleOpacity>* p : job.mPrimitives)
+			*p = opacity;
+	}
+
+	cout << "Classified " << jobs.size() << " alpha-tested meshes: " << counts[TRIANGLE_OPAQUE] << " opaque, "
+		<< counts[TRIANGLE_ALPHA_TESTED] << " alpha-tested and " << counts[TRIANGLE_TRANSPARENT] << " transparent triangles" << endl;
+}
+
 void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 	mLastUpdate = chrono::high_resolution_clock::now();
 
 	auto prevInstanceTransforms = move(mFrameData.mInstanceTransformMap);
+	auto prevInstancedMeshes = move(mFrameData.mInstancedMeshes);
 	mFrameData.clear();
 
 	// Construct resources used by renderers (mesh/material data buffers, image arrays, etc.)
@@ -445,7 +681,9 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 	vector<MeshVertexInfo> meshVertexInfos;
 	unordered_map<Buffer*, uint32_t> vertexBufferMap;
 
-	unordered_map<const void*, uint32_t> materialMap;
+	// materials are keyed by content, so that identical materials on different nodes are stored once. media are keyed by pointer.
+	unordered_multimap<size_t, pair<const Material*, uint32_t>> materialMap; // content hash -> material, address
+	unordered_map<const Medium*, uint32_t> mediumMap;
 
 	const bool useAccelerationStructure = commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure;
 	vector<vk::AccelerationStructureInstanceKHR> instancesAS;
@@ -466,13 +704,22 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 	// 'material' is either a Material or Medium
 	auto appendMaterialData = [&](const auto* material) {
 		// append unique materials to materials list
-		auto materialMap_it = materialMap.find(material);
-		if (materialMap_it == materialMap.end()) {
-			materialMap_it = materialMap.emplace(material, (uint32_t)mFrameData.mMaterialResources.mMaterialData.sizeBytes()).first;
-			material->store(mFrameData.mMaterialResources);
-			mFrameData.mMaterialCount++;
+		const uint32_t address = (uint32_t)mFrameData.mMaterialResources.mMaterialData.sizeBytes();
+		if constexpr (is_same_v<remove_cvref_t<decltype(*material)>, Material>) {
+			const size_t key = material->contentHash();
+			const auto[first, last] = materialMap.equal_range(key);
+			for (auto it = first; it != last; ++it)
+				if (it->second.first == material || it->second.first->sameContent(*material))
+					return it->second.second;
+			materialMap.emplace(key, make_pair(material, address));
+		} else {
+			if (auto it = mediumMap.find(material); it != mediumMap.end())
+				return it->second;
+			mediumMap.emplace(material, address);
 		}
-		return materialMap_it->second;
+		material->store(mFrameData.mMaterialResources);
+		mFrameData.mMaterialCount++;
+		return address;
 	};
 
 	auto appendInstanceData = [&](Node& node, const void* primPtr, const InstanceData& instance, const TransformData& transform, const float area, const shared_ptr<Material>& material) {
@@ -504,6 +751,11 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 		instanceInverseTransforms.emplace_back(invTransform);
 		instanceMotionTransforms.emplace_back(makeMotionTransform(invTransform, prevTransform));
 		mFrameData.mInstances.emplace_back(make_tuple(instance, material, transform));
+		mFrameData.mInstanceAabbs.emplace_back(InstanceAabb{
+			.mMin = float3::Constant(-numeric_limits<float>::infinity()),
+			.mMax = float3::Constant( numeric_limits<float>::infinity()) });
+		mFrameData.mInstanceMeshlets.emplace_back(nullptr, INVALID_MESHLET);
+		mFrameData.mInstanceIndexRanges.emplace_back(~0u, 0);
 		return instanceIndex;
 	};
 
@@ -535,77 +787,167 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 		blasBarriers.emplace_back(
 			vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR,
 			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-			**asbuf.buffer(), asbuf.offset(), asbuf.sizeBytes());
+			**asbuf.buffer(), asbuf.absoluteOffset(), asbuf.sizeBytes());
 
 		return mAABBs.emplace(key, make_pair(as, asbuf)).first->second;
 	};
 
-	{ // mesh instances
-		ProfilerScope s("Process mesh instances", &commandBuffer);
-		mNode.forEachDescendant<MeshPrimitive>([&](Node& primNode, const shared_ptr<MeshPrimitive>& prim) {
-			if (!prim->mMesh || !prim->mMaterial) return;
+	// unique 32-bit index buffers of mesh instances, and their first index in FrameData::mIndexBuffer
+	vector<Buffer::View<byte>> indexBufferSources;
+	map<pair<const Buffer*, vk::DeviceSize>, uint32_t> indexBufferMap;
+	uint32_t indexBufferSize = 0;
+
+	// BLAS, vertex info and index range of a mesh, shared by mesh and instanced mesh primitives
+	struct MeshGeometry {
+		vk::DeviceAddress mAccelerationStructureAddress;
+		uint32_t mVertexInfoIndex;
+		uint32_t mPrimitiveCount;
+		uint32_t mFirstIndex; // in FrameData::mIndexBuffer, or ~0u for meshes without 32-bit indices
+	};
+	auto appendMeshGeometry = [&](const string& name, const Mesh& mesh, const Material& material, const TriangleOpacity* opacity) -> optional<MeshGeometry> {
+		if (mesh.topology() != vk::PrimitiveTopology::eTriangleList ||
+			(mesh.indexType() != vk::IndexType::eUint32 && mesh.indexType() != vk::IndexType::eUint16) ||
+			!mesh.vertices().find(Mesh::VertexAttributeType::ePosition)) {
+			cout << "Skipping unsupported mesh in node " << name << endl;
+			return nullopt;
+		}
 
-			if (prim->mMesh->topology() != vk::PrimitiveTopology::eTriangleList ||
-				(prim->mMesh->indexType() != vk::IndexType::eUint32 && prim->mMesh->indexType() != vk::IndexType::eUint16) ||
-				!prim->mMesh->vertices().find(Mesh::VertexAttributeType::ePosition)) {
-				cout << "Skipping unsupported mesh in node " << primNode.name() << endl;
-				return;
-			}
+		auto [positions, positionsDesc] = mesh.vertices().at(Mesh::VertexAttributeType::ePosition)[0];
 
-			auto [positions, positionsDesc] = prim->mMesh->vertices().at(Mesh::VertexAttributeType::ePosition)[0];
+		const uint32_t vertexCount = (uint32_t)((positions.sizeBytes() - positionsDesc.mOffset) / positionsDesc.mStride);
+		const uint32_t primitiveCount = mesh.indices().size() / (mesh.indices().stride() * 3);
 
-			const uint32_t vertexCount = (uint32_t)((positions.sizeBytes() - positionsDesc.mOffset) / positionsDesc.mStride);
-			const uint32_t primitiveCount = prim->mMesh->indices().size() / (prim->mMesh->indices().stride() * 3);
+		// the classification is only valid for the alpha mask it was made against
+		if (!material.alphaTest()) opacity = nullptr;
 
-			// get/build BLAS
-			vk::DeviceAddress accelerationStructureAddress;
-			if (useAccelerationStructure) {
-				const size_t key = hashArgs(positions.buffer(), positions.offset(), positions.sizeBytes(), positionsDesc, prim->mMaterial->alphaTest());
-				auto it = mMeshAccelerationStructures.find(key);
-				if (it == mMeshAccelerationStructures.end()) {
-					ProfilerScope ps("Build acceleration structure", &commandBuffer);
+		// get/build BLAS
+		vk::DeviceAddress accelerationStructureAddress = 0;
+		if (useAccelerationStructure) {
+			const size_t key = hashArgs(positions.buffer(), positions.offset(), positions.sizeBytes(), positionsDesc, material.alphaTest(), opacity);
+			auto it = mMeshAccelerationStructures.find(key);
+			if (it == mMeshAccelerationStructures.end()) {
+				ProfilerScope ps("Build acceleration structure", &commandBuffer);
+
+				// meshes without a geometry hash can't be identified across runs, and triangle opacity isn't cached
+				const size_t cacheKey = (mesh.geometryHash() == 0 || opacity) ? 0 : hashArgs(
+					mesh.geometryHash(), vertexCount, primitiveCount, positionsDesc.mFormat, positionsDesc.mStride, mesh.indexType(), material.alphaTest());
 
+				optional<AccelerationStructureData> cached;
+				if (cacheKey != 0)
+					cached = mAccelerationStructureCache.load(commandBuffer, cacheKey, name + "/BLAS");
+
+				shared_ptr<vk::raii::AccelerationStructureKHR> as;
+				Buffer::View<byte> asbuf;
+				if (cached)
+					tie(as, asbuf) = *cached;
+				else {
 					vk::AccelerationStructureGeometryTrianglesDataKHR triangles;
 					triangles.vertexFormat = positionsDesc.mFormat;
 					triangles.vertexData = positions.deviceAddress();
 					triangles.vertexStride = positionsDesc.mStride;
 					triangles.maxVertex = vertexCount;
-					triangles.indexType = prim->mMesh->indexType();
-					triangles.indexData = prim->mMesh->indices().deviceAddress();
-					vk::AccelerationStructureGeometryKHR triangleGeometry(vk::GeometryTypeKHR::eTriangles, triangles, prim->mMaterial->alphaTest() ? vk::GeometryFlagBitsKHR{} : vk::GeometryFlagBitsKHR::eOpaque);
-					vk::AccelerationStructureBuildRangeInfoKHR range(primitiveCount);
-
-					auto [as, asbuf] = buildAccelerationStructure(commandBuffer, primNode.name() + "/BLAS", vk::AccelerationStructureTypeKHR::eBottomLevel, triangleGeometry, range);
+					triangles.indexType = mesh.indexType();
+					triangles.indexData = mesh.indices().deviceAddress();
+					if (positionsDesc.mFormat == vk::Format::eR16G16B16A16Snorm) {
+						// quantized positions are mapped back to the mesh's aabb by the build
+						const auto[offset, scale] = Mesh::positionQuantization(mesh.vertices().mAabb);
+						Buffer::View<vk::TransformMatrixKHR> transform = make_shared<Buffer>(commandBuffer.mDevice, name + "/BLAS transform", sizeof(vk::TransformMatrixKHR),
+							vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR|vk::BufferUsageFlagBits::eShaderDeviceAddress,
+							vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+						transform[0] = vk::TransformMatrixKHR(array<array<float,4>,3>{
+							array<float,4>{ scale[0], 0, 0, offset[0] },
+							array<float,4>{ 0, scale[1], 0, offset[1] },
+							array<float,4>{ 0, 0, scale[2], offset[2] } });
+						triangles.transformData = transform.deviceAddress();
+						commandBuffer.trackResource(transform.buffer());
+					}
+					vector<vk::AccelerationStructureGeometryKHR> geometries;
+					vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges;
+					if (opacity) {
+						// alpha-tested triangles, then opaque ones. transparent triangles are dropped.
+						triangles.indexType = vk::IndexType::eUint32;
+						triangles.indexData = opacity->mIndices.deviceAddress();
+						if (opacity->mAlphaTestedCount > 0) {
+							geometries.emplace_back(vk::GeometryTypeKHR::eTriangles, triangles, vk::GeometryFlagBitsKHR{});
+							ranges.emplace_back(opacity->mAlphaTestedCount);
+						}
+						if (opacity->mOpaqueCount > 0) {
+							triangles.indexData = opacity->mIndices.deviceAddress() + opacity->mAlphaTestedCount*3*sizeof(uint32_t);
+							geometries.emplace_back(vk::GeometryTypeKHR::eTriangles, triangles, vk::GeometryFlagBitsKHR::eOpaque);
+							ranges.emplace_back(opacity->mOpaqueCount);
+						}
+					} else {
+						geometries.emplace_back(vk::GeometryTypeKHR::eTriangles, triangles, material.alphaTest() ? vk::GeometryFlagBitsKHR{} : vk::GeometryFlagBitsKHR::eOpaque);
+						ranges.emplace_back(primitiveCount);
+					}
+
+					// meshes with only transparent triangles have no BLAS, which makes their TLAS instances inactive
+					if (!geometries.empty())
+						tie(as, asbuf) = buildAccelerationStructure(commandBuffer, name + "/BLAS", vk::AccelerationStructureTypeKHR::eBottomLevel, geometries, ranges);
+					if (cacheKey != 0)
+						mAccelerationStructureCache.store(commandBuffer, cacheKey, make_pair(as, asbuf));
+				}
 
+				if (as)
 					blasBarriers.emplace_back(
 						vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR,
 						VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-						**asbuf.buffer(), asbuf.offset(), asbuf.sizeBytes());
+						**asbuf.buffer(), asbuf.absoluteOffset(), asbuf.sizeBytes());
 
-					it = mMeshAccelerationStructures.emplace(key, make_pair(as, asbuf)).first;
-				}
+				it = mMeshAccelerationStructures.emplace(key, make_pair(as, asbuf)).first;
+			}
 
+			if (it->second.first)
 				accelerationStructureAddress = commandBuffer.mDevice->getAccelerationStructureAddressKHR(**it->second.first);
+		}
+
+		Buffer::View<byte> normals, texcoords;
+		Mesh::VertexAttributeDescription normalsDesc = {}, texcoordsDesc = {};
+		if (auto attrib = mesh.vertices().find(Mesh::VertexAttributeType::eNormal))
+			tie(normals, normalsDesc) = *attrib;
+		if (auto attrib = mesh.vertices().find(Mesh::VertexAttributeType::eTexcoord))
+			tie(texcoords, texcoordsDesc) = *attrib;
+
+		const uint32_t vertexInfoIndex = (uint32_t)meshVertexInfos.size();
+
+		const auto[positionOffset, positionScale] = Mesh::positionQuantization(mesh.vertices().mAabb);
+		meshVertexInfos.emplace_back(
+			appendVertexBuffer(mesh.indices().buffer()), (uint32_t)mesh.indices().offset(), (uint32_t)mesh.indices().stride(),
+			appendVertexBuffer(positions.buffer()), (uint32_t)positions.offset() + positionsDesc.mOffset, positionsDesc.mStride,
+			appendVertexBuffer(normals.buffer())  , (uint32_t)normals.offset()   + normalsDesc.mOffset  , normalsDesc.mStride,
+			appendVertexBuffer(texcoords.buffer()), (uint32_t)texcoords.offset() + texcoordsDesc.mOffset, texcoordsDesc.mStride,
+			vertexFormatCode(positionsDesc.mFormat), vertexFormatCode(normalsDesc.mFormat), vertexFormatCode(texcoordsDesc.mFormat),
+			positionOffset, positionScale);
+		if (opacity && opacity->mTriangles) {
+			meshVertexInfos.back().mTriangleMap = appendVertexBuffer(opacity->mTriangles.buffer());
+			meshVertexInfos.back().mFirstOpaquePrimitive = opacity->mAlphaTestedCount;
+		}
+
+		uint32_t firstIndex = ~0u;
+		if (mesh.indexType() == vk::IndexType::eUint32) {
+			const Buffer::StrideView& indices = mesh.indices();
+			auto[it, inserted] = indexBufferMap.emplace(make_pair(indices.buffer().get(), indices.offset()), indexBufferSize);
+			if (inserted) {
+				indexBufferSources.emplace_back(indices);
+				indexBufferSize += (uint32_t)(indices.sizeBytes() / sizeof(uint32_t));
 			}
+			firstIndex = it->second;
+		}
 
-			Buffer::View<byte> normals, texcoords;
-			Mesh::VertexAttributeDescription normalsDesc = {}, texcoordsDesc = {};
-			if (auto attrib = prim->mMesh->vertices().find(Mesh::VertexAttributeType::eNormal))
-				tie(normals, normalsDesc) = *attrib;
-			if (auto attrib = prim->mMesh->vertices().find(Mesh::VertexAttributeType::eTexcoord))
-				tie(texcoords, texcoordsDesc) = *attrib;
+		return MeshGeometry{ accelerationStructureAddress, vertexInfoIndex, primitiveCount, firstIndex };
+	};
 
-			const uint32_t vertexInfoIndex = (uint32_t)meshVertexInfos.size();
+	{ // mesh instances
+		ProfilerScope s("Process mesh instances", &commandBuffer);
+		mNode.forEachDescendant<MeshPrimitive>([&](Node& primNode, const shared_ptr<MeshPrimitive>& prim) {
+			if (!prim->mMesh || !prim->mMaterial) return;
 
-			meshVertexInfos.emplace_back(
-				appendVertexBuffer(prim->mMesh->indices().buffer()), (uint32_t)prim->mMesh->indices().offset(), (uint32_t)prim->mMesh->indices().stride(),
-				appendVertexBuffer(positions.buffer()), (uint32_t)positions.offset() + positionsDesc.mOffset, positionsDesc.mStride,
-				appendVertexBuffer(normals.buffer())  , (uint32_t)normals.offset()   + normalsDesc.mOffset  , normalsDesc.mStride,
-				appendVertexBuffer(texcoords.buffer()), (uint32_t)texcoords.offset() + texcoordsDesc.mOffset, texcoordsDesc.mStride);
+			const optional<MeshGeometry> geometry = appendMeshGeometry(primNode.name(), *prim->mMesh, *prim->mMaterial, prim->mTriangleOpacity.get());
+			if (!geometry) return;
 
 			const uint32_t materialAddress = appendMaterialData(prim->mMaterial.get());
 
-			const uint32_t triCount = prim->mMesh->indices().sizeBytes() / (prim->mMesh->indices().stride() * 3);
+			const uint32_t triCount = geometry->mPrimitiveCount;
 			const TransformData transform = nodeToWorld(primNode);
 			const float area = 1;
 
@@ -614,11 +956,20 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 
 			vk::AccelerationStructureInstanceKHR& instance = instancesAS.emplace_back();
 			float3x4::Map(&instance.transform.matrix[0][0]) = transform.to_float3x4();
-			instance.instanceCustomIndex = appendInstanceData(primNode, prim.get(), MeshInstanceData(materialAddress, vertexInfoIndex, primitiveCount), transform, area, prim->mMaterial);
+			instance.instanceCustomIndex = appendInstanceData(primNode, prim.get(), MeshInstanceData(materialAddress, geometry->mVertexInfoIndex, geometry->mPrimitiveCount), transform, area, prim->mMaterial);
 			instance.mask = BVH_FLAG_TRIANGLES;
-			instance.accelerationStructureReference = accelerationStructureAddress;
+			instance.accelerationStructureReference = geometry->mAccelerationStructureAddress;
 
 			const vk::AabbPositionsKHR& aabb = prim->mMesh->vertices().mAabb;
+			if (const auto& meshlets = prim->mMesh->meshlets())
+				mFrameData.mInstanceMeshlets[instance.instanceCustomIndex] = { meshlets, appendVertexBuffer(meshlets->mTables.buffer()) };
+
+			if (geometry->mFirstIndex != ~0u)
+				mFrameData.mInstanceIndexRanges[instance.instanceCustomIndex] = { geometry->mFirstIndex, triCount*3 };
+
+			InstanceAabb& instanceAabb = mFrameData.mInstanceAabbs[instance.instanceCustomIndex];
+			instanceAabb.mMin = float3::Constant( numeric_limits<float>::infinity());
+			instanceAabb.mMax = float3::Constant(-numeric_limits<float>::infinity());
 			for (uint32_t i = 0; i < 8; i++) {
 				const int3 idx(i % 2, (i % 4) / 2, i / 4);
 				float3 corner(
@@ -626,9 +977,11 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 					idx[1] == 0 ? aabb.minY : aabb.maxY,
 					idx[2] == 0 ? aabb.minZ : aabb.maxZ);
 				corner = transform.transformPoint(corner);
-				mFrameData.mAabbMin = min(mFrameData.mAabbMin, corner);
-				mFrameData.mAabbMax = max(mFrameData.mAabbMax, corner);
+				instanceAabb.mMin = min(instanceAabb.mMin, corner);
+				instanceAabb.mMax = max(instanceAabb.mMax, corner);
 			}
+			mFrameData.mAabbMin = min(mFrameData.mAabbMin, instanceAabb.mMin);
+			mFrameData.mAabbMax = max(mFrameData.mAabbMax, instanceAabb.mMax);
 		});
 	}
 
@@ -665,6 +1018,87 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 		});
 	}
 
+	{ // point cloud instances, one per chunk
+		ProfilerScope s("Process point clouds", &commandBuffer);
+		mNode.forEachDescendant<PointCloudPrimitive>([&](Node& primNode, const shared_ptr<PointCloudPrimitive>& prim) {
+			if (!prim->mMaterial || prim->mPointCount == 0) return;
+
+			const uint32_t chunkCount = (uint32_t)prim->mChunkAabbs.size();
+			// instance indices are limited to the 24-bit instanceCustomIndex of TLAS instances
+			if (instanceDatas.size() + chunkCount >= INVALID_INSTANCE) {
+				cerr << "Warning: Skipping point cloud in node " << primNode.name() << ": too many instances" << endl;
+				return;
+			}
+
+			if (!prim->mMaterial->mMaterialData.getEmission().isZero())
+				cerr << "Warning: Emissive point cloud in node " << primNode.name() << " is not sampled as a light" << endl;
+
+			const uint32_t materialAddress = appendMaterialData(prim->mMaterial.get());
+			const uint32_t pointBuffer = appendVertexBuffer(prim->mPoints.buffer());
+			const bool opaque = !prim->mMaterial->alphaTest();
+			const TransformData transform = nodeToWorld(primNode);
+
+			// BLASes are rebuilt when the material's opacity changes
+			if (useAccelerationStructure && (prim->mChunkBlases.size() != chunkCount || prim->mBlasesOpaque != opaque)) {
+				prim->mChunkBlases.clear();
+				prim->mChunkBlases.resize(chunkCount);
+				prim->mBlasesOpaque = opaque;
+			}
+
+			for (uint32_t c = 0; c < chunkCount; c++) {
+				vk::DeviceAddress accelerationStructureAddress = 0;
+				if (useAccelerationStructure) {
+					AccelerationStructureData& blas = prim->mChunkBlases[c];
+					if (!blas.first) {
+						ProfilerScope ps("Build acceleration structure", &commandBuffer);
+						const uint32_t count = min<uint32_t>(POINT_CLOUD_CHUNK_SIZE, prim->mPointCount - c*POINT_CLOUD_CHUNK_SIZE);
+						vk::AccelerationStructureGeometryAabbsDataKHR aabbs(prim->mAabbs.deviceAddress() + c*POINT_CLOUD_CHUNK_SIZE*sizeof(vk::AabbPositionsKHR), sizeof(vk::AabbPositionsKHR));
+						vk::AccelerationStructureGeometryKHR aabbGeometry(vk::GeometryTypeKHR::eAabbs, aabbs, opaque ? vk::GeometryFlagBitsKHR::eOpaque : vk::GeometryFlagBitsKHR{});
+						vk::AccelerationStructureBuildRangeInfoKHR range(count);
+						auto [as, asbuf] = buildAccelerationStructure(commandBuffer, primNode.name() + "/BLAS", vk::AccelerationStructureTypeKHR::eBottomLevel, aabbGeometry, range);
+						commandBuffer.trackResource(prim->mAabbs.buffer());
+
+						blasBarriers.emplace_back(
+							vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR,
+							VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+							**asbuf.buffer(), asbuf.absoluteOffset(), asbuf.sizeBytes());
+
+						blas = make_pair(as, asbuf);
+					} else {
+						// keep BLASes alive while TLASes built this frame reference them, in case the points are replaced
+						commandBuffer.trackResource(blas.second.buffer());
+						commandBuffer.trackVulkanResource(blas.first);
+					}
+					accelerationStructureAddress = commandBuffer.mDevice->getAccelerationStructureAddressKHR(**blas.first);
+				}
+
+				const vk::AabbPositionsKHR& aabb = prim->mChunkAabbs[c];
+
+				vk::AccelerationStructureInstanceKHR& instance = instancesAS.emplace_back();
+				float3x4::Map(&instance.transform.matrix[0][0]) = transform.to_float3x4();
+				instance.instanceCustomIndex = appendInstanceData(primNode, &aabb, PointCloudInstanceData(materialAddress, pointBuffer, c), transform, 0, {});
+				instance.mask = BVH_FLAG_SPHERES;
+				instance.accelerationStructureReference = accelerationStructureAddress;
+
+				InstanceAabb& instanceAabb = mFrameData.mInstanceAabbs[instance.instanceCustomIndex];
+				instanceAabb.mMin = float3::Constant( numeric_limits<float>::infinity());
+				instanceAabb.mMax = float3::Constant(-numeric_limits<float>::infinity());
+				for (uint32_t i = 0; i < 8; i++) {
+					const int3 idx(i % 2, (i % 4) / 2, i / 4);
+					float3 corner(
+						idx[0] == 0 ? aabb.minX : aabb.maxX,
+						idx[1] == 0 ? aabb.minY : aabb.maxY,
+						idx[2] == 0 ? aabb.minZ : aabb.maxZ);
+					corner = transform.transformPoint(corner);
+					instanceAabb.mMin = min(instanceAabb.mMin, corner);
+					instanceAabb.mMax = max(instanceAabb.mMax, corner);
+				}
+				mFrameData.mAabbMin = min(mFrameData.mAabbMin, instanceAabb.mMin);
+				mFrameData.mAabbMax = max(mFrameData.mAabbMax, instanceAabb.mMax);
+			}
+		});
+	}
+
 	{ // medium instances
 		ProfilerScope s("Process media", &commandBuffer);
 		mNode.forEachDescendant<Medium>([&](Node& primNode, const shared_ptr<Medium>& vol) {
@@ -712,6 +1146,92 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 		});
 	}
 
+	// instanced meshes, whose instances are expanded on the GPU once the instance buffers are uploaded
+	mFrameData.mInstanceCount = (uint32_t)instanceDatas.size();
+	vector<InstanceBatch> instanceBatches;
+	{
+		ProfilerScope s("Process instanced meshes", &commandBuffer);
+		mNode.forEachDescendant<InstancedMeshPrimitive>([&](Node& primNode, const shared_ptr<InstancedMeshPrimitive>& prim) {
+			if (!prim->mMesh || !prim->mMaterial || prim->mTransforms.empty()) return;
+
+			// instance indices are limited to the 24-bit instanceCustomIndex of TLAS instances
+			if (mFrameData.mInstanceCount + prim->mTransforms.size() >= INVALID_INSTANCE) {
+				cerr << "Warning: Skipping " << prim->mTransforms.size() << " instances in node " << primNode.name() << ": too many instances" << endl;
+				return;
+			}
+
+			const optional<MeshGeometry> geometry = appendMeshGeometry(primNode.name(), *prim->mMesh, *prim->mMaterial, prim->mTriangleOpacity.get());
+			if (!geometry) return;
+
+			if (!prim->mMaterial->mMaterialData.getEmission().isZero())
+				cerr << "Warning: Instances of emissive mesh in node " << primNode.name() << " are not sampled as lights" << endl;
+
+			const uint32_t materialAddress = appendMaterialData(prim->mMaterial.get());
+			const TransformData transform = nodeToWorld(primNode);
+
+			// instances only correspond to the previous update's if the transforms are unchanged
+			TransformData prevTransform;
+			uint32_t prevFirstInstance = -1;
+			if (auto it = ranges::find(prevInstancedMeshes, prim.get(), &FrameData::InstancedMesh::mPrimitive); it != prevInstancedMeshes.end()) {
+				prevTransform = it->mTransform;
+				if (it->mTransforms == prim->mTransforms)
+					prevFirstInstance = it->mFirstInstance;
+			}
+
+			mFrameData.mInstancedMeshes.emplace_back(FrameData::InstancedMesh{
+				.mPrimitive = prim.get(),
+				.mTransforms = prim->mTransforms,
+				.mTransform = transform,
+				.mMaterial = prim->mMaterial,
+				.mMaterialAddress = materialAddress,
+				.mFirstInstance = mFrameData.mInstanceCount,
+				.mFirstIndex = geometry->mFirstIndex,
+				.mIndexCount = geometry->mPrimitiveCount*3 });
+
+			const MeshInstanceData instance(materialAddress, geometry->mVertexInfoIndex, geometry->mPrimitiveCount);
+			const vk::AabbPositionsKHR& aabb = prim->mMesh->vertices().mAabb;
+			instanceBatches.emplace_back(InstanceBatch{
+				.mObjectToWorld = transform,
+				.mPrevObjectToWorld = prevTransform,
+				.mAccelerationStructureAddress = uint2((uint32_t)geometry->mAccelerationStructureAddress, (uint32_t)(geometry->mAccelerationStructureAddress >> 32)),
+				.mInstanceData = uint2(instance.mTypeMaterialAddress, instance.mData),
+				.mAabbMin = float3(aabb.minX, aabb.minY, aabb.minZ),
+				.mFirstInstance = mFrameData.mInstanceCount,
+				.mAabbMax = float3(aabb.maxX, aabb.maxY, aabb.maxZ),
+				.mInstanceCount = (uint32_t)prim->mTransforms.size(),
+				.mPrevFirstInstance = prevFirstInstance,
+				.mMask = BVH_FLAG_TRIANGLES });
+			mFrameData.mInstanceCount += (uint32_t)prim->mTransforms.size();
+
+			for (uint32_t i = 0; i < 8; i++) {
+				const int3 idx(i % 2, (i % 4) / 2, i / 4);
+				float3 corner(
+					idx[0] == 0 ? prim->mAabb.minX : prim->mAabb.maxX,
+					idx[1] == 0 ? prim->mAabb.minY : prim->mAabb.maxY,
+					idx[2] == 0 ? prim->mAabb.minZ : prim->mAabb.maxZ);
+				corner = transform.transformPoint(corner);
+				mFrameData.mAabbMin = min(mFrameData.mAabbMin, corner);
+				mFrameData.mAabbMax = max(mFrameData.mAabbMax, corner);
+			}
+		});
+	}
+
+	if (indexBufferSources != mIndexBufferSources) {
+		ProfilerScope s("Build index buffer", &commandBuffer);
+		mIndexBuffer.reset();
+		if (indexBufferSize > 0) {
+			mIndexBuffer = make_shared<Buffer>(commandBuffer.mDevice, "mIndexBuffer", indexBufferSize*sizeof(uint32_t), vk::BufferUsageFlagBits::eIndexBuffer|vk::BufferUsageFlagBits::eTransferDst);
+			vk::DeviceSize offset = 0;
+			for (const Buffer::View<byte>& src : indexBufferSources) {
+				Buffer::copy(commandBuffer, src, Buffer::View<byte>(mIndexBuffer.buffer(), offset, src.sizeBytes()));
+				offset += src.sizeBytes();
+			}
+			mIndexBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eIndexRead);
+		}
+		mIndexBufferSources = move(indexBufferSources);
+	}
+	mFrameData.mIndexBuffer = mIndexBuffer;
+
 	{ // environment material
 		ProfilerScope s("Process environment", &commandBuffer);
 		mFrameData.mEnvironmentMaterialAddress = -1;
@@ -723,34 +1243,20 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 		});
 	}
 
-	// Build TLAS
-	if (useAccelerationStructure) {
-		ProfilerScope s("Build TLAS", &commandBuffer);
-		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::DependencyFlagBits::eByRegion, {}, blasBarriers, {});
-
-		vk::AccelerationStructureGeometryKHR geom{ vk::GeometryTypeKHR::eInstances, vk::AccelerationStructureGeometryInstancesDataKHR() };
-		vk::AccelerationStructureBuildRangeInfoKHR range{ (uint32_t)instancesAS.size() };
-		if (!instancesAS.empty()) {
-			shared_ptr<Buffer> buf = make_shared<Buffer>(commandBuffer.mDevice, "TLAS instance buffer",
-				sizeof(vk::AccelerationStructureInstanceKHR) * instancesAS.size() + 16, // extra 16 bytes for alignment
-				vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-			const size_t address = (size_t)buf->deviceAddress();
-			const size_t offset = (-address & 15); // aligned = unaligned + (-unaligned & (alignment - 1))
+	// TLAS instances. The instances of instanced meshes are written by mExpandInstancesPipeline.
+	shared_ptr<Buffer> instanceBuffer;
+	size_t instanceBufferOffset = 0;
+	if (useAccelerationStructure && mFrameData.mInstanceCount > 0) {
+		instanceBuffer = make_shared<Buffer>(commandBuffer.mDevice, "TLAS instance buffer",
+			sizeof(vk::AccelerationStructureInstanceKHR) * mFrameData.mInstanceCount + 16, // extra 16 bytes for alignment
+			vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
-			ranges::copy(instancesAS, (vk::AccelerationStructureInstanceKHR*)((byte*)buf->data() + offset));
+		const size_t address = (size_t)instanceBuffer->deviceAddress();
+		instanceBufferOffset = (-address & 15); // aligned = unaligned + (-unaligned & (alignment - 1))
 
-			geom.geometry.instances.data = buf->deviceAddress() + offset;
-			commandBuffer.trackResource(buf);
-		}
-
-		const auto&[ as, asbuf ] = buildAccelerationStructure(commandBuffer, mNode.name() + "/TLAS", vk::AccelerationStructureTypeKHR::eTopLevel, geom, range);
-		mFrameData.mDescriptors[{ "mAccelerationStructure", 0u }] = as;
-		mFrameData.mAccelerationStructureBuffer = asbuf;
-		mFrameData.mAccelerationStructureBuffer.barrier(commandBuffer,
-			vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eComputeShader,
-			vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR);
+		ranges::copy(instancesAS, (vk::AccelerationStructureInstanceKHR*)((byte*)instanceBuffer->data() + instanceBufferOffset));
+		commandBuffer.trackResource(instanceBuffer);
 	}
 
 	{ // upload data
@@ -764,18 +1270,81 @@ void Scene::updateFrameData(CommandBuffer& commandBuffer) {
 			else
 				return mFrameData.mResourcePool.uploadData<T>(commandBuffer, name, data);
 		};
+		// per-instance data, with room for the instances of instanced meshes after the uploaded ones
+		auto uploadInstanceData = [&]<typename T>(const string& name, const vk::ArrayProxy<T>& data) -> Buffer::View<T> {
+			if (mFrameData.mInstanceCount == 0)
+				return emptyBuffer;
+			else
+				return mFrameData.mResourcePool.uploadData<T>(commandBuffer, name, data, mFrameData.mInstanceCount);
+		};
 
-		mFrameData.mDescriptors[{ "mInstances", 0u }]                 = uploadOrEmpty.operator()<InstanceData>  ("mInstances", instanceDatas);
-		mFrameData.mDescriptors[{ "mInstanceTransforms", 0u }]        = uploadOrEmpty.operator()<TransformData> ("mInstanceTransforms", instanceTransforms);
-		mFrameData.mDescriptors[{ "mInstanceInverseTransforms", 0u }] = uploadOrEmpty.operator()<TransformData> ("mInstanceInverseTransforms", instanceInverseTransforms);
-		mFrameData.mDescriptors[{ "mInstanceMotionTransforms", 0u }]  = uploadOrEmpty.operator()<TransformData> ("mInstanceMotionTransforms", instanceMotionTransforms);
+		Descriptors expandDescriptors;
+		auto& e = expandDescriptors;
+		mFrameData.mDescriptors[{ "mInstances", 0u }]                 = e[{ "gInstances", 0u }]                 = uploadInstanceData.operator()<InstanceData>  ("mInstances", instanceDatas);
+		mFrameData.mDescriptors[{ "mInstanceTransforms", 0u }]        = e[{ "gInstanceTransforms", 0u }]        = uploadInstanceData.operator()<TransformData> ("mInstanceTransforms", instanceTransforms);
+		mFrameData.mDescriptors[{ "mInstanceInverseTransforms", 0u }] = e[{ "gInstanceInverseTransforms", 0u }] = uploadInstanceData.operator()<TransformData> ("mInstanceInverseTransforms", instanceInverseTransforms);
+		mFrameData.mDescriptors[{ "mInstanceMotionTransforms", 0u }]  = e[{ "gInstanceMotionTransforms", 0u }]  = uploadInstanceData.operator()<TransformData> ("mInstanceMotionTransforms", instanceMotionTransforms);
 		mFrameData.mDescriptors[{ "mLightInstanceMap", 0u }]          = uploadOrEmpty.operator()<uint32_t>      ("mLightInstanceMap", lightInstanceMap);
-		mFrameData.mDescriptors[{ "mInstanceLightMap", 0u }]          = uploadOrEmpty.operator()<uint32_t>      ("mInstanceLightMap", instanceLightMap);
+		mFrameData.mDescriptors[{ "mInstanceLightMap", 0u }]          = e[{ "gInstanceLightMap", 0u }]          = uploadInstanceData.operator()<uint32_t>      ("mInstanceLightMap", instanceLightMap);
 		mFrameData.mDescriptors[{ "mMaterialData", 0u }]              = uploadOrEmpty.operator()<uint32_t>      ("mMaterialData", mFrameData.mMaterialResources.mMaterialData);
 		mFrameData.mDescriptors[{ "mMeshVertexInfo", 0u }]            = uploadOrEmpty.operator()<MeshVertexInfo>("mMeshVertexInfo", meshVertexInfos);
 		mFrameData.mDescriptors[{ "mInstanceVolumeInfo", 0u }]        = uploadOrEmpty.operator()<VolumeInfo>    ("mInstanceVolumeInfo", mFrameData.mInstanceVolumeInfo);
-		if (!instanceIndexMap.empty())
-			mFrameData.mResourcePool.uploadData<uint32_t>(commandBuffer, "mInstanceIndexMap", instanceIndexMap);
+		e[{ "gInstanceIndexMap", 0u }] = uploadInstanceData.operator()<uint32_t>("mInstanceIndexMap", instanceIndexMap);
+		// not part of SceneParameters, used by culling passes
+		mFrameData.mInstanceAabbBuffer = uploadInstanceData.operator()<InstanceAabb>("mInstanceAabbs", mFrameData.mInstanceAabbs);
+		e[{ "gInstanceAabbs", 0u }] = mFrameData.mInstanceAabbBuffer;
+
+		if (!instanceBatches.empty()) {
+			ProfilerScope ps("Expand instanced meshes", &commandBuffer);
+
+			vector<Buffer::View<byte>> instanceBuffers;
+			for (const auto& [id, descriptor] : expandDescriptors)
+				instanceBuffers.emplace_back(get<BufferDescriptor>(descriptor));
+			Buffer::barriers(commandBuffer, instanceBuffers,
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+				vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+
+			e[{ "gBatches", 0u }] = mFrameData.mResourcePool.uploadData<InstanceBatch>(commandBuffer, "InstanceBatches", instanceBatches);
+			get<BufferDescriptor>(e.at({ "gBatches", 0u })).barrier(commandBuffer,
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+				vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+			e[{ "gAccelerationStructureInstances", 0u }] = instanceBuffer ? Buffer::View<byte>(instanceBuffer) : Buffer::View<byte>(emptyBuffer);
+
+			const shared_ptr<ComputePipeline> pipeline = mExpandInstancesPipeline.get(commandBuffer.mDevice);
+			for (uint32_t i = 0; i < instanceBatches.size(); i++) {
+				e[{ "gTransforms", 0u }] = mFrameData.mInstancedMeshes[i].mTransforms;
+				pipeline->dispatchTiled(commandBuffer, vk::Extent3D(instanceBatches[i].mInstanceCount, 1, 1), expandDescriptors, {}, PushConstants{
+					{ "mBatchIndex", PushConstantValue(i) },
+					{ "mAccelerationStructureInstanceOffset", PushConstantValue(instanceBuffer ? (uint32_t)instanceBufferOffset : ~0u) } });
+				commandBuffer.trackResource(mFrameData.mInstancedMeshes[i].mTransforms.buffer());
+			}
+
+			Buffer::barriers(commandBuffer, instanceBuffers,
+				vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eAllCommands,
+				vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+			if (instanceBuffer)
+				Buffer::View<byte>(instanceBuffer).barrier(commandBuffer,
+					vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+					vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+		}
+	}
+
+	// Build TLAS
+	if (useAccelerationStructure) {
+		ProfilerScope s("Build TLAS", &commandBuffer);
+		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::DependencyFlagBits::eByRegion, {}, blasBarriers, {});
+
+		vk::AccelerationStructureGeometryKHR geom{ vk::GeometryTypeKHR::eInstances, vk::AccelerationStructureGeometryInstancesDataKHR() };
+		vk::AccelerationStructureBuildRangeInfoKHR range{ mFrameData.mInstanceCount };
+		if (instanceBuffer)
+			geom.geometry.instances.data = instanceBuffer->deviceAddress() + instanceBufferOffset;
+
+		const auto&[ as, asbuf ] = buildAccelerationStructure(commandBuffer, mNode.name() + "/TLAS", vk::AccelerationStructureTypeKHR::eTopLevel, geom, range);
+		mFrameData.mDescriptors[{ "mAccelerationStructure", 0u }] = as;
+		mFrameData.mAccelerationStructureBuffer = asbuf;
+		mFrameData.mAccelerationStructureBuffer.barrier(commandBuffer,
+			vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eComputeShader,
+			vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR);
 	}
 
 	for (uint32_t i = 0; i < mFrameData.mVertexBuffers.size(); i++)
@@ -842,6 +1411,28 @@ void Scene::drawGui() {
 		}
 	}
 
+	if (ImGui::CollapsingHeader("Textures")) {
+		ImGui::Indent();
+		ImGui::Checkbox("Compress material images", &mCompressMaterialImages);
+		mTextureCache.drawGui();
+		ImGui::Unindent();
+	}
+	if (ImGui::CollapsingHeader("Meshes")) {
+		ImGui::Indent();
+		mMeshCache.drawGui();
+		ImGui::Unindent();
+	}
+	if (mAccelerationStructureCache.enabled() && ImGui::CollapsingHeader("Acceleration structure cache")) {
+		ImGui::Indent();
+		mAccelerationStructureCache.drawGui();
+		ImGui::Unindent();
+	}
+	if (mSceneCache.enabled() && ImGui::CollapsingHeader("Scene cache")) {
+		ImGui::Indent();
+		mSceneCache.drawGui();
+		ImGui::Unindent();
+	}
+
 	if (ImGui::CollapsingHeader("Resources")) {
 		ImGui::Indent();
 		mFrameData.mResourcePool.drawGui();
@@ -1078,6 +1669,51 @@ void Camera::drawGui() {
 }
 
 void MeshPrimitive::drawGui(Node& node) {
+	if (mTriangleOpacity)
+		ImGui::Text("%u opaque, %u alpha-tested, %u transparent triangles", mTriangleOpacity->mOpaqueCount, mTriangleOpacity->mAlphaTestedCount, mTriangleOpacity->mTransparentCount);
+	if (mMesh) {
+		ImGui::Text("%s", type_index(typeid(Mesh)).name());
+		ImGui::SameLine();
+		if (ImGui::Button("Mesh"))
+			node.root()->findDescendant<Inspector>()->pin(node, mMesh);
+	}
+	if (mMaterial) {
+		ImGui::Text("%s", type_index(typeid(Material)).name());
+		ImGui::SameLine();
+		if (ImGui::Button("Material"))
+			node.root()->findDescendant<Inspector>()->pin(node, mMaterial);
+	}
+}
+void InstancedMeshPrimitive::setTransforms(CommandBuffer& commandBuffer, const vector<TransformData>& transforms) {
+	mTransforms.reset();
+	mAabb = vk::AabbPositionsKHR(0, 0, 0, 0, 0, 0);
+	if (transforms.empty()) return;
+
+	Buffer::View<TransformData> staging = make_shared<Buffer>(commandBuffer.mDevice, "InstanceTransforms/Staging", transforms.size()*sizeof(TransformData), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	ranges::copy(transforms, staging.begin());
+	mTransforms = make_shared<Buffer>(commandBuffer.mDevice, "InstanceTransforms", transforms.size()*sizeof(TransformData), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+	Buffer::copy(commandBuffer, staging, mTransforms);
+	mTransforms.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+
+	const vk::AabbPositionsKHR& aabb = mMesh->vertices().mAabb;
+	float3 mn = float3::Constant( numeric_limits<float>::infinity());
+	float3 mx = float3::Constant(-numeric_limits<float>::infinity());
+	for (const TransformData& t : transforms) {
+		for (uint32_t i = 0; i < 8; i++) {
+			const int3 idx(i % 2, (i % 4) / 2, i / 4);
+			float3 corner(
+				idx[0] == 0 ? aabb.minX : aabb.maxX,
+				idx[1] == 0 ? aabb.minY : aabb.maxY,
+				idx[2] == 0 ? aabb.minZ : aabb.maxZ);
+			corner = t.transformPoint(corner);
+			mn = min(mn, corner);
+			mx = max(mx, corner);
+		}
+	}
+	mAabb = vk::AabbPositionsKHR(mn[0], mn[1], mn[2], mx[0], mx[1], mx[2]);
+}
+void InstancedMeshPrimitive::drawGui(Node& node) {
+	ImGui::Text("%llu instances", (unsigned long long)mTransforms.size());
 	if (mMesh) {
 		ImGui::Text("%s", type_index(typeid(Mesh)).name());
 		ImGui::SameLine();
@@ -1103,6 +1739,71 @@ void SpherePrimitive::drawGui(Node& node) {
 	}
 }
 
+void PointCloudPrimitive::setPoints(CommandBuffer& commandBuffer, const span<const float4> points, const span<const uint32_t> colors) {
+	mPoints.reset();
+	mAabbs.reset();
+	mChunkAabbs.clear();
+	mChunkBlases.clear();
+	mPointCount = (uint32_t)points.size();
+	if (points.empty()) return;
+
+	const uint32_t chunkCount = (mPointCount + POINT_CLOUD_CHUNK_SIZE - 1) / POINT_CLOUD_CHUNK_SIZE;
+	mChunkAabbs.resize(chunkCount);
+
+	Buffer::View<byte> pointStaging = make_shared<Buffer>(commandBuffer.mDevice, "PointCloud/Staging", chunkCount*(vk::DeviceSize)POINT_CLOUD_CHUNK_STRIDE, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	Buffer::View<vk::AabbPositionsKHR> aabbStaging = make_shared<Buffer>(commandBuffer.mDevice, "PointCloud/Aabbs/Staging", mPointCount*sizeof(vk::AabbPositionsKHR), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+
+	// chunks are independent, so they are filled in parallel. chunk offsets aren't 16-byte aligned, so points are copied bytewise.
+	vector<future<void>> chunks(chunkCount);
+	for (uint32_t c = 0; c < chunkCount; c++) {
+		chunks[c] = ThreadPool::global().enqueue([&, c]() {
+			const uint32_t first = c*POINT_CLOUD_CHUNK_SIZE;
+			const uint32_t count = min<uint32_t>(POINT_CLOUD_CHUNK_SIZE, mPointCount - first);
+			byte* chunk = pointStaging.data() + c*(size_t)POINT_CLOUD_CHUNK_STRIDE;
+			memcpy(chunk, points.data() + first, count*sizeof(float4));
+			if (colors.empty())
+				memset(chunk + POINT_CLOUD_CHUNK_SIZE*sizeof(float4), 0xFF, count*sizeof(uint32_t));
+			else
+				memcpy(chunk + POINT_CLOUD_CHUNK_SIZE*sizeof(float4), colors.data() + first, count*sizeof(uint32_t));
+
+			float3 mn = float3::Constant( numeric_limits<float>::infinity());
+			float3 mx = float3::Constant(-numeric_limits<float>::infinity());
+			for (uint32_t i = 0; i < count; i++) {
+				const float4& p = points[first + i];
+				const float3 center = p.head<3>();
+				const float3 pmin = center - float3::Constant(p[3]);
+				const float3 pmax = center + float3::Constant(p[3]);
+				aabbStaging[first + i] = vk::AabbPositionsKHR(pmin[0], pmin[1], pmin[2], pmax[0], pmax[1], pmax[2]);
+				mn = min(mn, pmin);
+				mx = max(mx, pmax);
+			}
+			// the tail of the last chunk is never read
+			mChunkAabbs[c] = vk::AabbPositionsKHR(mn[0], mn[1], mn[2], mx[0], mx[1], mx[2]);
+		});
+	}
+	for (future<void>& f : chunks)
+		f.wait();
+
+	mPoints = make_shared<Buffer>(commandBuffer.mDevice, "PointCloud", pointStaging.sizeBytes(), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+	mAabbs = make_shared<Buffer>(commandBuffer.mDevice, "PointCloud/Aabbs", mPointCount*sizeof(vk::AabbPositionsKHR), vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR|vk::BufferUsageFlagBits::eShaderDeviceAddress|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+	Buffer::copy(commandBuffer, pointStaging, mPoints);
+	Buffer::copy(commandBuffer, aabbStaging, mAabbs);
+	commandBuffer.trackResource(pointStaging.buffer());
+	commandBuffer.trackResource(aabbStaging.buffer());
+	mPoints.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+	mAabbs.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+}
+void PointCloudPrimitive::drawGui(Node& node) {
+	ImGui::Text("%u points in %u chunks", mPointCount, (uint32_t)mChunkAabbs.size());
+	ImGui::Text("%.2f MiB", (mPoints.sizeBytes() + mAabbs.sizeBytes()) / float(1 << 20));
+	if (mMaterial) {
+		ImGui::Text("%s", type_index(typeid(Material)).name());
+		ImGui::SameLine();
+		if (ImGui::Button("Material"))
+			node.root()->findDescendant<Inspector>()->pin(node, mMaterial);
+	}
+}
+
 void EnvironmentMap::drawGui(Node& node) {
 	if (ImageValue<3>::drawGui("Emission"))
 		if (const shared_ptr<Scene> scene = node.findAncestor<Scene>())
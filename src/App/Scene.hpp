@@ -6,9 +6,13 @@
 
 #include <Core/Mesh.hpp>
 #include <Core/DeviceResourcePool.hpp>
+#include <Core/TextureCache.hpp>
+#include <Core/MeshCache.hpp>
+#include <Core/AccelerationStructureCache.hpp>
 
 #include "Node.hpp"
 #include "Material.hpp"
+#include "SceneCache.hpp"
 
 #include <future>
 
@@ -24,9 +28,38 @@ struct ImageValue {
 	bool drawGui(const string& label);
 };
 
+// Opacity of each triangle of an alpha-tested mesh, against the alpha mask of its material. Lets the BLAS skip the
+// alpha test on triangles that are fully opaque, and drop triangles that are fully transparent.
+// See Scene::classifyTriangleOpacity.
+struct TriangleOpacity {
+	uint32_t mOpaqueCount = 0;
+	uint32_t mAlphaTestedCount = 0;
+	uint32_t mTransparentCount = 0;
+	// 32-bit vertex indices of the alpha-tested triangles, followed by the opaque ones. Built into separate BLAS geometries.
+	Buffer::View<uint32_t> mIndices;
+	// mesh triangle of each triangle of mIndices, see MeshVertexInfo::mTriangleMap
+	Buffer::View<uint32_t> mTriangles;
+};
+
 struct MeshPrimitive {
 	shared_ptr<Material> mMaterial;
 	shared_ptr<Mesh> mMesh;
+	shared_ptr<TriangleOpacity> mTriangleOpacity;
+
+	void drawGui(Node& node);
+};
+
+// A mesh drawn at every transform in mTransforms, without a Node per instance. Scene::updateFrameData expands the
+// instances on the GPU, after the instances of every other primitive.
+struct InstancedMeshPrimitive {
+	shared_ptr<Material> mMaterial;
+	shared_ptr<Mesh> mMesh;
+	Buffer::View<TransformData> mTransforms; // instance to node transforms
+	vk::AabbPositionsKHR mAabb; // node-space bounds of every instance
+	shared_ptr<TriangleOpacity> mTriangleOpacity;
+
+	// Uploads transforms to a new buffer, and computes mAabb from them. mMesh must be set.
+	void setTransforms(CommandBuffer& commandBuffer, const vector<TransformData>& transforms);
 
 	void drawGui(Node& node);
 };
@@ -38,6 +71,25 @@ struct SpherePrimitive {
 	void drawGui(Node& node);
 };
 
+// Spheres whose centers, radii and colors are stored in a GPU buffer, instead of a Node per sphere.
+// Each chunk of POINT_CLOUD_CHUNK_SIZE points is one AABB BLAS and one TLAS instance.
+struct PointCloudPrimitive {
+	shared_ptr<Material> mMaterial;
+	Buffer::View<byte> mPoints; // starts at the beginning of its buffer, see POINT_CLOUD_CHUNK_STRIDE
+	Buffer::View<vk::AabbPositionsKHR> mAabbs; // bounds of each point, the input of the BLAS builds
+	vector<vk::AabbPositionsKHR> mChunkAabbs; // node-space bounds of each chunk
+	uint32_t mPointCount = 0;
+
+	// BLAS of each chunk, built by Scene::update and released with the points they were built from
+	vector<AccelerationStructureCache::AccelerationStructureData> mChunkBlases;
+	bool mBlasesOpaque = false; // geometry flag mChunkBlases were built with
+
+	// Uploads the centers and radii of the points, and their RGBA8 sRGB colors. colors may be empty for white points.
+	void setPoints(CommandBuffer& commandBuffer, const span<const float4> points, const span<const uint32_t> colors);
+
+	void drawGui(Node& node);
+};
+
 struct EnvironmentMap : public ImageValue<3> {
     inline void store(MaterialResources &resources) const {
         resources.mMaterialData.AppendN(mValue);
@@ -73,6 +125,26 @@ public:
 		vector<MeshVertexInfo> mMeshVertexInfo;
 
 		vector<VolumeInfo> mInstanceVolumeInfo;
+		vector<InstanceAabb> mInstanceAabbs; // world-space bounds of each instance
+		// meshlets of each mesh instance, and the index of their tables in mVertexBuffers. nullptr for other instances.
+		vector<pair<shared_ptr<const Mesh::Meshlets>, uint32_t>> mInstanceMeshlets;
+		// first index and index count of each mesh instance in mIndexBuffer. ~0u for instances without 32-bit indices.
+		vector<pair<uint32_t, uint32_t>> mInstanceIndexRanges;
+
+		// InstancedMeshPrimitives, whose instances follow the ones above and are only written on the GPU
+		struct InstancedMesh {
+			const InstancedMeshPrimitive* mPrimitive;
+			Buffer::View<TransformData> mTransforms;
+			TransformData mTransform; // node to world
+			shared_ptr<Material> mMaterial;
+			uint32_t mMaterialAddress;
+			uint32_t mFirstInstance;
+			// first index and index count of the mesh in mIndexBuffer, like mInstanceIndexRanges
+			uint32_t mFirstIndex;
+			uint32_t mIndexCount;
+		};
+		vector<InstancedMesh> mInstancedMeshes;
+		uint32_t mInstanceCount; // including the instances of mInstancedMeshes
 
 		unordered_map<const void* /* address of component */, pair<TransformData, uint32_t /* instance index */ >> mInstanceTransformMap;
 		vector<weak_ptr<Node>> mInstanceNodes;
@@ -89,10 +161,18 @@ public:
 		Descriptors mDescriptors;
 
 		Buffer::View<byte> mAccelerationStructureBuffer;
+		Buffer::View<InstanceAabb> mInstanceAabbBuffer;
+		// the 32-bit index buffers of all mesh instances, concatenated for indexed draws
+		Buffer::View<uint32_t> mIndexBuffer;
 
 		inline void clear() {
 			mInstances.clear();
 			mInstanceVolumeInfo.clear();
+			mInstanceAabbs.clear();
+			mInstanceMeshlets.clear();
+			mInstanceIndexRanges.clear();
+			mInstancedMeshes.clear();
+			mInstanceCount = 0;
 
 			mInstanceTransformMap.clear();
 			mInstanceNodes.clear();
@@ -110,6 +190,8 @@ public:
 
 			mDescriptors.clear();
 			mAccelerationStructureBuffer.reset();
+			mInstanceAabbBuffer.reset();
+			mIndexBuffer.reset();
 
 			mResourcePool.clean();
 		}
@@ -122,6 +204,8 @@ public:
 	void createPipelines();
 
 	inline const FrameData& frameData() const { return mFrameData; }
+	inline TextureCache& textureCache() { return mTextureCache; }
+	inline MeshCache& meshCache() { return mMeshCache; }
 
 	void drawGui();
 
@@ -135,6 +219,7 @@ public:
 	shared_ptr<Node> loadMitsuba(CommandBuffer& commandBuffer, const filesystem::path& filename);
 	shared_ptr<Node> loadVol(CommandBuffer& commandBuffer, const filesystem::path& filename);
 	shared_ptr<Node> loadNvdb(CommandBuffer& commandBuffer, const filesystem::path& filename);
+	shared_ptr<Node> loadPointCloud(CommandBuffer& commandBuffer, const filesystem::path& filename);
 #ifdef ENABLE_ASSIMP
 	shared_ptr<Node> loadAssimp(CommandBuffer& commandBuffer, const filesystem::path& filename);
 #endif
@@ -149,10 +234,10 @@ public:
 			"glTF Scenes (.gltf .glb)", "*.gltf *.glb",
 			"Mitsuba Volumes (.vol)" , "*.vol",
 			"NVDB Volume (.nvdb)" , "*.nvdb",
+			"Stanford Polygon Library Files and Point Clouds (.ply .xyzr)", "*.ply *.xyzr",
 	#ifdef ENABLE_ASSIMP
 			"Autodesk (.fbx)", "*.fbx",
 			"Wavefront Object Files (.obj)", "*.obj",
-			"Stanford Polygon Library Files (.ply)", "*.ply",
 			"Stereolithography Files (.stl)", "*.stl",
 			"Blender Scenes (.blend)", "*.blend",
 	#endif
@@ -170,11 +255,12 @@ public:
 		else if (ext == ".xml") return loadMitsuba(commandBuffer, filename);
 		else if (ext == ".vol") return loadVol(commandBuffer, filename);
 		else if (ext == ".nvdb") return loadNvdb(commandBuffer, filename);
+		else if (ext == ".ply") return loadPointCloud(commandBuffer, filename);
+		else if (ext == ".xyzr") return loadPointCloud(commandBuffer, filename);
 	#ifdef ENABLE_ASSIMP
 		else if (ext == ".fbx") return loadAssimp(commandBuffer, filename);
 		else if (ext == ".obj") return loadAssimp(commandBuffer, filename);
 		else if (ext == ".blend") return loadAssimp(commandBuffer, filename);
-		else if (ext == ".ply") return loadAssimp(commandBuffer, filename);
 		else if (ext == ".stl") return loadAssimp(commandBuffer, filename);
 	#endif
 	#ifdef ENABLE_OPENVDB
@@ -190,21 +276,55 @@ public:
 	Material makeDiffuseSpecularMaterial  (CommandBuffer& commandBuffer, const ImageValue<3>& diffuse, const ImageValue<3>& specular, const ImageValue<1>& roughness, const ImageValue<3>& transmission, const float eta, const ImageValue<3>& emission);
 
 private:
-	using AccelerationStructureData = pair<shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<byte> /* acceleration structure buffer */>;
+	using AccelerationStructureData = AccelerationStructureCache::AccelerationStructureData;
 
 	// cache aabb BLASs
 	unordered_map<size_t, AccelerationStructureData> mAABBs;
 	// cache mesh BLASs
 	unordered_map<size_t, AccelerationStructureData> mMeshAccelerationStructures;
+	// mesh BLASs from previous runs
+	AccelerationStructureCache mAccelerationStructureCache;
+	// scenes baked by previous runs
+	SceneCache mSceneCache;
 
 	FrameData mFrameData;
 
+	// shared by all loaded scenes
+	TextureCache mTextureCache;
+	MeshCache mMeshCache;
+
 	void updateFrameData(CommandBuffer& commandBuffer);
 
+	// Replaces the meshes of node and its descendants with identical meshes from mMeshCache, and registers the rest.
+	// Called once the command buffer that loaded node has completed.
+	void collapseMeshes(Node& node);
+
+	// An alpha-tested mesh whose triangles are being classified, and the primitives that use it
+	struct TriangleOpacityJob {
+		shared_ptr<Mesh> mMesh;
+		shared_ptr<Material> mMaterial;
+		vector<shared_ptr<TriangleOpacity>*> mPrimitives;
+		Buffer::View<uint4> mOutput;
+	};
+
+	// Records the classification of the triangles of alpha-tested meshes in node and its descendants into the
+	// command buffer that loaded node. See TriangleOpacity.
+	vector<TriangleOpacityJob> classifyTriangleOpacity(CommandBuffer& commandBuffer, Node& node);
+	// Reads back the classifications once the command buffer has completed, and assigns each primitive its TriangleOpacity
+	void applyTriangleOpacity(Device& device, const vector<TriangleOpacityJob>& jobs);
+
+	// Encodes every mip level of an RGBA8 image to BC7 on the GPU
+	Image::View encodeBC7(CommandBuffer& commandBuffer, const Image::View& image);
+
 	ComputePipelineCache mConvertAlphaToRoughnessPipeline;
 	ComputePipelineCache mConvertShininessToRoughnessPipeline;
 	ComputePipelineCache mConvertPbrPipeline;
 	ComputePipelineCache mConvertDiffuseSpecularPipeline;
+	ComputePipelineCache mEncodeBC7Pipeline;
+	ComputePipelineCache mExpandInstancesPipeline;
+	ComputePipelineCache mClassifyOpacityPipeline;
+
+	bool mCompressMaterialImages = true;
 
 	vector<string> mToLoad;
 	vector< future<pair<shared_ptr<Node>, shared_ptr<CommandBuffer>>> > mLoading;
@@ -213,6 +333,10 @@ private:
 	bool mUpdateOnce = false;
 	chrono::high_resolution_clock::time_point mLastUpdate;
 
+	// FrameData::mIndexBuffer, and the index buffers it was copied from. Rebuilt when those change.
+	Buffer::View<uint32_t> mIndexBuffer;
+	vector<Buffer::View<byte>> mIndexBufferSources;
+
 
 	// HACK: animation
 
@@ -0,0 +1,836 @@
+#include "SceneCache.hpp"
+#include "Scene.hpp"
+
+#include <Core/MappedFile.hpp>
+#include <Core/ThreadPool.hpp>
+
+#include <thread>
+#include <unordered_set>
+#include <imgui/imgui.h>
+
+namespace stm2 {
+
+namespace {
+
+using VolumeHandle = nanovdb::GridHandle<nanovdb::HostBuffer>;
+
+struct CacheFileHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	uint64_t mKey;
+	uint64_t mTableSize;  // size of the table that follows the header
+	uint64_t mDataOffset; // file offset of the first section
+};
+static constexpr uint32_t gCacheFileMagic = 0x43534D53; // "SMSC"
+static constexpr uint32_t gCacheFileVersion = 3;
+
+static constexpr uint64_t gSectionAlignment = 64;
+static constexpr uint32_t gInvalidIndex = ~0u;
+
+// Components are written as a type followed by their record, and each node's list ends with eEnd
+enum class ComponentType : uint32_t {
+	eEnd,
+	eTransform,
+	eMesh,
+	eMaterial,
+	eVolume,
+	eMeshPrimitive,
+	eInstancedMeshPrimitive,
+	eSpherePrimitive,
+	ePointCloudPrimitive,
+	eMedium,
+	eEnvironmentMap
+};
+
+struct BufferViewRecord {
+	uint32_t mBuffer; // index in the buffer table, or gInvalidIndex
+	uint64_t mOffset;
+	uint64_t mSize; // in bytes
+};
+struct ImageViewRecord {
+	uint32_t mImage; // index in the image table, or gInvalidIndex
+	vk::ImageSubresourceRange mSubresource;
+	vk::ImageViewType mType;
+	vk::ComponentMapping mComponentMapping;
+};
+struct VertexAttributeRecord {
+	BufferViewRecord mView;
+	Mesh::VertexAttributeDescription mDescription;
+};
+
+// files read by the loader on this thread, see SceneCache::addDependency
+thread_local vector<filesystem::path> tDependencies;
+
+// Size and modification time of a file, or zeros if it can't be read
+inline pair<uint64_t, int64_t> fileStamp(const filesystem::path& path) {
+	error_code ec;
+	const uintmax_t size = filesystem::file_size(path, ec);
+	if (ec) return { 0, 0 };
+	const auto time = filesystem::last_write_time(path, ec).time_since_epoch().count();
+	if (ec) return { 0, 0 };
+	return { (uint64_t)size, (int64_t)time };
+}
+
+inline uint64_t alignSection(const uint64_t offset) {
+	return (offset + gSectionAlignment - 1) & ~(gSectionAlignment - 1);
+}
+
+// Bytes of one layer of an image level, packed as buffer to image copies expect them
+vk::DeviceSize levelSize(const vk::Format format, const vk::Extent3D& extent) {
+	const vk::DeviceSize blocks = vk::DeviceSize((extent.width + 3)/4) * ((extent.height + 3)/4) * extent.depth;
+	switch (format) {
+	case vk::Format::eBc1RgbUnormBlock:
+	case vk::Format::eBc1RgbSrgbBlock:
+	case vk::Format::eBc1RgbaUnormBlock:
+	case vk::Format::eBc1RgbaSrgbBlock:
+	case vk::Format::eBc4UnormBlock:
+	case vk::Format::eBc4SnormBlock:
+		return blocks * 8;
+	case vk::Format::eBc2UnormBlock:
+	case vk::Format::eBc2SrgbBlock:
+	case vk::Format::eBc3UnormBlock:
+	case vk::Format::eBc3SrgbBlock:
+	case vk::Format::eBc5UnormBlock:
+	case vk::Format::eBc5SnormBlock:
+	case vk::Format::eBc6HUfloatBlock:
+	case vk::Format::eBc6HSfloatBlock:
+	case vk::Format::eBc7UnormBlock:
+	case vk::Format::eBc7SrgbBlock:
+		return blocks * 16;
+	default:
+		return vk::DeviceSize(texelSize(format)) * extent.width * extent.height * extent.depth;
+	}
+}
+
+// Values are stored in their in-memory layout, like the other caches in the temp directory
+struct TableWriter {
+	vector<byte> mData;
+
+	template<typename T>
+	inline void write(const T& value) {
+		const byte* p = reinterpret_cast<const byte*>(&value);
+		mData.insert(mData.end(), p, p + sizeof(T));
+	}
+	template<typename T>
+	inline void writeArray(const span<const T> values) {
+		write<uint64_t>(values.size());
+		const byte* p = reinterpret_cast<const byte*>(values.data());
+		mData.insert(mData.end(), p, p + values.size_bytes());
+	}
+	inline void writeString(const string& value) {
+		writeArray(span<const char>(value));
+	}
+	inline void append(const TableWriter& table) {
+		mData.insert(mData.end(), table.mData.begin(), table.mData.end());
+	}
+};
+
+struct TableReader {
+	span<const byte> mData;
+	size_t mOffset = 0;
+
+	inline span<const byte> take(const size_t size) {
+		if (size > mData.size() - mOffset) throw out_of_range("Scene cache table is truncated");
+		const span<const byte> result = mData.subspan(mOffset, size);
+		mOffset += size;
+		return result;
+	}
+	template<typename T>
+	inline T read() {
+		T value;
+		memcpy(&value, take(sizeof(T)).data(), sizeof(T));
+		return value;
+	}
+	template<typename T>
+	inline vector<T> readArray() {
+		const uint64_t count = read<uint64_t>();
+		if (count > mData.size()) throw out_of_range("Scene cache table is truncated");
+		const span<const byte> data = take(count*sizeof(T));
+		vector<T> values(count);
+		memcpy(values.data(), data.data(), data.size());
+		return values;
+	}
+	inline string readString() {
+		const vector<char> chars = readArray<char>();
+		return string(chars.begin(), chars.end());
+	}
+};
+
+// Builds the table of a scene, and records the readback of every resource it references into sections.
+// Shared objects (buffers, images, grids, meshes and materials) are written once to their own table, and referenced by index.
+class SceneWriter {
+public:
+	TableWriter mBuffers, mImages, mVolumes, mMeshes, mMaterials, mNodes;
+	unordered_map<const void*, uint32_t> mBufferIndices, mImageIndices, mVolumeIndices, mMeshIndices, mMaterialIndices;
+	uint32_t mNodeCount = 0;
+
+	// file data, at offsets relative to the first section. Only valid once the command buffer has completed.
+	vector<pair<uint64_t, span<const byte>>> mSections;
+	uint64_t mDataSize = 0;
+
+	inline SceneWriter(CommandBuffer& commandBuffer) : mCommandBuffer(commandBuffer) {}
+
+	void writeNodes(Node& root) {
+		unordered_map<const Node*, uint32_t> nodeIndices;
+		// parents are always visited before their children
+		root.forEachDescendant([&](Node& n) {
+			const shared_ptr<Node> parent = n.parent();
+			const uint32_t parentIndex = (&n == &root || !parent) ? gInvalidIndex : nodeIndices.at(parent.get());
+			nodeIndices.emplace(&n, mNodeCount++);
+			mNodes.writeString(n.name());
+			mNodes.write(parentIndex);
+			writeComponents(n);
+			mNodes.write(ComponentType::eEnd);
+		});
+	}
+
+	// Concatenates the tables, in the order SceneReader resolves them
+	inline TableWriter table() const {
+		TableWriter t;
+		t.write((uint32_t)mBufferIndices.size());
+		t.append(mBuffers);
+		t.write((uint32_t)mImageIndices.size());
+		t.append(mImages);
+		t.write((uint32_t)mVolumeIndices.size());
+		t.append(mVolumes);
+		t.write((uint32_t)mMeshIndices.size());
+		t.append(mMeshes);
+		t.write((uint32_t)mMaterialIndices.size());
+		t.append(mMaterials);
+		t.write(mNodeCount);
+		t.append(mNodes);
+		return t;
+	}
+
+private:
+	CommandBuffer& mCommandBuffer; // only used by writeNodes
+	vector<shared_ptr<Buffer>> mStaging;
+
+	inline uint64_t addSection(const span<const byte> data) {
+		const uint64_t offset = alignSection(mDataSize);
+		mSections.emplace_back(offset, data);
+		mDataSize = offset + data.size();
+		return offset;
+	}
+
+	inline Buffer::View<byte> createStaging(const vk::DeviceSize size) {
+		const Buffer::View<byte> staging = make_shared<Buffer>(mCommandBuffer.mDevice, "SceneCache/Staging", size, vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		mStaging.emplace_back(staging.buffer());
+		return staging;
+	}
+
+	uint32_t bufferIndex(const shared_ptr<Buffer>& buffer) {
+		if (!buffer) return gInvalidIndex;
+		const auto[it, inserted] = mBufferIndices.emplace(buffer.get(), (uint32_t)mBufferIndices.size());
+		if (!inserted) return it->second;
+
+		uint64_t section;
+		if (buffer->memoryUsage() & vk::MemoryPropertyFlagBits::eHostVisible)
+			section = addSection(span<const byte>(reinterpret_cast<const byte*>(buffer->data()), buffer->size()));
+		else {
+			if (!(buffer->usage() & vk::BufferUsageFlagBits::eTransferSrc))
+				throw runtime_error("Buffer " + buffer->resourceName() + " can not be read back");
+			const Buffer::View<byte> staging = createStaging(buffer->size());
+			Buffer::copy(mCommandBuffer, Buffer::View<byte>(buffer), staging);
+			section = addSection(span<const byte>(staging.data(), staging.sizeBytes()));
+		}
+
+		mBuffers.writeString(buffer->resourceName());
+		mBuffers.write(buffer->size());
+		mBuffers.write(buffer->usage());
+		mBuffers.write(buffer->memoryUsage());
+		mBuffers.write(section);
+		return it->second;
+	}
+
+	inline BufferViewRecord bufferView(const Buffer::View<byte>& view) {
+		if (!view) return BufferViewRecord{ gInvalidIndex, 0, 0 };
+		return BufferViewRecord{ bufferIndex(view.buffer()), view.offset(), view.sizeBytes() };
+	}
+
+	// Images may be shared with scenes that are already being drawn, so mCommandBuffer must be recorded by the thread that draws them
+	uint32_t imageIndex(const shared_ptr<Image>& image) {
+		if (!image) return gInvalidIndex;
+		const auto[it, inserted] = mImageIndices.emplace(image.get(), (uint32_t)mImageIndices.size());
+		if (!inserted) return it->second;
+
+		if (!(image->usage() & vk::ImageUsageFlagBits::eTransferSrc))
+			throw runtime_error("Image " + image->resourceName() + " can not be read back");
+
+		const Image::Metadata md = image->metadata();
+		vector<vk::BufferImageCopy> copies(md.mLevels);
+		vk::DeviceSize size = 0;
+		for (uint32_t i = 0; i < md.mLevels; i++) {
+			copies[i] = vk::BufferImageCopy(size, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, i, 0, md.mLayers), vk::Offset3D{0,0,0}, image->extent(i));
+			size += levelSize(md.mFormat, image->extent(i)) * md.mLayers;
+		}
+		const Buffer::View<byte> staging = createStaging(size);
+		image->barrier(mCommandBuffer, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, md.mLevels, 0, md.mLayers), vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
+		staging.copyFromImage(mCommandBuffer, image, copies);
+
+		mImages.writeString(image->resourceName());
+		mImages.write(md.mCreateFlags);
+		mImages.write(md.mType);
+		mImages.write(md.mFormat);
+		mImages.write(md.mExtent);
+		mImages.write(md.mLevels);
+		mImages.write(md.mLayers);
+		mImages.write(md.mUsage);
+		mImages.write(addSection(span<const byte>(staging.data(), staging.sizeBytes())));
+		return it->second;
+	}
+
+	inline ImageViewRecord imageView(const Image::View& view) {
+		if (!view) return ImageViewRecord{ gInvalidIndex, {}, {}, {} };
+		return ImageViewRecord{ imageIndex(view.image()), view.subresourceRange(), view.type(), view.componentMapping() };
+	}
+
+	uint32_t volumeIndex(const shared_ptr<VolumeHandle>& volume) {
+		if (!volume) return gInvalidIndex;
+		const auto[it, inserted] = mVolumeIndices.emplace(volume.get(), (uint32_t)mVolumeIndices.size());
+		if (!inserted) return it->second;
+		mVolumes.write<uint64_t>(volume->size());
+		mVolumes.write(addSection(span<const byte>(reinterpret_cast<const byte*>(volume->data()), volume->size())));
+		return it->second;
+	}
+
+	uint32_t meshIndex(const shared_ptr<Mesh>& mesh) {
+		if (!mesh) return gInvalidIndex;
+		const auto[it, inserted] = mMeshIndices.emplace(mesh.get(), (uint32_t)mMeshIndices.size());
+		if (!inserted) return it->second;
+
+		mMeshes.write((uint32_t)mesh->vertices().size());
+		for (const auto&[type, attributes] : mesh->vertices()) {
+			vector<VertexAttributeRecord> records;
+			for (const auto&[view, description] : attributes)
+				records.emplace_back(bufferView(view), description);
+			mMeshes.write(type);
+			mMeshes.writeArray(span<const VertexAttributeRecord>(records));
+		}
+		mMeshes.write(mesh->vertices().mAabb);
+		mMeshes.write(bufferView(mesh->indices()));
+		mMeshes.write<uint64_t>(mesh->indices().stride());
+		mMeshes.write(mesh->topology());
+		mMeshes.write<uint64_t>(mesh->geometryHash());
+		mMeshes.write(mesh->contentHash());
+
+		const shared_ptr<const Mesh::Meshlets>& meshlets = mesh->meshlets();
+		mMeshes.write<uint32_t>(meshlets ? 1 : 0);
+		if (meshlets) {
+			mMeshes.writeArray(span<const MeshletInfo>(meshlets->mMeshlets));
+			mMeshes.write(bufferView(meshlets->mTables));
+			mMeshes.write(meshlets->mTriangleTableOffset);
+		}
+		return it->second;
+	}
+
+	uint32_t materialIndex(const shared_ptr<Material>& material) {
+		if (!material) return gInvalidIndex;
+		const auto[it, inserted] = mMaterialIndices.emplace(material.get(), (uint32_t)mMaterialIndices.size());
+		if (!inserted) return it->second;
+
+		mMaterials.write(material->mMaterialData);
+		for (const Image::View& img : material->mImages)
+			mMaterials.write(imageView(img));
+		mMaterials.write(imageView(material->mAlphaMask));
+		mMaterials.write(material->mAlphaCutoff);
+		mMaterials.write(bufferView(material->mMinAlpha));
+		mMaterials.write(imageView(material->mBumpImage));
+		mMaterials.write(material->mBumpStrength);
+		return it->second;
+	}
+
+	void writeComponents(Node& n) {
+		for (const type_index type : n.components()) {
+			if (type == typeid(TransformData)) {
+				mNodes.write(ComponentType::eTransform);
+				mNodes.write(*n.getComponent<TransformData>());
+			} else if (type == typeid(Mesh)) {
+				mNodes.write(ComponentType::eMesh);
+				mNodes.write(meshIndex(n.getComponent<Mesh>()));
+			} else if (type == typeid(Material)) {
+				mNodes.write(ComponentType::eMaterial);
+				mNodes.write(materialIndex(n.getComponent<Material>()));
+			} else if (type == typeid(VolumeHandle)) {
+				mNodes.write(ComponentType::eVolume);
+				mNodes.write(volumeIndex(n.getComponent<VolumeHandle>()));
+			} else if (type == typeid(MeshPrimitive)) {
+				const MeshPrimitive& prim = *n.getComponent<MeshPrimitive>();
+				mNodes.write(ComponentType::eMeshPrimitive);
+				mNodes.write(materialIndex(prim.mMaterial));
+				mNodes.write(meshIndex(prim.mMesh));
+			} else if (type == typeid(InstancedMeshPrimitive)) {
+				const InstancedMeshPrimitive& prim = *n.getComponent<InstancedMeshPrimitive>();
+				mNodes.write(ComponentType::eInstancedMeshPrimitive);
+				mNodes.write(materialIndex(prim.mMaterial));
+				mNodes.write(meshIndex(prim.mMesh));
+				mNodes.write(bufferView(prim.mTransforms));
+				mNodes.write(prim.mAabb);
+			} else if (type == typeid(SpherePrimitive)) {
+				const SpherePrimitive& prim = *n.getComponent<SpherePrimitive>();
+				mNodes.write(ComponentType::eSpherePrimitive);
+				mNodes.write(materialIndex(prim.mMaterial));
+				mNodes.write(prim.mRadius);
+			} else if (type == typeid(PointCloudPrimitive)) {
+				const PointCloudPrimitive& prim = *n.getComponent<PointCloudPrimitive>();
+				mNodes.write(ComponentType::ePointCloudPrimitive);
+				mNodes.write(materialIndex(prim.mMaterial));
+				mNodes.write(bufferView(prim.mPoints));
+				mNodes.write(bufferView(prim.mAabbs));
+				mNodes.writeArray(span<const vk::AabbPositionsKHR>(prim.mChunkAabbs));
+				mNodes.write(prim.mPointCount);
+			} else if (type == typeid(Medium)) {
+				const Medium& medium = *n.getComponent<Medium>();
+				mNodes.write(ComponentType::eMedium);
+				mNodes.write(medium.mDensityScale);
+				mNodes.write(medium.mAlbedoScale);
+				mNodes.write(medium.mAnisotropy);
+				// the device buffers hold the grids, and are uploaded from them again
+				mNodes.write(volumeIndex(medium.mDensityGrid));
+				mNodes.write(volumeIndex(medium.mAlbedoGrid));
+			} else if (type == typeid(EnvironmentMap)) {
+				const EnvironmentMap& env = *n.getComponent<EnvironmentMap>();
+				mNodes.write(ComponentType::eEnvironmentMap);
+				mNodes.write(env.mValue);
+				mNodes.write(imageView(env.mImage));
+			} else
+				cerr << "Warning: Scene cache skips component " << type.name() << " of " << n.name() << endl;
+		}
+	}
+};
+
+// Rebuilds a scene from its table, copying each section from the mapped file into staging memory
+class SceneReader {
+public:
+	inline SceneReader(CommandBuffer& commandBuffer, const MappedFile& file, const uint64_t dataOffset)
+		: mCommandBuffer(commandBuffer), mFile(file), mDataOffset(dataOffset) {}
+
+	shared_ptr<Node> read(TableReader& t) {
+		mBuffers.resize(t.read<uint32_t>());
+		for (shared_ptr<Buffer>& buffer : mBuffers) buffer = readBuffer(t);
+		mImages.resize(t.read<uint32_t>());
+		for (shared_ptr<Image>& image : mImages) image = readImage(t);
+		mVolumes.resize(t.read<uint32_t>());
+		for (shared_ptr<VolumeHandle>& volume : mVolumes) volume = readVolume(t);
+		mMeshes.resize(t.read<uint32_t>());
+		for (shared_ptr<Mesh>& mesh : mMeshes) mesh = readMesh(t);
+		mMaterials.resize(t.read<uint32_t>());
+		for (shared_ptr<Material>& material : mMaterials) material = readMaterial(t);
+
+		// every copy above must finish before the scene is used
+		mCommandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, {},
+			vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead), {}, {});
+
+		vector<shared_ptr<Node>> nodes(t.read<uint32_t>());
+		for (shared_ptr<Node>& node : nodes) {
+			const string name = t.readString();
+			const uint32_t parent = t.read<uint32_t>();
+			if (parent == gInvalidIndex) {
+				if (&node != &nodes.front()) throw runtime_error("Scene cache has more than one root");
+				node = Node::create(name);
+			} else {
+				if (parent >= uint32_t(&node - nodes.data())) throw out_of_range("Scene cache node precedes its parent");
+				node = nodes[parent]->addChild(name);
+			}
+			readComponents(t, *node);
+		}
+		return nodes.empty() ? nullptr : nodes.front();
+	}
+
+private:
+	CommandBuffer& mCommandBuffer;
+	const MappedFile& mFile;
+	uint64_t mDataOffset;
+
+	vector<shared_ptr<Buffer>> mBuffers;
+	vector<shared_ptr<Image>> mImages;
+	vector<shared_ptr<VolumeHandle>> mVolumes;
+	vector<shared_ptr<Mesh>> mMeshes;
+	vector<shared_ptr<Material>> mMaterials;
+
+	inline span<const byte> section(const uint64_t offset, const uint64_t size) const {
+		return mFile.bytes(mDataOffset + offset, size);
+	}
+
+	inline Buffer::View<byte> stage(const span<const byte> data) {
+		const Buffer::View<byte> staging = make_shared<Buffer>(mCommandBuffer.mDevice, "SceneCache/Staging", data.size(), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		memcpy(staging.data(), data.data(), data.size());
+		mCommandBuffer.trackResource(staging.buffer());
+		return staging;
+	}
+
+	template<typename T>
+	inline static const shared_ptr<T>& at(const vector<shared_ptr<T>>& v, const uint32_t index) {
+		static const shared_ptr<T> null;
+		return index == gInvalidIndex ? null : v.at(index);
+	}
+
+	shared_ptr<Buffer> readBuffer(TableReader& t) {
+		const string name = t.readString();
+		const vk::DeviceSize size = t.read<vk::DeviceSize>();
+		const vk::BufferUsageFlags usage = t.read<vk::BufferUsageFlags>();
+		const vk::MemoryPropertyFlags memoryFlags = t.read<vk::MemoryPropertyFlags>();
+		const span<const byte> data = section(t.read<uint64_t>(), size);
+
+		const shared_ptr<Buffer> buffer = make_shared<Buffer>(mCommandBuffer.mDevice, name, size, usage|vk::BufferUsageFlagBits::eTransferDst, memoryFlags);
+		if (memoryFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+			memcpy(buffer->data(), data.data(), size);
+		else
+			Buffer::copy(mCommandBuffer, stage(data), Buffer::View<byte>(buffer));
+		return buffer;
+	}
+
+	template<typename T = byte>
+	inline Buffer::View<T> bufferView(const BufferViewRecord& r) const {
+		if (r.mBuffer == gInvalidIndex) return {};
+		return Buffer::View<T>(mBuffers.at(r.mBuffer), r.mOffset, r.mSize / sizeof(T));
+	}
+
+	shared_ptr<Image> readImage(TableReader& t) {
+		const string name = t.readString();
+		Image::Metadata md;
+		md.mCreateFlags = t.read<vk::ImageCreateFlags>();
+		md.mType = t.read<vk::ImageType>();
+		md.mFormat = t.read<vk::Format>();
+		md.mExtent = t.read<vk::Extent3D>();
+		md.mLevels = t.read<uint32_t>();
+		md.mLayers = t.read<uint32_t>();
+		md.mUsage = t.read<vk::ImageUsageFlags>() | vk::ImageUsageFlagBits::eTransferDst;
+
+		const shared_ptr<Image> image = make_shared<Image>(mCommandBuffer.mDevice, name, md);
+		vector<vk::BufferImageCopy> copies(md.mLevels);
+		vk::DeviceSize size = 0;
+		for (uint32_t i = 0; i < md.mLevels; i++) {
+			copies[i] = vk::BufferImageCopy(size, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, i, 0, md.mLayers), vk::Offset3D{0,0,0}, image->extent(i));
+			size += levelSize(md.mFormat, image->extent(i)) * md.mLayers;
+		}
+		const Buffer::View<byte> staging = stage(section(t.read<uint64_t>(), size));
+		image->barrier(mCommandBuffer, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, md.mLevels, 0, md.mLayers), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+		staging.copyToImage(mCommandBuffer, image, copies);
+		mCommandBuffer.trackResource(image);
+		return image;
+	}
+
+	inline Image::View imageView(const ImageViewRecord& r) const {
+		if (r.mImage == gInvalidIndex) return {};
+		return Image::View(mImages.at(r.mImage), r.mSubresource, r.mType, r.mComponentMapping);
+	}
+
+	shared_ptr<VolumeHandle> readVolume(TableReader& t) {
+		const uint64_t size = t.read<uint64_t>();
+		const span<const byte> data = section(t.read<uint64_t>(), size);
+		nanovdb::HostBuffer buffer = nanovdb::HostBuffer::create(size);
+		memcpy(buffer.data(), data.data(), size);
+		return make_shared<VolumeHandle>(move(buffer));
+	}
+
+	shared_ptr<Mesh> readMesh(TableReader& t) {
+		Mesh::Vertices vertices;
+		const uint32_t typeCount = t.read<uint32_t>();
+		for (uint32_t i = 0; i < typeCount; i++) {
+			auto& attributes = vertices[t.read<Mesh::VertexAttributeType>()];
+			for (const VertexAttributeRecord& r : t.readArray<VertexAttributeRecord>())
+				attributes.emplace_back(bufferView(r.mView), r.mDescription);
+		}
+		vertices.mAabb = t.read<vk::AabbPositionsKHR>();
+		const Buffer::View<byte> indices = bufferView(t.read<BufferViewRecord>());
+		const uint64_t indexStride = t.read<uint64_t>();
+		const vk::PrimitiveTopology topology = t.read<vk::PrimitiveTopology>();
+
+		const shared_ptr<Mesh> mesh = make_shared<Mesh>(move(vertices), Buffer::StrideView(indices, indexStride), topology);
+		mesh->setGeometryHash(t.read<uint64_t>());
+		mesh->setContentHash(t.read<Hash128>());
+		if (t.read<uint32_t>()) {
+			const shared_ptr<Mesh::Meshlets> meshlets = make_shared<Mesh::Meshlets>();
+			meshlets->mMeshlets = t.readArray<MeshletInfo>();
+			meshlets->mTables = bufferView<uint32_t>(t.read<BufferViewRecord>());
+			meshlets->mTriangleTableOffset = t.read<uint32_t>();
+			mesh->setMeshlets(meshlets);
+		}
+		return mesh;
+	}
+
+	shared_ptr<Material> readMaterial(TableReader& t) {
+		const shared_ptr<Material> material = make_shared<Material>();
+		material->mMaterialData = t.read<PackedMaterialData>();
+		for (Image::View& img : material->mImages)
+			img = imageView(t.read<ImageViewRecord>());
+		material->mAlphaMask = imageView(t.read<ImageViewRecord>());
+		material->mAlphaCutoff = t.read<float>();
+		material->mMinAlpha = bufferView<uint32_t>(t.read<BufferViewRecord>());
+		material->mBumpImage = imageView(t.read<ImageViewRecord>());
+		material->mBumpStrength = t.read<float>();
+		return material;
+	}
+
+	Buffer::View<byte> uploadVolume(const shared_ptr<VolumeHandle>& volume, const string& name) {
+		if (!volume) return {};
+		Buffer::View<byte> buffer = make_shared<Buffer>(mCommandBuffer.mDevice, name, volume->size(), vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer);
+		Buffer::copy(mCommandBuffer, stage(span<const byte>(reinterpret_cast<const byte*>(volume->data()), volume->size())), buffer);
+		return buffer;
+	}
+
+	void readComponents(TableReader& t, Node& n) {
+		for (ComponentType type = t.read<ComponentType>(); type != ComponentType::eEnd; type = t.read<ComponentType>()) {
+			switch (type) {
+			case ComponentType::eTransform:
+				n.makeComponent<TransformData>(t.read<TransformData>());
+				break;
+			case ComponentType::eMesh:
+				n.addComponent(at(mMeshes, t.read<uint32_t>()));
+				break;
+			case ComponentType::eMaterial:
+				n.addComponent(at(mMaterials, t.read<uint32_t>()));
+				break;
+			case ComponentType::eVolume:
+				n.addComponent(at(mVolumes, t.read<uint32_t>()));
+				break;
+			case ComponentType::eMeshPrimitive: {
+				const shared_ptr<MeshPrimitive> prim = n.makeComponent<MeshPrimitive>();
+				prim->mMaterial = at(mMaterials, t.read<uint32_t>());
+				prim->mMesh = at(mMeshes, t.read<uint32_t>());
+				break;
+			}
+			case ComponentType::eInstancedMeshPrimitive: {
+				const shared_ptr<InstancedMeshPrimitive> prim = n.makeComponent<InstancedMeshPrimitive>();
+				prim->mMaterial = at(mMaterials, t.read<uint32_t>());
+				prim->mMesh = at(mMeshes, t.read<uint32_t>());
+				prim->mTransforms = bufferView<TransformData>(t.read<BufferViewRecord>());
+				prim->mAabb = t.read<vk::AabbPositionsKHR>();
+				break;
+			}
+			case ComponentType::eSpherePrimitive: {
+				const shared_ptr<SpherePrimitive> prim = n.makeComponent<SpherePrimitive>();
+				prim->mMaterial = at(mMaterials, t.read<uint32_t>());
+				prim->mRadius = t.read<float>();
+				break;
+			}
+			case ComponentType::ePointCloudPrimitive: {
+				const shared_ptr<PointCloudPrimitive> prim = n.makeComponent<PointCloudPrimitive>();
+				prim->mMaterial = at(mMaterials, t.read<uint32_t>());
+				prim->mPoints = bufferView(t.read<BufferViewRecord>());
+				prim->mAabbs = bufferView<vk::AabbPositionsKHR>(t.read<BufferViewRecord>());
+				prim->mChunkAabbs = t.readArray<vk::AabbPositionsKHR>();
+				prim->mPointCount = t.read<uint32_t>();
+				break;
+			}
+			case ComponentType::eMedium: {
+				const shared_ptr<Medium> medium = n.makeComponent<Medium>();
+				medium->mDensityScale = t.read<float3>();
+				medium->mAlbedoScale = t.read<float3>();
+				medium->mAnisotropy = t.read<float>();
+				medium->mDensityGrid = at(mVolumes, t.read<uint32_t>());
+				medium->mAlbedoGrid = at(mVolumes, t.read<uint32_t>());
+				medium->mDensityBuffer = uploadVolume(medium->mDensityGrid, n.name() + "/density");
+				medium->mAlbedoBuffer = uploadVolume(medium->mAlbedoGrid, n.name() + "/albedo");
+				break;
+			}
+			case ComponentType::eEnvironmentMap: {
+				const shared_ptr<EnvironmentMap> env = n.makeComponent<EnvironmentMap>();
+				env->mValue = t.read<float3>();
+				env->mImage = imageView(t.read<ImageViewRecord>());
+				break;
+			}
+			default:
+				throw runtime_error("Unknown component type " + to_string((uint32_t)type) + " in scene cache");
+			}
+		}
+	}
+};
+
+}
+
+filesystem::path SceneCache::filename(const filesystem::path& source) const {
+	error_code ec;
+	const filesystem::path path = filesystem::weakly_canonical(source, ec);
+	ostringstream name;
+	name << hex << setfill('0') << setw(16) << hashArgs((ec ? source : path).string()) << ".scene";
+	return mDirectory / name.str();
+}
+
+void SceneCache::addDependency(const filesystem::path& path) {
+	tDependencies.emplace_back(path);
+}
+vector<filesystem::path> SceneCache::takeDependencies() {
+	return exchange(tDependencies, {});
+}
+
+size_t SceneCache::key(Device& device, const filesystem::path& source, const size_t settingsKey) const {
+	const auto[size, time] = fileStamp(source);
+	return hashArgs(
+		filename(source).string(), size, time, settingsKey,
+		Mesh::vertexPrecision(device),
+		device.features().textureCompressionBC,
+		device.accelerationStructureFeatures().accelerationStructure);
+}
+
+shared_ptr<Node> SceneCache::load(CommandBuffer& commandBuffer, const filesystem::path& source, const size_t settingsKey) {
+	if (!enabled()) return nullptr;
+
+	const filesystem::path path = filename(source);
+	error_code ec;
+	if (!filesystem::exists(path, ec)) {
+		scoped_lock l(mMutex);
+		mStats.mMisses++;
+		return nullptr;
+	}
+
+	try {
+		const MappedFile file(path);
+		CacheFileHeader header;
+		memcpy(&header, file.bytes(0, sizeof(header)).data(), sizeof(header));
+		if (header.mMagic != gCacheFileMagic || header.mVersion != gCacheFileVersion || header.mKey != key(commandBuffer.mDevice, source, settingsKey)) {
+			scoped_lock l(mMutex);
+			mStats.mMisses++;
+			return nullptr;
+		}
+
+		TableReader table{ file.bytes(sizeof(header), header.mTableSize) };
+		const uint32_t dependencyCount = table.read<uint32_t>();
+		for (uint32_t i = 0; i < dependencyCount; i++) {
+			const string dependency = table.readString();
+			const uint64_t size = table.read<uint64_t>();
+			const int64_t time = table.read<int64_t>();
+			if (fileStamp(dependency) != make_pair(size, time)) {
+				scoped_lock l(mMutex);
+				mStats.mMisses++;
+				return nullptr;
+			}
+		}
+
+		SceneReader reader(commandBuffer, file, header.mDataOffset);
+		const shared_ptr<Node> node = reader.read(table);
+
+		scoped_lock l(mMutex);
+		mStats.mHits++;
+		mStats.mBytesRead += file.size();
+		return node;
+	} catch (exception& e) {
+		cerr << "Warning: Failed to load " << source << " from " << path << ": " << e.what() << endl;
+		scoped_lock l(mMutex);
+		mStats.mMisses++;
+		return nullptr;
+	}
+}
+
+struct SceneCache::PendingStore {
+	filesystem::path mSource;
+	size_t mSettingsKey;
+	vector<filesystem::path> mDependencies;
+	shared_ptr<Node> mNode; // keeps the host-visible buffers and grids that sections point to alive
+	size_t mKey = 0;
+	unique_ptr<SceneWriter> mWriter;
+	size_t mFrameIndex = 0; // of the command buffer that reads the scene back
+};
+
+SceneCache::~SceneCache() {
+	for (future<void>& f : mWrites)
+		f.wait();
+}
+
+void SceneCache::store(const filesystem::path& source, const size_t settingsKey, const vector<filesystem::path>& dependencies, const shared_ptr<Node>& node) {
+	if (!enabled()) return;
+	scoped_lock l(mMutex);
+	mQueued.emplace_back(make_shared<PendingStore>(PendingStore{
+		.mSource = source,
+		.mSettingsKey = settingsKey,
+		.mDependencies = dependencies,
+		.mNode = node }));
+}
+
+void SceneCache::update(CommandBuffer& commandBuffer) {
+	vector<shared_ptr<PendingStore>> queued;
+	{
+		scoped_lock l(mMutex);
+		queued.swap(mQueued);
+	}
+
+	for (const shared_ptr<PendingStore>& p : queued) {
+		try {
+			p->mKey = key(commandBuffer.mDevice, p->mSource, p->mSettingsKey);
+			p->mWriter = make_unique<SceneWriter>(commandBuffer);
+			p->mWriter->writeNodes(*p->mNode);
+			p->mFrameIndex = commandBuffer.mDevice.frameIndex();
+			mReading.emplace_back(p);
+		} catch (exception& e) {
+			cerr << "Warning: Failed to bake " << p->mSource << ": " << e.what() << endl;
+		}
+	}
+	if (!queued.empty())
+		commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {},
+			vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead), {}, {});
+
+	erase_if(mWrites, [](const future<void>& f) { return f.wait_for(0s) == future_status::ready; });
+
+	for (auto it = mReading.begin(); it != mReading.end();) {
+		if ((*it)->mFrameIndex > commandBuffer.mDevice.lastFrameDone()) {
+			it++;
+			continue;
+		}
+		mWrites.emplace_back(ThreadPool::global().enqueue([this, p = *it]() { write(*p); }));
+		it = mReading.erase(it);
+	}
+}
+
+void SceneCache::write(const PendingStore& p) {
+	try {
+		const SceneWriter& writer = *p.mWriter;
+
+		// the files the loader read come first, so that stale files are rejected before the scene is read
+		unordered_set<string> dependencyNames;
+		for (const filesystem::path& dependency : p.mDependencies) {
+			error_code ec;
+			const filesystem::path path = filesystem::weakly_canonical(dependency, ec);
+			dependencyNames.emplace((ec ? dependency : path).string());
+		}
+		TableWriter table;
+		table.write((uint32_t)dependencyNames.size());
+		for (const string& name : dependencyNames) {
+			// missing files are recorded too, since loaders may probe for them
+			const auto[size, time] = fileStamp(name);
+			table.writeString(name);
+			table.write(size);
+			table.write(time);
+		}
+		table.append(writer.table());
+
+		const CacheFileHeader header{ gCacheFileMagic, gCacheFileVersion, p.mKey, table.mData.size(), alignSection(sizeof(CacheFileHeader) + table.mData.size()) };
+
+		const filesystem::path path = filename(p.mSource);
+		filesystem::create_directories(path.parent_path());
+		// written to a temporary file first, so that other instances never read a partial file
+		const filesystem::path tmp = filesystem::path(path).concat(".tmp" + to_string(hash<thread::id>()(this_thread::get_id())));
+		{
+			ofstream file(tmp, ios::binary);
+			if (!file.is_open()) throw runtime_error("Could not open " + tmp.string());
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(table.mData.data()), table.mData.size());
+			uint64_t position = sizeof(header) + table.mData.size();
+			const array<char, gSectionAlignment> padding = {};
+			for (const auto&[offset, data] : writer.mSections) {
+				file.write(padding.data(), header.mDataOffset + offset - position);
+				file.write(reinterpret_cast<const char*>(data.data()), data.size());
+				position = header.mDataOffset + offset + data.size();
+			}
+			if (!file) throw runtime_error("Failed to write " + tmp.string());
+		}
+		filesystem::rename(tmp, path);
+
+		const size_t bytesWritten = header.mDataOffset + writer.mDataSize;
+		cout << "Baked " << p.mSource << " to " << path << " (" << bytesWritten / float(1 << 20) << " MiB)" << endl;
+		scoped_lock l(mMutex);
+		mStats.mWritten++;
+		mStats.mBytesWritten += bytesWritten;
+	} catch (exception& e) {
+		cerr << "Warning: Failed to bake " << p.mSource << ": " << e.what() << endl;
+	}
+}
+
+void SceneCache::drawGui() {
+	const Stats s = stats();
+	ImGui::Text("%s", mBake ? "Baking loaded scenes" : "Reading baked scenes");
+	ImGui::Text("%u hits, %u misses, %u written", s.mHits, s.mMisses, s.mWritten);
+	ImGui::Text("%.2f MiB read, %.2f MiB written", s.mBytesRead/float(1 << 20), s.mBytesWritten/float(1 << 20));
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <mutex>
+#include <future>
+
+#include <Core/CommandBuffer.hpp>
+
+#include "Node.hpp"
+
+namespace stm2 {
+
+// On-disk cache of loaded scenes. In bake mode, scenes loaded from their source files are read back from the device
+// and written to a single versioned file: the node hierarchy and its components, packed material data, vertex and
+// index buffers in their device layout, every mip level of every image, and NanoVDB grids. Later runs memory-map the
+// file and copy each section straight into staging memory, skipping parsing, decoding and mip generation.
+// Files are keyed by the source file's path, size and modification time, and by the settings that change what
+// loaders produce. The size and modification time of every other file the loader read are stored in the file, and
+// checked before it is used. Meshes keep their content and geometry hashes, so MeshCache and AccelerationStructureCache still
+// apply to cached scenes.
+class SceneCache {
+public:
+	struct Stats {
+		uint32_t mHits = 0;
+		uint32_t mMisses = 0;
+		uint32_t mWritten = 0;
+		size_t mBytesRead = 0;
+		size_t mBytesWritten = 0;
+	};
+
+	// Disabled if directory is empty
+	inline SceneCache(const filesystem::path& directory = {}) : mDirectory(directory) {}
+	~SceneCache();
+
+	inline void setDirectory(const filesystem::path& directory) { mDirectory = directory; }
+	inline const filesystem::path& directory() const { return mDirectory; }
+	inline bool enabled() const { return !mDirectory.empty(); }
+
+	// Whether scenes that miss the cache are written to it once loaded
+	inline void setBake(const bool bake) { mBake = bake; }
+	inline bool bake() const { return mBake; }
+
+	// Records a file other than the source that the loader running on this thread reads. Loaders that read files on
+	// other threads record them before handing them off.
+	static void addDependency(const filesystem::path& path);
+	// Returns the files recorded on this thread since the last call, and clears them
+	static vector<filesystem::path> takeDependencies();
+
+	// Records the upload of a cached scene, or returns nullptr on a miss. settingsKey is a hash of any loader settings
+	// that change the loaded scene. Thread safe.
+	shared_ptr<Node> load(CommandBuffer& commandBuffer, const filesystem::path& source, const size_t settingsKey);
+
+	// Queues a fully loaded scene to be written to the cache, along with the files the loader read. Thread safe.
+	void store(const filesystem::path& source, const size_t settingsKey, const vector<filesystem::path>& dependencies, const shared_ptr<Node>& node);
+
+	// Records the readback of every resource the queued scenes reference into commandBuffer, and starts writing the scenes
+	// whose readback has finished on the worker pool. Their images may be shared with scenes that are already being drawn,
+	// so this must be called by the thread that records the draws.
+	void update(CommandBuffer& commandBuffer);
+
+	inline Stats stats() {
+		scoped_lock l(mMutex);
+		return mStats;
+	}
+	void drawGui();
+
+private:
+	filesystem::path mDirectory;
+	bool mBake = false;
+	mutex mMutex;
+	Stats mStats;
+
+	struct PendingStore;
+	vector<shared_ptr<PendingStore>> mQueued;  // waiting for update(), guarded by mMutex
+	vector<shared_ptr<PendingStore>> mReading; // read back by a command buffer that may still be executing
+	vector<future<void>> mWrites;
+
+	filesystem::path filename(const filesystem::path& source) const;
+	size_t key(Device& device, const filesystem::path& source, const size_t settingsKey) const;
+	void write(const PendingStore& p);
+};
+
+}
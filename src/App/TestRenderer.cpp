@@ -3,9 +3,11 @@
 #include "Scene.hpp"
 #include "Denoiser.hpp"
 #include "Tonemapper.hpp"
+#include "Gui.hpp"
 
 #include <Core/Instance.hpp>
 #include <Core/Profiler.hpp>
+#include <Core/GpuStats.hpp>
 
 #include <imgui/imgui.h>
 #include <ImGuizmo.h>
@@ -33,6 +35,7 @@ TestRenderer::TestRenderer(Node& node) : mNode(node) {
 		{ "gReSTIR_DI_Reuse", false },
 		{ "gReSTIR_DI_Reuse_Visibility", false },
 		{ "gUseVC", false },
+		{ "gGpuStats", false },
 	};
 
 	mPushConstants["mMaxDepth"] = 5u;
@@ -49,7 +52,8 @@ TestRenderer::TestRenderer(Node& node) : mNode(node) {
 
 	Device& device = *mNode.findAncestor<Device>();
 
-	mHashGrid = GpuHashGrid(device, sizeof(float4)*8, 100000, 0.5f);
+	mHashGrid = GpuHashGrid(device, sizeof(float4)*7, 100000, 0.5f);
+	mPathSort = GpuRadixSort(device);
 
 	mStaticSampler = make_shared<vk::raii::Sampler>(*device, vk::SamplerCreateInfo({},
 		vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear,
@@ -82,6 +86,8 @@ void TestRenderer::createPipelines(Device& device) {
 	mPipelines.clear();
 	mPipelines.emplace("Render",                 ComputePipelineCache(shaderPath / "testrenderer.slang", "Render"             , "sm_6_6", args, md));
 	mPipelines.emplace("RenderIteration",        ComputePipelineCache(shaderPath / "testrenderer.slang", "RenderIteration"    , "sm_6_6", args, md));
+	mPipelines.emplace("WritePathDispatchArgs",      ComputePipelineCache(shaderPath / "testrenderer.slang", "WritePathDispatchArgs"     , "sm_6_6", args, md));
+	mPipelines.emplace("WriteShadowRayDispatchArgs", ComputePipelineCache(shaderPath / "testrenderer.slang", "WriteShadowRayDispatchArgs", "sm_6_6", args, md));
 	mPipelines.emplace("ProcessShadowRays",      ComputePipelineCache(shaderPath / "testrenderer.slang", "ProcessShadowRays"  , "sm_6_6", args, md));
 	mPipelines.emplace("ProcessAtomicOutput",    ComputePipelineCache(shaderPath / "testrenderer.slang", "ProcessAtomicOutput", "sm_6_6", args, md));
 }
@@ -90,6 +96,13 @@ void TestRenderer::drawGui() {
 	bool changed = false;
 
 	ImGui::PushID(this);
+
+	if (const shared_ptr<GpuStats> stats = mNode.findAncestor<GpuStats>(); stats && mDefines.at("gGpuStats")) {
+		const auto[rps,rpsUnit] = formatNumber(stats->rate(GpuStat::eRays));
+		const auto[sps,spsUnit] = formatNumber(stats->rate(GpuStat::eShadowRays));
+		ImGui::Text("%.1f%s rays/s, %.1f%s shadow rays/s", rps, rpsUnit, sps, spsUnit);
+	}
+
 	if (ImGui::Button("Clear resources")) {
 		Device& device = *mNode.findAncestor<Device>();
 		device->waitIdle();
@@ -141,6 +154,13 @@ void TestRenderer::drawGui() {
 			if (ImGui::DragScalarN("Length, light vertices", ImGuiDataType_U16, &mPushConstants["mDebugPathLengths"].get<uint32_t>(), 2, .2f)) changed = true;
 		}
 		if (ImGui::Checkbox("Random frame seed", &mRandomPerFrame)) changed = true;
+		if (mDefines.at("gMultiDispatch")) {
+			ImGui::Checkbox("Compact paths", &mCompactPaths);
+			if (mCompactPaths) {
+				ImGui::SetNextItemWidth(150);
+				Gui::enumDropdown<PathSortMode>("Sort paths", mPathSortMode, (uint32_t)PathSortMode::ePathSortModeCount);
+			}
+		}
 		ImGui::PushItemWidth(40);
 		uint32_t one = 1;
 		if (ImGui::DragScalar("Max depth", ImGuiDataType_U32, &mPushConstants["mMaxDepth"].get<uint32_t>(), .2f, &one)) changed = true;
@@ -297,7 +317,7 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 		if (it->first.buffer()->inFlight())
 			break;
 
-		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].instanceIndex();
+		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].mInstanceIndex;
 		if (shared_ptr<Inspector> inspector = mNode.root()->findDescendant<Inspector>()) {
 			if (selectedInstance == INVALID_INSTANCE || selectedInstance >= scene->frameData().mInstanceNodes.size())
 				inspector->select(nullptr);
@@ -336,7 +356,7 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 		.mUsage = vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc,
 	}, 0);
 	const Image::View visibilityImage = mResourcePool.getImage(commandBuffer.mDevice, "mVisibility", Image::Metadata{
-		.mFormat = vk::Format::eR32G32Uint,
+		.mFormat = vk::Format::eR32G32B32A32Uint,
 		.mExtent = extent,
 		.mUsage = vk::ImageUsageFlagBits::eStorage|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eTransferSrc,
 	});
@@ -350,7 +370,14 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 
 	Descriptors descriptors;
 
-	auto pathStates   = mResourcePool.getBuffer<float4x4>(commandBuffer.mDevice, "mPathStates", mDefines.at("gMultiDispatch") ? extent.width*extent.height : 1, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
+	// path state streams, 44 bytes per path. See LoadPathState in testrenderer.slang.
+	const uint32_t pathStateCount = mDefines.at("gMultiDispatch") ? extent.width*extent.height : 1;
+	const vector<Buffer::View<byte>> pathStates = {
+		mResourcePool.getBuffer<float4>  (commandBuffer.mDevice, "mPathRays"       , pathStateCount, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0),
+		mResourcePool.getBuffer<uint4>   (commandBuffer.mDevice, "mPathWeights"    , pathStateCount, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0),
+		mResourcePool.getBuffer<uint4>   (commandBuffer.mDevice, "mPathVertices"   , pathStateCount, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0),
+		mResourcePool.getBuffer<uint32_t>(commandBuffer.mDevice, "mPathRngCounters", pathStateCount, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0)
+	};
 	auto atomicOutput = mResourcePool.getBuffer<uint4>(commandBuffer.mDevice, "mOutputAtomic", (mDefines.at("gDeferShadowRays")||mDefines.at("gUseVC")||mLightTrace) ? extent.width*extent.height : 1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
 
 	descriptors[{ "gRenderParams.mOutput", 0 }]     = ImageDescriptor{ outputImage    , vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} };
@@ -358,7 +385,10 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 	descriptors[{ "gRenderParams.mPrevUVs", 0 }]    = ImageDescriptor{ prevUVsImage   , vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} };
 	descriptors[{ "gRenderParams.mVisibility", 0 }] = ImageDescriptor{ visibilityImage, vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} };
 	descriptors[{ "gRenderParams.mDepth", 0 }]      = ImageDescriptor{ depthImage     , vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {} };
-	descriptors[{ "gRenderParams.mPathStates", 0 }] = pathStates;
+	descriptors[{ "gRenderParams.mPathRays", 0 }]        = pathStates[0];
+	descriptors[{ "gRenderParams.mPathWeights", 0 }]     = pathStates[1];
+	descriptors[{ "gRenderParams.mPathVertices", 0 }]    = pathStates[2];
+	descriptors[{ "gRenderParams.mPathRngCounters", 0 }] = pathStates[3];
 	descriptors[{ "gRenderParams.mOutputAtomic", 0 }] = atomicOutput;
 
 	bool changed = false;
@@ -384,7 +414,7 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 
 		for (auto& [name, d] : sceneData.mDescriptors)
 			descriptors[{ "gScene." + name.first, name.second }] = d;
-		descriptors[{ "gScene.mRayCount", 0u }] = make_shared<Buffer>(commandBuffer.mDevice, "mRayCount", 2*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+		descriptors[{ "gScene.mGpuStats", 0u }] = mNode.findAncestor<GpuStats>()->counters(commandBuffer);
 
 		// track resources which are not held by the descriptorset
 		commandBuffer.trackResource(sceneData.mAccelerationStructureBuffer.buffer());
@@ -479,12 +509,30 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 		extent.width*extent.height*(mDefines.at("gUseVC") ? 2 : 1) + (mLightTrace || mDefines.at("gUseVC") ? mPushConstants["mLightSubpathCount"].get<uint32_t>() : 0))
 		: 0;
 
-	auto lightVertexBuffer = mResourcePool.getBuffer<array<float4,3>>(commandBuffer.mDevice, "mLightVertices", mDefines.at("gUseVC") ? max(1u, mPushConstants["mLightSubpathCount"].get<uint32_t>()*(mPushConstants["mMaxDepth"].get<uint32_t>()-1)) : 1, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
+	auto lightVertexBuffer = mResourcePool.getBuffer<array<float4,2>>(commandBuffer.mDevice, "mLightVertices", mDefines.at("gUseVC") ? max(1u, mPushConstants["mLightSubpathCount"].get<uint32_t>()*(mPushConstants["mMaxDepth"].get<uint32_t>()-1)) : 1, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
 	auto counterBuffer = mResourcePool.getBuffer<uint32_t>(commandBuffer.mDevice, "mCounters", 2, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
 	descriptors[{ "gRenderParams.mLightVertices", 0 }] = lightVertexBuffer;
 	descriptors[{ "gRenderParams.mCounters", 0 }] = counterBuffer;
 	descriptors[{ "gRenderParams.mShadowRays", 0 }] = mResourcePool.getBuffer<array<float4,4>>(commandBuffer.mDevice, "mShadowRays", max(1u, maxShadowRays), vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
 
+	const bool compactPaths = mDefines.at("gMultiDispatch") && mCompactPaths;
+	const bool sortPaths    = compactPaths && mPathSortMode != PathSortMode::eNone;
+	const uint32_t maxPaths = max(extent.width*extent.height, (mDefines.at("gUseVC") || mLightTrace) ? mPushConstants["mLightSubpathCount"].get<uint32_t>() : 0);
+	// queues are bound separately when sorted, so the stride is padded to the largest storage buffer offset alignment
+	const uint32_t pathQueueStride = (maxPaths + 63) & ~63u;
+	auto pathQueues   = mResourcePool.getBuffer<uint32_t>(commandBuffer.mDevice, "mPathQueues", compactPaths ? 2*pathQueueStride : 1, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
+	auto pathSortKeys = mResourcePool.getBuffer<uint2>(commandBuffer.mDevice, "mPathSortKeys", sortPaths ? maxPaths : 1, vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
+	// bounces of compacted paths are predicated on whether any paths remain
+	const bool conditionalBounces = compactPaths && commandBuffer.mDevice.conditionalRenderingFeatures().conditionalRendering;
+	auto dispatchArgs = mResourcePool.getBuffer<uint32_t>(commandBuffer.mDevice, "mDispatchArgs", 12,
+		vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eIndirectBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst|(conditionalBounces ? vk::BufferUsageFlagBits::eConditionalRenderingEXT : vk::BufferUsageFlags{}),
+		vk::MemoryPropertyFlagBits::eDeviceLocal, 0);
+	descriptors[{ "gRenderParams.mPathQueues", 0 }] = pathQueues;
+	descriptors[{ "gRenderParams.mPathSortKeys", 0 }] = pathSortKeys;
+	descriptors[{ "gRenderParams.mDispatchArgs", 0 }] = dispatchArgs;
+	mPushConstants["mPathQueue"] = 0u;
+	mPushConstants["mPathQueueStride"] = pathQueueStride;
+
 	mHashGrid.mSize = mDefines.at("gReSTIR_DI_Reuse") ? max(1u, extent.width*extent.height*min(2u,mPushConstants["mMaxDepth"].get<uint32_t>()-1)) : 1;
 	const auto hashGrid = mHashGrid.init(commandBuffer, descriptors, "mHashGrid", GpuHashGrid::Metadata{
 			.mCameraPosition = viewTransformsBufferData[0].transformPoint(float3::Zero()),
@@ -509,6 +557,14 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 	if (hasHeterogeneousMedia)
 		defines.emplace("gHasHeterogeneousMedia", "true");
 
+	// only Render and RenderIteration depend on path compaction
+	Defines compactDefines;
+	if (compactPaths) {
+		compactDefines["gCompactPaths"] = "true";
+		if (sortPaths)
+			compactDefines["gPathSortKey"] = to_string((uint32_t)mPathSortMode);
+	}
+
 
 	// create pipelines
 
@@ -522,10 +578,12 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 	};
 
 	shared_ptr<ComputePipeline> renderPipeline, renderIterationPipeline, renderLightPipeline, renderLightIterationPipeline, processShadowRaysPipeline, processAtomicOutputPipeline;
+	shared_ptr<ComputePipeline> pathDispatchArgsPipeline, shadowRayDispatchArgsPipeline;
 	{
 		{
 			Defines tmp = defines;
 			if (mDefines.at("gMultiDispatch")) {
+				tmp.insert(compactDefines.begin(), compactDefines.end());
 				renderIterationPipeline = loadPipeline("RenderIteration", tmp);
 				tmp["gMultiDispatchFirst"] = "true";
 			}
@@ -535,13 +593,18 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 			Defines tmp = defines;
 			tmp["gTraceFromLight"] = "true";
 			if (mDefines.at("gMultiDispatch")) {
+				tmp.insert(compactDefines.begin(), compactDefines.end());
 				renderLightIterationPipeline = loadPipeline("RenderIteration", tmp);
 				tmp["gMultiDispatchFirst"] = "true";
 			}
 			renderLightPipeline = loadPipeline("Render", tmp);
 		}
-		if (mDefines.at("gDeferShadowRays"))
-			processShadowRaysPipeline = loadPipeline("ProcessShadowRays", defines);
+		if (compactPaths)
+			pathDispatchArgsPipeline = loadPipeline("WritePathDispatchArgs", defines);
+		if (mDefines.at("gDeferShadowRays")) {
+			processShadowRaysPipeline     = loadPipeline("ProcessShadowRays", defines);
+			shadowRayDispatchArgsPipeline = loadPipeline("WriteShadowRayDispatchArgs", defines);
+		}
 		if (mDefines.at("gDeferShadowRays") || mDefines.at("gUseVC") || mLightTrace)
 			processAtomicOutputPipeline = loadPipeline("ProcessAtomicOutput", Defines{ { "gClearImage", to_string(mLightTrace) }});
 	}
@@ -554,6 +617,66 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 	// create descriptor sets
 	const shared_ptr<DescriptorSets> descriptorSets = mResourcePool.getDescriptorSets(*renderPipeline, "DescriptorSets", descriptors);
 
+	// traces the remaining bounces of paths started by Render, one dispatch per bounce.
+	// with path compaction, each bounce is dispatched indirectly over the paths Render or the previous bounce
+	// queued. With conditional rendering, the sort and dispatch of a bounce are skipped on the device once
+	// WritePathDispatchArgs finds the queue empty, so only its barriers and one single-thread dispatch remain.
+	auto renderIterations = [&](const shared_ptr<ComputePipeline>& iterationPipeline, const vk::Extent3D& dispatchExtent, const uint32_t pathCount) {
+		for (uint32_t i = 1; i < mPushConstants["mMaxDepth"].get<uint32_t>(); i++) {
+			Buffer::barriers(commandBuffer, pathStates,
+				vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+				vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+
+			if (!compactPaths) {
+				iterationPipeline->dispatchTiled(commandBuffer, dispatchExtent, descriptorSets, {}, mPushConstants);
+				continue;
+			}
+
+			const uint32_t queue = (i - 1) % 2;
+			mPushConstants["mPathQueue"] = queue;
+
+			const Buffer::View<uint32_t> queueSize(dispatchArgs.buffer(), dispatchArgs.offset() + queue*4*sizeof(uint32_t), 1);
+
+			// writes this queue's dispatch args and the predicate, and empties the next queue, which the previous bounce read
+			Buffer::barriers(commandBuffer, { pathQueues, pathSortKeys, dispatchArgs },
+				vk::PipelineStageFlagBits::eComputeShader|vk::PipelineStageFlagBits::eDrawIndirect|(conditionalBounces ? vk::PipelineStageFlagBits::eConditionalRenderingEXT : vk::PipelineStageFlags{}), vk::PipelineStageFlagBits::eComputeShader,
+				vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite|vk::AccessFlagBits::eIndirectCommandRead|(conditionalBounces ? vk::AccessFlagBits::eConditionalRenderingReadEXT : vk::AccessFlags{}), vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+			pathDispatchArgsPipeline->dispatch(commandBuffer, vk::Extent3D{1, 1, 1}, descriptorSets, {}, mPushConstants);
+			dispatchArgs.barrier(commandBuffer,
+				vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect|vk::PipelineStageFlagBits::eComputeShader|(conditionalBounces ? vk::PipelineStageFlagBits::eConditionalRenderingEXT : vk::PipelineStageFlags{}),
+				vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead|vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite|(conditionalBounces ? vk::AccessFlagBits::eConditionalRenderingReadEXT : vk::AccessFlags{}));
+
+			if (conditionalBounces)
+				commandBuffer->beginConditionalRenderingEXT(vk::ConditionalRenderingBeginInfoEXT(**dispatchArgs.buffer(), dispatchArgs.absoluteOffset() + 8*sizeof(uint32_t)));
+
+			if (sortPaths) {
+				ProfilerScope ps("Sort paths", &commandBuffer);
+				mPathSort.sort(commandBuffer,
+					pathSortKeys,
+					Buffer::View<uint32_t>(pathQueues.buffer(), pathQueues.offset() + queue*pathQueueStride*sizeof(uint32_t), pathCount),
+					pathCount,
+					mPathSortMode == PathSortMode::eLastMaterial ? 64 : 30,
+					queueSize);
+			}
+
+			iterationPipeline->dispatchIndirect(commandBuffer, Buffer::View<vk::DispatchIndirectCommand>(dispatchArgs.buffer(), queueSize.offset() + sizeof(uint32_t), 1), descriptorSets, {}, mPushConstants);
+
+			if (conditionalBounces)
+				commandBuffer->endConditionalRenderingEXT();
+		}
+	};
+
+	// clears the path queue written by Render
+	auto clearPathQueues = [&]() {
+		dispatchArgs.barrier(commandBuffer,
+			vk::PipelineStageFlagBits::eComputeShader|vk::PipelineStageFlagBits::eDrawIndirect, vk::PipelineStageFlagBits::eTransfer,
+			vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eIndirectCommandRead, vk::AccessFlagBits::eTransferWrite);
+		dispatchArgs.fill(commandBuffer, 0);
+		dispatchArgs.barrier(commandBuffer,
+			vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+			vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+	};
+
 	// render
 	{
 		if (mDefines.at("gDeferShadowRays") || mDefines.at("gUseVC")) {
@@ -573,15 +696,11 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 				vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 
 			const vk::Extent3D lightExtent = { extent.width, (mPushConstants["mLightSubpathCount"].get<uint32_t>() + extent.width-1)/extent.width, 1 };
+			if (compactPaths)
+				clearPathQueues();
 			renderLightPipeline->dispatchTiled(commandBuffer, lightExtent, descriptorSets, {}, mPushConstants);
-			if (mDefines.at("gMultiDispatch")) {
-				for (uint32_t i = 1; i < mPushConstants["mMaxDepth"].get<uint32_t>(); i++) {
-					pathStates.barrier(commandBuffer,
-						vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
-						vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
-					renderLightIterationPipeline->dispatchTiled(commandBuffer, lightExtent, descriptorSets, {}, mPushConstants);
-				}
-			}
+			if (mDefines.at("gMultiDispatch"))
+				renderIterations(renderLightIterationPipeline, lightExtent, mPushConstants["mLightSubpathCount"].get<uint32_t>());
 
 			lightVertexBuffer.barrier(commandBuffer,
 				vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
@@ -602,7 +721,7 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 							VK_QUEUE_FAMILY_IGNORED,
 							VK_QUEUE_FAMILY_IGNORED,
 							**get<BufferDescriptor>(buf).buffer(),
-							get<BufferDescriptor>(buf).offset(),
+							get<BufferDescriptor>(buf).absoluteOffset(),
 							get<BufferDescriptor>(buf).size() });
 					commandBuffer->waitEvents(**mPrevHashGridEvent, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, barriers, {});
 					commandBuffer.trackVulkanResource(mPrevHashGridEvent);
@@ -610,15 +729,11 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 				mHashGrid.clear(commandBuffer, hashGrid);
 			}
 
+			if (compactPaths)
+				clearPathQueues();
 			renderPipeline->dispatchTiled(commandBuffer, extent, descriptorSets, {}, mPushConstants);
-			if (mDefines.at("gMultiDispatch")) {
-				for (uint32_t i = 1; i < mPushConstants["mMaxDepth"].get<uint32_t>(); i++) {
-					pathStates.barrier(commandBuffer,
-						vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
-						vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
-					renderIterationPipeline->dispatchTiled(commandBuffer, extent, descriptorSets, {}, mPushConstants);
-				}
-			}
+			if (mDefines.at("gMultiDispatch"))
+				renderIterations(renderIterationPipeline, extent, extent.width*extent.height);
 
 			if (mDefines.at("gReSTIR_DI_Reuse")) {
 				mHashGrid.build(commandBuffer, hashGrid);
@@ -637,7 +752,15 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 					vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
 					vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 			}
-			processShadowRaysPipeline->dispatchTiled(commandBuffer, vk::Extent3D{extent.width, (maxShadowRays + extent.width-1) / extent.width, 1}, descriptorSets, {}, mPushConstants);
+			// dispatched over the shadow rays that were queued, rather than maxShadowRays
+			Buffer::barriers(commandBuffer, { counterBuffer, dispatchArgs },
+				vk::PipelineStageFlagBits::eComputeShader|vk::PipelineStageFlagBits::eDrawIndirect, vk::PipelineStageFlagBits::eComputeShader,
+				vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite|vk::AccessFlagBits::eIndirectCommandRead, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+			shadowRayDispatchArgsPipeline->dispatch(commandBuffer, vk::Extent3D{1, 1, 1}, descriptorSets, {}, mPushConstants);
+			dispatchArgs.barrier(commandBuffer,
+				vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect,
+				vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead);
+			processShadowRaysPipeline->dispatchIndirect(commandBuffer, Buffer::View<vk::DispatchIndirectCommand>(dispatchArgs.buffer(), dispatchArgs.offset() + 9*sizeof(uint32_t), 1), descriptorSets, {}, mPushConstants);
 		}
 
 		if (mDefines.at("gDeferShadowRays") || mDefines.at("gUseVC") || mLightTrace) {
@@ -687,7 +810,7 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 		const ImVec2 c = ImGui::GetIO().MousePos;
 		for (const ViewData& view : viewsBufferData)
 			if (view.isInside(int2(c.x, c.y))) {
-				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(uint2), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(VisibilityData), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 				visibilityImage.barrier(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
 				selectionBuffer.copyFromImage(commandBuffer, visibilityImage.image(), visibilityImage.subresourceLayer(), vk::Offset3D{int(c.x), int(c.y), 0}, vk::Extent3D{1,1,1});
 				mSelectionData.push_back(make_pair(selectionBuffer, ImGui::GetIO().KeyShift));
@@ -750,6 +873,7 @@ void TestRenderer::render(CommandBuffer& commandBuffer, const Image::View& rende
 
 			commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, ***lightPathPipeline);
 			descriptorSets->bind(commandBuffer);
+			mRasterPushConstants["mSceneSphere"] = mPushConstants["mSceneSphere"];
 			lightPathPipeline->pushConstants(commandBuffer, mRasterPushConstants);
 			const uint32_t vertexCount = mPushConstants["mLightSubpathCount"].get<uint32_t>()*mPushConstants["mMaxDepth"].get<uint32_t>();
 			commandBuffer->draw(uint32_t(mRasterPushConstants["mVertexPercent"].get<float>() * vertexCount)*6, 1, 0, 0);
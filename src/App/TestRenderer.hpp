@@ -3,10 +3,20 @@
 #include "GpuHashGrid.hpp"
 #include "Node.hpp"
 
+#include <Core/GpuRadixSort.hpp>
+
 #include <Shaders/compat/transform.h>
 
 namespace stm2 {
 
+// Order of active paths between wavefront bounces
+enum class PathSortMode {
+	eNone,
+	eRayCoherence, // ray direction octant, then origin Morton code
+	eLastMaterial, // material of the vertex the ray leaves, then ray coherence. the next hit is only known once RenderIteration traces it
+	ePathSortModeCount
+};
+
 class TestRenderer {
 public:
 	Node& mNode;
@@ -35,6 +45,9 @@ private:
 
 	GpuHashGrid mHashGrid;
 
+	bool mCompactPaths = true;
+	PathSortMode mPathSortMode = PathSortMode::eNone;
+	GpuRadixSort mPathSort;
 
 	bool mRandomPerFrame = true;
 
@@ -50,4 +63,15 @@ private:
 	vector<TransformData> mPrevViewTransforms;
 };
 
-};
\ No newline at end of file
+};
+
+namespace std {
+inline string to_string(const stm2::PathSortMode& m) {
+	switch (m) {
+		default: return "Unknown";
+		case stm2::PathSortMode::eNone: return "None";
+		case stm2::PathSortMode::eRayCoherence: return "Ray coherence";
+		case stm2::PathSortMode::eLastMaterial: return "Last material";
+	}
+}
+}
\ No newline at end of file
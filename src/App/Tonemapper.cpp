@@ -22,12 +22,21 @@ void Tonemapper::createPipelines(Device& device) {
 	if (mPushConstants.empty()) {
 		mPushConstants["mExposure"] = 0.f;
 
+		mPushConstants["mMinLogLuminance"] = -10.f;
+		mPushConstants["mLogLuminanceRange"] = 22.f;
+		mPushConstants["mLowPercentile"] = 0.5f;
+		mPushConstants["mHighPercentile"] = 0.95f;
+		mPushConstants["mMinExposure"] = -10.f;
+		mPushConstants["mMaxExposure"] = 10.f;
+
 		if (auto arg = device.mInstance.findArgument("exposure"); arg) mPushConstants["mExposure"] = atof(arg->c_str());
+		if (device.mInstance.findArgument("autoExposure")) mAutoExposure = true;
 	}
 
 	const filesystem::path shaderPath = *device.mInstance.findArgument("shaderKernelPath");
 	mPipeline          = ComputePipelineCache(shaderPath / "tonemap.slang");
 	mMaxReducePipeline = ComputePipelineCache(shaderPath / "tonemap.slang", "maxReduce");
+	mExposurePipeline  = ComputePipelineCache(shaderPath / "tonemap.slang", "computeExposure");
 }
 
 void Tonemapper::drawGui() {
@@ -44,46 +53,96 @@ void Tonemapper::drawGui() {
 	ImGui::DragFloat("Exposure", &mPushConstants["mExposure"].get<float>(), .1f, -10, 10);
 	ImGui::PopItemWidth();
 	ImGui::Checkbox("Gamma correct", &mGammaCorrect);
+
+	ImGui::Checkbox("Auto exposure", &mAutoExposure);
+	if (mAutoExposure) {
+		ImGui::Indent();
+		ImGui::PushItemWidth(80);
+		ImGui::DragFloatRange2("Percentiles", &mPushConstants["mLowPercentile"].get<float>(), &mPushConstants["mHighPercentile"].get<float>(), .01f, 0, 1);
+		ImGui::DragFloatRange2("Exposure range", &mPushConstants["mMinExposure"].get<float>(), &mPushConstants["mMaxExposure"].get<float>(), .1f, -20, 20);
+		ImGui::DragFloat("Min log luminance", &mPushConstants["mMinLogLuminance"].get<float>(), .1f, -20, 0);
+		ImGui::DragFloat("Log luminance range", &mPushConstants["mLogLuminanceRange"].get<float>(), .1f, 1, 40);
+		ImGui::DragFloat("Adaptation speed", &mAdaptationSpeed, .1f, 0, 10);
+		ImGui::PopItemWidth();
+		ImGui::Unindent();
+	}
 }
 
 void Tonemapper::render(CommandBuffer& commandBuffer, const Image::View& input, const Image::View& output, const Image::View& albedo) {
 	ProfilerScope ps("Tonemapper::render", &commandBuffer);
 
-	Buffer::View maxBuf = make_shared<Buffer>(commandBuffer.mDevice, "Tonemap max", sizeof(uint4), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+	Device& device = commandBuffer.mDevice;
+	if (!mMaxBuffer) {
+		mMaxBuffer       = make_shared<Buffer>(device, "Tonemap max", sizeof(uint4), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+		mHistogramBuffer = make_shared<Buffer>(device, "Tonemap histogram", 256*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+		mExposureBuffer  = make_shared<Buffer>(device, "Tonemap exposure", 2*sizeof(float), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+		// computeExposure clears the histogram after reading it
+		commandBuffer->fillBuffer(**mHistogramBuffer.buffer(), mHistogramBuffer.absoluteOffset(), mHistogramBuffer.sizeBytes(), 0);
+		commandBuffer->fillBuffer(**mExposureBuffer.buffer(), mExposureBuffer.absoluteOffset(), mExposureBuffer.sizeBytes(), 0);
+		mHistogramBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+		mExposureBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+	}
+
+	const auto t = chrono::high_resolution_clock::now();
+	const float deltaTime = mLastRender == chrono::high_resolution_clock::time_point() ? 0 : chrono::duration_cast<chrono::duration<float>>(t - mLastRender).count();
+	mLastRender = t;
+	mPushConstants["mAdaptation"] = 1 - exp(-deltaTime * mAdaptationSpeed);
 
 	Defines defines;
 	defines.emplace("gMode", to_string((uint32_t)mMode));
 	if (albedo)        defines.emplace("gModulateAlbedo", "true");
 	if (mGammaCorrect) defines.emplace("gGammaCorrection", "true");
+	if (mAutoExposure) defines.emplace("gAutoExposure", "true");
 
 	const vk::Extent3D extent = input.extent();
 
-	// get maximum value in image
-	{
+	// get maximum value and luminance histogram of the image
+	if (mAutoExposure || gTonemapModeNeedsMax.contains(mMode)) {
 		ProfilerScope ps("Tonemap reduce", &commandBuffer);
 
-		commandBuffer->fillBuffer(**maxBuf.buffer(), maxBuf.offset(), maxBuf.sizeBytes(), 0);
-		maxBuf.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+		// the previous frame's tonemap may still be reading the maximum
+		mMaxBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eTransferWrite);
+		commandBuffer->fillBuffer(**mMaxBuffer.buffer(), mMaxBuffer.absoluteOffset(), mMaxBuffer.sizeBytes(), 0);
+		mMaxBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 
 		Descriptors descriptors{
 			{ {"gInput", 0} , ImageDescriptor{ input, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, {}} },
-			{ {"gMax", 0}, maxBuf }
+			{ {"gMax", 0}, mMaxBuffer }
 		};
+		if (mAutoExposure)
+			descriptors[{ "gHistogram", 0 }] = mHistogramBuffer;
 		if (albedo)
 			descriptors[{ "gAlbedo", 0 }] = ImageDescriptor{ albedo.image(), vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, {} };
 
-		mMaxReducePipeline.get(commandBuffer.mDevice, defines)->dispatchTiled(commandBuffer, extent, descriptors, {}, {});
+		mMaxReducePipeline.get(device, defines)->dispatchTiled(commandBuffer, extent, descriptors, {}, mPushConstants);
+
+		mMaxBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite,  vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+		if (mAutoExposure)
+			mHistogramBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite,  vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
 	}
 
-	maxBuf.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite,  vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+	// adapt the exposure on the device, so the tonemap never waits on a readback
+	if (mAutoExposure) {
+		ProfilerScope ps("Tonemap exposure", &commandBuffer);
+		Descriptors descriptors{
+			{ {"gHistogram", 0}, mHistogramBuffer },
+			{ {"gExposure", 0}, mExposureBuffer }
+		};
+		mExposurePipeline.get(device, defines)->dispatch(commandBuffer, vk::Extent3D(1, 1, 1), descriptors, {}, mPushConstants);
+
+		mHistogramBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite,  vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+		mExposureBuffer.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite,  vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+	}
 
 	// tonemap
 	{
 		ProfilerScope ps("Tonemap", &commandBuffer);
 		Descriptors descriptors{
 			{ { "gOutput", 0 }, ImageDescriptor{ output, vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, {} } },
-			{ { "gMax", 0 }, maxBuf },
+			{ { "gMax", 0 }, mMaxBuffer },
 		};
+		if (mAutoExposure)
+			descriptors[{ "gExposure", 0 }] = mExposureBuffer;
 		if (albedo)
 			descriptors[{ "gAlbedo", 0 }] = ImageDescriptor{ albedo.image(), vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, {} };
 		if (input != output) {
@@ -92,7 +151,7 @@ void Tonemapper::render(CommandBuffer& commandBuffer, const Image::View& input,
 		} else
 			defines.emplace("gSingleBuffer", "1");
 		output.barrier(commandBuffer, vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
-		mPipeline.get(commandBuffer.mDevice, defines)->dispatchTiled(commandBuffer, extent, descriptors, {}, mPushConstants);
+		mPipeline.get(device, defines)->dispatchTiled(commandBuffer, extent, descriptors, {}, mPushConstants);
 	}
 }
 
@@ -2,6 +2,7 @@
 
 #include "Node.hpp"
 #include <Core/Pipeline.hpp>
+#include <chrono>
 #include <Shaders/compat/tonemap.h>
 
 namespace stm2 {
@@ -20,11 +21,21 @@ public:
 private:
 	ComputePipelineCache mPipeline;
 	ComputePipelineCache mMaxReducePipeline;
+	ComputePipelineCache mExposurePipeline;
 
 	PushConstants mPushConstants;
 
 	bool mGammaCorrect = true;
 	TonemapMode mMode = TonemapMode::eRaw;
+
+	bool mAutoExposure = false;
+	float mAdaptationSpeed = 2.f;
+	chrono::high_resolution_clock::time_point mLastRender;
+
+	// kept across frames, so that the exposure never leaves the device
+	Buffer::View<uint32_t> mMaxBuffer;
+	Buffer::View<uint32_t> mHistogramBuffer;
+	Buffer::View<float> mExposureBuffer;
 };
 
 }
\ No newline at end of file
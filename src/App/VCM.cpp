@@ -10,6 +10,7 @@
 
 #include <Core/Instance.hpp>
 #include <Core/Swapchain.hpp>
+#include <Core/GpuStats.hpp>
 #include <Core/CommandBuffer.hpp>
 #include <Core/Profiler.hpp>
 
@@ -64,10 +65,9 @@ void VCM::createPipelines(Device& device) {
 		"-capability", "GL_EXT_ray_tracing"
 	};
 	const filesystem::path kernelPath = shaderPath / "vcm.slang";
-	mRenderPipelines[RenderPipelineIndex::eGenerateLightPaths]     = ComputePipelineCache(kernelPath, "GenerateLightPaths"    , "sm_6_6", args, md);
-	mRenderPipelines[RenderPipelineIndex::eGenerateCameraPaths]    = ComputePipelineCache(kernelPath, "GenerateCameraPaths"   , "sm_6_6", args, md);
-	mRenderPipelines[RenderPipelineIndex::eHashGridComputeIndices] = ComputePipelineCache(shaderPath / "hashgrid.slang", "ComputeIndices", "sm_6_6", { "-O3", "-matrix-layout-row-major", "-capability", "spirv_1_5" });
-	mRenderPipelines[RenderPipelineIndex::eHashGridSwizzle]        = ComputePipelineCache(shaderPath / "hashgrid.slang", "Swizzle"       , "sm_6_6", { "-O3", "-matrix-layout-row-major", "-capability", "spirv_1_5" });
+	mRenderPipelines[RenderPipelineIndex::eGenerateLightPaths]  = ComputePipelineCache(kernelPath, "GenerateLightPaths"    , "sm_6_6", args, md);
+	mRenderPipelines[RenderPipelineIndex::eGenerateCameraPaths] = ComputePipelineCache(kernelPath, "GenerateCameraPaths"   , "sm_6_6", args, md);
+	mRenderPipelines[RenderPipelineIndex::eSortLightVertices]   = ComputePipelineCache(kernelPath, "SortLightVertices"     , "sm_6_6", args, md);
 
 	auto swapchain = mNode.root()->findDescendant<Swapchain>();
 	createRasterPipeline(device, swapchain->extent(), swapchain->format().format);
@@ -177,6 +177,12 @@ void VCM::drawGui() {
 		if (mAlgorithm == VcmAlgorithmType::kBpt)
 			if (ImGui::Checkbox("Light vertex cache", &mUseLightVertexCache)) changed = true;
 
+		if (mAlgorithm != VcmAlgorithmType::kPathTrace) {
+			const bool useVM = mAlgorithm == VcmAlgorithmType::kPpm || mAlgorithm == VcmAlgorithmType::kBpm || mAlgorithm == VcmAlgorithmType::kVcm;
+			const size_t lightVertexCount = size_t(mPushConstants.mLightSubPathCount)*mPushConstants.mMaxPathLength;
+			ImGui::Text("Light vertices: %.2f MiB (%u bytes each)", lightVertexCount*sizeof(PackedVcmVertex)*(useVM ? 2 : 1) / float(1 << 20), (uint32_t)sizeof(PackedVcmVertex));
+		}
+
 		// reservoirs
 		if (mAlgorithm != VcmAlgorithmType::kLightTrace) {
 			if (ImGui::CheckboxFlags("DI reservoir resampling", reinterpret_cast<uint32_t*>(&mDIReservoirFlags), (uint32_t)VcmReservoirFlags::eRIS)) changed = true;
@@ -297,7 +303,7 @@ void VCM::render(CommandBuffer& commandBuffer, const Image::View& renderTarget)
 		if (it->first.buffer()->inFlight())
 			break;
 
-		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].instanceIndex();
+		const uint32_t selectedInstance = it->first.cast<VisibilityData>()[0].mInstanceIndex;
 		if (shared_ptr<Inspector> inspector = mNode.root()->findDescendant<Inspector>()) {
 			if (selectedInstance == INVALID_INSTANCE || selectedInstance >= scene->frameData().mInstanceNodes.size())
 				inspector->select(nullptr);
@@ -479,12 +485,13 @@ void VCM::render(CommandBuffer& commandBuffer, const Image::View& renderTarget)
 		descriptors[{"gRenderParams.mOutput",0}]     = ImageDescriptor{mResourcePool.getImage(commandBuffer.mDevice, "mOutput",     Image::Metadata{ .mFormat = vk::Format::eR32G32B32A32Sfloat, .mExtent = extent, .mUsage = usage }), vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {}};
 		descriptors[{"gRenderParams.mAlbedo",0}]     = ImageDescriptor{mResourcePool.getImage(commandBuffer.mDevice, "mAlbedo",     Image::Metadata{ .mFormat = vk::Format::eR16G16B16A16Sfloat, .mExtent = extent, .mUsage = usage }), vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {}};
 		descriptors[{"gRenderParams.mPrevUVs",0}]    = ImageDescriptor{mResourcePool.getImage(commandBuffer.mDevice, "mPrevUVs",    Image::Metadata{ .mFormat = vk::Format::eR32G32Sfloat,       .mExtent = extent, .mUsage = usage }), vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {}};
-		descriptors[{"gRenderParams.mVisibility",0}] = ImageDescriptor{mResourcePool.getImage(commandBuffer.mDevice, "mVisibility", Image::Metadata{ .mFormat = vk::Format::eR32G32Uint,         .mExtent = extent, .mUsage = usage }), vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {}};
+		descriptors[{"gRenderParams.mVisibility",0}] = ImageDescriptor{mResourcePool.getImage(commandBuffer.mDevice, "mVisibility", Image::Metadata{ .mFormat = vk::Format::eR32G32B32A32Uint,   .mExtent = extent, .mUsage = usage }), vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {}};
 		descriptors[{"gRenderParams.mDepth",0}]      = ImageDescriptor{mResourcePool.getImage(commandBuffer.mDevice, "mDepth" ,     Image::Metadata{ .mFormat = vk::Format::eR32G32B32A32Sfloat, .mExtent = extent, .mUsage = usage }), vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderWrite, {}};
 
 		descriptors[{"gRenderParams.mLightImage",0}]       = mResourcePool.getBuffer<uint4>          (commandBuffer.mDevice, "mLightImage", mPushConstants.mScreenPixelCount*sizeof(uint4), vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eStorageBuffer);
 		descriptors[{"gRenderParams.mLightVertices",0}]    = mResourcePool.getBuffer<PackedVcmVertex>(commandBuffer.mDevice, "mLightVertices", maxLightVertices);
 		descriptors[{"gRenderParams.mLightPathLengths",0}] = mResourcePool.getBuffer<uint32_t>       (commandBuffer.mDevice, "mLightPathLengths", mPushConstants.mLightSubPathCount, vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eStorageBuffer);
+		descriptors[{"gRenderParams.mSortedLightVertices",0}] = mResourcePool.getBuffer<PackedVcmVertex>(commandBuffer.mDevice, "mSortedLightVertices", useVM ? maxLightVertices : 1);
 
 		mLightHashGrid.mSize = maxLightVertices;
 		mDIHashGrid.mSize    = maxCameraVertices;
@@ -509,7 +516,7 @@ void VCM::render(CommandBuffer& commandBuffer, const Image::View& renderTarget)
 
 		for (auto& [name, d] : sceneData.mDescriptors)
 			descriptors[{ "gScene." + name.first, name.second }] = d;
-		descriptors[{ "gScene.mRayCount", 0u }] = make_shared<Buffer>(commandBuffer.mDevice, "mRayCount", 2*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+		descriptors[{ "gScene.mGpuStats", 0u }] = mNode.findAncestor<GpuStats>()->counters(commandBuffer);
 
 		// track resources which are not held by the descriptorset
 		commandBuffer.trackResource(sceneData.mAccelerationStructureBuffer.buffer());
@@ -527,10 +534,12 @@ void VCM::render(CommandBuffer& commandBuffer, const Image::View& renderTarget)
 		return p;
 	};
 
-	shared_ptr<ComputePipeline> generateLightPathsPipeline, generateCameraPathsPipeline;
+	shared_ptr<ComputePipeline> generateLightPathsPipeline, generateCameraPathsPipeline, sortLightVerticesPipeline;
 
 	if (mAlgorithm != VcmAlgorithmType::kPathTrace)
 		generateLightPathsPipeline = loadPipeline(eGenerateLightPaths, defines);
+	if (useVM)
+		sortLightVerticesPipeline = loadPipeline(eSortLightVertices, defines);
 	generateCameraPathsPipeline = loadPipeline(eGenerateCameraPaths, defines);
 
 	if (loading) {
@@ -582,9 +591,16 @@ void VCM::render(CommandBuffer& commandBuffer, const Image::View& renderTarget)
 				vk::DependencyFlagBits::eByRegion,
 				vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead), {}, {});
 
-			// Build hash grid over light vertices
-			if (useVM)
+			// Build hash grid over light vertices, then store the vertices in cell order
+			if (useVM) {
 				mLightHashGrid.build(commandBuffer, lightHashGrid);
+
+				const Buffer::View<byte>& otherCounters = get<BufferDescriptor>(lightHashGrid.at({"gHashGrid.mOtherCounters",0}));
+				sortLightVerticesPipeline->dispatchIndirect(commandBuffer, Buffer::View<vk::DispatchIndirectCommand>(otherCounters.buffer(), otherCounters.offset() + sizeof(uint32_t), 1), descriptorSets, {}, { { "", PushConstantValue(mPushConstants) } });
+				get<BufferDescriptor>(descriptors.at({"gRenderParams.mSortedLightVertices",0})).barrier(commandBuffer,
+					vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+					vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+			}
 		}
 
 		// generate camera paths
@@ -647,7 +663,7 @@ void VCM::render(CommandBuffer& commandBuffer, const Image::View& renderTarget)
 		for (const ViewData& view : views)
 			if (view.isInside(int2(c.x, c.y))) {
 				const Image::View& visibilityImage = get<Image::View>(get<ImageDescriptor>(descriptors.at({"gRenderParams.mVisibility", 0})));
-				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(uint2), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+				Buffer::View<VisibilityData> selectionBuffer = make_shared<Buffer>(commandBuffer.mDevice, "SelectionData", sizeof(VisibilityData), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 				visibilityImage.barrier(commandBuffer, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
 				selectionBuffer.copyFromImage(commandBuffer, visibilityImage.image(), visibilityImage.subresourceLayer(), vk::Offset3D{int(c.x), int(c.y), 0}, vk::Extent3D{1,1,1});
 				mSelectionData.push_back(make_pair(selectionBuffer, ImGui::GetIO().KeyShift));
@@ -717,9 +733,12 @@ void VCM::rasterLightPaths(CommandBuffer& commandBuffer, const Image::View& rend
 
 		commandBuffer->bindPipeline(vk::PipelineBindPoint::eGraphics, ***lightPathPipeline);
 		descriptorSets->bind(commandBuffer);
+		const Scene::FrameData& sceneData = mNode.findAncestor<Scene>()->frameData();
+		const float3 sceneCenter = (sceneData.mAabbMin + sceneData.mAabbMax) / 2;
 		lightPathPipeline->pushConstants(commandBuffer, {
 			{ "mLineRadius", mVisualizeLightPathRadius },
 			{ "mLineLength", mVisualizeLightPathLength },
+			{ "mSceneSphere", float4(sceneCenter[0], sceneCenter[1], sceneCenter[2], length<float,3>(sceneData.mAabbMax - sceneCenter)) },
 		});
 		commandBuffer->draw((mPushConstants.mMaxPathLength+1)*6, min(mVisualizeLightPathCount, mPushConstants.mLightSubPathCount), 0, 0);
 
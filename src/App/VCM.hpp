@@ -28,8 +28,7 @@ private:
 	enum RenderPipelineIndex {
 		eGenerateLightPaths,
 		eGenerateCameraPaths,
-		eHashGridComputeIndices,
-		eHashGridSwizzle,
+		eSortLightVertices,
 		ePipelineCount
 	};
 	array<ComputePipelineCache, RenderPipelineIndex::ePipelineCount> mRenderPipelines;
@@ -2,8 +2,10 @@
 
 #include <App/Scene.hpp>
 #include <Core/Profiler.hpp>
+#include <Core/ThreadPool.hpp>
 
 #include <assimp/Importer.hpp>
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
@@ -11,6 +13,15 @@
 
 namespace stm2 {
 
+// Records the files Assimp opens besides the scene, such as material libraries, for the scene cache
+class DependencyIOSystem : public Assimp::DefaultIOSystem {
+public:
+	inline Assimp::IOStream* Open(const char* file, const char* mode = "rb") override {
+		SceneCache::addDependency(file);
+		return Assimp::DefaultIOSystem::Open(file, mode);
+	}
+};
+
 shared_ptr<Node> Scene::loadAssimp(CommandBuffer& commandBuffer, const filesystem::path& filename) {
 	cout << "Loading " << filename << endl;
 
@@ -18,6 +29,7 @@ shared_ptr<Node> Scene::loadAssimp(CommandBuffer& commandBuffer, const filesyste
 
 	// Create an instance of the Importer class
 	Assimp::Importer importer;
+	importer.SetIOHandler(new DependencyIOSystem()); // owned by importer
 	// And have it read the given file with some example postprocessing
 	// Usually - if speed is not the most important aspect for you - you'll
 	// propably to request more postprocessing than we do in this example.
@@ -46,23 +58,13 @@ shared_ptr<Node> Scene::loadAssimp(CommandBuffer& commandBuffer, const filesyste
 	unordered_map<string, Image::View> images;
 
 	auto getImage = [&](filesystem::path path, const bool srgb) -> Image::View {
-		if (path.is_relative()) {
-			filesystem::path cur = filesystem::current_path();
-			filesystem::current_path(filename.parent_path());
-			path = filesystem::absolute(path);
-			filesystem::current_path(cur);
-		}
+		if (path.is_relative())
+			path = filesystem::absolute(filename.parent_path() / path);
 		auto it = images.find(path.string());
 		if (it != images.end()) return it->second;
 
-		Image::Metadata md = {};
-		shared_ptr<Buffer> pixels;
-		tie(pixels, md.mFormat, md.mExtent) = Image::loadFile(commandBuffer.mDevice, path, srgb);
-		md.mUsage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
-		const shared_ptr<Image> img = make_shared<Image>(commandBuffer.mDevice, path.filename().string(), md);
-
-		pixels->copyToImage(commandBuffer, img);
-		commandBuffer.trackResource(pixels);
+		SceneCache::addDependency(path);
+		const Image::View img = mTextureCache.getImage(commandBuffer, mTextureCache.load(commandBuffer.mDevice, path, srgb, 0, true), vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, false);
 
 		images.emplace(path.string(), img);
 		return img;
@@ -143,125 +145,192 @@ shared_ptr<Node> Scene::loadAssimp(CommandBuffer& commandBuffer, const filesyste
 	if (scene->HasMeshes()) {
 		cout << "Loading meshes...";
 
-		size_t vertexDataSize = 0;
-		size_t indexDataSize = 0;
-
-		vector<size_t> positionsOffsets(scene->mNumMeshes);
-		vector<size_t> normalsOffsets(scene->mNumMeshes);
-		vector<size_t> uvsOffsets(scene->mNumMeshes);
-		vector<size_t> indicesOffsets(scene->mNumMeshes);
-
-		for (int i = 0; i < scene->mNumMeshes; i++) {
-			const aiMesh* m = scene->mMeshes[i];
-
-			if (!(m->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) || (m->mPrimitiveTypes & ~aiPrimitiveType_TRIANGLE) != 0)
-				continue;
-
-			positionsOffsets[i] = vertexDataSize;
-			vertexDataSize += m->mNumVertices*3;
-
-			normalsOffsets[i] = vertexDataSize;
-			vertexDataSize += m->mNumVertices*3;
-
-			if (m->GetNumUVChannels() > 0) {
-				uvsOffsets[i] = vertexDataSize;
-				vertexDataSize += m->mNumVertices*2;
-			}
-
-			indicesOffsets[i] = indexDataSize;
-			indexDataSize += m->mNumFaces*3;
-		}
+		// positions, normals and uvs are encoded by the precision policy
+		const Mesh::VertexPrecision precision = Mesh::vertexPrecision(device);
+		const vk::Format positionFormat = Mesh::positionFormat(device, precision);
+		const vk::Format normalFormat = Mesh::normalFormat(precision);
+
+		// encoded vertex data of each mesh: positions, then normals, then uvs
+		struct MeshData {
+			vector<byte> mVertices;
+			vector<uint32_t> mIndices;
+			vk::Format mUvFormat = vk::Format::eUndefined;
+			vk::AabbPositionsKHR mAabb;
+			optional<Mesh::MeshletData> mMeshlets;
+			size_t mGeometryHash = 0;
+			Hash128 mContentHash;
+		};
+		vector<MeshData> meshData(scene->mNumMeshes);
 
-		Buffer::View<float> vertexBufferTmp   = make_shared<Buffer>(commandBuffer.mDevice, "tmp vertices" , vertexDataSize*sizeof(float), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-		Buffer::View<uint32_t> indexBufferTmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp indices" , indexDataSize*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		auto isTriangleMesh = [](const aiMesh* m) {
+			return (m->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) && (m->mPrimitiveTypes & ~aiPrimitiveType_TRIANGLE) == 0;
+		};
 
-		// copy vertex data to staging buffers
+		// optimize, encode and hash vertex data
 		auto copyVertices = [&](const uint32_t i) {
 			const aiMesh* m = scene->mMeshes[i];
-			if (!(m->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) || (m->mPrimitiveTypes & ~aiPrimitiveType_TRIANGLE) != 0)
+			if (!isTriangleMesh(m))
 				return;
+			MeshData& data = meshData[i];
+
+			vector<float3> positions(m->mNumVertices);
+			vector<float3> normals(m->mNumVertices);
+			vector<float2> uvs(m->GetNumUVChannels() >= 1 ? m->mNumVertices : 0);
+			for (int vi = 0; vi < m->mNumVertices; vi++) {
+				positions[vi] = float3((float)m->mVertices[vi].x, (float)m->mVertices[vi].y, (float)m->mVertices[vi].z);
+				normals[vi] = float3((float)m->mNormals[vi].x, (float)m->mNormals[vi].y, (float)m->mNormals[vi].z);
+			}
+			for (int vi = 0; vi < uvs.size(); vi++)
+				uvs[vi] = float2((float)m->mTextureCoords[0][vi].x, (float)m->mTextureCoords[0][vi].y);
 
-			const size_t offsetPos = positionsOffsets[i];
-			for (int vi = 0; vi < m->mNumVertices; vi++)
-				float3::Map(&vertexBufferTmp[offsetPos + 3*vi]) = float3((float)m->mVertices[vi].x, (float)m->mVertices[vi].y, (float)m->mVertices[vi].z);
-
-			const size_t offsetNorm = normalsOffsets[i];
-			for (int vi = 0; vi < m->mNumVertices; vi++)
-				float3::Map(&vertexBufferTmp[offsetNorm + 3*vi]) = float3((float)m->mNormals[vi].x, (float)m->mNormals[vi].y, (float)m->mNormals[vi].z);
+			data.mIndices.resize(m->mNumFaces*3);
+			for (int fi = 0; fi < m->mNumFaces; fi++) {
+				data.mIndices[fi*3+0] = m->mFaces[fi].mIndices[0];
+				data.mIndices[fi*3+1] = m->mFaces[fi].mIndices[1];
+				data.mIndices[fi*3+2] = m->mFaces[fi].mIndices[2];
+			}
 
-			if (m->GetNumUVChannels() >= 1) {
-				const size_t offsetUv = uvsOffsets[i];
-				for (int vi = 0; vi < m->mNumVertices; vi++)
-					float2::Map(&vertexBufferTmp[offsetUv + 2*vi]) = float2((float)m->mTextureCoords[0][vi].x, (float)m->mTextureCoords[0][vi].y);
+			// optimize triangle and vertex order for rasterization
+			vector<uint32_t> vertexRemap;
+			data.mMeshlets = Mesh::optimizeTriangles(positions, data.mIndices, m->mName.C_Str(), &vertexRemap);
+			if (data.mMeshlets) {
+				Mesh::remapVertices<float3>(positions, vertexRemap);
+				Mesh::remapVertices<float3>(normals, vertexRemap);
+				if (!uvs.empty())
+					Mesh::remapVertices<float2>(uvs, vertexRemap);
 			}
 
-			const size_t offsetIdx = indicesOffsets[i];
-			for (int fi = 0; fi < m->mNumFaces; fi++) {
-				const uint32_t idx = fi*3;
-				indexBufferTmp[offsetIdx + idx+0] = m->mFaces[fi].mIndices[0];
-				indexBufferTmp[offsetIdx + idx+1] = m->mFaces[fi].mIndices[1];
-				indexBufferTmp[offsetIdx + idx+2] = m->mFaces[fi].mIndices[2];
+			float3 vmin = float3::Constant( numeric_limits<float>::infinity());
+			float3 vmax = float3::Constant(-numeric_limits<float>::infinity());
+			for (const float3& p : positions) {
+				vmin = min(vmin, p);
+				vmax = max(vmax, p);
 			}
+			data.mAabb = vk::AabbPositionsKHR(vmin[0], vmin[1], vmin[2], vmax[0], vmax[1], vmax[2]);
+
+			if (!uvs.empty())
+				data.mUvFormat = Mesh::texcoordFormat(precision, uvs);
+			const size_t normalsOffset = positions.size()*texelSize(positionFormat);
+			const size_t uvsOffset = normalsOffset + normals.size()*texelSize(normalFormat);
+			data.mVertices.resize(uvsOffset + (uvs.empty() ? 0 : uvs.size()*texelSize(data.mUvFormat)));
+			Mesh::encodePositions(positions, data.mAabb, positionFormat, data.mVertices.data());
+			Mesh::encodeNormals(normals, normalFormat, data.mVertices.data() + normalsOffset);
+			if (!uvs.empty())
+				Mesh::encodeTexcoords(uvs, data.mUvFormat, data.mVertices.data() + uvsOffset);
+
+			data.mGeometryHash = hashArgs(
+				hashBytes(positions.data(), positions.size()*sizeof(float3)),
+				hashBytes(data.mIndices.data(), data.mIndices.size()*sizeof(uint32_t)));
+			data.mContentHash = hashArgs128(
+				hashBytes128(data.mVertices.data(), data.mVertices.size()),
+				hashBytes128(data.mIndices.data(), data.mIndices.size()*sizeof(uint32_t)),
+				data.mAabb,
+				positionFormat, normalFormat, data.mUvFormat, m->mNumVertices);
 		};
 
-		vector<thread> threads;
-		threads.reserve(scene->mNumMeshes);
+		vector<future<void>> jobs;
+		jobs.reserve(scene->mNumMeshes);
 		for (uint32_t i = 0; i < scene->mNumMeshes; i++)
-			threads.push_back(thread(bind(copyVertices, i)));
+			jobs.emplace_back(ThreadPool::global().enqueue(bind(copyVertices, i)));
 		cout << "Copying vertex data...";
-		for (thread& t : threads) if (t.joinable()) t.join();
+		for (future<void>& job : jobs) job.get();
 		cout << endl;
 
-
-		vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eStorageBuffer;
-		if (commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure) {
-			bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
-			bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+		// meshes whose contents were loaded before are taken from the mesh cache, and meshes whose contents appear
+		// earlier in this file refer to the first one, so only the first copy of each mesh is uploaded
+		meshes.resize(scene->mNumMeshes);
+		vector<uint32_t> firstCopy(scene->mNumMeshes);
+		unordered_map<Hash128, uint32_t> contents;
+		vector<size_t> vertexOffsets(scene->mNumMeshes);
+		vector<size_t> indexOffsets(scene->mNumMeshes);
+		size_t vertexDataSize = 0;
+		size_t indexDataSize = 0;
+		for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+			const MeshData& data = meshData[i];
+			firstCopy[i] = i;
+			if (!isTriangleMesh(scene->mMeshes[i]))
+				continue;
+			if (const auto it = contents.find(data.mContentHash); it != contents.end()) {
+				firstCopy[i] = it->second;
+				mMeshCache.addDuplicate(data.mVertices.size() + data.mIndices.size()*sizeof(uint32_t));
+				continue;
+			}
+			contents.emplace(data.mContentHash, i);
+			if ((meshes[i] = mMeshCache.find(data.mContentHash)))
+				continue;
+			vertexOffsets[i] = vertexDataSize;
+			vertexDataSize += data.mVertices.size();
+			indexOffsets[i] = indexDataSize;
+			indexDataSize += data.mIndices.size();
 		}
 
-		Buffer::View<float> vertexBuffer   = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + "/Vertices" , vertexDataSize*sizeof(float), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		Buffer::View<uint32_t> indexBuffer = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + "/Indices" , indexDataSize*sizeof(uint32_t), bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
-		Buffer::copy(commandBuffer, vertexBufferTmp, vertexBuffer);
-		Buffer::copy(commandBuffer, indexBufferTmp , indexBuffer);
+		if (vertexDataSize > 0) {
+			Buffer::View<byte> vertexBufferTmp   = make_shared<Buffer>(commandBuffer.mDevice, "tmp vertices" , vertexDataSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+			Buffer::View<uint32_t> indexBufferTmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp indices" , indexDataSize*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+			for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+				if (firstCopy[i] != i || meshes[i] || !isTriangleMesh(scene->mMeshes[i]))
+					continue;
+				ranges::copy(meshData[i].mVertices, &vertexBufferTmp[vertexOffsets[i]]);
+				ranges::copy(meshData[i].mIndices, &indexBufferTmp[indexOffsets[i]]);
+			}
 
-		// construct meshes
+			vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eStorageBuffer;
+			if (commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure) {
+				bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
+				bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+			}
 
-		const shared_ptr<Node>& meshesNode = root->addChild("meshes");
-		for (int i = 0; i < scene->mNumMeshes; i++) {
-			cout << "\rCreating meshes " << (i+1) << "/" << scene->mNumMeshes;
+			Buffer::View<byte> vertexBuffer    = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + "/Vertices" , vertexDataSize, bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
+			Buffer::View<uint32_t> indexBuffer = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + "/Indices" , indexDataSize*sizeof(uint32_t), bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
+			Buffer::copy(commandBuffer, vertexBufferTmp, vertexBuffer);
+			Buffer::copy(commandBuffer, indexBufferTmp , indexBuffer);
 
-			const aiMesh* m = scene->mMeshes[i];
+			// construct meshes
 
-			if (!(m->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) || (m->mPrimitiveTypes & ~aiPrimitiveType_TRIANGLE) != 0)
-				continue;
+			for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+				cout << "\rCreating meshes " << (i+1) << "/" << scene->mNumMeshes;
 
-			Mesh::Vertices vertices;
+				const aiMesh* m = scene->mMeshes[i];
+				const MeshData& data = meshData[i];
+				if (firstCopy[i] != i || meshes[i] || !isTriangleMesh(m))
+					continue;
 
-			vertices[Mesh::VertexAttributeType::ePosition].emplace_back(
-				Buffer::View<byte>(vertexBuffer.buffer(), positionsOffsets[i]*sizeof(float), m->mNumVertices*3*sizeof(float)),
-				Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
+				Mesh::Vertices vertices;
 
-			vertices[Mesh::VertexAttributeType::eNormal].emplace_back(
-				Buffer::View<byte>(vertexBuffer.buffer(), normalsOffsets[i]*sizeof(float), m->mNumVertices*3*sizeof(float)),
-				Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
+				size_t offset = vertexOffsets[i];
+				vertices[Mesh::VertexAttributeType::ePosition].emplace_back(
+					Buffer::View<byte>(vertexBuffer.buffer(), offset, m->mNumVertices*texelSize(positionFormat)),
+					Mesh::VertexAttributeDescription{ texelSize(positionFormat), positionFormat, 0, vk::VertexInputRate::eVertex });
+				offset += m->mNumVertices*texelSize(positionFormat);
 
-			if (m->GetNumUVChannels() >= 1) {
-				vertices[Mesh::VertexAttributeType::eTexcoord].emplace_back(
-					Buffer::View<byte>(vertexBuffer.buffer(), uvsOffsets[i]*sizeof(float), m->mNumVertices*2*sizeof(float)),
-					Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float2), vk::Format::eR32G32Sfloat, 0, vk::VertexInputRate::eVertex } );
-			}
+				vertices[Mesh::VertexAttributeType::eNormal].emplace_back(
+					Buffer::View<byte>(vertexBuffer.buffer(), offset, m->mNumVertices*texelSize(normalFormat)),
+					Mesh::VertexAttributeDescription{ texelSize(normalFormat), normalFormat, 0, vk::VertexInputRate::eVertex });
+				offset += m->mNumVertices*texelSize(normalFormat);
+
+				if (data.mUvFormat != vk::Format::eUndefined) {
+					vertices[Mesh::VertexAttributeType::eTexcoord].emplace_back(
+						Buffer::View<byte>(vertexBuffer.buffer(), offset, m->mNumVertices*texelSize(data.mUvFormat)),
+						Mesh::VertexAttributeDescription{ texelSize(data.mUvFormat), data.mUvFormat, 0, vk::VertexInputRate::eVertex } );
+				}
 
-			vertices.mAabb.minX = (float)m->mAABB.mMin.x;
-			vertices.mAabb.minY = (float)m->mAABB.mMin.y;
-			vertices.mAabb.minZ = (float)m->mAABB.mMin.z;
-			vertices.mAabb.maxX = (float)m->mAABB.mMax.x;
-			vertices.mAabb.maxY = (float)m->mAABB.mMax.y;
-			vertices.mAabb.maxZ = (float)m->mAABB.mMax.z;
+				vertices.mAabb = data.mAabb;
 
-			const shared_ptr<Node>& meshNode = meshesNode->addChild(m->mName.C_Str());
-			meshes.emplace_back( meshNode->makeComponent<Mesh>(vertices, Buffer::View<uint32_t>(indexBuffer, indicesOffsets[i], m->mNumFaces*3), vk::PrimitiveTopology::eTriangleList) );
+				meshes[i] = make_shared<Mesh>(vertices, Buffer::View<uint32_t>(indexBuffer, indexOffsets[i], data.mIndices.size()), vk::PrimitiveTopology::eTriangleList);
+				meshes[i]->setGeometryHash(data.mGeometryHash);
+				meshes[i]->setContentHash(data.mContentHash);
+				if (data.mMeshlets)
+					meshes[i]->setMeshlets(Mesh::uploadMeshlets(commandBuffer, *data.mMeshlets, m->mName.C_Str()));
+			}
+			cout << endl;
+		}
+
+		const shared_ptr<Node>& meshesNode = root->addChild("meshes");
+		for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+			meshes[i] = meshes[firstCopy[i]];
+			if (meshes[i] && firstCopy[i] == i)
+				meshesNode->addChild(scene->mMeshes[i]->mName.C_Str())->addComponent(meshes[i]);
 		}
-		cout << endl;
 	}
 
 	stack<pair<aiNode*, Node*>> nodes;
@@ -272,11 +341,14 @@ shared_ptr<Node> Scene::loadAssimp(CommandBuffer& commandBuffer, const filesyste
 
 		n->makeComponent<TransformData>( Eigen::Array<ai_real,4,4,Eigen::RowMajor>::Map(&an->mTransformation.a1).block<3,4>(0,0).cast<float>() );
 
-		if (an->mNumMeshes == 1)
-			n->makeComponent<MeshPrimitive>(materials[scene->mMeshes[an->mMeshes[0]]->mMaterialIndex], meshes[an->mMeshes[0]]);
-		else if (an->mNumMeshes > 1)
+		// meshes that aren't triangle lists weren't loaded
+		if (an->mNumMeshes == 1) {
+			if (meshes[an->mMeshes[0]])
+				n->makeComponent<MeshPrimitive>(materials[scene->mMeshes[an->mMeshes[0]]->mMaterialIndex], meshes[an->mMeshes[0]]);
+		} else if (an->mNumMeshes > 1)
 			for (int i = 0; i < an->mNumMeshes; i++)
-				n->addChild(scene->mMeshes[an->mMeshes[i]]->mName.C_Str())->makeComponent<MeshPrimitive>(materials[scene->mMeshes[an->mMeshes[i]]->mMaterialIndex], meshes[an->mMeshes[i]]);
+				if (meshes[an->mMeshes[i]])
+					n->addChild(scene->mMeshes[an->mMeshes[i]]->mName.C_Str())->makeComponent<MeshPrimitive>(materials[scene->mMeshes[an->mMeshes[i]]->mMaterialIndex], meshes[an->mMeshes[i]]);
 
 		for (int i = 0; i < an->mNumChildren; i++)
 			nodes.push(make_pair(an->mChildren[i], n->addChild(an->mChildren[i]->mName.C_Str()).get()));
@@ -1,92 +1,280 @@
 #include <App/Scene.hpp>
 #include <Core/CommandBuffer.hpp>
 #include <Core/Profiler.hpp>
+#include <Core/MappedFile.hpp>
+#include <Core/ThreadPool.hpp>
 
 #define TINYGLTF_USE_CPP14
+#define TINYGLTF_NO_STB_IMAGE
 #define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_EXTERNAL_IMAGE
 #define TINYGLTF_IMPLEMENTATION
 #include <tiny_gltf.h>
 
 namespace stm2 {
 
-shared_ptr<Node> Scene::loadGltf(CommandBuffer& commandBuffer, const filesystem::path& filename) {
-	cout << "Loading " << filename << endl;
+// Images are decoded by the loader on a thread pool, so tinygltf only stores the encoded bytes
+static bool storeEncodedImage(tinygltf::Image* image, const int imageIndex, string* err, string* warn, int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData) {
+	image->image.assign(bytes, bytes + size);
+	return true;
+}
 
-	tinygltf::Model model;
-	tinygltf::TinyGLTF loader;
+// malformed escapes are kept as they are
+static string urlDecode(const string& str) {
+	auto hexDigit = [](const char c) { return isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10; };
+	string result;
+	result.reserve(str.size());
+	for (size_t i = 0; i < str.size(); i++) {
+		if (str[i] == '%' && i + 2 < str.size() && isxdigit((unsigned char)str[i + 1]) && isxdigit((unsigned char)str[i + 2])) {
+			result.push_back((char)(hexDigit(str[i + 1])*16 + hexDigit(str[i + 2])));
+			i += 2;
+		} else
+			result.push_back(str[i]);
+	}
+	return result;
+}
+
+struct GltfFile {
+	tinygltf::Model mModel;
+
+	// .glb files are memory mapped. The BIN chunk is read directly from the mapping
+	// instead of being copied into mModel.buffers.
+	unique_ptr<MappedFile> mMappedFile;
+	size_t mBinChunkOffset = 0;
+	int mBinBuffer = -1;
+	// bufferView of images stored in the BIN chunk, per image
+	vector<int> mImageBufferViews;
+
+	inline span<const byte> bufferViewData(const tinygltf::BufferView& bv) const {
+		if (bv.buffer == mBinBuffer)
+			return mMappedFile->bytes(mBinChunkOffset + bv.byteOffset, bv.byteLength);
+		const vector<unsigned char>& data = mModel.buffers[bv.buffer].data;
+		if (bv.byteOffset + bv.byteLength > data.size()) throw runtime_error("bufferView exceeds buffer size");
+		return span<const byte>(reinterpret_cast<const byte*>(data.data()) + bv.byteOffset, bv.byteLength);
+	}
+};
+
+// Parses the JSON chunk of a .glb with tinygltf, without letting it copy the BIN chunk or decode images.
+void loadGlb(tinygltf::TinyGLTF& loader, GltfFile& dst, const filesystem::path& filename) {
+	dst.mMappedFile = make_unique<MappedFile>(filename);
+	const MappedFile& file = *dst.mMappedFile;
+
+	auto readUint = [&](const size_t offset) {
+		uint32_t v;
+		memcpy(&v, file.bytes(offset, sizeof(uint32_t)).data(), sizeof(uint32_t));
+		return v;
+	};
+
+	if (file.size() < 20 || readUint(0) != 0x46546C67 /* glTF */) throw runtime_error(filename.string() + ": Invalid magic");
+	if (readUint(4) != 2) throw runtime_error(filename.string() + ": Unsupported glTF binary version");
+	const size_t length = min<size_t>(readUint(8), file.size());
+
+	const uint32_t jsonLength = readUint(12);
+	if (readUint(16) != 0x4E4F534A /* JSON */) throw runtime_error(filename.string() + ": First chunk is not JSON");
+	const span<const byte> jsonBytes = file.bytes(20, jsonLength);
+
+	const size_t binHeader = 20 + jsonLength;
+	size_t binLength = 0;
+	if (binHeader + 8 <= length && readUint(binHeader + 4) == 0x004E4942 /* BIN */) {
+		binLength = readUint(binHeader);
+		dst.mBinChunkOffset = binHeader + 8;
+	}
+
+	nlohmann::json json = nlohmann::json::parse(reinterpret_cast<const char*>(jsonBytes.data()), reinterpret_cast<const char*>(jsonBytes.data() + jsonBytes.size()));
+
+	// replace the BIN chunk buffer with a tiny placeholder, so that tinygltf doesn't copy it
+	if (json.contains("buffers"))
+		for (size_t i = 0; i < json["buffers"].size(); i++) {
+			nlohmann::json& buffer = json["buffers"][i];
+			if (buffer.contains("uri")) continue;
+			if (buffer["byteLength"].get<size_t>() > binLength) throw runtime_error(filename.string() + ": Buffer exceeds BIN chunk size");
+			dst.mBinBuffer = (int)i;
+			buffer["uri"] = "data:application/octet-stream;base64,AAAA";
+			buffer["byteLength"] = 3;
+		}
+
+	// images in the BIN chunk are decoded straight from the mapping. Give them a placeholder external uri,
+	// which tinygltf keeps without loading (TINYGLTF_NO_EXTERNAL_IMAGE).
+	if (json.contains("images")) {
+		dst.mImageBufferViews.resize(json["images"].size(), -1);
+		for (size_t i = 0; i < json["images"].size(); i++) {
+			nlohmann::json& image = json["images"][i];
+			if (!image.contains("bufferView")) continue;
+			const int bufferView = image["bufferView"].get<int>();
+			if (json["bufferViews"][bufferView]["buffer"].get<int>() != dst.mBinBuffer) continue;
+			dst.mImageBufferViews[i] = bufferView;
+			image.erase("bufferView");
+			image.erase("mimeType");
+			image["uri"] = "glb_image_" + to_string(i);
+		}
+	}
+
+	const string jsonString = json.dump();
 	string err, warn;
-	if (
-		(filename.extension() == ".glb" && !loader.LoadBinaryFromFile(&model, &err, &warn, filename.string())) ||
-		(filename.extension() == ".gltf" && !loader.LoadASCIIFromFile(&model, &err, &warn, filename.string())) )
+	if (!loader.LoadASCIIFromString(&dst.mModel, &err, &warn, jsonString.c_str(), (unsigned int)jsonString.size(), filename.parent_path().string()))
 		throw runtime_error(filename.string() + ": " + err);
 	if (!warn.empty()) cerr << filename.string() << ": " << warn << endl;
+}
+
+shared_ptr<Node> Scene::loadGltf(CommandBuffer& commandBuffer, const filesystem::path& filename) {
+	cout << "Loading " << filename << endl;
+
+	GltfFile file;
+	tinygltf::TinyGLTF loader;
+	loader.SetImageLoader(&storeEncodedImage, nullptr);
+	if (filename.extension() == ".glb")
+		loadGlb(loader, file, filename);
+	else {
+		string err, warn;
+		if (!loader.LoadASCIIFromFile(&file.mModel, &err, &warn, filename.string()))
+			throw runtime_error(filename.string() + ": " + err);
+		if (!warn.empty()) cerr << filename.string() << ": " << warn << endl;
+	}
+	const tinygltf::Model& model = file.mModel;
+	for (const tinygltf::Buffer& buffer : model.buffers)
+		if (!buffer.uri.empty() && !tinygltf::IsDataURI(buffer.uri))
+			SceneCache::addDependency(filename.parent_path() / urlDecode(buffer.uri));
 
 	cout << "Processing scene data..." << endl;
 
 	Device& device = commandBuffer.mDevice;
+	ThreadPool& threadPool = ThreadPool::global();
 
-	vector<shared_ptr<Buffer>> buffers(model.buffers.size());
 	vector<Image::View> images(model.images.size());
+	vector<TextureCache::TextureFuture> imagePixels(model.images.size());
 	vector<shared_ptr<Material>> materials(model.materials.size());
 	vector<vector<shared_ptr<Mesh>>> meshes(model.meshes.size());
 
 	const shared_ptr<Node> rootNode = Node::create(filename.stem().string());
 
+	// jobs reference file and model, so make sure they have finished if anything below throws
+	vector<future<void>> copies;
+	struct JobGuard {
+		vector<TextureCache::TextureFuture>& mImagePixels;
+		vector<future<void>>& mCopies;
+		inline ~JobGuard() {
+			for (const auto& f : mImagePixels) if (f.valid()) f.wait();
+			for (const auto& f : mCopies) if (f.valid()) f.wait();
+		}
+	} jobGuard{ imagePixels, copies };
+
+	// start decoding every image used by a material. The images are only waited on once the materials are created.
+
+	{
+		vector<optional<bool>> imageSrgb(model.images.size());
+		auto markImage = [&](const int textureIndex, const bool srgb) {
+			if (textureIndex < 0 || textureIndex >= model.textures.size()) return;
+			const int index = model.textures[textureIndex].source;
+			if (index < 0 || index >= model.images.size() || imageSrgb[index]) return;
+			imageSrgb[index] = srgb;
+		};
+		for (const tinygltf::Material& material : model.materials) {
+			markImage(material.emissiveTexture.index, true);
+			markImage(material.pbrMetallicRoughness.baseColorTexture.index, true);
+			markImage(material.pbrMetallicRoughness.metallicRoughnessTexture.index, false);
+			markImage(material.normalTexture.index, false);
+		}
+
+		for (uint32_t i = 0; i < model.images.size(); i++) {
+			if (!imageSrgb[i]) continue;
+			const tinygltf::Image& image = model.images[i];
+			const string name = image.name.empty() ? filename.stem().string() + "/image" + to_string(i) : image.name;
+			if (i < file.mImageBufferViews.size() && file.mImageBufferViews[i] >= 0)
+				imagePixels[i] = mTextureCache.loadMemory(device, name, file.bufferViewData(model.bufferViews[file.mImageBufferViews[i]]), *imageSrgb[i], 4, true);
+			else if (!image.image.empty())
+				imagePixels[i] = mTextureCache.loadMemory(device, name, span<const byte>(reinterpret_cast<const byte*>(image.image.data()), image.image.size()), *imageSrgb[i], 4, true);
+			else if (!image.uri.empty()) {
+				const filesystem::path path = filename.parent_path() / urlDecode(image.uri);
+				SceneCache::addDependency(path);
+				imagePixels[i] = mTextureCache.load(device, path, *imageSrgb[i], 4, true);
+			} else
+				throw runtime_error(filename.string() + ": No data for image " + name);
+		}
+	}
+
 	auto getImage = [&](const uint32_t texture_index, const bool srgb) -> Image::View {
 		if (texture_index >= model.textures.size()) return {};
 		const uint32_t index = model.textures[texture_index].source;
 		if (index >= images.size()) return {};
 		if (images[index]) return images[index];
+		if (!imagePixels[index].valid()) return {};
 
-		const tinygltf::Image& image = model.images[index];
-		Buffer::View<unsigned char> pixels = make_shared<Buffer>(device, image.name+"/Staging", image.image.size(), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-		ranges::uninitialized_copy(image.image, pixels);
-
-		Image::Metadata md = {};
-		if (srgb) {
-			static const std::array<vk::Format,4> formatMap { vk::Format::eR8Srgb, vk::Format::eR8G8Srgb, vk::Format::eR8G8B8Srgb, vk::Format::eR8G8B8A8Srgb };
-			md.mFormat = formatMap.at(image.component - 1);
-		} else {
-			static const unordered_map<int, std::array<vk::Format,4>> formatMap {
-				{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE,  { vk::Format::eR8Unorm, vk::Format::eR8G8Unorm, vk::Format::eR8G8B8Unorm, vk::Format::eR8G8B8A8Unorm } },
-				{ TINYGLTF_COMPONENT_TYPE_BYTE,           { vk::Format::eR8Snorm, vk::Format::eR8G8Snorm, vk::Format::eR8G8B8Snorm, vk::Format::eR8G8B8A8Snorm } },
-				{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, { vk::Format::eR16Unorm, vk::Format::eR16G16Unorm, vk::Format::eR16G16B16Unorm, vk::Format::eR16G16B16A16Unorm } },
-				{ TINYGLTF_COMPONENT_TYPE_SHORT,          { vk::Format::eR16Snorm, vk::Format::eR16G16Snorm, vk::Format::eR16G16B16Snorm, vk::Format::eR16G16B16A16Snorm } },
-				{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,   { vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint } },
-				{ TINYGLTF_COMPONENT_TYPE_INT,            { vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint } },
-				{ TINYGLTF_COMPONENT_TYPE_FLOAT,          { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat } },
-				{ TINYGLTF_COMPONENT_TYPE_DOUBLE,         { vk::Format::eR64Sfloat, vk::Format::eR64G64Sfloat, vk::Format::eR64G64B64Sfloat, vk::Format::eR64G64B64A64Sfloat } }
-			};
-			md.mFormat = formatMap.at(image.pixel_type).at(image.component - 1);
-		}
-
-		md.mExtent = vk::Extent3D(image.width, image.height, 1);
-		md.mLevels = Image::maxMipLevels(md.mExtent);
-		const shared_ptr<Image> img = make_shared<Image>(device, image.name, md);
-
-		pixels.copyToImage(commandBuffer, img);
-
-		img->generateMipMaps(commandBuffer);
-
+		const Image::View img = mTextureCache.getImage(commandBuffer, imagePixels[index]);
 		images[index] = img;
 		return img;
 	};
 
 	cout << "Loading buffers..." << endl;
 
+	// Only bufferViews referenced by mesh primitives are uploaded. Views are packed per glTF buffer,
+	// and copied from the file (or mapping) into staging memory on the thread pool.
+
 	vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eVertexBuffer|vk::BufferUsageFlagBits::eIndexBuffer|vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eTransferSrc;
 	if (commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure) {
 		bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
 		bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
 	}
-	ranges::transform(model.buffers, buffers.begin(), [&](const tinygltf::Buffer& buffer) {
-		Buffer::View<unsigned char> tmp = make_shared<Buffer>(device, buffer.name+"/Staging", buffer.data.size(), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-		ranges::copy(buffer.data, tmp.begin());
-		Buffer::View<unsigned char> dst = make_shared<Buffer>(device, buffer.name, buffer.data.size(), bufferUsage, vk::MemoryPropertyFlagBits::eDeviceLocal);
-		Buffer::copy(commandBuffer, tmp, dst);
-		dst.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput|vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eVertexAttributeRead|vk::AccessFlagBits::eIndexRead|vk::AccessFlagBits::eShaderRead);
-		return dst.buffer();
-	});
+
+	// bufferView index -> (device buffer, offset of the view within it)
+	unordered_map<int, pair<shared_ptr<Buffer>, vk::DeviceSize>> bufferViews;
+	{
+		// glTF buffer index -> referenced bufferViews
+		map<int, set<int>> usedViews;
+		auto useAccessor = [&](const int accessorIndex) {
+			if (accessorIndex < 0 || accessorIndex >= model.accessors.size()) return;
+			const int bv = model.accessors[accessorIndex].bufferView;
+			if (bv < 0 || bv >= model.bufferViews.size()) return;
+			usedViews[model.bufferViews[bv].buffer].emplace(bv);
+		};
+		for (const tinygltf::Mesh& mesh : model.meshes)
+			for (const tinygltf::Primitive& prim : mesh.primitives) {
+				useAccessor(prim.indices);
+				for (const auto&[name, accessorIndex] : prim.attributes)
+					useAccessor(accessorIndex);
+			}
+
+		vector<tuple<shared_ptr<Buffer>, shared_ptr<Buffer>, vector<vk::BufferCopy>>> uploads;
+		for (const auto&[bufferIndex, views] : usedViews) {
+			vector<vk::BufferCopy> regions;
+			vk::DeviceSize size = 0;
+			for (const int bv : views) {
+				size = (size + 15) & ~vk::DeviceSize(15);
+				regions.emplace_back(size, size, model.bufferViews[bv].byteLength);
+				size += model.bufferViews[bv].byteLength;
+			}
+
+			const string name = model.buffers[bufferIndex].name;
+			const shared_ptr<Buffer> staging = make_shared<Buffer>(device, name+"/Staging", size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+			const shared_ptr<Buffer> dst = make_shared<Buffer>(device, name, size, bufferUsage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+			uint32_t regionIndex = 0;
+			for (const int bv : views) {
+				const vk::DeviceSize offset = regions[regionIndex++].dstOffset;
+				bufferViews.emplace(bv, make_pair(dst, offset));
+				copies.emplace_back(threadPool.enqueue([&, bv, offset, staging]() {
+					const span<const byte> src = file.bufferViewData(model.bufferViews[bv]);
+					memcpy(static_cast<byte*>(staging->data()) + offset, src.data(), src.size());
+				}));
+			}
+
+			uploads.emplace_back(staging, dst, move(regions));
+		}
+
+		for (future<void>& f : copies) f.wait();
+		for (future<void>& f : copies) f.get();
+
+		for (const auto&[staging, dst, regions] : uploads) {
+			commandBuffer.trackResource(staging);
+			commandBuffer.trackResource(dst);
+			vector<vk::BufferCopy> absoluteRegions = regions;
+			for (vk::BufferCopy& r : absoluteRegions) {
+				r.srcOffset += staging->offset();
+				r.dstOffset += dst->offset();
+			}
+			commandBuffer->copyBuffer(**staging, **dst, absoluteRegions);
+			dst->barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput|vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eVertexAttributeRead|vk::AccessFlagBits::eIndexRead|vk::AccessFlagBits::eShaderRead);
+		}
+	}
 
 	cout << "Loading materials..." << endl;
 	ranges::transform(model.materials, materials.begin(), [&](const tinygltf::Material& material) {
@@ -128,16 +316,100 @@ shared_ptr<Node> Scene::loadGltf(CommandBuffer& commandBuffer, const filesystem:
 		return make_shared<Material>(m);
 	});
 
+	// hash of the bytes an accessor covers, read from the file (or mapping)
+	// data of an accessor and its stride. throws if readSize bytes, or the accessor's elements if they are larger,
+	// can't be read at every element without leaving the accessor's bufferView
+	auto accessorData = [&](const tinygltf::Accessor& accessor, const size_t readSize = 0) {
+		if (accessor.bufferView < 0 || accessor.bufferView >= (int)model.bufferViews.size())
+			throw runtime_error(filename.string() + ": Accessor " + accessor.name + " has invalid bufferView " + to_string(accessor.bufferView));
+		const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
+		const int stride = accessor.ByteStride(bv);
+		const int elementSize = tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type);
+		if (stride <= 0 || elementSize <= 0)
+			throw runtime_error(filename.string() + ": Accessor " + accessor.name + " has an invalid type or stride");
+		// byteOffset + (count - 1)*stride + size <= byteLength, without overflowing
+		const size_t size = max<size_t>(elementSize, readSize);
+		const size_t available = accessor.byteOffset <= bv.byteLength ? bv.byteLength - accessor.byteOffset : 0;
+		if (accessor.count > 0 && (available < size || (accessor.count - 1) > (available - size) / stride))
+			throw runtime_error(filename.string() + ": Accessor " + accessor.name + " (offset " + to_string(accessor.byteOffset) + ", " + to_string(accessor.count) + " elements of "
+				+ to_string(size) + " bytes, stride " + to_string(stride) + ") exceeds its bufferView of " + to_string(bv.byteLength) + " bytes");
+		return make_pair(file.bufferViewData(bv).subspan(accessor.byteOffset), (size_t)stride);
+	};
+
+	auto accessorHash = [&](const tinygltf::Accessor& accessor) -> Hash128 {
+		const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
+		const span<const byte> data = file.bufferViewData(bv);
+		const size_t stride = accessor.ByteStride(bv);
+		const size_t offset = min<size_t>(accessor.byteOffset, data.size());
+		return hashArgs128(hashBytes128(data.data() + offset, min(stride*accessor.count, data.size() - offset)), stride, accessor.componentType, accessor.type, accessor.count);
+	};
+
+	auto accessorAabb = [](const tinygltf::Accessor& accessor) {
+		return vk::AabbPositionsKHR(
+			(float)accessor.minValues[0], (float)accessor.minValues[1], (float)accessor.minValues[2],
+			(float)accessor.maxValues[0], (float)accessor.maxValues[1], (float)accessor.maxValues[2]);
+	};
+
+	// float attributes are re-encoded on the host when the precision policy compresses them
+	const Mesh::VertexPrecision precision = Mesh::vertexPrecision(device);
+	auto readAccessor = [&]<typename T>(const tinygltf::Accessor& accessor) {
+		const auto[data, stride] = accessorData(accessor, sizeof(T));
+		vector<T> values(accessor.count);
+		for (size_t k = 0; k < values.size(); k++)
+			memcpy(values[k].data(), data.data() + k*stride, sizeof(T));
+		return values;
+	};
+	// accessor index -> re-encoded attribute, since accessors may be shared between meshes
+	unordered_map<int, Mesh::VertexAttributeData> encodedAttributes;
+
+	// content hashes of every accessor, computed on the thread pool
+	vector<Hash128> accessorHashes(model.accessors.size());
+	{
+		vector<future<void>> jobs;
+		jobs.reserve(model.accessors.size());
+		for (size_t a = 0; a < model.accessors.size(); a++)
+			if (model.accessors[a].bufferView >= 0)
+				jobs.emplace_back(threadPool.enqueue([&, a]() { accessorHashes[a] = accessorHash(model.accessors[a]); }));
+		for (future<void>& job : jobs) job.get();
+	}
+
+	// primitives with identical accessors share a Mesh
+	map<tuple<int, int, map<string, int>>, shared_ptr<Mesh>> uniqueMeshes;
+	// as do primitives whose accessors hold identical data. meshes loaded from other files come from the mesh cache.
+	unordered_map<Hash128, shared_ptr<Mesh>> contentMeshes;
+	// triangle list meshes whose 32-bit indices are uploaded once they are optimized
+	vector<tuple<shared_ptr<Mesh>, Buffer::View<uint32_t>, future<optional<Mesh::MeshletData>>, string>> pendingMeshes;
+
 	cout << "Loading meshes...";
 	for (uint32_t i = 0; i < model.meshes.size(); i++) {
 		cout << "\rLoading meshes " << (i+1) << "/" << model.meshes.size() << "     ";
 		meshes[i].resize(model.meshes[i].primitives.size());
 		for (uint32_t j = 0; j < model.meshes[i].primitives.size(); j++) {
 			const tinygltf::Primitive& prim = model.meshes[i].primitives[j];
+
+			shared_ptr<Mesh>& uniqueMesh = uniqueMeshes[make_tuple(prim.indices, prim.mode, prim.attributes)];
+			if (uniqueMesh) {
+				meshes[i][j] = uniqueMesh;
+				continue;
+			}
+
+			Hash128 contentHash = hashArgs128(accessorHashes[prim.indices], prim.mode, precision);
+			for (const auto&[attribName, attribIndex] : prim.attributes)
+				contentHash = hashArgs128(contentHash, hashBytes128(attribName), accessorHashes[attribIndex]);
+			if (const auto it = contentMeshes.find(contentHash); it != contentMeshes.end()) {
+				mMeshCache.addDuplicate(it->second->sizeBytes());
+				meshes[i][j] = uniqueMesh = it->second;
+				continue;
+			}
+			if (const shared_ptr<Mesh> cached = mMeshCache.find(contentHash)) {
+				meshes[i][j] = uniqueMesh = contentMeshes[contentHash] = cached;
+				continue;
+			}
+
 			const auto& indicesAccessor = model.accessors[prim.indices];
-			const auto& indexBufferView = model.bufferViews[indicesAccessor.bufferView];
+			const auto&[indexBuffer_, indexViewOffset] = bufferViews.at(indicesAccessor.bufferView);
 			const size_t indexStride = tinygltf::GetComponentSizeInBytes(indicesAccessor.componentType);
-			const Buffer::StrideView indexBuffer = Buffer::StrideView(buffers[indexBufferView.buffer], indexStride, indexBufferView.byteOffset + indicesAccessor.byteOffset, indicesAccessor.count * indexStride);
+			const Buffer::StrideView indexBuffer = Buffer::StrideView(indexBuffer_, indexStride, indexViewOffset + indicesAccessor.byteOffset, indicesAccessor.count * indexStride);
 
 			Mesh::Vertices vertexData;
 
@@ -239,23 +511,87 @@ shared_ptr<Node> Scene::loadGltf(CommandBuffer& commandBuffer, const filesystem:
 				if (attribs.size() <= typeIndex) attribs.resize(typeIndex+1);
 				const tinygltf::BufferView& bv = model.bufferViews[accessor.bufferView];
 				const uint32_t stride = accessor.ByteStride(bv);
+				const auto&[buffer, viewOffset] = bufferViews.at(accessor.bufferView);
 				attribs[typeIndex] = {
-					Buffer::View<byte>(buffers[bv.buffer], bv.byteOffset + accessor.byteOffset, stride*accessor.count),
+					Buffer::View<byte>(buffer, viewOffset + accessor.byteOffset, stride*accessor.count),
 					Mesh::VertexAttributeDescription(stride, attributeFormat, 0, vk::VertexInputRate::eVertex) };
 
-				if (attributeType == Mesh::VertexAttributeType::ePosition) {
-					vertexData.mAabb.minX = (float)accessor.minValues[0];
-					vertexData.mAabb.minY = (float)accessor.minValues[1];
-					vertexData.mAabb.minZ = (float)accessor.minValues[2];
-					vertexData.mAabb.maxX = (float)accessor.maxValues[0];
-					vertexData.mAabb.maxY = (float)accessor.maxValues[1];
-					vertexData.mAabb.maxZ = (float)accessor.maxValues[2];
+				if (attributeType == Mesh::VertexAttributeType::ePosition)
+					vertexData.mAabb = accessorAabb(accessor);
+
+				if (precision != Mesh::VertexPrecision::eFull && accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+					const string encodedName = model.meshes[i].name + "/" + attribName;
+					if (auto it = encodedAttributes.find(attribIndex); it != encodedAttributes.end())
+						attribs[typeIndex] = it->second;
+					else if (attributeType == Mesh::VertexAttributeType::ePosition && accessor.type == TINYGLTF_TYPE_VEC3) {
+						if (Mesh::positionFormat(device, precision) != vk::Format::eR32G32B32Sfloat)
+							attribs[typeIndex] = encodedAttributes[attribIndex] = Mesh::uploadPositions(commandBuffer, readAccessor.operator()<float3>(accessor), vertexData.mAabb, precision, encodedName, bufferUsage);
+					} else if (attributeType == Mesh::VertexAttributeType::eNormal && accessor.type == TINYGLTF_TYPE_VEC3)
+						attribs[typeIndex] = encodedAttributes[attribIndex] = Mesh::uploadNormals(commandBuffer, readAccessor.operator()<float3>(accessor), precision, encodedName, bufferUsage);
+					else if (attributeType == Mesh::VertexAttributeType::eTexcoord && accessor.type == TINYGLTF_TYPE_VEC2) {
+						const vector<float2> texcoords = readAccessor.operator()<float2>(accessor);
+						if (Mesh::texcoordFormat(precision, texcoords) != vk::Format::eR32G32Sfloat)
+							attribs[typeIndex] = encodedAttributes[attribIndex] = Mesh::uploadTexcoords(commandBuffer, texcoords, precision, encodedName, bufferUsage);
+					}
 				}
 			}
 
-			meshes[i][j] = make_shared<Mesh>(vertexData, indexBuffer, topology);
+			uniqueMesh = contentMeshes[contentHash] = make_shared<Mesh>(vertexData, indexBuffer, topology);
+			uniqueMesh->setContentHash(contentHash);
+			const auto positionIt = prim.attributes.find("POSITION");
+			if (positionIt != prim.attributes.end())
+				uniqueMesh->setGeometryHash(hashArgs(accessorHashes[positionIt->second], accessorHashes[prim.indices], topology == vk::PrimitiveTopology::eTriangleList));
+
+			// triangle lists get 32-bit indices, optimized on the thread pool when positions are float3. vertices are
+			// not renumbered, since accessors may share buffer views.
+			if (topology == vk::PrimitiveTopology::eTriangleList) {
+				const auto[indexData, indexDataStride] = accessorData(indicesAccessor);
+				Buffer::View<uint32_t> indices_tmp = make_shared<Buffer>(device, "tmp indices", indicesAccessor.count*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+				for (size_t k = 0; k < indicesAccessor.count; k++) {
+					const byte* src = indexData.data() + k*indexDataStride;
+					switch (indicesAccessor.componentType) {
+						case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  indices_tmp[k] = *reinterpret_cast<const uint8_t*>(src); break;
+						case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: { uint16_t i; memcpy(&i, src, sizeof(i)); indices_tmp[k] = i; break; }
+						default: memcpy(&indices_tmp[k], src, sizeof(uint32_t)); break;
+					}
+				}
+
+				future<optional<Mesh::MeshletData>> meshletData;
+				if (positionIt != prim.attributes.end()) {
+					const tinygltf::Accessor& positionAccessor = model.accessors[positionIt->second];
+					if (positionAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && positionAccessor.type == TINYGLTF_TYPE_VEC3) {
+						// positions are copied here, since the job may outlive file and model if anything below throws
+						const auto[positionData, positionStride] = accessorData(positionAccessor, sizeof(float3));
+						vector<float3> positions(positionAccessor.count);
+						for (size_t v = 0; v < positions.size(); v++)
+							memcpy(positions[v].data(), positionData.data() + v*positionStride, sizeof(float3));
+						meshletData = threadPool.enqueue([positions = move(positions), indices_tmp, name = model.meshes[i].name]() {
+							return Mesh::optimizeTriangles(positions, span(indices_tmp.data(), indices_tmp.size()), name);
+						});
+					}
+				}
+				pendingMeshes.emplace_back(uniqueMesh, indices_tmp, move(meshletData), model.meshes[i].name);
+			}
+
+			meshes[i][j] = uniqueMesh;
 		}
 	}
+	for (auto&[mesh, indices_tmp, meshletData, name] : pendingMeshes) {
+		Buffer::View<uint32_t> indices = make_shared<Buffer>(device, name + " indices", indices_tmp.sizeBytes(), bufferUsage);
+		Buffer::copy(commandBuffer, indices_tmp, indices);
+		// optimizeTriangles reorders indices_tmp in place, before the copy executes
+		optional<Mesh::MeshletData> data;
+		if (meshletData.valid())
+			data = meshletData.get();
+		// the geometry hash keys cached BLASes, whose primitive indices follow the optimized triangle order
+		const size_t geometryHash = mesh->geometryHash() == 0 ? 0 : hashArgs(mesh->geometryHash(), hashBytes(indices_tmp.data(), indices_tmp.sizeBytes()));
+		const Hash128 contentHash = mesh->contentHash();
+		*mesh = Mesh(mesh->vertices(), indices, mesh->topology());
+		mesh->setGeometryHash(geometryHash);
+		mesh->setContentHash(contentHash);
+		if (data)
+			mesh->setMeshlets(Mesh::uploadMeshlets(commandBuffer, *data, name));
+	}
 	cout << endl;
 
 	cout << "Loading primitives...";
@@ -281,12 +617,41 @@ shared_ptr<Node> Scene::loadGltf(CommandBuffer& commandBuffer, const filesystem:
 		} else if (!node.matrix.empty())
 			dst->makeComponent<TransformData>(Eigen::Array<double,4,4>::Map(node.matrix.data()).block<3,4>(0,0).cast<float>());
 
-		// make node for MeshPrimitive
+		// EXT_mesh_gpu_instancing: node-space transforms of each instance of the node's mesh
+
+		vector<TransformData> instanceTransforms;
+		if (auto it = node.extensions.find("EXT_mesh_gpu_instancing"); it != node.extensions.end() && it->second.Has("attributes")) {
+			const tinygltf::Value& attributes = it->second.Get("attributes");
+			auto readInstanceAttribute = [&]<typename T>(const string& attribName) -> vector<T> {
+				if (!attributes.Has(attribName)) return {};
+				const tinygltf::Accessor& accessor = model.accessors[attributes.Get(attribName).GetNumberAsInt()];
+				if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.bufferView < 0) {
+					cerr << "Warning: Ignoring unsupported " << attribName << " instance attribute of node " << node.name << endl;
+					return {};
+				}
+				return readAccessor.operator()<T>(accessor);
+			};
+			const vector<float3> translations = readInstanceAttribute.operator()<float3>("TRANSLATION");
+			const vector<float4> rotations    = readInstanceAttribute.operator()<float4>("ROTATION");
+			const vector<float3> scales       = readInstanceAttribute.operator()<float3>("SCALE");
+			instanceTransforms.resize(max({ translations.size(), rotations.size(), scales.size() }));
+			for (size_t k = 0; k < instanceTransforms.size(); k++)
+				instanceTransforms[k] = TransformData(
+					k < translations.size() ? translations[k] : float3::Zero(),
+					k < rotations.size() ? normalize(quatf(rotations[k][0], rotations[k][1], rotations[k][2], rotations[k][3])) : quatf::identity(),
+					k < scales.size() ? scales[k] : float3::Ones());
+		}
+
+		// make node for MeshPrimitive, or InstancedMeshPrimitive
 
 		if (node.mesh < model.meshes.size())
 			for (uint32_t i = 0; i < model.meshes[node.mesh].primitives.size(); i++) {
 				const auto& prim = model.meshes[node.mesh].primitives[i];
-				dst->addChild(model.meshes[node.mesh].name)->makeComponent<MeshPrimitive>(materials[prim.material], meshes[node.mesh][i]);
+				const shared_ptr<Node> primNode = dst->addChild(model.meshes[node.mesh].name);
+				if (instanceTransforms.empty())
+					primNode->makeComponent<MeshPrimitive>(materials[prim.material], meshes[node.mesh][i]);
+				else
+					primNode->makeComponent<InstancedMeshPrimitive>(materials[prim.material], meshes[node.mesh][i])->setTransforms(commandBuffer, instanceTransforms);
 			}
 
 		auto light_it = node.extensions.find("KHR_lights_punctual");
@@ -1,11 +1,14 @@
 #include <App/Scene.hpp>
 #include <Core/Profiler.hpp>
+#include <Core/ThreadPool.hpp>
 
 #include "load_obj.hpp"
 #include "load_serialized.hpp"
+#include "load_ply.hpp"
 
 #include <pugixml.hpp>
 #include <regex>
+#include <unordered_set>
 
 namespace stm2 {
 
@@ -228,54 +231,164 @@ float3 parse_color(pugi::xml_node node) {
 }
 
 
-Mesh create_mesh(CommandBuffer& commandBuffer, const vector<float3>& vertices, const vector<float3>& normals, const vector<float2>& uvs, const vector<uint32_t>& indices) {
-	vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer;
-	if (commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure) {
-		bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
-		bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+// State shared by the parsing and loading phases of a single Mitsuba scene load
+struct MitsubaLoadContext {
+	Scene& mScene;
+	// Command buffer used for work recorded while building the node graph (material conversion, etc.)
+	CommandBuffer& mCommandBuffer;
+	// Directory containing the scene file. Relative paths are resolved against this, instead of the working directory.
+	filesystem::path mBasePath;
+
+	unordered_map<string /* name id */, shared_ptr<Material>> mMaterialIds;
+	unordered_map<string /* name id */, Image::View> mTextureIds;
+
+	// resources loaded in parallel by load_resources, keyed by resolved path
+	unordered_map<string /* path */, Image::View> mBitmaps;
+	unordered_map<pair<string /* path */, int /* shape index */>, shared_ptr<Mesh>> mMeshes;
+	unordered_map<string /* path */, shared_ptr<Node>> mEnvironmentMaps;
+	unordered_set<const Mesh*> mAttachedMeshes;
+
+	// shapegroups, which are only rendered through their instances
+	struct ShapeGroup {
+		vector<shared_ptr<Node>> mShapes; // shapes of the group, parsed into nodes outside of the scene
+		vector<TransformData> mInstances; // toWorld transforms of each instance
+	};
+	unordered_map<string /* name id */, ShapeGroup> mShapeGroups;
+
+	inline filesystem::path resolve(const filesystem::path& p) const {
+		return (p.is_absolute() ? p : mBasePath / p).lexically_normal();
 	}
+};
+
+// Returns the value of the child with name=<name>, or an empty string
+string find_property(pugi::xml_node node, const string& name) {
+	for (auto child : node.children())
+		if (child.attribute("name").value() == name)
+			return child.attribute("value").value();
+	return {};
+}
+
+// First phase: walk the document and find every unique file that needs to be loaded
+void collect_resources(MitsubaLoadContext& ctx, pugi::xml_node node, unordered_set<string>& bitmaps, unordered_set<pair<string,int>>& meshes, unordered_set<string>& envmaps) {
+	for (auto child : node.children()) {
+		const string name = child.name();
+		const string type = child.attribute("type").value();
+		if (name == "texture" && type == "bitmap") {
+			const string filename = find_property(child, "filename");
+			if (!filename.empty()) bitmaps.emplace(ctx.resolve(filename).string());
+		} else if (name == "shape" && (type == "obj" || type == "serialized" || type == "ply")) {
+			const string filename = find_property(child, "filename");
+			const string shapeIndex = find_property(child, "shapeIndex");
+			if (!filename.empty()) meshes.emplace(ctx.resolve(filename).string(), (type == "serialized" && !shapeIndex.empty()) ? stoi(shapeIndex) : -1);
+		} else if (name == "emitter" && type == "envmap") {
+			const string filename = find_property(child, "filename");
+			if (!filename.empty()) envmaps.emplace(ctx.resolve(filename).string());
+		}
+		collect_resources(ctx, child, bitmaps, meshes, envmaps);
+	}
+}
+
+// Second phase: load all meshes and environment maps on a worker pool.
+// Each worker thread records into its own command buffer (allocated from that thread's command pool),
+// and all of them are submitted together once every job is done.
+// Bitmaps are decoded by the scene's TextureCache, and uploaded by this thread while the meshes load.
+void load_resources(MitsubaLoadContext& ctx, pugi::xml_node sceneNode) {
+	unordered_set<string> bitmaps;
+	unordered_set<pair<string,int>> meshes;
+	unordered_set<string> envmaps;
+	collect_resources(ctx, sceneNode, bitmaps, meshes, envmaps);
+
+	// the meshes and environment maps are read on the worker pool, so they are recorded here
+	for (const string& path : bitmaps) SceneCache::addDependency(path);
+	for (const auto&[path, shapeIndex] : meshes) SceneCache::addDependency(path);
+	for (const string& path : envmaps) SceneCache::addDependency(path);
+
+	Device& device = ctx.mCommandBuffer.mDevice;
+	const uint32_t queueFamily = ctx.mCommandBuffer.queueFamily();
+
+	TextureCache& textureCache = ctx.mScene.textureCache();
+	vector<pair<string, TextureCache::TextureFuture>> textures;
+	textures.reserve(bitmaps.size());
+	for (const string& path : bitmaps)
+		textures.emplace_back(path, textureCache.load(device, path, false, 4));
+
+	const size_t jobCount = meshes.size() + envmaps.size();
+
+	mutex resultMutex;
+	unordered_map<thread::id, shared_ptr<CommandBuffer>> threadCommandBuffers;
+	auto threadCommandBuffer = [&]() -> CommandBuffer& {
+		scoped_lock l(resultMutex);
+		auto it = threadCommandBuffers.find(this_thread::get_id());
+		if (it == threadCommandBuffers.end()) {
+			// the pool threads exit once the load is done, so each gets a pool that is freed with its command buffer
+			// rather than one from Device::commandPool, which would outlive the thread
+			const auto commandPool = make_shared<vk::raii::CommandPool>(*device, vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, queueFamily));
+			const shared_ptr<CommandBuffer> cb = make_shared<CommandBuffer>(device, "mitsuba load", commandPool, queueFamily);
+			(*cb)->begin(vk::CommandBufferBeginInfo{});
+			it = threadCommandBuffers.emplace(this_thread::get_id(), cb).first;
+		}
+		return *it->second;
+	};
+
+	vector<future<void>> jobs;
+	jobs.reserve(jobCount);
+	{
+		ThreadPool pool((uint32_t)clamp<size_t>(jobCount, 1, max(thread::hardware_concurrency(), 1u)));
+
+		for (const auto&[path, shapeIndex] : meshes)
+			jobs.emplace_back(pool.enqueue([&, path = path, shapeIndex = shapeIndex]() {
+				CommandBuffer& commandBuffer = threadCommandBuffer();
+				const string ext = filesystem::path(path).extension().string();
+				shared_ptr<Mesh> mesh;
+				if (ext == ".obj")
+					mesh = make_shared<Mesh>(loadObj(commandBuffer, path));
+				else if (ext == ".ply")
+					mesh = make_shared<Mesh>(loadPly(commandBuffer, path));
+				else
+					mesh = make_shared<Mesh>(loadSerialized(commandBuffer, path, shapeIndex));
+				scoped_lock l(resultMutex);
+				ctx.mMeshes.emplace(make_pair(path, shapeIndex), mesh);
+			}));
+
+		for (const string& path : envmaps)
+			jobs.emplace_back(pool.enqueue([&, path]() {
+				const shared_ptr<Node> node = ctx.mScene.load(threadCommandBuffer(), path);
+				scoped_lock l(resultMutex);
+				ctx.mEnvironmentMaps.emplace(path, node);
+			}));
+
+		for (const auto&[path, texture] : textures)
+			ctx.mBitmaps.emplace(path, textureCache.getImage(ctx.mCommandBuffer, texture,
+				vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eStorage, false));
+
+		// ThreadPool destructor waits for all jobs to finish
+	}
+
+	// rethrow any exceptions from the jobs
+	for (future<void>& job : jobs)
+		job.get();
 
-	// create staging buffers
-	Buffer::View<float3> positions_tmp = make_shared<Buffer>(commandBuffer.mDevice, "positions_tmp", vertices.size() * sizeof(float3), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<float3> normals_tmp   = make_shared<Buffer>(commandBuffer.mDevice, "normals_tmp", normals.size() * sizeof(float3)   , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<float2> texcoords_tmp = make_shared<Buffer>(commandBuffer.mDevice, "texcoords_tmp", uvs.size() * sizeof(float2)     , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<uint32_t> indices_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp indices", indices.size() * sizeof(uint32_t) , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-
-	// compute aabb
-	float3 vmin = float3::Constant(numeric_limits<float>::infinity());
-	float3 vmax = float3::Constant(-numeric_limits<float>::infinity());
-	for (const float3& p : vertices) {
-		vmin = min(vmin, p);
-		vmax = min(vmax, p);
+	vector<shared_ptr<CommandBuffer>> commandBuffers;
+	for (const auto&[id, cb] : threadCommandBuffers) {
+		(*cb)->end();
+		commandBuffers.emplace_back(cb);
+	}
+	if (!commandBuffers.empty()) {
+		device.submit(device->getQueue(queueFamily, 0), commandBuffers);
+		// every thread's uploads must be complete before the resources are used, whether or not they share a fence
+		vector<vk::Fence> fences;
+		for (const shared_ptr<CommandBuffer>& cb : commandBuffers)
+			if (ranges::find(fences, **cb->fence()) == fences.end())
+				fences.emplace_back(**cb->fence());
+		if (device->waitForFences(fences, true, numeric_limits<uint64_t>::max()) != vk::Result::eSuccess)
+			throw runtime_error("Failed to wait for mitsuba load command buffers");
 	}
 
-	// copy vertex data to staging buffers
-	memcpy(positions_tmp.data(), vertices.data(), positions_tmp.sizeBytes());
-	memcpy(normals_tmp.data(), vertices.data(), normals_tmp.sizeBytes());
-	memcpy(texcoords_tmp.data(), vertices.data(), texcoords_tmp.sizeBytes());
-	memcpy(indices_tmp.data(), indices.data(), indices_tmp.sizeBytes());
-
-	// copy vertex data to gpu buffers
-	Buffer::View<float3> positions_buf = make_shared<Buffer>(commandBuffer.mDevice, "positions", positions_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-	Buffer::View<float3> normals_buf   = make_shared<Buffer>(commandBuffer.mDevice, "normals"  , normals_tmp.sizeBytes()  , bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-	Buffer::View<float2> texcoords_buf = make_shared<Buffer>(commandBuffer.mDevice, "texcoords", texcoords_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-	Buffer::View<uint32_t> indices_buf = make_shared<Buffer>(commandBuffer.mDevice, "indices"  , indices_tmp.sizeBytes()  , bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
-	Buffer::copy(commandBuffer, positions_tmp, positions_buf);
-	Buffer::copy(commandBuffer, normals_tmp, normals_buf);
-	Buffer::copy(commandBuffer, texcoords_tmp, texcoords_buf);
-	Buffer::copy(commandBuffer, indices_tmp, indices_buf);
-
-	// construct mesh object
-	Mesh::Vertices vertexArray;
-	vertexArray[Mesh::VertexAttributeType::ePosition].emplace_back(positions_buf, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-	vertexArray[Mesh::VertexAttributeType::eNormal].emplace_back(normals_buf, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-	vertexArray[Mesh::VertexAttributeType::eTexcoord].emplace_back(texcoords_buf, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float2), vk::Format::eR32G32Sfloat, 0, vk::VertexInputRate::eVertex });
-	vertexArray.mAabb = vk::AabbPositionsKHR(vmin[0], vmin[1], vmin[2], vmax[0], vmax[1], vmax[2]);
-	return Mesh(vertexArray, indices_buf, vk::PrimitiveTopology::eTriangleList);
+	cout << "Loaded " << bitmaps.size() << " bitmaps, " << meshes.size() << " meshes and " << envmaps.size() << " environment maps using " << commandBuffers.size() << " threads" << endl;
 }
 
 // parse "texture" node
-Image::View parse_texture(CommandBuffer& commandBuffer, pugi::xml_node node) {
+Image::View parse_texture(MitsubaLoadContext& ctx, pugi::xml_node node) {
 	const string type = node.attribute("type").value();
 
 	filesystem::path filename;
@@ -308,23 +421,17 @@ Image::View parse_texture(CommandBuffer& commandBuffer, pugi::xml_node node) {
 	}
 
 	if (type == "bitmap") {
-		Image::Metadata metadata;
-		const Image::PixelData pixels = Image::loadFile(commandBuffer.mDevice, filename, 0, 4);
-		metadata.mExtent = get<vk::Extent3D>(pixels);
-		metadata.mFormat = get<vk::Format>(pixels);
-		metadata.mUsage = vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eStorage;
-		auto img = make_shared<Image>(commandBuffer.mDevice, filename.stem().string(), metadata);
-		commandBuffer.trackResource(img);
-		img->upload(commandBuffer, pixels);
-		img->generateMipMaps(commandBuffer);
-		return img;
+		// bitmaps are loaded ahead of time by load_resources
+		auto it = ctx.mBitmaps.find(ctx.resolve(filename).string());
+		if (it == ctx.mBitmaps.end()) throw logic_error("Bitmap was not loaded: " + filename.string());
+		return it->second;
 	} else if (type == "checkerboard") {
 		Image::Metadata metadata;
 		metadata.mExtent = vk::Extent3D(512, 512, 1);
 		metadata.mFormat = vk::Format::eR8G8B8A8Unorm;
 		metadata.mUsage = vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eSampled|vk::ImageUsageFlagBits::eStorage;
 
-		Buffer::View<byte> buf = make_shared<Buffer>(commandBuffer.mDevice, "checkerboard pixels", metadata.mExtent.width*metadata.mExtent.height*4, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		Buffer::View<byte> buf = make_shared<Buffer>(ctx.mCommandBuffer.mDevice, "checkerboard pixels", metadata.mExtent.width*metadata.mExtent.height*4, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 
 		for (uint32_t y = 0; y < metadata.mExtent.height; y++)
 			for (uint32_t x = 0; x < metadata.mExtent.width; x++) {
@@ -338,16 +445,16 @@ Image::View parse_texture(CommandBuffer& commandBuffer, pugi::xml_node node) {
 				buf[addr+3] = (byte)(0xFF);
 			}
 
-		auto img = make_shared<Image>(commandBuffer.mDevice, "checkerboard", metadata);
-		commandBuffer.trackResource(img);
-		img->upload(commandBuffer, Image::PixelData { buf.buffer(), metadata.mFormat, metadata.mExtent });
-		img->generateMipMaps(commandBuffer);
+		auto img = make_shared<Image>(ctx.mCommandBuffer.mDevice, "checkerboard", metadata);
+		ctx.mCommandBuffer.trackResource(img);
+		img->upload(ctx.mCommandBuffer, Image::PixelData { buf.buffer(), metadata.mFormat, metadata.mExtent });
+		img->generateMipMaps(ctx.mCommandBuffer);
 		return img;
 	}
 	throw runtime_error("Unsupported texture type: " + type + " for " + node.attribute("name").value());
 }
 
-ImageValue<3> parse_spectrum_texture(CommandBuffer& commandBuffer, pugi::xml_node node, unordered_map<string /* name id */, Image::View>& texture_map) {
+ImageValue<3> parse_spectrum_texture(MitsubaLoadContext& ctx, pugi::xml_node node) {
 	const string type = node.name();
 
 	if (type == "spectrum") {
@@ -369,17 +476,17 @@ ImageValue<3> parse_spectrum_texture(CommandBuffer& commandBuffer, pugi::xml_nod
 	} else if (type == "ref") {
 		// referencing a texture
 		string ref_id = node.attribute("id").value();
-		auto t_it = texture_map.find(ref_id);
-		if (t_it == texture_map.end()) {
+		auto t_it = ctx.mTextureIds.find(ref_id);
+		if (t_it == ctx.mTextureIds.end()) {
 			throw runtime_error("Texture not found: " + ref_id);
 		}
 		return ImageValue<3>{float3::Ones(), t_it->second};
 	} else if (type == "texture") {
-		Image::View t = parse_texture(commandBuffer, node);
+		Image::View t = parse_texture(ctx, node);
 		if (!node.attribute("id").empty()) {
 			string id = node.attribute("id").value();
-			if (texture_map.find(id) != texture_map.end()) throw runtime_error("Duplicate texture ID: " + id);
-			texture_map.emplace(id, t);
+			if (ctx.mTextureIds.find(id) != ctx.mTextureIds.end()) throw runtime_error("Duplicate texture ID: " + id);
+			ctx.mTextureIds.emplace(id, t);
 		}
 		return ImageValue<3>{float3::Ones(), t};
 	}
@@ -387,23 +494,23 @@ ImageValue<3> parse_spectrum_texture(CommandBuffer& commandBuffer, pugi::xml_nod
 	throw runtime_error("Unsupported spectrum texture type: " + type);
 }
 
-ImageValue<1> parse_float_texture(CommandBuffer& commandBuffer, pugi::xml_node node, unordered_map<string /* name id */, Image::View>& texture_map) {
+ImageValue<1> parse_float_texture(MitsubaLoadContext& ctx, pugi::xml_node node) {
 	const string type = node.name();
 
 	if (type == "ref") {
 		// referencing a texture
 		string ref_id = node.attribute("id").value();
-		auto t_it = texture_map.find(ref_id);
-		if (t_it == texture_map.end()) throw runtime_error("Texture not found: " + ref_id);
+		auto t_it = ctx.mTextureIds.find(ref_id);
+		if (t_it == ctx.mTextureIds.end()) throw runtime_error("Texture not found: " + ref_id);
 		return { float1::Ones(), t_it->second };
 	} else if (type == "float") {
 		return { float1::Constant(stof(node.attribute("value").value())), {} };
 	} else if (type == "texture") {
-		Image::View t = parse_texture(commandBuffer, node);
+		Image::View t = parse_texture(ctx, node);
 		if (!node.attribute("id").empty()) {
 			string id = node.attribute("id").value();
-			if (texture_map.find(id) != texture_map.end()) throw runtime_error("Duplicate texture ID: " + id);
-			texture_map.emplace(id, t);
+			if (ctx.mTextureIds.find(id) != ctx.mTextureIds.end()) throw runtime_error("Duplicate texture ID: " + id);
+			ctx.mTextureIds.emplace(id, t);
 		}
 		return { float1::Ones(), t };
 	}
@@ -411,7 +518,7 @@ ImageValue<1> parse_float_texture(CommandBuffer& commandBuffer, pugi::xml_node n
 	throw runtime_error("Unsupported float texture type: " + type);
 }
 
-shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandBuffer, pugi::xml_node node, unordered_map<string /* name id */, shared_ptr<Material>>& material_map, unordered_map<string /* name id */, Image::View>& texture_map) {
+shared_ptr<Material> parse_bsdf(MitsubaLoadContext& ctx, Node& dst, pugi::xml_node node) {
 	string type = node.attribute("type").value();
 
 	unordered_set<string> ids;
@@ -430,7 +537,7 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 		for (auto child : node.children()) {
 			string name = child.attribute("name").value();
 			if (name == "reflectance")
-				diffuse = parse_spectrum_texture(commandBuffer, child, texture_map);
+				diffuse = parse_spectrum_texture(ctx, child);
 		}
 		auto m = dst.addChild(name)->makeComponent<Material>();
 		m->mMaterialData.setBaseColor(diffuse.mValue);
@@ -438,7 +545,7 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 		m->mMaterialData.setMetallic(0);
 		m->mMaterialData.setEta(1.5f);
 		for (const string& id : ids)
-			if (!id.empty()) material_map[id] = m;
+			if (!id.empty()) ctx.mMaterialIds[id] = m;
 		return m;
 	} else if (type == "roughplastic" || type == "plastic" || type == "conductor" || type == "roughconductor") {
 		ImageValue<3> diffuse  { float3::Ones(), {} };
@@ -451,9 +558,9 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 		for (auto child : node.children()) {
 			string name = child.attribute("name").value();
 			if (name == "diffuseReflectance") {
-				diffuse = parse_spectrum_texture(commandBuffer, child, texture_map);
+				diffuse = parse_spectrum_texture(ctx, child);
 			} else if (name == "specularReflectance") {
-				specular = parse_spectrum_texture(commandBuffer, child, texture_map);
+				specular = parse_spectrum_texture(ctx, child);
 			} else if (name == "alpha") {
 				// Alpha requires special treatment since we need to convert
 				// the values to roughness
@@ -461,16 +568,16 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 				if (type == "ref") {
 					// referencing a texture
 					string ref_id = child.attribute("id").value();
-					auto t_it = texture_map.find(ref_id);
-					if (t_it == texture_map.end()) throw runtime_error("Texture not found: " + ref_id);
-					roughness = scene.alphaToRoughness(commandBuffer, { float1::Ones(), t_it->second });
+					auto t_it = ctx.mTextureIds.find(ref_id);
+					if (t_it == ctx.mTextureIds.end()) throw runtime_error("Texture not found: " + ref_id);
+					roughness = ctx.mScene.alphaToRoughness(ctx.mCommandBuffer, { float1::Ones(), t_it->second });
 				} else if (type == "float") {
 					float alpha = stof(child.attribute("value").value());
 					roughness.mValue = sqrt(alpha);
 				} else
 					throw runtime_error("Unsupported float texture type: " + type);
 			} else if (name == "roughness") {
-				roughness = parse_float_texture(commandBuffer, child, texture_map);
+				roughness = parse_float_texture(ctx, child);
 			} else if (name == "intIOR") {
 				intIOR = stof(child.attribute("value").value());
 				eta = intIOR / extIOR;
@@ -479,9 +586,9 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 				eta = intIOR / extIOR;
 			}
 		}
-		auto m = dst.addChild(name)->makeComponent<Material>(scene.makeDiffuseSpecularMaterial(commandBuffer, diffuse, specular, roughness, { float3::Zero(), {} }, eta, { float3::Zero(), {} }));
+		auto m = dst.addChild(name)->makeComponent<Material>(ctx.mScene.makeDiffuseSpecularMaterial(ctx.mCommandBuffer, diffuse, specular, roughness, { float3::Zero(), {} }, eta, { float3::Zero(), {} }));
 		for (const string& id : ids)
-			if (!id.empty()) material_map[id] = m;
+			if (!id.empty()) ctx.mMaterialIds[id] = m;
 		return m;
 	} else if (type == "roughdielectric" || type == "dielectric" || type == "thindielectric") {
 		ImageValue<3> diffuse       { float3::Zero(), {} };
@@ -494,23 +601,23 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 		for (auto child : node.children()) {
 			string name = child.attribute("name").value();
 			if (name == "specularReflectance") {
-				specular = parse_spectrum_texture(commandBuffer, child, texture_map);
+				specular = parse_spectrum_texture(ctx, child);
 			} else if (name == "specularTransmittance") {
-				transmittance = parse_spectrum_texture(commandBuffer, child, texture_map);
+				transmittance = parse_spectrum_texture(ctx, child);
 			} else if (name == "alpha") {
 				string type = child.name();
 				if (type == "ref") {
 					// referencing a texture
 					string ref_id = child.attribute("id").value();
-					auto t_it = texture_map.find(ref_id);
-					if (t_it == texture_map.end()) throw runtime_error("Texture not found: " + ref_id);
-					roughness.mImage = scene.alphaToRoughness(commandBuffer, { float1::Ones(), t_it->second }).mImage;
+					auto t_it = ctx.mTextureIds.find(ref_id);
+					if (t_it == ctx.mTextureIds.end()) throw runtime_error("Texture not found: " + ref_id);
+					roughness.mImage = ctx.mScene.alphaToRoughness(ctx.mCommandBuffer, { float1::Ones(), t_it->second }).mImage;
 				} else if (type == "float") {
 					roughness.mValue = sqrt(stof(child.attribute("value").value()));
 				} else
 					throw runtime_error("Unsupported float texture type: " + type);
 			} else if (name == "roughness") {
-				roughness = parse_float_texture(commandBuffer, child, texture_map);
+				roughness = parse_float_texture(ctx, child);
 			} else if (name == "intIOR") {
 				intIOR = stof(child.attribute("value").value());
 				eta = intIOR / extIOR;
@@ -519,9 +626,9 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 				eta = intIOR / extIOR;
 			}
 		}
-		auto m = dst.addChild(name)->makeComponent<Material>(scene.makeDiffuseSpecularMaterial(commandBuffer, diffuse, specular, roughness, transmittance, eta, { float3::Zero(), {} }));
+		auto m = dst.addChild(name)->makeComponent<Material>(ctx.mScene.makeDiffuseSpecularMaterial(ctx.mCommandBuffer, diffuse, specular, roughness, transmittance, eta, { float3::Zero(), {} }));
 		for (const string& id : ids)
-			if (!id.empty()) material_map[id] = m;
+			if (!id.empty()) ctx.mMaterialIds[id] = m;
 		return m;
 	}
 
@@ -533,7 +640,7 @@ shared_ptr<Material> parse_bsdf(Scene& scene, Node& dst, CommandBuffer& commandB
 	throw runtime_error("Unsupported BSDF type: \"" + type + "\" with IDs " + idstr);
 }
 
-void parse_shape(Scene& scene, CommandBuffer& commandBuffer, Node& dst, pugi::xml_node node, unordered_map<string, shared_ptr<Material>>& material_map, unordered_map<string, Image::View>& texture_map, unordered_map<string, shared_ptr<Mesh>>& obj_map, unordered_map<pair<string,uint32_t>, shared_ptr<Mesh>>& serialized_map) {
+void parse_shape(MitsubaLoadContext& ctx, Node& dst, pugi::xml_node node) {
 	shared_ptr<Material> material;
 	string filename;
 	int shape_index = -1;
@@ -546,8 +653,8 @@ void parse_shape(Scene& scene, CommandBuffer& commandBuffer, Node& dst, pugi::xm
 			const string name_value = child.attribute("name").value();
 			pugi::xml_attribute id = child.attribute("id");
 			if (id.empty()) throw runtime_error("Material reference id not specified.");
-			auto it = material_map.find(id.value());
-			if (it == material_map.end()) throw runtime_error("Material reference " + string(id.value()) + " not found.");
+			auto it = ctx.mMaterialIds.find(id.value());
+			if (it == ctx.mMaterialIds.end()) throw runtime_error("Material reference " + string(id.value()) + " not found.");
 			if (!material)
 				material = it->second;
 		} else if (name == "bsdf") {
@@ -555,7 +662,7 @@ void parse_shape(Scene& scene, CommandBuffer& commandBuffer, Node& dst, pugi::xm
 			optional<float3> emission;
 			if (material) emission = material->mMaterialData.getEmission();
 			// parse material
-			material = parse_bsdf(scene, dst, commandBuffer, child, material_map, texture_map);
+			material = parse_bsdf(ctx, dst, child);
 			// override emission with previously parsed emission
 			if (emission) material->mMaterialData.setEmission(*emission);
 		} else if (name == "emitter") {
@@ -607,24 +714,15 @@ void parse_shape(Scene& scene, CommandBuffer& commandBuffer, Node& dst, pugi::xm
 	}
 
 	string type = node.attribute("type").value();
-	if (type == "obj") {
-		shared_ptr<Mesh> m;
-		if (auto m_it = obj_map.find(filename); m_it != obj_map.end()) {
-			m = m_it->second;
-		} else {
-			m = dst.makeComponent<Mesh>(loadObj(commandBuffer, filename));
-			obj_map.emplace(filename, m);
-		}
-		dst.makeComponent<MeshPrimitive>(material, m);
-	} else if (type == "serialized") {
-		const auto key = make_pair(filename, shape_index);
-		shared_ptr<Mesh> m;
-		if (auto m_it = serialized_map.find(key); m_it != serialized_map.end()) {
-			m = m_it->second;
-		} else {
-			m = dst.makeComponent<Mesh>(loadSerialized(commandBuffer, filename, shape_index));
-			serialized_map.emplace(key, m);
-		}
+	if (type == "obj" || type == "serialized" || type == "ply") {
+		// meshes are loaded ahead of time by load_resources
+		const auto key = make_pair(ctx.resolve(filename).string(), type == "serialized" ? shape_index : -1);
+		auto m_it = ctx.mMeshes.find(key);
+		if (m_it == ctx.mMeshes.end()) throw logic_error("Mesh was not loaded: " + filename);
+		const shared_ptr<Mesh>& m = m_it->second;
+		// the first shape to reference a mesh owns it
+		if (ctx.mAttachedMeshes.emplace(m.get()).second)
+			dst.addComponent(m);
 		dst.makeComponent<MeshPrimitive>(material, m);
 	} else if (type == "sphere") {
 		optional<float3> center;
@@ -652,7 +750,7 @@ void parse_shape(Scene& scene, CommandBuffer& commandBuffer, Node& dst, pugi::xm
 		const vector<float3> normals = { float3(0,0,1), float3(0,0,1), float3(0,0,1), float3(0,0,1) };
 		const vector<float2> uvs = { float2(0,0), float2(0,1), float2(1,0), float2(1,1) };
 		const vector<uint32_t> indices = { 0, 1, 2, 1, 3, 2 };
-		dst.makeComponent<MeshPrimitive>(material, dst.makeComponent<Mesh>(create_mesh(commandBuffer, vertices, normals, uvs, indices)));
+		dst.makeComponent<MeshPrimitive>(material, dst.makeComponent<Mesh>(create_mesh(ctx.mCommandBuffer, vertices, normals, uvs, indices, "rectangle")));
 	}/* else if (type == "cube") {
 		vector<float3> vertices(16);
 		vector<float3> normals(16);
@@ -698,31 +796,85 @@ void parse_shape(Scene& scene, CommandBuffer& commandBuffer, Node& dst, pugi::xm
 			indices[face*6 + 4] = i + 3;
 			indices[face*6 + 5] = i + 2;
 		}
-		dst.makeComponent<MeshPrimitive>(material, dst.makeComponent<Mesh>(create_mesh(commandBuffer, vertices, normals, uvs, indices)));
+		dst.makeComponent<MeshPrimitive>(material, dst.makeComponent<Mesh>(create_mesh(ctx.mCommandBuffer, vertices, normals, uvs, indices, "cube")));
 	}*/
 	else throw runtime_error("Unsupported shape: " + type);
 }
 
-shared_ptr<Node> parse_scene(Scene& scene, CommandBuffer& commandBuffer, pugi::xml_node node) {
-	unordered_map<string /* name id */, shared_ptr<Material>> material_map;
-	unordered_map<string /* name id */, Image::View> texture_map;
-	unordered_map<string /* filename */, shared_ptr<Mesh>> obj_map;
-	unordered_map<pair<string /* filename */, uint32_t /* shape index */>, shared_ptr<Mesh>> serialized_map;
+void parse_shapegroup(MitsubaLoadContext& ctx, pugi::xml_node node) {
+	const string id = node.attribute("id").value();
+	if (id.empty()) throw runtime_error("Shapegroup id not specified.");
+	if (ctx.mShapeGroups.contains(id)) throw runtime_error("Duplicate shapegroup ID: " + id);
+	MitsubaLoadContext::ShapeGroup& group = ctx.mShapeGroups[id];
+	for (auto child : node.children("shape")) {
+		const shared_ptr<Node> shape = Node::create(id + "/shape");
+		parse_shape(ctx, *shape, child);
+		group.mShapes.emplace_back(shape);
+	}
+}
 
+void parse_instance(MitsubaLoadContext& ctx, pugi::xml_node node) {
+	MitsubaLoadContext::ShapeGroup* group = nullptr;
+	TransformData transform;
+	for (auto child : node.children()) {
+		const string name = child.name();
+		if (name == "ref") {
+			pugi::xml_attribute id = child.attribute("id");
+			if (id.empty()) throw runtime_error("Shapegroup reference id not specified.");
+			auto it = ctx.mShapeGroups.find(id.value());
+			if (it == ctx.mShapeGroups.end()) throw runtime_error("Shapegroup reference " + string(id.value()) + " not found.");
+			group = &it->second;
+		} else if (name == "transform" && child.attribute("name").value() == string("toWorld")) {
+			transform = parse_transform(child);
+		}
+	}
+	if (!group) throw runtime_error("Instance without a shapegroup reference.");
+	group->mInstances.emplace_back(transform);
+}
+
+// Creates an InstancedMeshPrimitive for each mesh of each instanced shapegroup
+void create_instances(MitsubaLoadContext& ctx, Node& root) {
+	for (const auto& [id, group] : ctx.mShapeGroups) {
+		if (group.mInstances.empty()) continue;
+		for (const shared_ptr<Node>& shape : group.mShapes) {
+			const shared_ptr<MeshPrimitive> prim = shape->getComponent<MeshPrimitive>();
+			if (!prim) {
+				cerr << "Warning: Skipping non-mesh shape in shapegroup " << id << endl;
+				continue;
+			}
+			const shared_ptr<TransformData> shapeTransform = shape->getComponent<TransformData>();
+			vector<TransformData> transforms(group.mInstances.size());
+			for (uint32_t i = 0; i < transforms.size(); i++)
+				transforms[i] = shapeTransform ? tmul(group.mInstances[i], *shapeTransform) : group.mInstances[i];
+
+			const shared_ptr<Node> dst = root.addChild(id);
+			if (const shared_ptr<Mesh> mesh = shape->getComponent<Mesh>())
+				dst->addComponent(mesh);
+			dst->makeComponent<InstancedMeshPrimitive>(prim->mMaterial, prim->mMesh)->setTransforms(ctx.mCommandBuffer, transforms);
+		}
+	}
+}
+
+shared_ptr<Node> parse_scene(MitsubaLoadContext& ctx, pugi::xml_node node) {
 	int envmap_light_id = -1;
 
 	const shared_ptr<Node> root = Node::create(node.name());
 
 	for (auto child : node.children()) {
 		string name = child.name();
+		const string type = child.attribute("type").value();
 		if (name == "bsdf") {
-			parse_bsdf(scene, *root, commandBuffer, child, material_map, texture_map);
+			parse_bsdf(ctx, *root, child);
+		} else if (name == "shape" && type == "shapegroup") {
+			parse_shapegroup(ctx, child);
+		} else if (name == "shape" && type == "instance") {
+			parse_instance(ctx, child);
 		} else if (name == "shape") {
-			parse_shape(scene, commandBuffer, *root->addChild("shape"), child, material_map, texture_map, obj_map, serialized_map);
+			parse_shape(ctx, *root->addChild("shape"), child);
 		} else if (name == "texture") {
 			string id = child.attribute("id").value();
-			if (texture_map.find(id) != texture_map.end()) throw runtime_error("Duplicate texture ID: " + id);
-			texture_map[id] = parse_texture(commandBuffer, child);
+			if (ctx.mTextureIds.find(id) != ctx.mTextureIds.end()) throw runtime_error("Duplicate texture ID: " + id);
+			ctx.mTextureIds[id] = parse_texture(ctx, child);
 		} else if (name == "emitter") {
 			string type = child.attribute("type").value();
 			if (type == "envmap") {
@@ -740,7 +892,15 @@ shared_ptr<Node> parse_scene(Scene& scene, CommandBuffer& commandBuffer, pugi::x
 					}
 				}
 				if (filename.size() > 0) {
-					const shared_ptr<Node> envNode = scene.load(commandBuffer, filename);
+					auto it = ctx.mEnvironmentMaps.find(ctx.resolve(filename).string());
+					if (it == ctx.mEnvironmentMaps.end()) throw logic_error("Environment map was not loaded: " + filename);
+					shared_ptr<Node> envNode = it->second;
+					if (envNode->parent()) {
+						// the same file is used by multiple emitters
+						const shared_ptr<EnvironmentMap> env = envNode->getComponent<EnvironmentMap>();
+						envNode = Node::create(envNode->name());
+						envNode->makeComponent<EnvironmentMap>(*env);
+					}
 					envNode->getComponent<EnvironmentMap>()->mValue *= scale;
 					if (transform)
 						envNode->makeComponent<TransformData>(*transform);
@@ -754,6 +914,8 @@ shared_ptr<Node> parse_scene(Scene& scene, CommandBuffer& commandBuffer, pugi::x
 		}
 	}
 
+	create_instances(ctx, *root);
+
 	return root;
 }
 
@@ -767,14 +929,16 @@ shared_ptr<Node> Scene::loadMitsuba(CommandBuffer& commandBuffer, const filesyst
 		cerr << "Error offset: " << result.offset << endl;
 		throw runtime_error("Parse error");
 	}
-	// back up the current working directory and switch to the parent folder of the file
-	filesystem::path old_path = filesystem::current_path();
-	filesystem::current_path(filename.parent_path());
 
-	auto root = parse_scene(*this, commandBuffer, doc.child("scene"));
+	// paths in the scene file are relative to the file itself
+	MitsubaLoadContext ctx {
+		.mScene = *this,
+		.mCommandBuffer = commandBuffer,
+		.mBasePath = filesystem::absolute(filename).parent_path() };
 
-	// switch back to the old current working directory
-	filesystem::current_path(old_path);
+	const pugi::xml_node sceneNode = doc.child("scene");
+	load_resources(ctx, sceneNode);
+	auto root = parse_scene(ctx, sceneNode);
 
 	cout << "Loaded " << filename << endl;
 
@@ -140,9 +140,6 @@ Mesh loadObj(CommandBuffer& commandBuffer, const filesystem::path &filename) {
     vector<float2> st_pool;
     map<ObjVertex, size_t> vertex_map;
 
-	float3 vmin = float3::Constant(numeric_limits<float>::infinity());
-	float3 vmax = float3::Constant(-numeric_limits<float>::infinity());
-
     ifstream ifs(filename.c_str(), ifstream::in);
     if (!ifs.is_open()) {
         throw runtime_error("Unable to open the obj file");
@@ -161,9 +158,7 @@ Mesh loadObj(CommandBuffer& commandBuffer, const filesystem::path &filename) {
         if (token == "v") {  // vertices
             float x, y, z, w = 1;
             ss >> x >> y >> z >> w;
-            const float3& p = pos_pool.emplace_back(float3{x, y, z} / w);
-			vmin = min(vmin, p);
-			vmax = max(vmax, p);
+            pos_pool.emplace_back(float3{x, y, z} / w);
         } else if (token == "vt") {
             float s, t, w;
             ss >> s >> t >> w;
@@ -235,46 +230,65 @@ Mesh loadObj(CommandBuffer& commandBuffer, const filesystem::path &filename) {
     }
 
 
-	Buffer::View<float3> positions_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp vertices", positions.size()*sizeof(float3), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<float3> normals_tmp   = make_shared<Buffer>(commandBuffer.mDevice, "tmp normals", normals.size()*sizeof(float3)   , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-	Buffer::View<uint32_t> indices_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp indices", indices.size()*sizeof(uint32_t) , vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-    memcpy(positions_tmp.data(), positions.data(), positions_tmp.sizeBytes());
-    memcpy(normals_tmp.data(), normals.data(), normals_tmp.sizeBytes());
-    memcpy(indices_tmp.data(), indices.data(), indices_tmp.sizeBytes());
+	cout << "Loaded " << filename << endl;
+	return create_mesh(commandBuffer, positions, normals, uvs, indices, filename.stem().string());
+}
 
+Mesh create_mesh(CommandBuffer& commandBuffer, const vector<float3>& vertices_, const vector<float3>& normals_, const vector<float2>& uvs_, const vector<uint32_t>& indices_, const string& name) {
 	vk::BufferUsageFlags bufferUsage = vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eStorageBuffer;
 	if (commandBuffer.mDevice.accelerationStructureFeatures().accelerationStructure) {
 		bufferUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
 		bufferUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
 	}
 
-    Mesh::Vertices vao;
-	vao[Mesh::VertexAttributeType::ePosition].emplace_back(
-            make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " vertices", positions_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer),
-            Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-	vao[Mesh::VertexAttributeType::eNormal].emplace_back(
-            make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " normals", normals_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer),
-            Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
-    vao.mAabb = vk::AabbPositionsKHR(vmin[0], vmin[1], vmin[2], vmax[0], vmax[1], vmax[2]);
-
-	Buffer::View<uint32_t> indexBuffer = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " indices", indices_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
-	Buffer::copy(commandBuffer, positions_tmp, vao.at(Mesh::VertexAttributeType::ePosition)[0].first);
-	Buffer::copy(commandBuffer, normals_tmp, vao.at(Mesh::VertexAttributeType::eNormal)[0].first);
-	Buffer::copy(commandBuffer, indices_tmp, indexBuffer);
+	// optimize triangle and vertex order for rasterization
+	vector<float3> vertices = vertices_;
+	vector<float3> normals = normals_;
+	vector<float2> uvs = uvs_;
+	vector<uint32_t> indices = indices_;
+	vector<uint32_t> vertexRemap;
+	const optional<Mesh::MeshletData> meshletData = Mesh::optimizeTriangles(vertices, indices, name, &vertexRemap);
+	if (meshletData) {
+		Mesh::remapVertices<float3>(vertices, vertexRemap);
+		if (normals.size() == vertices.size()) Mesh::remapVertices<float3>(normals, vertexRemap);
+		if (uvs.size() == vertices.size()) Mesh::remapVertices<float2>(uvs, vertexRemap);
+	}
 
-    if (!uvs.empty()) {
-        Buffer::View<float2> uvs_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp uvs", uvs.size()*sizeof(float2), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-        vao[Mesh::VertexAttributeType::eTexcoord].emplace_back(
-            make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " uvs", uvs_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer),
-            Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float2), vk::Format::eR32G32Sfloat, 0, vk::VertexInputRate::eVertex });
+	// compute aabb
+	float3 vmin = float3::Constant(numeric_limits<float>::infinity());
+	float3 vmax = float3::Constant(-numeric_limits<float>::infinity());
+	for (const float3& p : vertices) {
+		vmin = min(vmin, p);
+		vmax = max(vmax, p);
+	}
 
-		memcpy(uvs_tmp.data(), uvs.data(), uvs_tmp.sizeBytes());
+	Mesh::Vertices vao;
+	vao.mAabb = vk::AabbPositionsKHR(vmin[0], vmin[1], vmin[2], vmax[0], vmax[1], vmax[2]);
 
-		Buffer::copy(commandBuffer, uvs_tmp, vao.at(Mesh::VertexAttributeType::eTexcoord)[0].first);
-    }
+	const Mesh::VertexPrecision precision = Mesh::vertexPrecision(commandBuffer.mDevice);
+	vao[Mesh::VertexAttributeType::ePosition].emplace_back(Mesh::uploadPositions(commandBuffer, vertices, vao.mAabb, precision, name + " vertices", bufferUsage));
+	if (!normals.empty())
+		vao[Mesh::VertexAttributeType::eNormal].emplace_back(Mesh::uploadNormals(commandBuffer, normals, precision, name + " normals", bufferUsage));
+	if (!uvs.empty())
+		vao[Mesh::VertexAttributeType::eTexcoord].emplace_back(Mesh::uploadTexcoords(commandBuffer, uvs, precision, name + " uvs", bufferUsage));
 
-	cout << "Loaded " << filename << endl;
-	return Mesh(vao, indexBuffer, vk::PrimitiveTopology::eTriangleList);
+	Buffer::View<uint32_t> indices_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp indices", indices.size()*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	memcpy(indices_tmp.data(), indices.data(), indices_tmp.sizeBytes());
+	Buffer::View<uint32_t> indexBuffer = make_shared<Buffer>(commandBuffer.mDevice, name + " indices", indices_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eIndexBuffer);
+	Buffer::copy(commandBuffer, indices_tmp, indexBuffer);
+
+	Mesh mesh(vao, indexBuffer, vk::PrimitiveTopology::eTriangleList);
+	mesh.setGeometryHash(hashArgs(hashBytes(vertices.data(), vertices.size()*sizeof(float3)), hashBytes(indices.data(), indices.size()*sizeof(uint32_t))));
+	// attributes are encoded deterministically from the host data and the precision policy, so the content hash can be taken before encoding
+	mesh.setContentHash(hashArgs128(
+		hashBytes128(vertices.data(), vertices.size()*sizeof(float3)),
+		hashBytes128(indices.data(), indices.size()*sizeof(uint32_t)),
+		hashBytes128(normals.data(), normals.size()*sizeof(float3)),
+		hashBytes128(uvs.data(), uvs.size()*sizeof(float2)),
+		precision));
+	if (meshletData)
+		mesh.setMeshlets(Mesh::uploadMeshlets(commandBuffer, *meshletData, name));
+	return mesh;
 }
 
 }
\ No newline at end of file
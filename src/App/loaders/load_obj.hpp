@@ -6,4 +6,7 @@ namespace stm2 {
 
 Mesh loadObj(CommandBuffer& commandBuffer, const filesystem::path& filename);
 
+// Uploads triangle list vertex data into device-local buffers. normals and uvs may be empty.
+Mesh create_mesh(CommandBuffer& commandBuffer, const vector<float3>& vertices, const vector<float3>& normals, const vector<float2>& uvs, const vector<uint32_t>& indices, const string& name = "mesh");
+
 }
\ No newline at end of file
@@ -0,0 +1,410 @@
+#include "load_ply.hpp"
+#include "load_obj.hpp"
+
+#include <bit>
+#include <array>
+#include <sstream>
+
+namespace stm2 {
+
+enum class PlyType { eInt8, eUInt8, eInt16, eUInt16, eInt32, eUInt32, eFloat32, eFloat64 };
+enum class PlyFormat { eAscii, eBinaryLittleEndian, eBinaryBigEndian };
+
+static PlyType parsePlyType(const string& s) {
+	if (s == "char"   || s == "int8")    return PlyType::eInt8;
+	if (s == "uchar"  || s == "uint8")   return PlyType::eUInt8;
+	if (s == "short"  || s == "int16")   return PlyType::eInt16;
+	if (s == "ushort" || s == "uint16")  return PlyType::eUInt16;
+	if (s == "int"    || s == "int32")   return PlyType::eInt32;
+	if (s == "uint"   || s == "uint32")  return PlyType::eUInt32;
+	if (s == "float"  || s == "float32") return PlyType::eFloat32;
+	if (s == "double" || s == "float64") return PlyType::eFloat64;
+	throw runtime_error("Unknown PLY property type: " + s);
+}
+
+static size_t plyTypeSize(const PlyType t) {
+	switch (t) {
+	default:
+	case PlyType::eInt8:
+	case PlyType::eUInt8:   return 1;
+	case PlyType::eInt16:
+	case PlyType::eUInt16:  return 2;
+	case PlyType::eInt32:
+	case PlyType::eUInt32:
+	case PlyType::eFloat32: return 4;
+	case PlyType::eFloat64: return 8;
+	}
+}
+
+struct PlyProperty {
+	string mName;
+	PlyType mType;
+	optional<PlyType> mListCountType;
+};
+struct PlyElement {
+	string mName;
+	size_t mCount;
+	vector<PlyProperty> mProperties;
+};
+
+template<typename T>
+static T readBinary(istream& s, const bool swapEndian) {
+	T v;
+	s.read(reinterpret_cast<char*>(&v), sizeof(T));
+	if (swapEndian) {
+		auto bytes = bit_cast<array<uint8_t, sizeof(T)>>(v);
+		ranges::reverse(bytes);
+		v = bit_cast<T>(bytes);
+	}
+	return v;
+}
+
+static double readPlyValue(istream& s, const PlyType type, const PlyFormat format) {
+	if (format == PlyFormat::eAscii) {
+		double v;
+		s >> v;
+		return v;
+	}
+	const bool swapEndian = (format == PlyFormat::eBinaryBigEndian) != (endian::native == endian::big);
+	switch (type) {
+	default:
+	case PlyType::eInt8:    return readBinary<int8_t>(s, swapEndian);
+	case PlyType::eUInt8:   return readBinary<uint8_t>(s, swapEndian);
+	case PlyType::eInt16:   return readBinary<int16_t>(s, swapEndian);
+	case PlyType::eUInt16:  return readBinary<uint16_t>(s, swapEndian);
+	case PlyType::eInt32:   return readBinary<int32_t>(s, swapEndian);
+	case PlyType::eUInt32:  return readBinary<uint32_t>(s, swapEndian);
+	case PlyType::eFloat32: return readBinary<float>(s, swapEndian);
+	case PlyType::eFloat64: return readBinary<double>(s, swapEndian);
+	}
+}
+
+// reads the header, leaving fs at the start of the first element
+static pair<PlyFormat, vector<PlyElement>> readPlyHeader(istream& fs, const filesystem::path& filename) {
+	PlyFormat format = PlyFormat::eAscii;
+	vector<PlyElement> elements;
+	string line;
+	getline(fs, line);
+	if (line.rfind("ply", 0) != 0) throw runtime_error("Invalid PLY header: " + filename.string());
+	while (getline(fs, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		istringstream ss(line);
+		string token;
+		ss >> token;
+		if (token == "format") {
+			string f;
+			ss >> f;
+			if      (f == "ascii")                format = PlyFormat::eAscii;
+			else if (f == "binary_little_endian") format = PlyFormat::eBinaryLittleEndian;
+			else if (f == "binary_big_endian")    format = PlyFormat::eBinaryBigEndian;
+			else throw runtime_error("Unsupported PLY format: " + f);
+		} else if (token == "element") {
+			PlyElement& e = elements.emplace_back();
+			ss >> e.mName >> e.mCount;
+		} else if (token == "property") {
+			if (elements.empty()) throw runtime_error("PLY property declared before element");
+			PlyProperty& p = elements.back().mProperties.emplace_back();
+			string type;
+			ss >> type;
+			if (type == "list") {
+				string countType;
+				ss >> countType >> type;
+				p.mListCountType = parsePlyType(countType);
+			}
+			p.mType = parsePlyType(type);
+			ss >> p.mName;
+		} else if (token == "end_header")
+			break;
+	}
+	return { format, elements };
+}
+
+static void skipPlyElement(istream& fs, const PlyElement& e, const PlyFormat format) {
+	for (size_t i = 0; i < e.mCount; i++)
+		for (const PlyProperty& p : e.mProperties) {
+			const size_t n = p.mListCountType ? (size_t)readPlyValue(fs, *p.mListCountType, format) : 1;
+			if (format == PlyFormat::eAscii)
+				for (size_t j = 0; j < n; j++) readPlyValue(fs, p.mType, format);
+			else
+				fs.ignore(n * plyTypeSize(p.mType));
+		}
+}
+
+Mesh loadPly(CommandBuffer& commandBuffer, const filesystem::path& filename) {
+	ifstream fs(filename, ios::in | ios::binary);
+	if (!fs.is_open()) throw runtime_error("Unable to open the ply file: " + filename.string());
+
+	const auto[format, elements] = readPlyHeader(fs, filename);
+
+	vector<float3> positions;
+	vector<float3> normals;
+	vector<float2> uvs;
+	vector<uint32_t> indices;
+
+	for (const PlyElement& e : elements) {
+		if (e.mName == "vertex") {
+			int px = -1, py = -1, pz = -1, nx = -1, ny = -1, nz = -1, u = -1, v = -1;
+			for (int i = 0; i < (int)e.mProperties.size(); i++) {
+				const string& n = e.mProperties[i].mName;
+				if      (n == "x") px = i;
+				else if (n == "y") py = i;
+				else if (n == "z") pz = i;
+				else if (n == "nx") nx = i;
+				else if (n == "ny") ny = i;
+				else if (n == "nz") nz = i;
+				else if (n == "u" || n == "s" || n == "texture_u" || n == "texture_s") u = i;
+				else if (n == "v" || n == "t" || n == "texture_v" || n == "texture_t") v = i;
+			}
+			if (px < 0 || py < 0 || pz < 0) throw runtime_error("PLY vertex element has no position: " + filename.string());
+			const bool hasNormals = nx >= 0 && ny >= 0 && nz >= 0;
+			const bool hasUvs = u >= 0 && v >= 0;
+
+			positions.resize(e.mCount);
+			if (hasNormals) normals.resize(e.mCount);
+			if (hasUvs) uvs.resize(e.mCount);
+			vector<double> values(e.mProperties.size());
+			for (size_t vi = 0; vi < e.mCount; vi++) {
+				for (size_t i = 0; i < e.mProperties.size(); i++) {
+					const PlyProperty& p = e.mProperties[i];
+					if (p.mListCountType) {
+						const size_t n = (size_t)readPlyValue(fs, *p.mListCountType, format);
+						for (size_t j = 0; j < n; j++) readPlyValue(fs, p.mType, format);
+						values[i] = 0;
+					} else
+						values[i] = readPlyValue(fs, p.mType, format);
+				}
+				positions[vi] = float3((float)values[px], (float)values[py], (float)values[pz]);
+				if (hasNormals) normals[vi] = normalize(float3((float)values[nx], (float)values[ny], (float)values[nz]));
+				if (hasUvs) uvs[vi] = float2((float)values[u], 1 - (float)values[v]);
+			}
+		} else if (e.mName == "face") {
+			indices.reserve(e.mCount*3);
+			vector<uint32_t> polygon;
+			for (size_t fi = 0; fi < e.mCount; fi++) {
+				for (const PlyProperty& p : e.mProperties) {
+					if (p.mListCountType) {
+						const size_t n = (size_t)readPlyValue(fs, *p.mListCountType, format);
+						polygon.resize(n);
+						for (size_t j = 0; j < n; j++)
+							polygon[j] = (uint32_t)readPlyValue(fs, p.mType, format);
+						if (p.mName != "vertex_indices" && p.mName != "vertex_index") continue;
+						// triangulate as a fan
+						for (size_t j = 2; j < n; j++) {
+							indices.push_back(polygon[0]);
+							indices.push_back(polygon[j-1]);
+							indices.push_back(polygon[j]);
+						}
+					} else
+						readPlyValue(fs, p.mType, format);
+				}
+			}
+		} else
+			skipPlyElement(fs, e, format); // skip unknown elements
+		if (!fs.good()) throw runtime_error("Unexpected end of file while reading PLY element \"" + e.mName + "\": " + filename.string());
+	}
+
+	if (indices.empty()) throw runtime_error("PLY file contains no faces: " + filename.string());
+
+	cout << "Loaded " << filename << endl;
+	return create_mesh(commandBuffer, positions, normals, uvs, indices, filename.stem().string());
+}
+
+template<typename T>
+static T decodeBinary(const char* p, const bool swapEndian) {
+	array<uint8_t, sizeof(T)> bytes;
+	memcpy(bytes.data(), p, sizeof(T));
+	if (swapEndian) ranges::reverse(bytes);
+	return bit_cast<T>(bytes);
+}
+
+// decodes a value of a binary element, see readPlyValue
+static double decodePlyValue(const char* p, const PlyType type, const bool swapEndian) {
+	switch (type) {
+	default:
+	case PlyType::eInt8:    return decodeBinary<int8_t>(p, swapEndian);
+	case PlyType::eUInt8:   return decodeBinary<uint8_t>(p, swapEndian);
+	case PlyType::eInt16:   return decodeBinary<int16_t>(p, swapEndian);
+	case PlyType::eUInt16:  return decodeBinary<uint16_t>(p, swapEndian);
+	case PlyType::eInt32:   return decodeBinary<int32_t>(p, swapEndian);
+	case PlyType::eUInt32:  return decodeBinary<uint32_t>(p, swapEndian);
+	case PlyType::eFloat32: return decodeBinary<float>(p, swapEndian);
+	case PlyType::eFloat64: return decodeBinary<double>(p, swapEndian);
+	}
+}
+
+bool loadPlyPoints(const filesystem::path& filename, vector<float4>& points, vector<uint32_t>& colors) {
+	ifstream fs(filename, ios::in | ios::binary);
+	if (!fs.is_open()) throw runtime_error("Unable to open the ply file: " + filename.string());
+
+	const auto[format, elements] = readPlyHeader(fs, filename);
+	if (ranges::any_of(elements, [](const PlyElement& e) { return e.mName == "face" && e.mCount > 0; }))
+		return false;
+
+	for (const PlyElement& e : elements) {
+		if (e.mName != "vertex") {
+			skipPlyElement(fs, e, format);
+			continue;
+		}
+
+		int px = -1, py = -1, pz = -1, pr = -1;
+		array<int, 4> rgba = { -1, -1, -1, -1 };
+		for (int i = 0; i < (int)e.mProperties.size(); i++) {
+			const string& n = e.mProperties[i].mName;
+			if      (n == "x") px = i;
+			else if (n == "y") py = i;
+			else if (n == "z") pz = i;
+			else if (n == "radius") pr = i;
+			else if (n == "red"   || n == "r" || n == "diffuse_red")   rgba[0] = i;
+			else if (n == "green" || n == "g" || n == "diffuse_green") rgba[1] = i;
+			else if (n == "blue"  || n == "b" || n == "diffuse_blue")  rgba[2] = i;
+			else if (n == "alpha" || n == "a") rgba[3] = i;
+		}
+		if (px < 0 || py < 0 || pz < 0) throw runtime_error("PLY vertex element has no position: " + filename.string());
+		const bool hasColors = rgba[0] >= 0 && rgba[1] >= 0 && rgba[2] >= 0;
+
+		points.resize(e.mCount);
+		if (hasColors) colors.resize(e.mCount);
+
+		// colors are 8-bit sRGB, or normalized if stored as floating point
+		auto storePoint = [&](const size_t vi, const auto& value) {
+			points[vi] = float4((float)value(px), (float)value(py), (float)value(pz), pr >= 0 ? (float)value(pr) : 0.f);
+			if (!hasColors) return;
+			uint32_t c = 0;
+			for (uint32_t j = 0; j < 4; j++) {
+				double v = 255;
+				if (rgba[j] >= 0) {
+					v = value(rgba[j]);
+					const PlyType t = e.mProperties[rgba[j]].mType;
+					if (t == PlyType::eFloat32 || t == PlyType::eFloat64) v *= 255;
+				}
+				c |= (uint32_t)clamp(v, 0.0, 255.0) << (8*j);
+			}
+			colors[vi] = c;
+		};
+
+		if (format != PlyFormat::eAscii && ranges::none_of(e.mProperties, [](const PlyProperty& p) { return p.mListCountType.has_value(); })) {
+			// fixed-size vertices are read in blocks, instead of one value at a time
+			const bool swapEndian = (format == PlyFormat::eBinaryBigEndian) != (endian::native == endian::big);
+			vector<size_t> offsets(e.mProperties.size());
+			size_t stride = 0;
+			for (size_t i = 0; i < e.mProperties.size(); i++) {
+				offsets[i] = stride;
+				stride += plyTypeSize(e.mProperties[i].mType);
+			}
+			const size_t blockSize = max<size_t>(1, (1 << 24) / stride);
+			vector<char> block(blockSize*stride);
+			for (size_t first = 0; first < e.mCount; first += blockSize) {
+				const size_t count = min(blockSize, e.mCount - first);
+				fs.read(block.data(), count*stride);
+				if (!fs.good()) break;
+				for (size_t vi = 0; vi < count; vi++) {
+					const char* vertex = block.data() + vi*stride;
+					storePoint(first + vi, [&](const int i) { return decodePlyValue(vertex + offsets[i], e.mProperties[i].mType, swapEndian); });
+				}
+			}
+		} else {
+			vector<double> values(e.mProperties.size());
+			for (size_t vi = 0; vi < e.mCount; vi++) {
+				for (size_t i = 0; i < e.mProperties.size(); i++) {
+					const PlyProperty& p = e.mProperties[i];
+					if (p.mListCountType) {
+						const size_t n = (size_t)readPlyValue(fs, *p.mListCountType, format);
+						for (size_t j = 0; j < n; j++) readPlyValue(fs, p.mType, format);
+						values[i] = 0;
+					} else
+						values[i] = readPlyValue(fs, p.mType, format);
+				}
+				storePoint(vi, [&](const int i) { return values[i]; });
+			}
+		}
+		if (!fs.good()) throw runtime_error("Unexpected end of file while reading PLY element \"" + e.mName + "\": " + filename.string());
+		break;
+	}
+
+	if (points.empty()) throw runtime_error("PLY file contains no vertices: " + filename.string());
+	return true;
+}
+
+// a raw stream of little-endian float32 x, y, z and radius
+static vector<float4> loadXyzr(const filesystem::path& filename) {
+	ifstream fs(filename, ios::in | ios::binary);
+	if (!fs.is_open()) throw runtime_error("Unable to open the point file: " + filename.string());
+	const size_t size = filesystem::file_size(filename);
+	if (size % sizeof(float4) != 0)
+		cerr << "Warning: Ignoring " << size % sizeof(float4) << " trailing bytes in " << filename << endl;
+	vector<float4> points(size / sizeof(float4));
+	fs.read(reinterpret_cast<char*>(points.data()), points.size()*sizeof(float4));
+	if (endian::native == endian::big)
+		for (float4& p : points)
+			for (float& f : p)
+				f = decodeBinary<float>(reinterpret_cast<const char*>(&f), true);
+	return points;
+}
+
+shared_ptr<Node> Scene::loadPointCloud(CommandBuffer& commandBuffer, const filesystem::path& filename) {
+	vector<float4> points;
+	vector<uint32_t> colors;
+	if (filename.extension() == ".xyzr")
+		points = loadXyzr(filename);
+	else if (!loadPlyPoints(filename, points, colors)) {
+		// PLY files with faces are meshes
+#ifdef ENABLE_ASSIMP
+		return loadAssimp(commandBuffer, filename);
+#else
+		const shared_ptr<Node> node = Node::create(filename.stem().string());
+		const shared_ptr<Material> material = node->makeComponent<Material>();
+		material->mMaterialData.setBaseColor(float3::Ones());
+		material->mMaterialData.setMetallic(0);
+		material->mMaterialData.setEta(1.5f);
+		node->makeComponent<MeshPrimitive>(material, make_shared<Mesh>(loadPly(commandBuffer, filename)));
+		return node;
+#endif
+	}
+
+	// drop degenerate points, which would give the BLAS empty bounds
+	const size_t count = points.size();
+	for (size_t i = 0; i < points.size();) {
+		if (points[i].isFinite().all() && points[i][3] >= 0) {
+			i++;
+			continue;
+		}
+		points[i] = points.back();
+		points.pop_back();
+		if (!colors.empty()) {
+			colors[i] = colors.back();
+			colors.pop_back();
+		}
+	}
+	if (points.size() < count)
+		cerr << "Warning: Skipping " << count - points.size() << " invalid points in " << filename << endl;
+	if (points.empty()) return nullptr;
+
+	// points without a radius are sized to roughly the spacing of points sampling the surface of their bounds
+	if (ranges::any_of(points, [](const float4& p) { return p[3] == 0; })) {
+		float3 mn = float3::Constant( numeric_limits<float>::infinity());
+		float3 mx = float3::Constant(-numeric_limits<float>::infinity());
+		for (const float4& p : points) {
+			const float3 center = p.head<3>();
+			mn = min(mn, center);
+			mx = max(mx, center);
+		}
+		float radius = (mx - mn).matrix().norm() / sqrt((float)points.size());
+		if (radius <= 0) radius = 1;
+		for (float4& p : points)
+			if (p[3] == 0) p[3] = radius;
+	}
+
+	const shared_ptr<Node> node = Node::create(filename.stem().string());
+	const shared_ptr<Material> material = node->makeComponent<Material>();
+	material->mMaterialData.setBaseColor(float3::Ones());
+	material->mMaterialData.setMetallic(0);
+	material->mMaterialData.setEta(1.5f);
+	const shared_ptr<PointCloudPrimitive> prim = node->makeComponent<PointCloudPrimitive>();
+	prim->mMaterial = material;
+	prim->setPoints(commandBuffer, points, colors);
+
+	cout << "Loaded " << points.size() << " points from " << filename << endl;
+	return node;
+}
+
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <App/Scene.hpp>
+
+namespace stm2 {
+
+Mesh loadPly(CommandBuffer& commandBuffer, const filesystem::path& filename);
+// Reads the vertices of a PLY file without faces as points, with an optional "radius" property and 8-bit sRGB colors.
+// Points without a radius have a radius of 0. Returns false if the file has faces.
+bool loadPlyPoints(const filesystem::path& filename, vector<float4>& points, vector<uint32_t>& colors);
+
+}
@@ -149,6 +149,7 @@ Mesh loadSerialized(CommandBuffer& commandBuffer, const filesystem::path& filena
 
 	Mesh::Vertices attributes;
 
+	// attributes are read into staging buffers, and uploaded after the mesh is optimized
 	Buffer::View<float3> positions_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp positions", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 	{
 		float3 vmin = float3::Constant(numeric_limits<float>::infinity());
@@ -169,13 +170,11 @@ Mesh loadSerialized(CommandBuffer& commandBuffer, const filesystem::path& filena
 			}
 		}
 		attributes.mAabb = vk::AabbPositionsKHR(vmin[0], vmin[1], vmin[2], vmax[0], vmax[1], vmax[2]);
-		Buffer::View<float3> positions = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " positions", positions_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		Buffer::copy(commandBuffer, positions_tmp, positions);
-		attributes[Mesh::VertexAttributeType::ePosition].emplace_back(positions, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
 	}
 
+	Buffer::View<float3> normals_tmp;
 	if (flags & EHasNormals) {
-		Buffer::View<float3> normals_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp normals", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		normals_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp normals", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 		if (file_double_precision) {
 			for (uint32_t i = 0; i < vertex_count; i++) {
 				double3 tmp;
@@ -186,13 +185,11 @@ Mesh loadSerialized(CommandBuffer& commandBuffer, const filesystem::path& filena
 			for (uint32_t i = 0; i < vertex_count; i++)
 				zs.read(normals_tmp[i].data(), sizeof(float) * 3);
 		}
-		Buffer::View<float3> normals = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " normals", normals_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		Buffer::copy(commandBuffer, normals_tmp, normals);
-		attributes[Mesh::VertexAttributeType::eNormal].emplace_back(normals, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
 	}
 
+	Buffer::View<float2> uvs_tmp;
 	if (flags & EHasTexcoords) {
-		Buffer::View<float2> uvs_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp uvs", sizeof(float2) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		uvs_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp uvs", sizeof(float2) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 		if (file_double_precision) {
 			for (uint32_t i = 0; i < vertex_count; i++) {
 				double2 tmp;
@@ -203,13 +200,11 @@ Mesh loadSerialized(CommandBuffer& commandBuffer, const filesystem::path& filena
 			for (uint32_t i = 0; i < vertex_count; i++)
 				zs.read(uvs_tmp[i].data(), sizeof(float) * 2);
 		}
-		Buffer::View<float2> uvs = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " uvs", uvs_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		Buffer::copy(commandBuffer, uvs_tmp, uvs);
-		attributes[Mesh::VertexAttributeType::eTexcoord].emplace_back(uvs, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float2), vk::Format::eR32G32Sfloat, 0, vk::VertexInputRate::eVertex });
 	}
 
+	Buffer::View<float3> colors_tmp;
 	if (flags & EHasColors) {
-		Buffer::View<float3> colors_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp colors", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		colors_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp colors", sizeof(float3) * vertex_count, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 		if (file_double_precision) {
 			for (uint32_t i = 0; i < vertex_count; i++) {
 				double3 tmp;
@@ -220,18 +215,51 @@ Mesh loadSerialized(CommandBuffer& commandBuffer, const filesystem::path& filena
 			for (uint32_t i = 0; i < vertex_count; i++)
 				zs.read(colors_tmp[i].data(), sizeof(float) * 3);
 		}
-		Buffer::View<float2> colors = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " colors", colors_tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
-		Buffer::copy(commandBuffer, colors_tmp, colors);
-		attributes[Mesh::VertexAttributeType::eColor].emplace_back(colors, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(float3), vk::Format::eR32G32B32Sfloat, 0, vk::VertexInputRate::eVertex });
 	}
 
 	Buffer::View<uint32_t> indices_tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp inds", 3 * triangle_count * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 	zs.read(indices_tmp.data(), sizeof(uint32_t) * 3 * triangle_count);
 
+	// optimize triangle and vertex order for rasterization
+	vector<uint32_t> vertexRemap;
+	const optional<Mesh::MeshletData> meshletData = Mesh::optimizeTriangles(span(positions_tmp.data(), positions_tmp.size()), span(indices_tmp.data(), indices_tmp.size()), filename.stem().string(), &vertexRemap);
+	if (meshletData) {
+		Mesh::remapVertices(span(positions_tmp.data(), positions_tmp.size()), vertexRemap);
+		if (normals_tmp) Mesh::remapVertices(span(normals_tmp.data(), normals_tmp.size()), vertexRemap);
+		if (uvs_tmp)     Mesh::remapVertices(span(uvs_tmp.data(), uvs_tmp.size()), vertexRemap);
+		if (colors_tmp)  Mesh::remapVertices(span(colors_tmp.data(), colors_tmp.size()), vertexRemap);
+	}
+
+	auto uploadAttribute = [&]<typename T>(const Mesh::VertexAttributeType type, const Buffer::View<T>& tmp, const vk::Format format, const string& attributeName) {
+		if (!tmp) return;
+		Buffer::View<T> buf = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " " + attributeName, tmp.sizeBytes(), bufferUsage|vk::BufferUsageFlagBits::eVertexBuffer);
+		Buffer::copy(commandBuffer, tmp, buf);
+		attributes[type].emplace_back(buf, Mesh::VertexAttributeDescription{ (uint32_t)sizeof(T), format, 0, vk::VertexInputRate::eVertex });
+	};
+	// positions, normals and uvs are encoded by the precision policy
+	const Mesh::VertexPrecision precision = Mesh::vertexPrecision(commandBuffer.mDevice);
+	attributes[Mesh::VertexAttributeType::ePosition].emplace_back(Mesh::uploadPositions(commandBuffer, span(positions_tmp.data(), positions_tmp.size()), attributes.mAabb, precision, filename.stem().string() + " positions", bufferUsage));
+	if (normals_tmp)
+		attributes[Mesh::VertexAttributeType::eNormal].emplace_back(Mesh::uploadNormals(commandBuffer, span(normals_tmp.data(), normals_tmp.size()), precision, filename.stem().string() + " normals", bufferUsage));
+	if (uvs_tmp)
+		attributes[Mesh::VertexAttributeType::eTexcoord].emplace_back(Mesh::uploadTexcoords(commandBuffer, span(uvs_tmp.data(), uvs_tmp.size()), precision, filename.stem().string() + " uvs", bufferUsage));
+	uploadAttribute(Mesh::VertexAttributeType::eColor, colors_tmp, vk::Format::eR32G32B32Sfloat, "colors");
+
 	Buffer::View<uint32_t> indexBuffer = make_shared<Buffer>(commandBuffer.mDevice, filename.stem().string() + " indices", indices_tmp.sizeBytes(), bufferUsage | vk::BufferUsageFlagBits::eIndexBuffer);
 	Buffer::copy(commandBuffer, indices_tmp, indexBuffer);
 
-	return Mesh(attributes, indexBuffer, vk::PrimitiveTopology::eTriangleList);
+	Mesh mesh(attributes, indexBuffer, vk::PrimitiveTopology::eTriangleList);
+	mesh.setGeometryHash(hashArgs(hashBytes(positions_tmp.data(), positions_tmp.sizeBytes()), hashBytes(indices_tmp.data(), indices_tmp.sizeBytes())));
+	mesh.setContentHash(hashArgs128(
+		hashBytes128(positions_tmp.data(), positions_tmp.sizeBytes()),
+		hashBytes128(indices_tmp.data(), indices_tmp.sizeBytes()),
+		normals_tmp ? hashBytes128(normals_tmp.data(), normals_tmp.sizeBytes()) : Hash128{},
+		uvs_tmp     ? hashBytes128(uvs_tmp.data(), uvs_tmp.sizeBytes()) : Hash128{},
+		colors_tmp  ? hashBytes128(colors_tmp.data(), colors_tmp.sizeBytes()) : Hash128{},
+		precision));
+	if (meshletData)
+		mesh.setMeshlets(Mesh::uploadMeshlets(commandBuffer, *meshletData, filename.stem().string()));
+	return mesh;
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "AccelerationStructureCache.hpp"
+
+#include <thread>
+#include <imgui/imgui.h>
+
+namespace stm2 {
+
+namespace {
+
+struct CacheFileHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	uint64_t mKey;
+	uint64_t mSize; // size of the serialized acceleration structure that follows
+};
+static constexpr uint32_t gCacheFileMagic = 0x53414D53; // "SMAS"
+static constexpr uint32_t gCacheFileVersion = 1;
+
+// serialized acceleration structures must be 256-byte aligned in device memory
+static constexpr vk::DeviceSize gSerializedAlignment = 256;
+
+AccelerationStructureCache::AccelerationStructureData createAccelerationStructure(Device& device, const string& name, const vk::DeviceSize size) {
+	Buffer::View<byte> buffer = make_shared<Buffer>(
+		device,
+		name + "/Buffer",
+		size,
+		vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress);
+	auto accelerationStructure = make_shared<vk::raii::AccelerationStructureKHR>(*device, vk::AccelerationStructureCreateInfoKHR({}, **buffer.buffer(), buffer.absoluteOffset(), buffer.sizeBytes(), vk::AccelerationStructureTypeKHR::eBottomLevel));
+	device.setDebugName(**accelerationStructure, name);
+	return { accelerationStructure, buffer };
+}
+
+// host visible buffer with a 256-byte aligned device address
+Buffer::View<byte> createSerializedBuffer(Device& device, const string& name, const vk::DeviceSize size) {
+	const shared_ptr<Buffer> buffer = make_shared<Buffer>(
+		device,
+		name,
+		size + gSerializedAlignment,
+		vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		true);
+	const vk::DeviceSize offset = (-buffer->deviceAddress() & (gSerializedAlignment - 1));
+	return Buffer::View<byte>(buffer, offset, size);
+}
+
+void recordQuery(CommandBuffer& commandBuffer, vk::raii::QueryPool& queryPool, const vk::AccelerationStructureKHR accelerationStructure, const vk::QueryType type) {
+	commandBuffer->resetQueryPool(*queryPool, 0, 1);
+	commandBuffer->writeAccelerationStructuresPropertiesKHR(accelerationStructure, type, *queryPool, 0);
+}
+
+}
+
+filesystem::path AccelerationStructureCache::filename(Device& device, const size_t key) const {
+	const vk::PhysicalDeviceProperties properties = device.physical().getProperties();
+	const size_t deviceKey = hashArgs(hashBytes(properties.pipelineCacheUUID.data(), VK_UUID_SIZE), properties.vendorID, properties.deviceID, properties.driverVersion);
+	ostringstream name;
+	name << hex << setfill('0') << setw(16) << hashArgs(key, deviceKey) << ".blas";
+	return mDirectory / name.str();
+}
+
+optional<AccelerationStructureCache::AccelerationStructureData> AccelerationStructureCache::load(CommandBuffer& commandBuffer, const size_t key, const string& name) {
+	if (!enabled()) return nullopt;
+
+	const filesystem::path path = filename(commandBuffer.mDevice, key);
+	ifstream file(path, ios::binary);
+	if (!file.is_open()) {
+		mStats.mMisses++;
+		return nullopt;
+	}
+
+	CacheFileHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || header.mMagic != gCacheFileMagic || header.mVersion != gCacheFileVersion || header.mKey != key || header.mSize < 2*VK_UUID_SIZE + 3*sizeof(uint64_t)) {
+		mStats.mMisses++;
+		return nullopt;
+	}
+
+	const Buffer::View<byte> serialized = createSerializedBuffer(commandBuffer.mDevice, name + "/Serialized", header.mSize);
+	file.read(reinterpret_cast<char*>(serialized.data()), header.mSize);
+	if (!file) {
+		cerr << "Warning: Failed to read " << path << endl;
+		mStats.mMisses++;
+		return nullopt;
+	}
+
+	// the serialized data begins with the driver UUID and compatibility data, followed by the serialized and deserialized sizes
+	const uint8_t* versionData = reinterpret_cast<const uint8_t*>(serialized.data());
+	if (commandBuffer.mDevice->getAccelerationStructureCompatibilityKHR(vk::AccelerationStructureVersionInfoKHR(versionData)) != vk::AccelerationStructureCompatibilityKHR::eCompatible) {
+		mStats.mMisses++;
+		return nullopt;
+	}
+	uint64_t deserializedSize;
+	memcpy(&deserializedSize, versionData + 2*VK_UUID_SIZE + sizeof(uint64_t), sizeof(uint64_t));
+
+	const AccelerationStructureData result = createAccelerationStructure(commandBuffer.mDevice, name, deserializedSize);
+	commandBuffer->copyMemoryToAccelerationStructureKHR(vk::CopyMemoryToAccelerationStructureInfoKHR(
+		vk::DeviceOrHostAddressConstKHR(serialized.deviceAddress()), **result.first, vk::CopyAccelerationStructureModeKHR::eDeserialize));
+
+	commandBuffer.trackResource(serialized.buffer());
+	commandBuffer.trackResource(result.second.buffer());
+	commandBuffer.trackVulkanResource(result.first);
+
+	mStats.mHits++;
+	mStats.mBytesRead += header.mSize;
+	return result;
+}
+
+void AccelerationStructureCache::store(CommandBuffer& commandBuffer, const size_t key, const AccelerationStructureData& accelerationStructure) {
+	if (!enabled()) return;
+	mPending.emplace_back(PendingWrite::State::eBuilt, key, accelerationStructure.second.buffer()->resourceName(), commandBuffer.mDevice.frameIndex(), accelerationStructure);
+}
+
+void AccelerationStructureCache::update(CommandBuffer& commandBuffer) {
+	if (mPending.empty()) return;
+
+	Device& device = commandBuffer.mDevice;
+
+	// the builds, compaction copies and serialization of earlier frames must finish before their results are queried or copied
+	commandBuffer->pipelineBarrier(
+		vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR|vk::PipelineStageFlagBits::eHost,
+		{},
+		vk::MemoryBarrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR|vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eAccelerationStructureReadKHR|vk::AccessFlagBits::eHostRead),
+		{}, {});
+
+	for (auto it = mPending.begin(); it != mPending.end();) {
+		PendingWrite& p = *it;
+
+		if (p.mState != PendingWrite::State::eBuilt && p.mFrameIndex > device.lastFrameDone()) {
+			it++;
+			continue;
+		}
+
+		try {
+			switch (p.mState) {
+			case PendingWrite::State::eBuilt:
+				p.mQueryPool = make_shared<vk::raii::QueryPool>(*device, vk::QueryPoolCreateInfo({}, vk::QueryType::eAccelerationStructureCompactedSizeKHR, 1));
+				recordQuery(commandBuffer, *p.mQueryPool, **p.mAccelerationStructure.first, vk::QueryType::eAccelerationStructureCompactedSizeKHR);
+				commandBuffer.trackVulkanResource(p.mAccelerationStructure.first);
+				p.mState = PendingWrite::State::eQueried;
+				break;
+
+			case PendingWrite::State::eQueried: {
+				const auto[result, compactedSize] = p.mQueryPool->getResult<vk::DeviceSize>(0, 1, sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64);
+				if (result != vk::Result::eSuccess) { it++; continue; }
+
+				const AccelerationStructureData compacted = createAccelerationStructure(device, p.mName + "/Compacted", compactedSize);
+				commandBuffer->copyAccelerationStructureKHR(vk::CopyAccelerationStructureInfoKHR(**p.mAccelerationStructure.first, **compacted.first, vk::CopyAccelerationStructureModeKHR::eCompact));
+				commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, {},
+					vk::MemoryBarrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR), {}, {});
+				p.mQueryPool = make_shared<vk::raii::QueryPool>(*device, vk::QueryPoolCreateInfo({}, vk::QueryType::eAccelerationStructureSerializationSizeKHR, 1));
+				recordQuery(commandBuffer, *p.mQueryPool, **compacted.first, vk::QueryType::eAccelerationStructureSerializationSizeKHR);
+
+				commandBuffer.trackVulkanResource(p.mAccelerationStructure.first);
+				commandBuffer.trackResource(compacted.second.buffer());
+				commandBuffer.trackVulkanResource(compacted.first);
+				// the original is still used by the scene, only the compacted copy is written
+				p.mAccelerationStructure = compacted;
+				p.mState = PendingWrite::State::eCompacted;
+				break;
+			}
+
+			case PendingWrite::State::eCompacted: {
+				const auto[result, serializedSize] = p.mQueryPool->getResult<vk::DeviceSize>(0, 1, sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64);
+				if (result != vk::Result::eSuccess) { it++; continue; }
+
+				p.mSerialized = createSerializedBuffer(device, p.mName + "/Serialized", serializedSize);
+				commandBuffer->copyAccelerationStructureToMemoryKHR(vk::CopyAccelerationStructureToMemoryInfoKHR(
+					**p.mAccelerationStructure.first, vk::DeviceOrHostAddressKHR(p.mSerialized.deviceAddress()), vk::CopyAccelerationStructureModeKHR::eSerialize));
+
+				commandBuffer.trackVulkanResource(p.mAccelerationStructure.first);
+				commandBuffer.trackResource(p.mAccelerationStructure.second.buffer());
+				commandBuffer.trackResource(p.mSerialized.buffer());
+				p.mQueryPool.reset();
+				p.mState = PendingWrite::State::eSerialized;
+				break;
+			}
+
+			case PendingWrite::State::eSerialized: {
+				const filesystem::path path = filename(device, p.mKey);
+				filesystem::create_directories(path.parent_path());
+				// written to a temporary file first, so that other instances never read a partial file
+				const filesystem::path tmp = filesystem::path(path).concat(".tmp" + to_string(hash<thread::id>()(this_thread::get_id())));
+				{
+					ofstream file(tmp, ios::binary);
+					if (!file.is_open()) throw runtime_error("Could not open " + tmp.string());
+					const CacheFileHeader header{ gCacheFileMagic, gCacheFileVersion, p.mKey, p.mSerialized.sizeBytes() };
+					file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+					file.write(reinterpret_cast<const char*>(p.mSerialized.data()), p.mSerialized.sizeBytes());
+					if (!file) throw runtime_error("Failed to write " + tmp.string());
+				}
+				filesystem::rename(tmp, path);
+				mStats.mWritten++;
+				mStats.mBytesWritten += p.mSerialized.sizeBytes();
+				it = mPending.erase(it);
+				continue;
+			}
+			}
+		} catch (exception& e) {
+			cerr << "Warning: Failed to cache acceleration structure " << p.mName << ": " << e.what() << endl;
+			it = mPending.erase(it);
+			continue;
+		}
+
+		p.mFrameIndex = device.frameIndex();
+		it++;
+	}
+}
+
+void AccelerationStructureCache::drawGui() {
+	ImGui::Text("%u hits, %u misses", mStats.mHits, mStats.mMisses);
+	ImGui::Text("%u written, %u pending", mStats.mWritten, (uint32_t)mPending.size());
+	ImGui::Text("%.2f MiB read, %.2f MiB written", mStats.mBytesRead/float(1 << 20), mStats.mBytesWritten/float(1 << 20));
+}
+
+}
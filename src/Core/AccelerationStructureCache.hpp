@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Buffer.hpp"
+
+namespace stm2 {
+
+// On-disk cache of compacted bottom level acceleration structures. Structures built this run are
+// compacted and serialized over the next few frames, without stalling; later runs deserialize
+// them with vkCmdCopyMemoryToAccelerationStructureKHR instead of rebuilding.
+// Files are keyed by geometry hash and the device's pipeline cache UUID, and are checked with
+// vkGetDeviceAccelerationStructureCompatibilityKHR before use, so driver updates invalidate them.
+class AccelerationStructureCache {
+public:
+	using AccelerationStructureData = pair<shared_ptr<vk::raii::AccelerationStructureKHR>, Buffer::View<byte> /* acceleration structure buffer */>;
+
+	struct Stats {
+		uint32_t mHits = 0;
+		uint32_t mMisses = 0;
+		uint32_t mWritten = 0;
+		vk::DeviceSize mBytesRead = 0;
+		vk::DeviceSize mBytesWritten = 0;
+	};
+
+	// Disabled if directory is empty
+	inline AccelerationStructureCache(const filesystem::path& directory = {}) : mDirectory(directory) {}
+
+	inline void setDirectory(const filesystem::path& directory) { mDirectory = directory; }
+	inline const filesystem::path& directory() const { return mDirectory; }
+	inline bool enabled() const { return !mDirectory.empty(); }
+
+	// Records a copy of the cached structure into a new acceleration structure, or returns nullopt on a miss.
+	// The result must be barriered before use, the same as a build.
+	optional<AccelerationStructureData> load(CommandBuffer& commandBuffer, const size_t key, const string& name);
+
+	// Queues a structure built in commandBuffer to be compacted and written to the cache
+	void store(CommandBuffer& commandBuffer, const size_t key, const AccelerationStructureData& accelerationStructure);
+
+	// Advances queued writes whose previous commands have finished executing. Called once per frame,
+	// after any builds passed to store() were recorded.
+	void update(CommandBuffer& commandBuffer);
+
+	inline const Stats& stats() const { return mStats; }
+	void drawGui();
+
+private:
+	struct PendingWrite {
+		enum class State {
+			eBuilt,      // waiting to query the compacted size
+			eQueried,    // compacted size query recorded
+			eCompacted,  // compacted copy and serialization size query recorded
+			eSerialized, // serialization recorded into mSerialized
+		};
+		State mState;
+		size_t mKey;
+		string mName;
+		size_t mFrameIndex; // frame in which the last command for this entry was recorded
+		AccelerationStructureData mAccelerationStructure;
+		shared_ptr<vk::raii::QueryPool> mQueryPool;
+		Buffer::View<byte> mSerialized;
+	};
+
+	filesystem::path mDirectory;
+	vector<PendingWrite> mPending;
+	Stats mStats;
+
+	filesystem::path filename(Device& device, const size_t key) const;
+};
+
+}
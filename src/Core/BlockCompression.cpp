@@ -0,0 +1,602 @@
+#include "BlockCompression.hpp"
+
+#include <bit>
+#include <cmath>
+#include <array>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STM2_BC_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define STM2_BC_NEON
+#endif
+
+namespace stm2 {
+
+// Encoders work on one 4x4 block at a time. Every encoder uses a single endpoint pair (BC7 mode 6, BC6H mode 11),
+// fit along the principal axis of the block and refined once with least squares. Index selection, where most of
+// the time goes, compares four texels against each palette entry at once with SSE2 or NEON.
+
+namespace {
+
+using Texels = array<array<float,4>, 16>;
+
+// Four floats in an SSE2 or NEON register, or in an array on other targets.
+// Masks returned by lessThan have every bit of a lane set where the comparison holds.
+struct Float4 {
+#if defined(STM2_BC_SSE2)
+	__m128 v;
+	static inline Float4 set(const float x) { return { _mm_set1_ps(x) }; }
+	static inline Float4 load(const float* p) { return { _mm_loadu_ps(p) }; }
+	inline void store(float* p) const { _mm_storeu_ps(p, v); }
+	friend inline Float4 operator+(const Float4 a, const Float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+	friend inline Float4 operator-(const Float4 a, const Float4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+	friend inline Float4 operator*(const Float4 a, const Float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+	friend inline Float4 lessThan(const Float4 a, const Float4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	friend inline Float4 select(const Float4 mask, const Float4 a, const Float4 b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+#elif defined(STM2_BC_NEON)
+	float32x4_t v;
+	static inline Float4 set(const float x) { return { vdupq_n_f32(x) }; }
+	static inline Float4 load(const float* p) { return { vld1q_f32(p) }; }
+	inline void store(float* p) const { vst1q_f32(p, v); }
+	friend inline Float4 operator+(const Float4 a, const Float4 b) { return { vaddq_f32(a.v, b.v) }; }
+	friend inline Float4 operator-(const Float4 a, const Float4 b) { return { vsubq_f32(a.v, b.v) }; }
+	friend inline Float4 operator*(const Float4 a, const Float4 b) { return { vmulq_f32(a.v, b.v) }; }
+	friend inline Float4 lessThan(const Float4 a, const Float4 b) { return { vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)) }; }
+	friend inline Float4 select(const Float4 mask, const Float4 a, const Float4 b) { return { vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v) }; }
+#else
+	array<float,4> v;
+	static inline Float4 set(const float x) { return { { x, x, x, x } }; }
+	static inline Float4 load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+	inline void store(float* p) const { memcpy(p, v.data(), sizeof(v)); }
+	template<typename F>
+	static inline Float4 apply(const Float4 a, const Float4 b, F&& f) { return { { f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]), f(a.v[3], b.v[3]) } }; }
+	friend inline Float4 operator+(const Float4 a, const Float4 b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+	friend inline Float4 operator-(const Float4 a, const Float4 b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+	friend inline Float4 operator*(const Float4 a, const Float4 b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+	friend inline Float4 lessThan(const Float4 a, const Float4 b) { return apply(a, b, [](float x, float y) { return bit_cast<float>(x < y ? ~0u : 0u); }); }
+	friend inline Float4 select(const Float4 mask, const Float4 a, const Float4 b) {
+		Float4 r;
+		for (int i = 0; i < 4; i++) r.v[i] = bit_cast<uint32_t>(mask.v[i]) ? a.v[i] : b.v[i];
+		return r;
+	}
+#endif
+};
+
+// Finds the nearest palette entry to each texel, over the first N channels. Returns the summed squared error.
+// Ties go to the lowest index.
+template<int N, size_t P>
+float selectIndices(const Texels& px, const array<array<float,4>,P>& palette, array<uint32_t,16>& indices) {
+	// one row of 16 texels per channel
+	array<array<float,16>,N> rows;
+	for (uint32_t i = 0; i < 16; i++)
+		for (int c = 0; c < N; c++)
+			rows[c][i] = px[i][c];
+
+	Float4 total = Float4::set(0);
+	for (uint32_t i = 0; i < 16; i += 4) {
+		array<Float4,N> texels;
+		for (int c = 0; c < N; c++)
+			texels[c] = Float4::load(&rows[c][i]);
+
+		Float4 bestError = Float4::set(numeric_limits<float>::infinity());
+		Float4 best = Float4::set(0);
+		for (uint32_t j = 0; j < P; j++) {
+			Float4 error = Float4::set(0);
+			for (int c = 0; c < N; c++) {
+				const Float4 d = Float4::set(palette[j][c]) - texels[c];
+				error = error + d*d;
+			}
+			const Float4 closer = lessThan(error, bestError);
+			bestError = select(closer, error, bestError);
+			best = select(closer, Float4::set((float)j), best);
+		}
+		total = total + bestError;
+
+		array<float,4> b;
+		best.store(b.data());
+		for (uint32_t k = 0; k < 4; k++)
+			indices[i + k] = (uint32_t)b[k];
+	}
+
+	array<float,4> t;
+	total.store(t.data());
+	return (t[0] + t[1]) + (t[2] + t[3]);
+}
+
+// BC6H and BC7 4-bit index weights
+static constexpr array<uint32_t, 16> gWeights4 = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BitWriter {
+	array<uint64_t, 2> mBits = { 0, 0 };
+	uint32_t mPosition = 0;
+
+	inline void write(const uint64_t value, const uint32_t count) {
+		for (uint32_t i = 0; i < count; i++, mPosition++)
+			if (value & (1ull << i))
+				mBits[mPosition >> 6] |= 1ull << (mPosition & 63);
+	}
+	inline void store(byte* dst) const {
+		memcpy(dst, mBits.data(), sizeof(mBits));
+	}
+};
+
+inline float srgbToLinear(const float c) {
+	return c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+}
+inline float linearToSrgb(const float c) {
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * pow(c, 1/2.4f) - 0.055f;
+}
+
+// positive float to the bits of a half float, clamped to the largest finite half
+inline uint32_t floatToHalfBits(const float f) {
+	if (!(f > 0)) return 0;
+	if (f >= 65504.f) return 0x7BFF;
+	const uint32_t x = bit_cast<uint32_t>(f);
+	const int32_t e = int32_t((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t m = x & 0x7FFFFF;
+	if (e <= 0) {
+		// subnormal
+		if (e < -10) return 0;
+		m |= 0x800000;
+		const uint32_t shift = 14 - e;
+		return (m + (1u << (shift - 1))) >> shift;
+	}
+	return min((uint32_t(e) << 10) + ((m + 0x1000) >> 13), 0x7BFFu);
+}
+
+// Endpoints at the extents of the texels projected onto their principal axis
+template<int N>
+void principalEndpoints(const Texels& px, array<float,N>& e0, array<float,N>& e1) {
+	array<float,N> mean;
+	mean.fill(0);
+	for (uint32_t i = 0; i < 16; i++)
+		for (int c = 0; c < N; c++)
+			mean[c] += px[i][c];
+	for (int c = 0; c < N; c++)
+		mean[c] /= 16;
+
+	array<array<float,N>,N> covariance = {};
+	for (uint32_t i = 0; i < 16; i++)
+		for (int a = 0; a < N; a++)
+			for (int b = 0; b < N; b++)
+				covariance[a][b] += (px[i][a] - mean[a]) * (px[i][b] - mean[b]);
+
+	// power iteration, starting from the largest diagonal element
+	array<float,N> axis;
+	axis.fill(0);
+	int largest = 0;
+	for (int c = 1; c < N; c++)
+		if (covariance[c][c] > covariance[largest][largest]) largest = c;
+	axis[largest] = 1;
+	for (uint32_t iteration = 0; iteration < 8; iteration++) {
+		array<float,N> next;
+		next.fill(0);
+		for (int a = 0; a < N; a++)
+			for (int b = 0; b < N; b++)
+				next[a] += covariance[a][b] * axis[b];
+		float length = 0;
+		for (int c = 0; c < N; c++)
+			length = max(length, abs(next[c]));
+		if (length <= 0) break;
+		for (int c = 0; c < N; c++)
+			axis[c] = next[c] / length;
+	}
+
+	float tmin = numeric_limits<float>::infinity();
+	float tmax = -numeric_limits<float>::infinity();
+	for (uint32_t i = 0; i < 16; i++) {
+		float t = 0;
+		for (int c = 0; c < N; c++)
+			t += (px[i][c] - mean[c]) * axis[c];
+		tmin = min(tmin, t);
+		tmax = max(tmax, t);
+	}
+	float axisLength2 = 0;
+	for (int c = 0; c < N; c++)
+		axisLength2 += axis[c] * axis[c];
+	if (axisLength2 > 0) {
+		tmin /= axisLength2;
+		tmax /= axisLength2;
+	} else
+		tmin = tmax = 0;
+
+	for (int c = 0; c < N; c++) {
+		e0[c] = mean[c] + axis[c] * tmin;
+		e1[c] = mean[c] + axis[c] * tmax;
+	}
+}
+
+// Solves for the endpoints that minimize the squared error, given the interpolation weight of each texel
+template<int N>
+bool leastSquaresEndpoints(const Texels& px, const array<float,16>& t, array<float,N>& e0, array<float,N>& e1) {
+	float a = 0, b = 0, c = 0;
+	array<float,N> r0, r1;
+	r0.fill(0);
+	r1.fill(0);
+	for (uint32_t i = 0; i < 16; i++) {
+		const float s = 1 - t[i];
+		a += s * s;
+		b += s * t[i];
+		c += t[i] * t[i];
+		for (int k = 0; k < N; k++) {
+			r0[k] += s * px[i][k];
+			r1[k] += t[i] * px[i][k];
+		}
+	}
+	const float det = a*c - b*b;
+	if (abs(det) < 1e-6f) return false;
+	for (int k = 0; k < N; k++) {
+		e0[k] = (c*r0[k] - b*r1[k]) / det;
+		e1[k] = (a*r1[k] - b*r0[k]) / det;
+	}
+	return true;
+}
+
+// BC4: two 8-bit endpoints, 3-bit indices
+void encodeBC4(const array<float,16>& values, byte* dst) {
+	float lo = 255, hi = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		lo = min(lo, values[i]);
+		hi = max(hi, values[i]);
+	}
+	const uint32_t r0 = (uint32_t)clamp(round(hi), 0.f, 255.f);
+	const uint32_t r1 = (uint32_t)clamp(round(lo), 0.f, 255.f);
+
+	BitWriter w;
+	w.write(r0, 8);
+	w.write(r1, 8);
+	if (r0 > r1) {
+		array<array<float,4>,8> palette = {};
+		palette[0][0] = (float)r0;
+		palette[1][0] = (float)r1;
+		for (uint32_t i = 2; i < 8; i++)
+			palette[i][0] = ((8 - i)*r0 + (i - 1)*r1) / 7.f;
+		Texels px = {};
+		for (uint32_t i = 0; i < 16; i++)
+			px[i][0] = values[i];
+		array<uint32_t,16> indices;
+		selectIndices<1>(px, palette, indices);
+		for (uint32_t i = 0; i < 16; i++)
+			w.write(indices[i], 3);
+	} else
+		w.write(0, 48);
+	memcpy(dst, w.mBits.data(), 8);
+}
+
+// BC7 mode 6: RGBA 7-bit endpoints with a p-bit each, 4-bit indices
+struct BC7Endpoints {
+	array<uint32_t,4> mQ0, mQ1; // 7-bit
+	uint32_t mP0, mP1;
+
+	inline array<uint32_t,4> value(const uint32_t e) const {
+		const array<uint32_t,4>& q = e == 0 ? mQ0 : mQ1;
+		const uint32_t p = e == 0 ? mP0 : mP1;
+		return { (q[0] << 1) | p, (q[1] << 1) | p, (q[2] << 1) | p, (q[3] << 1) | p };
+	}
+};
+
+inline void quantizeBC7(const array<float,4>& e, array<uint32_t,4>& q, uint32_t& p) {
+	float bestError = numeric_limits<float>::infinity();
+	for (uint32_t pbit = 0; pbit < 2; pbit++) {
+		array<uint32_t,4> qp;
+		float error = 0;
+		for (int c = 0; c < 4; c++) {
+			qp[c] = (uint32_t)clamp(round((e[c] - pbit) / 2), 0.f, 127.f);
+			const float d = float((qp[c] << 1) | pbit) - e[c];
+			error += d*d;
+		}
+		if (error < bestError) {
+			bestError = error;
+			q = qp;
+			p = pbit;
+		}
+	}
+}
+
+float selectIndicesBC7(const Texels& px, const BC7Endpoints& endpoints, array<uint32_t,16>& indices) {
+	const array<uint32_t,4> v0 = endpoints.value(0);
+	const array<uint32_t,4> v1 = endpoints.value(1);
+	array<array<float,4>,16> palette;
+	for (uint32_t j = 0; j < 16; j++)
+		for (int c = 0; c < 4; c++)
+			palette[j][c] = float(((64 - gWeights4[j])*v0[c] + gWeights4[j]*v1[c] + 32) >> 6);
+	return selectIndices<4>(px, palette, indices);
+}
+
+// px is in [0,255]
+void encodeBC7(const Texels& px, byte* dst) {
+	array<float,4> e0, e1;
+	principalEndpoints<4>(px, e0, e1);
+
+	BC7Endpoints endpoints;
+	quantizeBC7(e0, endpoints.mQ0, endpoints.mP0);
+	quantizeBC7(e1, endpoints.mQ1, endpoints.mP1);
+	array<uint32_t,16> indices;
+	float error = selectIndicesBC7(px, endpoints, indices);
+
+	// refine
+	array<float,16> t;
+	for (uint32_t i = 0; i < 16; i++)
+		t[i] = gWeights4[indices[i]] / 64.f;
+	if (leastSquaresEndpoints<4>(px, t, e0, e1)) {
+		for (int c = 0; c < 4; c++) {
+			e0[c] = clamp(e0[c], 0.f, 255.f);
+			e1[c] = clamp(e1[c], 0.f, 255.f);
+		}
+		BC7Endpoints refined;
+		quantizeBC7(e0, refined.mQ0, refined.mP0);
+		quantizeBC7(e1, refined.mQ1, refined.mP1);
+		array<uint32_t,16> refinedIndices;
+		if (selectIndicesBC7(px, refined, refinedIndices) < error) {
+			endpoints = refined;
+			indices = refinedIndices;
+		}
+	}
+
+	// the anchor index's msb is implicitly 0
+	if (indices[0] & 8) {
+		swap(endpoints.mQ0, endpoints.mQ1);
+		swap(endpoints.mP0, endpoints.mP1);
+		for (uint32_t& i : indices)
+			i = 15 - i;
+	}
+
+	BitWriter w;
+	w.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		w.write(endpoints.mQ0[c], 7);
+		w.write(endpoints.mQ1[c], 7);
+	}
+	w.write(endpoints.mP0, 1);
+	w.write(endpoints.mP1, 1);
+	w.write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++)
+		w.write(indices[i], 4);
+	w.store(dst);
+}
+
+// BC6H mode 11 (unsigned): RGB 10-bit endpoints, 4-bit indices.
+// Texels are in the 'pre-finish' space, where interpolation is linear: x = halfBits * 64/31.
+inline uint32_t unquantizeBC6H(const uint32_t q) {
+	if (q == 0) return 0;
+	if (q == 1023) return 0xFFFF;
+	return ((q << 16) + 0x8000) >> 10;
+}
+inline uint32_t quantizeBC6H(const float x) {
+	return (uint32_t)clamp(round((x - 32) / 64), 0.f, 1023.f);
+}
+
+float selectIndicesBC6H(const Texels& px, const array<uint32_t,3>& q0, const array<uint32_t,3>& q1, array<uint32_t,16>& indices) {
+	array<array<float,4>,16> palette = {};
+	for (uint32_t j = 0; j < 16; j++)
+		for (int c = 0; c < 3; c++) {
+			const uint32_t x = ((64 - gWeights4[j])*unquantizeBC6H(q0[c]) + gWeights4[j]*unquantizeBC6H(q1[c]) + 32) >> 6;
+			palette[j][c] = float((x * 31) >> 6) * (64/31.f);
+		}
+	return selectIndices<3>(px, palette, indices);
+}
+
+void encodeBC6H(const Texels& px, byte* dst) {
+	array<float,3> e0, e1;
+	principalEndpoints<3>(px, e0, e1);
+
+	array<uint32_t,3> q0, q1;
+	for (int c = 0; c < 3; c++) {
+		q0[c] = quantizeBC6H(e0[c]);
+		q1[c] = quantizeBC6H(e1[c]);
+	}
+	array<uint32_t,16> indices;
+	float error = selectIndicesBC6H(px, q0, q1, indices);
+
+	// refine
+	array<float,16> t;
+	for (uint32_t i = 0; i < 16; i++)
+		t[i] = gWeights4[indices[i]] / 64.f;
+	if (leastSquaresEndpoints<3>(px, t, e0, e1)) {
+		array<uint32_t,3> r0, r1;
+		for (int c = 0; c < 3; c++) {
+			r0[c] = quantizeBC6H(e0[c]);
+			r1[c] = quantizeBC6H(e1[c]);
+		}
+		array<uint32_t,16> refinedIndices;
+		if (selectIndicesBC6H(px, r0, r1, refinedIndices) < error) {
+			q0 = r0;
+			q1 = r1;
+			indices = refinedIndices;
+		}
+	}
+
+	if (indices[0] & 8) {
+		swap(q0, q1);
+		for (uint32_t& i : indices)
+			i = 15 - i;
+	}
+
+	BitWriter w;
+	w.write(0x03, 5);
+	for (int c = 0; c < 3; c++) w.write(q0[c], 10);
+	for (int c = 0; c < 3; c++) w.write(q1[c], 10);
+	w.write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++)
+		w.write(indices[i], 4);
+	w.store(dst);
+}
+
+struct FloatImage {
+	uint32_t mWidth, mHeight;
+	vector<array<float,4>> mTexels;
+
+	inline const array<float,4>& at(const uint32_t x, const uint32_t y) const {
+		return mTexels[min(y, mHeight - 1)*mWidth + min(x, mWidth - 1)];
+	}
+
+	// 2x2 box filter
+	inline FloatImage downsample() const {
+		FloatImage r;
+		r.mWidth  = max(mWidth  / 2, 1u);
+		r.mHeight = max(mHeight / 2, 1u);
+		r.mTexels.resize(r.mWidth * r.mHeight);
+		for (uint32_t y = 0; y < r.mHeight; y++)
+			for (uint32_t x = 0; x < r.mWidth; x++) {
+				array<float,4>& dst = r.mTexels[y*r.mWidth + x];
+				for (int c = 0; c < 4; c++)
+					dst[c] = (at(2*x, 2*y)[c] + at(2*x + 1, 2*y)[c] + at(2*x, 2*y + 1)[c] + at(2*x + 1, 2*y + 1)[c]) / 4;
+			}
+		return r;
+	}
+};
+
+}
+
+vk::Format blockCompressedFormat(const vk::Format format) {
+	switch (format) {
+		case vk::Format::eR8Unorm:            return vk::Format::eBc4UnormBlock;
+		case vk::Format::eR8G8Unorm:          return vk::Format::eBc5UnormBlock;
+		case vk::Format::eR8G8B8A8Unorm:      return vk::Format::eBc7UnormBlock;
+		case vk::Format::eR8G8B8A8Srgb:       return vk::Format::eBc7SrgbBlock;
+		case vk::Format::eR32G32B32A32Sfloat: return vk::Format::eBc6HUfloatBlock;
+		default:                              return vk::Format::eUndefined;
+	}
+}
+
+CompressedImage compressImage(const span<const byte> pixels, const vk::Format format, const vk::Extent3D& extent) {
+	const vk::Format dstFormat = blockCompressedFormat(format);
+	if (dstFormat == vk::Format::eUndefined) throw invalid_argument("Block compression is not supported for format " + vk::to_string(format));
+	const bool srgb = format == vk::Format::eR8G8B8A8Srgb;
+	const uint32_t channels = channelCount(format);
+
+	// convert to linear floats
+
+	FloatImage level;
+	level.mWidth = extent.width;
+	level.mHeight = extent.height;
+	level.mTexels.resize(extent.width * extent.height);
+	if (pixels.size() < level.mTexels.size() * texelSize(format)) throw invalid_argument("Pixel data is smaller than the image extent");
+	if (format == vk::Format::eR32G32B32A32Sfloat)
+		memcpy(level.mTexels.data(), pixels.data(), level.mTexels.size() * sizeof(float)*4);
+	else {
+		const uint8_t* src = reinterpret_cast<const uint8_t*>(pixels.data());
+		for (size_t i = 0; i < level.mTexels.size(); i++) {
+			array<float,4>& dst = level.mTexels[i];
+			dst = { 0, 0, 0, 1 };
+			for (uint32_t c = 0; c < channels; c++) {
+				dst[c] = src[i*channels + c] / 255.f;
+				if (srgb && c < 3) dst[c] = srgbToLinear(dst[c]);
+			}
+		}
+	}
+
+	CompressedImage result;
+	result.mFormat = dstFormat;
+	result.mExtent = vk::Extent3D(extent.width, extent.height, 1);
+
+	const size_t blockSize = dstFormat == vk::Format::eBc4UnormBlock ? 8 : 16;
+	const uint32_t levelCount = bit_width(max(extent.width, extent.height));
+
+	for (uint32_t l = 0; l < levelCount; l++) {
+		if (l > 0) level = level.downsample();
+
+		const uint32_t blocksX = (level.mWidth  + 3) / 4;
+		const uint32_t blocksY = (level.mHeight + 3) / 4;
+		const size_t offset = result.mData.size();
+		result.mLevelOffsets.emplace_back(offset);
+		result.mData.resize(offset + blocksX*blocksY*blockSize);
+
+		for (uint32_t by = 0; by < blocksY; by++)
+			for (uint32_t bx = 0; bx < blocksX; bx++) {
+				byte* dst = result.mData.data() + offset + (by*blocksX + bx)*blockSize;
+
+				// gather texels, replicating edge texels for partial blocks
+				Texels px;
+				for (uint32_t i = 0; i < 16; i++)
+					px[i] = level.at(bx*4 + i%4, by*4 + i/4);
+
+				if (dstFormat == vk::Format::eBc6HUfloatBlock) {
+					for (array<float,4>& t : px)
+						for (int c = 0; c < 3; c++)
+							t[c] = floatToHalfBits(t[c]) * (64/31.f);
+					encodeBC6H(px, dst);
+					continue;
+				}
+
+				for (array<float,4>& t : px)
+					for (int c = 0; c < 4; c++)
+						t[c] = clamp(round(((srgb && c < 3) ? linearToSrgb(t[c]) : t[c]) * 255), 0.f, 255.f);
+
+				if (dstFormat == vk::Format::eBc7UnormBlock || dstFormat == vk::Format::eBc7SrgbBlock)
+					encodeBC7(px, dst);
+				else {
+					for (uint32_t c = 0; c < channels; c++) {
+						array<float,16> values;
+						for (uint32_t i = 0; i < 16; i++)
+							values[i] = px[i][c];
+						encodeBC4(values, dst + 8*c);
+					}
+				}
+			}
+	}
+
+	return result;
+}
+
+// cache file layout: header, level offsets, data
+struct CompressedImageHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	uint64_t mKey;
+	uint32_t mFormat;
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mLevels;
+	uint64_t mDataSize;
+};
+static constexpr uint32_t gCompressedImageMagic = 0x4E434253; // SBCN
+
+void writeCompressedImage(const filesystem::path& filename, const CompressedImage& image, const size_t key) {
+	filesystem::create_directories(filename.parent_path());
+	// write to a temporary file first, so that concurrent readers never see a partial file
+	const filesystem::path tmp = filesystem::path(filename).concat(".tmp" + to_string(hash<thread::id>()(this_thread::get_id())));
+	{
+		ofstream file(tmp, ios::binary);
+		if (!file.is_open()) throw runtime_error("Failed to open " + tmp.string());
+		const CompressedImageHeader header {
+			.mMagic = gCompressedImageMagic,
+			.mVersion = gBlockCompressionVersion,
+			.mKey = key,
+			.mFormat = (uint32_t)image.mFormat,
+			.mWidth = image.mExtent.width,
+			.mHeight = image.mExtent.height,
+			.mLevels = image.levels(),
+			.mDataSize = image.mData.size() };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(image.mLevelOffsets.data()), image.mLevelOffsets.size()*sizeof(vk::DeviceSize));
+		file.write(reinterpret_cast<const char*>(image.mData.data()), image.mData.size());
+		if (!file.good()) throw runtime_error("Failed to write " + tmp.string());
+	}
+	filesystem::rename(tmp, filename);
+}
+
+optional<CompressedImage> readCompressedImage(const filesystem::path& filename, const size_t key) {
+	ifstream file(filename, ios::binary);
+	if (!file.is_open()) return nullopt;
+
+	CompressedImageHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file.good() || header.mMagic != gCompressedImageMagic || header.mVersion != gBlockCompressionVersion || header.mKey != key)
+		return nullopt;
+
+	CompressedImage image;
+	image.mFormat = (vk::Format)header.mFormat;
+	image.mExtent = vk::Extent3D(header.mWidth, header.mHeight, 1);
+	image.mLevelOffsets.resize(header.mLevels);
+	image.mData.resize(header.mDataSize);
+	file.read(reinterpret_cast<char*>(image.mLevelOffsets.data()), image.mLevelOffsets.size()*sizeof(vk::DeviceSize));
+	file.read(reinterpret_cast<char*>(image.mData.data()), image.mData.size());
+	if (!file.good()) return nullopt;
+	return image;
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <span>
+
+#include "fwd.hpp"
+#include "utils.hpp"
+
+namespace stm2 {
+
+// Mip chain of a block compressed image, as produced by compressImage
+struct CompressedImage {
+	vk::Format mFormat;
+	vk::Extent3D mExtent;
+	vector<vk::DeviceSize> mLevelOffsets; // offset of each mip level in mData
+	vector<byte> mData;
+
+	inline uint32_t levels() const { return (uint32_t)mLevelOffsets.size(); }
+
+	inline vector<vk::BufferImageCopy> copies(const vk::DeviceSize bufferOffset = 0) const {
+		vector<vk::BufferImageCopy> result(levels());
+		for (uint32_t i = 0; i < levels(); i++) {
+			const vk::Extent3D extent(max(mExtent.width >> i, 1u), max(mExtent.height >> i, 1u), 1);
+			result[i] = vk::BufferImageCopy(bufferOffset + mLevelOffsets[i], 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, i, 0, 1), vk::Offset3D{0,0,0}, extent);
+		}
+		return result;
+	}
+};
+
+// Bumped whenever the encoder output changes, to invalidate cached images
+static constexpr uint32_t gBlockCompressionVersion = 2;
+
+// The block compressed format that compressImage produces for images of the given format,
+// or eUndefined if the format is not supported:
+//   R8 -> BC4, R8G8 -> BC5, R8G8B8A8 (unorm or srgb) -> BC7, R32G32B32A32 float -> BC6H (alpha is dropped)
+vk::Format blockCompressedFormat(const vk::Format format);
+
+// Generates a full mip chain (box filtered, in linear space for srgb formats), and encodes every level.
+// Runs on the calling thread; callers compress many images in parallel instead.
+CompressedImage compressImage(const span<const byte> pixels, const vk::Format format, const vk::Extent3D& extent);
+
+// On-disk cache of compressed images. key identifies the source data and conversion parameters.
+void writeCompressedImage(const filesystem::path& filename, const CompressedImage& image, const size_t key);
+optional<CompressedImage> readCompressedImage(const filesystem::path& filename, const size_t key);
+
+}
@@ -5,26 +5,20 @@ namespace stm2 {
 
 Buffer::Buffer(Device& device, const string& name, const vk::BufferCreateInfo& createInfo, const vk::MemoryPropertyFlags memoryFlags, const bool hostRandomAccess)
 	: Device::Resource(device, name), mSize(createInfo.size), mUsage(createInfo.usage), mMemoryFlags(memoryFlags), mSharingMode(createInfo.sharingMode) {
-	VmaAllocationCreateInfo allocationCreateInfo;
-	allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | (hostRandomAccess ? VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT : VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-    allocationCreateInfo.usage = (memoryFlags & vk::MemoryPropertyFlagBits::eDeviceLocal) ? VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE : VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
-    allocationCreateInfo.requiredFlags = (VkMemoryPropertyFlags)memoryFlags;
-    allocationCreateInfo.memoryTypeBits = 0;
-    allocationCreateInfo.pool = VK_NULL_HANDLE;
-    allocationCreateInfo.pUserData = VK_NULL_HANDLE;
-    allocationCreateInfo.priority = 0;
-	vk::Result result = (vk::Result)vmaCreateBuffer(mDevice.allocator(), &(const VkBufferCreateInfo&)createInfo, &allocationCreateInfo, &(VkBuffer&)mBuffer, &mAllocation, &mAllocationInfo);
-	if (result != vk::Result::eSuccess)
-		vk::throwResultException(result, "vmaCreateBuffer");
-	device.setDebugName(mBuffer, resourceName());
+	mAllocation = mDevice.allocateBuffer(createInfo, memoryFlags, hostRandomAccess);
+	mBuffer = mAllocation.mBuffer;
+	// sub-allocated buffers share their VkBuffer's name
+	if (mAllocation.mAllocation)
+		device.setDebugName(mBuffer, resourceName());
 }
 Buffer::~Buffer() {
-	if (mBuffer && mAllocation)
-		vmaDestroyBuffer(mDevice.allocator(), mBuffer, mAllocation);
+	if (mBuffer)
+		mDevice.freeBuffer(mAllocation);
 }
 
 void Buffer::fill(CommandBuffer& commandBuffer, const uint32_t data, const vk::DeviceSize offset, const vk::DeviceSize size) const {
-	commandBuffer->fillBuffer(mBuffer, offset, size, data);
+	// VK_WHOLE_SIZE would run to the end of a shared VkBuffer
+	commandBuffer->fillBuffer(mBuffer, this->offset() + offset, size == VK_WHOLE_SIZE ? (mSize - offset) & ~vk::DeviceSize(3) : size, data);
 }
 
 void Buffer::barrier(CommandBuffer& commandBuffer,
@@ -38,7 +32,7 @@ void Buffer::barrier(CommandBuffer& commandBuffer,
 		vk::BufferMemoryBarrier(
 			srcAccess, dstAccess,
 			srcQueue, dstQueue,
-			mBuffer, offset, size),
+			mBuffer, this->offset() + offset, size == VK_WHOLE_SIZE ? mSize - offset : size),
 		{});
 }
 
@@ -54,7 +48,7 @@ void Buffer::barriers(CommandBuffer& commandBuffer, const vector<Buffer::View<by
 	ranges::transform(buffers, bufferMemoryBarriers.begin(), [=](const auto& v){ return vk::BufferMemoryBarrier(
 			srcAccess, dstAccess,
 			srcQueue, dstQueue,
-			**v.buffer(), v.offset(), v.sizeBytes()); });
+			**v.buffer(), v.absoluteOffset(), v.sizeBytes()); });
 
 	commandBuffer->pipelineBarrier(
 		srcStage, dstStage,
@@ -71,24 +65,24 @@ void Buffer::copy(CommandBuffer& commandBuffer, const Buffer::View<byte>& src, c
 	commandBuffer.trackResource(src.buffer());
 	commandBuffer.trackResource(dst.buffer());
 
-	commandBuffer->copyBuffer(**src.buffer(), **dst.buffer(), vk::BufferCopy(src.offset(), dst.offset(), src.sizeBytes()));
+	commandBuffer->copyBuffer(**src.buffer(), **dst.buffer(), vk::BufferCopy(src.absoluteOffset(), dst.absoluteOffset(), src.sizeBytes()));
 }
 
 void Buffer::copyToImage(CommandBuffer& commandBuffer, const shared_ptr<Image>& dst, const vk::DeviceSize offset) const {
 	commandBuffer.trackResource(dst);
 	dst->barrier(commandBuffer, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
 	commandBuffer->copyBufferToImage(mBuffer, **dst, vk::ImageLayout::eTransferDstOptimal,
-		vk::BufferImageCopy(offset, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor,0,0,1), {0,0,0}, dst->extent()));
+		vk::BufferImageCopy(this->offset() + offset, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor,0,0,1), {0,0,0}, dst->extent()));
 }
 void Buffer::copyToImage(CommandBuffer& commandBuffer, const shared_ptr<Image>& dst, const vk::ArrayProxy<vk::BufferImageCopy>& copies) const {
 	commandBuffer.trackResource(dst);
 	dst->barrier(commandBuffer, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
-	commandBuffer->copyBufferToImage(mBuffer, **dst, vk::ImageLayout::eTransferDstOptimal, copies);
+	commandBuffer->copyBufferToImage(mBuffer, **dst, vk::ImageLayout::eTransferDstOptimal, offsetCopies(copies));
 }
 void Buffer::copyFromImage(CommandBuffer& commandBuffer, const shared_ptr<Image>& src, const vk::ArrayProxy<vk::BufferImageCopy>& copies) const {
 	src->barrier(commandBuffer, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
 	commandBuffer.trackResource(src);
-	commandBuffer->copyImageToBuffer(**src, vk::ImageLayout::eTransferSrcOptimal, mBuffer, copies);
+	commandBuffer->copyImageToBuffer(**src, vk::ImageLayout::eTransferSrcOptimal, mBuffer, offsetCopies(copies));
 }
 
 }
\ No newline at end of file
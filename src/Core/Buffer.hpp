@@ -17,16 +17,19 @@ public:
 
 	inline operator bool() const { return mBuffer; }
 
-	inline void* data() const { return mAllocationInfo.pMappedData; }
+	inline void* data() const { return mAllocation.mMappedData; }
+	// offset of this buffer within the VkBuffer it was sub-allocated from, see Device::allocateBuffer
+	inline vk::DeviceSize offset() const { return mAllocation.mOffset; }
 	inline vk::DeviceSize size() const { return mSize; }
 	inline vk::BufferUsageFlags usage() const { return mUsage; }
 	inline vk::MemoryPropertyFlags memoryUsage() const { return mMemoryFlags; }
 	inline vk::SharingMode sharingMode() const { return mSharingMode; }
 #if VK_KHR_buffer_device_address
-	inline vk::DeviceSize deviceAddress() const { return mDevice->getBufferAddress(mBuffer); }
+	inline vk::DeviceSize deviceAddress() const { return mDevice->getBufferAddress(mBuffer) + offset(); }
 #endif
 
 	// note: does NOT call commandBuffer.trackResource
+	// offsets are relative to this buffer, here and in the image copies below
 	void barrier(CommandBuffer& commandBuffer,
 		const vk::PipelineStageFlags srcStage, const vk::PipelineStageFlags dstStage,
 		const vk::AccessFlags srcAccess, const vk::AccessFlags dstAccess,
@@ -75,7 +78,10 @@ public:
 		inline operator bool() const { return !empty(); }
 
 		inline const shared_ptr<Buffer>& buffer() const { return mBuffer; }
+		// offset within buffer(), which is what shaders see through descriptors
 		inline vk::DeviceSize offset() const { return mOffset; }
+		// offset within the VkBuffer, for passing **buffer() to Vulkan commands directly
+		inline vk::DeviceSize absoluteOffset() const { return mBuffer->offset() + mOffset; }
 
 		inline bool empty() const { return !mBuffer || mSize == 0; }
 		inline void reset() { mBuffer.reset(); }
@@ -178,12 +184,18 @@ public:
 
 private:
 	vk::Buffer mBuffer;
-	VmaAllocation mAllocation;
-	VmaAllocationInfo mAllocationInfo;
+	Device::BufferAllocation mAllocation;
 	vk::DeviceSize mSize;
 	vk::BufferUsageFlags mUsage;
 	vk::MemoryPropertyFlags mMemoryFlags;
 	vk::SharingMode mSharingMode;
+
+	inline vector<vk::BufferImageCopy> offsetCopies(const vk::ArrayProxy<vk::BufferImageCopy>& copies) const {
+		vector<vk::BufferImageCopy> result(copies.begin(), copies.end());
+		for (vk::BufferImageCopy& c : result)
+			c.bufferOffset += offset();
+		return result;
+	}
 };
 
 }
\ No newline at end of file
@@ -10,6 +10,11 @@ CommandBuffer::CommandBuffer(Device& device, const string& name, const uint32_t
 	mCommandBuffer = move(commandBuffers[0]);
 	device.setDebugName(*mCommandBuffer, resourceName());
 }
+CommandBuffer::CommandBuffer(Device& device, const string& name, const shared_ptr<vk::raii::CommandPool>& commandPool, const uint32_t queueFamily) : Device::Resource(device, name), mCommandPool(commandPool), mCommandBuffer(nullptr), mQueueFamily(queueFamily) {
+	vk::raii::CommandBuffers commandBuffers(*mDevice, vk::CommandBufferAllocateInfo(**mCommandPool, vk::CommandBufferLevel::ePrimary, 1));
+	mCommandBuffer = move(commandBuffers[0]);
+	device.setDebugName(*mCommandBuffer, resourceName());
+}
 
 void CommandBuffer::reset() {
 	mResources.clear();
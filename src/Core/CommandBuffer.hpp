@@ -7,6 +7,8 @@ namespace stm2 {
 class CommandBuffer : public Device::Resource {
 public:
 	CommandBuffer(Device& device, const string& name, const uint32_t queueFamily);
+	// Allocates from commandPool instead of the calling thread's pool, and keeps it alive until destroyed
+	CommandBuffer(Device& device, const string& name, const shared_ptr<vk::raii::CommandPool>& commandPool, const uint32_t queueFamily);
 
 	DECLARE_DEREFERENCE_OPERATORS(vk::raii::CommandBuffer, mCommandBuffer)
 
@@ -39,6 +41,7 @@ public:
 
 private:
 	friend class Device;
+	shared_ptr<vk::raii::CommandPool> mCommandPool;
 	vk::raii::CommandBuffer mCommandBuffer;
 	shared_ptr<vk::raii::Fence> mFence;
 	uint32_t mQueueFamily;
@@ -26,6 +26,15 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 	}
 	if (mExtensions.contains(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME))
 		mExtensions.emplace(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
+	// used by GPU-driven rasterization
+	for (const vk::ExtensionProperties& e : mPhysicalDevice.enumerateDeviceExtensionProperties()) {
+		const string name = e.extensionName.data();
+		if (name == VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME || name == VK_EXT_MESH_SHADER_EXTENSION_NAME)
+			mExtensions.emplace(name);
+		// skips the bounces of compacted paths once every path terminated, see TestRenderer
+		if (name == VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME)
+			mExtensions.emplace(name);
+	}
 
 	// Queue create infos
 
@@ -47,10 +56,15 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 	mFeatures.wideLines = true;
 	mFeatures.largePoints = true;
 	mFeatures.sampleRateShading = true;
+	mFeatures.multiDrawIndirect = true;
+	mFeatures.drawIndirectFirstInstance = true;
 	//mFeatures.shaderFloat64 = true; // needed by slang?
 	mFeatures.shaderStorageBufferArrayDynamicIndexing = true;
 	mFeatures.shaderSampledImageArrayDynamicIndexing = true;
 	mFeatures.shaderStorageImageArrayDynamicIndexing = true;
+	mFeatures.textureCompressionBC = mPhysicalDevice.getFeatures().textureCompressionBC;
+	// SV_PrimitiveID in fragment shaders of the indexed raster pipeline. RasterRenderer draws non-indexed without it.
+	mFeatures.geometryShader = mPhysicalDevice.getFeatures().geometryShader;
 
 	vk::PhysicalDeviceVulkan13Features& vk13features = get<vk::PhysicalDeviceVulkan13Features>(mFeatureChain);
 	vk13features.dynamicRendering = true;
@@ -66,6 +80,8 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 	rtfeatures.rayTracingPipeline = mExtensions.contains(VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME);
 	rtfeatures.rayTraversalPrimitiveCulling = rtfeatures.rayTracingPipeline;
 	get<vk::PhysicalDeviceRayQueryFeaturesKHR>(mFeatureChain).rayQuery = mExtensions.contains(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+	get<vk::PhysicalDeviceMeshShaderFeaturesEXT>(mFeatureChain).meshShader = mExtensions.contains(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+	get<vk::PhysicalDeviceConditionalRenderingFeaturesEXT>(mFeatureChain).conditionalRendering = mExtensions.contains(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME);
 
 
 	auto& atomicFloatFeatures = get<vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT>(mFeatureChain);
@@ -121,13 +137,39 @@ Device::Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice) :
 	allocatorInfo.device = *mDevice;
 	allocatorInfo.instance = **mInstance;
 	allocatorInfo.vulkanApiVersion = mInstance.vulkanVersion();
-	allocatorInfo.preferredLargeHeapBlockSize = 1024 * 1024;
+	// small buffers are sub-allocated below, so heap blocks only hold images and large buffers
+	const auto heapBlockSize = mInstance.findArgument("heapBlockSize");
+	allocatorInfo.preferredLargeHeapBlockSize = (heapBlockSize ? stoull(*heapBlockSize) : 256) * 1024 * 1024;
 	allocatorInfo.flags = 0;
 	if (mExtensions.contains(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
 		allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
 	if (get<vk::PhysicalDeviceBufferDeviceAddressFeatures>(mFeatureChain).bufferDeviceAddress)
 		allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
 	vmaCreateAllocator(&allocatorInfo, &mAllocator);
+
+	// Shared buffers for sub-allocation
+
+	// buffers up to 1/64th of a block are sub-allocated, bufferBlockSize=0 disables sub-allocation
+	const auto bufferBlockSize = mInstance.findArgument("bufferBlockSize");
+	mBufferBlockSize = (bufferBlockSize ? stoull(*bufferBlockSize) : 16) * 1024 * 1024;
+	mBufferBlockAlignment = max<vk::DeviceSize>({ 256, mLimits.minStorageBufferOffsetAlignment, mLimits.minUniformBufferOffsetAlignment });
+	mBufferBlockUsage =
+		vk::BufferUsageFlagBits::eTransferSrc |
+		vk::BufferUsageFlagBits::eTransferDst |
+		vk::BufferUsageFlagBits::eUniformBuffer |
+		vk::BufferUsageFlagBits::eStorageBuffer |
+		vk::BufferUsageFlagBits::eIndexBuffer |
+		vk::BufferUsageFlagBits::eVertexBuffer |
+		vk::BufferUsageFlagBits::eIndirectBuffer;
+	if (get<vk::PhysicalDeviceBufferDeviceAddressFeatures>(mFeatureChain).bufferDeviceAddress)
+		mBufferBlockUsage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
+	if (mExtensions.contains(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME)) {
+		mBufferBlockUsage |= vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
+		// build scratch buffers only need storage and device address usage, so they are sub-allocated too
+		const auto asProperties = mPhysicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
+		mBufferBlockAlignment = max<vk::DeviceSize>(mBufferBlockAlignment, asProperties.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>().minAccelerationStructureScratchOffsetAlignment);
+	}
+	mDedicatedBufferCount = 0;
 }
 Device::~Device() {
 	if (!mInstance.findArgument("noPipelineCache")) {
@@ -139,9 +181,110 @@ Device::~Device() {
 			cerr << "Warning: Failed to write pipeline cache: " << e.what() << endl;
 		}
 	}
+	for (auto&[key, blocks] : mBufferBlocks)
+		for (const BufferBlock& block : blocks) {
+			vmaClearVirtualBlock(block.mVirtualBlock);
+			vmaDestroyVirtualBlock(block.mVirtualBlock);
+			vmaDestroyBuffer(mAllocator, block.mBuffer, block.mAllocation);
+		}
+	mBufferBlocks.clear();
 	vmaDestroyAllocator(mAllocator);
 }
 
+Device::BufferAllocation Device::allocateBuffer(const vk::BufferCreateInfo& createInfo, const vk::MemoryPropertyFlags memoryFlags, const bool hostRandomAccess) {
+	VmaAllocationCreateInfo allocationCreateInfo;
+	allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | (hostRandomAccess ? VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT : VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+	allocationCreateInfo.usage = (memoryFlags & vk::MemoryPropertyFlagBits::eDeviceLocal) ? VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE : VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+	allocationCreateInfo.requiredFlags = (VkMemoryPropertyFlags)memoryFlags;
+	allocationCreateInfo.preferredFlags = 0;
+	allocationCreateInfo.memoryTypeBits = 0;
+	allocationCreateInfo.pool = VK_NULL_HANDLE;
+	allocationCreateInfo.pUserData = VK_NULL_HANDLE;
+	allocationCreateInfo.priority = 0;
+
+	BufferAllocation allocation;
+
+	// acceleration structure storage, texel buffers, queue family sharing and sparse buffers get their own VkBuffer
+	const bool subAllocate =
+		createInfo.size > 0 &&
+		createInfo.size <= mBufferBlockSize/64 &&
+		!createInfo.flags &&
+		createInfo.sharingMode == vk::SharingMode::eExclusive &&
+		!(createInfo.usage & ~mBufferBlockUsage);
+	if (!subAllocate) {
+		VmaAllocationInfo allocationInfo;
+		const vk::Result result = (vk::Result)vmaCreateBuffer(mAllocator, &(const VkBufferCreateInfo&)createInfo, &allocationCreateInfo, &(VkBuffer&)allocation.mBuffer, &allocation.mAllocation, &allocationInfo);
+		if (result != vk::Result::eSuccess)
+			vk::throwResultException(result, "vmaCreateBuffer");
+		allocation.mMappedData = allocationInfo.pMappedData;
+		mDedicatedBufferCount++;
+		return allocation;
+	}
+
+	VmaVirtualAllocationCreateInfo virtualCreateInfo{};
+	virtualCreateInfo.size = max<vk::DeviceSize>(createInfo.size, 1);
+	virtualCreateInfo.alignment = mBufferBlockAlignment;
+
+	scoped_lock l(mBufferBlockMutex);
+	list<BufferBlock>& blocks = mBufferBlocks[(uint32_t(VkMemoryPropertyFlags(memoryFlags)) << 1) | (hostRandomAccess ? 1 : 0)];
+	for (const BufferBlock& block : blocks) {
+		if (vmaVirtualAllocate(block.mVirtualBlock, &virtualCreateInfo, &allocation.mVirtualAllocation, &allocation.mOffset) != VK_SUCCESS)
+			continue;
+		allocation.mBuffer = block.mBuffer;
+		allocation.mBlock = block.mVirtualBlock;
+		allocation.mMappedData = block.mMappedData ? static_cast<byte*>(block.mMappedData) + allocation.mOffset : nullptr;
+		return allocation;
+	}
+
+	// no block has room, create a new one
+	BufferBlock& block = blocks.emplace_back();
+	const vk::BufferCreateInfo blockCreateInfo({}, mBufferBlockSize, mBufferBlockUsage);
+	VmaAllocationInfo allocationInfo;
+	// the block's base address is aligned too, since build scratch addresses must be
+	const vk::Result result = (vk::Result)vmaCreateBufferWithAlignment(mAllocator, &(const VkBufferCreateInfo&)blockCreateInfo, &allocationCreateInfo, mBufferBlockAlignment, &(VkBuffer&)block.mBuffer, &block.mAllocation, &allocationInfo);
+	if (result != vk::Result::eSuccess) {
+		blocks.pop_back();
+		vk::throwResultException(result, "vmaCreateBufferWithAlignment");
+	}
+	block.mMappedData = allocationInfo.pMappedData;
+	setDebugName(block.mBuffer, "Buffer block");
+
+	VmaVirtualBlockCreateInfo blockInfo{};
+	blockInfo.size = mBufferBlockSize;
+	vmaCreateVirtualBlock(&blockInfo, &block.mVirtualBlock);
+
+	vmaVirtualAllocate(block.mVirtualBlock, &virtualCreateInfo, &allocation.mVirtualAllocation, &allocation.mOffset);
+	allocation.mBuffer = block.mBuffer;
+	allocation.mBlock = block.mVirtualBlock;
+	allocation.mMappedData = block.mMappedData ? static_cast<byte*>(block.mMappedData) + allocation.mOffset : nullptr;
+	return allocation;
+}
+void Device::freeBuffer(const BufferAllocation& allocation) {
+	if (allocation.mAllocation) {
+		vmaDestroyBuffer(mAllocator, allocation.mBuffer, allocation.mAllocation);
+		mDedicatedBufferCount--;
+		return;
+	}
+	if (!allocation.mBlock)
+		return;
+
+	scoped_lock l(mBufferBlockMutex);
+	vmaVirtualFree(allocation.mBlock, allocation.mVirtualAllocation);
+	if (!vmaIsVirtualBlockEmpty(allocation.mBlock))
+		return;
+	// release empty blocks, keeping one per memory type around
+	for (auto&[key, blocks] : mBufferBlocks) {
+		if (blocks.size() < 2) continue;
+		for (auto it = blocks.begin(); it != blocks.end(); it++) {
+			if (it->mVirtualBlock != allocation.mBlock) continue;
+			vmaDestroyVirtualBlock(it->mVirtualBlock);
+			vmaDestroyBuffer(mAllocator, it->mBuffer, it->mAllocation);
+			blocks.erase(it);
+			return;
+		}
+	}
+}
+
 vk::raii::CommandPool& Device::commandPool(const uint32_t queueFamily) {
 	scoped_lock l(mCommandPoolMutex);
 	auto& pools = mCommandPools[this_thread::get_id()];
@@ -201,6 +344,31 @@ void Device::submit(const vk::raii::Queue queue, const vk::ArrayProxy<const shar
 }
 
 void Device::drawGui() {
+	if (ImGui::CollapsingHeader("Buffer allocations")) {
+		uint32_t blockCount = 0;
+		uint32_t subAllocationCount = 0;
+		VkDeviceSize subAllocationBytes = 0;
+		{
+			scoped_lock l(mBufferBlockMutex);
+			for (const auto&[key, blocks] : mBufferBlocks)
+				for (const BufferBlock& block : blocks) {
+					VmaStatistics stats;
+					vmaGetVirtualBlockStatistics(block.mVirtualBlock, &stats);
+					blockCount++;
+					subAllocationCount += stats.allocationCount;
+					subAllocationBytes += stats.allocationBytes;
+				}
+		}
+		const auto[blockSize, blockSizeUnit] = formatBytes(mBufferBlockSize);
+		const auto[subAllocationSize, subAllocationUnit] = formatBytes(subAllocationBytes);
+		ImGui::Text("%u shared buffers\t(%llu %s each)", blockCount, blockSize, blockSizeUnit);
+		ImGui::Text("%u sub-allocated buffers\t(%llu %s)", subAllocationCount, subAllocationSize, subAllocationUnit);
+		ImGui::Text("%u dedicated buffers", mDedicatedBufferCount.load());
+
+		VmaTotalStatistics stats;
+		vmaCalculateStatistics(mAllocator, &stats);
+		ImGui::Text("%u VMA allocations in %u memory blocks", stats.total.statistics.allocationCount, stats.total.statistics.blockCount);
+	}
 	if (ImGui::CollapsingHeader("Heap budgets")) {
 		const bool memoryBudgetExt = mExtensions.contains(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 		vk::StructureChain<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT> structureChain;
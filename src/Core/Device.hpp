@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
@@ -37,6 +38,16 @@ public:
 		friend class Device;
 	};
 
+	// Memory backing a Buffer: either its own VkBuffer, or a range of a shared VkBuffer, see allocateBuffer
+	struct BufferAllocation {
+		vk::Buffer mBuffer;
+		vk::DeviceSize mOffset = 0;
+		void* mMappedData = nullptr;
+		VmaAllocation mAllocation = VK_NULL_HANDLE; // dedicated buffers
+		VmaVirtualBlock mBlock = VK_NULL_HANDLE; // sub-allocated buffers
+		VmaVirtualAllocation mVirtualAllocation = VK_NULL_HANDLE;
+	};
+
 	Instance& mInstance;
 
 	Device(Instance& instance, vk::raii::PhysicalDevice physicalDevice);
@@ -59,6 +70,8 @@ public:
 	inline const vk::PhysicalDeviceAccelerationStructureFeaturesKHR& accelerationStructureFeatures() const { return get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>(mFeatureChain); }
 	inline const vk::PhysicalDeviceRayTracingPipelineFeaturesKHR&    ray_tracingPipelineFeatures() const   { return get<vk::PhysicalDeviceRayTracingPipelineFeaturesKHR>(mFeatureChain); }
 	inline const vk::PhysicalDeviceRayQueryFeaturesKHR&              rayQueryFeatures() const              { return get<vk::PhysicalDeviceRayQueryFeaturesKHR>(mFeatureChain); }
+	inline const vk::PhysicalDeviceMeshShaderFeaturesEXT&            meshShaderFeatures() const            { return get<vk::PhysicalDeviceMeshShaderFeaturesEXT>(mFeatureChain); }
+	inline const vk::PhysicalDeviceConditionalRenderingFeaturesEXT&  conditionalRenderingFeatures() const  { return get<vk::PhysicalDeviceConditionalRenderingFeaturesEXT>(mFeatureChain); }
 
 	template<typename T> requires(convertible_to<decltype(T::objectType), vk::ObjectType>)
 	inline void setDebugName(const T& object, const string& name) {
@@ -71,6 +84,11 @@ public:
 
 	vk::raii::CommandPool& commandPool(const uint32_t queueFamily);
 
+	// Small buffers with compatible usage are sub-allocated from shared VkBuffers of mBufferBlockSize bytes, so that
+	// they don't each need their own VkBuffer and VMA allocation. Thread safe.
+	BufferAllocation allocateBuffer(const vk::BufferCreateInfo& createInfo, const vk::MemoryPropertyFlags memoryFlags, const bool hostRandomAccess);
+	void freeBuffer(const BufferAllocation& allocation);
+
 	const shared_ptr<vk::raii::DescriptorPool>& allocateDescriptorPool();
 	const shared_ptr<vk::raii::DescriptorPool>& getDescriptorPool();
 
@@ -106,6 +124,19 @@ private:
 
 	VmaAllocator mAllocator;
 
+	struct BufferBlock {
+		vk::Buffer mBuffer;
+		VmaAllocation mAllocation;
+		void* mMappedData;
+		VmaVirtualBlock mVirtualBlock;
+	};
+	shared_mutex mBufferBlockMutex;
+	unordered_map<uint32_t, list<BufferBlock>> mBufferBlocks; // keyed by memory flags and host access
+	vk::DeviceSize mBufferBlockSize;
+	vk::DeviceSize mBufferBlockAlignment;
+	vk::BufferUsageFlags mBufferBlockUsage;
+	atomic<uint32_t> mDedicatedBufferCount;
+
 	size_t mFrameIndex;
 	size_t mLastFrameDone;
 
@@ -119,7 +150,9 @@ private:
 		vk::PhysicalDeviceAccelerationStructureFeaturesKHR,
 		vk::PhysicalDeviceRayTracingPipelineFeaturesKHR,
 		vk::PhysicalDeviceRayQueryFeaturesKHR,
-		vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT
+		vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT,
+		vk::PhysicalDeviceMeshShaderFeaturesEXT,
+		vk::PhysicalDeviceConditionalRenderingFeaturesEXT
 	> mFeatureChain;
 	vk::PhysicalDeviceLimits mLimits;
 };
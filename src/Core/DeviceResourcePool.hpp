@@ -112,6 +112,19 @@ public:
 		commandBuffer.trackResource(dst.buffer());
 		return dst;
 	}
+	// Uploads data to the start of a buffer of at least count elements, leaving the rest for the device to write
+	template<typename T>
+	inline Buffer::View<T> uploadData(CommandBuffer& commandBuffer, const string& name, const vk::ArrayProxy<T>& data, const vk::DeviceSize count, const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer, const vk::MemoryPropertyFlags memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal, const uint32_t bufferCount = 1) {
+		Buffer::View<T> dst = getBuffer<T>(commandBuffer.mDevice, name, count, vk::BufferUsageFlagBits::eTransferDst|usage, memoryProperties, bufferCount);
+		if (!data.empty()) {
+			Buffer::View<T> src = getBuffer<T>(commandBuffer.mDevice, name+" (Staging)", data.size(), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, commandBuffer.mDevice.frameIndex() - commandBuffer.mDevice.lastFrameDone() - 1);
+			ranges::uninitialized_copy(data, src);
+			Buffer::copy(commandBuffer, Buffer::View<T>(src, 0, data.size()), dst);
+			commandBuffer.trackResource(src.buffer());
+		}
+		commandBuffer.trackResource(dst.buffer());
+		return dst;
+	}
 
 	inline Image::View getImage(Device& device, const string& name, const Image::Metadata& metadata, const uint32_t bufferCount = 1) {
 		auto& images = mImages[name];
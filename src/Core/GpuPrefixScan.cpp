@@ -0,0 +1,32 @@
+#include "GpuPrefixScan.hpp"
+#include "Instance.hpp"
+
+namespace stm2 {
+
+GpuPrefixScan::GpuPrefixScan(Device& device) {
+	const filesystem::path shaderPath = *device.mInstance.findArgument("shaderKernelPath");
+	mPipeline = ComputePipelineCache(shaderPath / "prefix_scan.slang", "ExclusiveScan", "sm_6_6", { "-O3", "-capability", "spirv_1_5" });
+}
+
+void GpuPrefixScan::exclusiveScan(CommandBuffer& commandBuffer, const Buffer::View<uint32_t>& input, const Buffer::View<uint32_t>& output, const uint32_t count) {
+	if (count == 0) return;
+
+	mResourcePool.clean();
+
+	const uint32_t partitionCount = (count + gPartitionSize - 1) / gPartitionSize;
+
+	// partition counter + one descriptor per partition
+	const Buffer::View<uint32_t> state = mResourcePool.getBuffer<uint32_t>(commandBuffer.mDevice, "GpuPrefixScan::mState", 1 + partitionCount, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+	state.fill(commandBuffer, 0);
+	state.barrier(commandBuffer,
+		vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+
+	Descriptors descriptors;
+	descriptors[{ "gInput", 0 }] = input;
+	descriptors[{ "gOutput", 0 }] = output;
+	descriptors[{ "gState", 0 }] = state;
+	mPipeline.get(commandBuffer.mDevice)->dispatch(commandBuffer, vk::Extent3D(partitionCount, 1, 1), descriptors, {}, PushConstants{ { "mCount", PushConstantValue(count) } });
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "DeviceResourcePool.hpp"
+
+namespace stm2 {
+
+// Exclusive prefix sum over uint32 values in a single pass, using decoupled look-back (kernels/prefix_scan.slang).
+// Sums must fit in 30 bits.
+class GpuPrefixScan {
+public:
+	static constexpr uint32_t gPartitionSize = 256*8; // GROUP_SIZE*ITEMS_PER_THREAD in prefix_scan.slang
+
+	GpuPrefixScan() = default;
+	GpuPrefixScan(const GpuPrefixScan&) = default;
+	GpuPrefixScan(GpuPrefixScan&&) = default;
+	GpuPrefixScan(Device& device);
+
+	GpuPrefixScan& operator=(const GpuPrefixScan&) = default;
+	GpuPrefixScan& operator=(GpuPrefixScan&&) = default;
+
+	// Writes the exclusive prefix sum of input[0, count) to output, which may alias input.
+	// Writes to input must be visible to compute shaders. The caller barriers output before reading it.
+	void exclusiveScan(CommandBuffer& commandBuffer, const Buffer::View<uint32_t>& input, const Buffer::View<uint32_t>& output, const uint32_t count);
+
+private:
+	ComputePipelineCache mPipeline;
+	DeviceResourcePool mResourcePool;
+};
+
+}
@@ -0,0 +1,109 @@
+#include "GpuRadixSort.hpp"
+#include "Instance.hpp"
+
+namespace stm2 {
+
+GpuRadixSort::GpuRadixSort(Device& device) {
+	const filesystem::path shaderPath = *device.mInstance.findArgument("shaderKernelPath");
+	mDispatchArgsPipeline   = ComputePipelineCache(shaderPath / "radix_sort.slang", "WriteDispatchArgs", "sm_6_6", { "-O3", "-capability", "spirv_1_5" });
+	mHistogramPipeline      = ComputePipelineCache(shaderPath / "radix_sort.slang", "Histogram"     , "sm_6_6", { "-O3", "-capability", "spirv_1_5" });
+	mScanHistogramsPipeline = ComputePipelineCache(shaderPath / "radix_sort.slang", "ScanHistograms", "sm_6_6", { "-O3", "-capability", "spirv_1_5" });
+	mOnesweepPipeline       = ComputePipelineCache(shaderPath / "radix_sort.slang", "Onesweep"      , "sm_6_6", { "-O3", "-capability", "spirv_1_5" });
+}
+
+void GpuRadixSort::sort(CommandBuffer& commandBuffer, const Buffer::View<uint32_t>& keys, const Buffer::View<uint32_t>& values, const uint32_t maxCount, const uint32_t keyBits, const Buffer::View<uint32_t>& countBuffer) {
+	sortKeys(commandBuffer, keys, values, 1, maxCount, keyBits, countBuffer);
+}
+void GpuRadixSort::sort(CommandBuffer& commandBuffer, const Buffer::View<uint2>& keys, const Buffer::View<uint32_t>& values, const uint32_t maxCount, const uint32_t keyBits, const Buffer::View<uint32_t>& countBuffer) {
+	sortKeys(commandBuffer, keys, values, 2, maxCount, keyBits, countBuffer);
+}
+
+void GpuRadixSort::sortKeys(CommandBuffer& commandBuffer, const Buffer::View<byte>& keys, const Buffer::View<uint32_t>& values, const uint32_t keyWords, const uint32_t maxCount, const uint32_t keyBits, const Buffer::View<uint32_t>& countBuffer) {
+	if (maxCount == 0 || keyBits == 0) return;
+
+	mResourcePool.clean();
+
+	Device& device = commandBuffer.mDevice;
+
+	// an even number of passes leaves the result in the input buffers. the extra pass, if any, is past keyBits,
+	// where every digit is 0, so it is a stable copy.
+	const uint32_t bits = min(keyBits, keyWords*32);
+	uint32_t passCount = (bits + 7)/8;
+	passCount += passCount % 2;
+
+	const uint32_t partitionCount = (maxCount + gPartitionSize - 1) / gPartitionSize;
+
+	const Buffer::View<byte>     tmpKeys    = mResourcePool.getBuffer<uint32_t>(device, "GpuRadixSort::mKeys", maxCount*keyWords);
+	const Buffer::View<uint32_t> tmpValues  = mResourcePool.getBuffer<uint32_t>(device, "GpuRadixSort::mValues", maxCount);
+	const Buffer::View<uint32_t> histograms = mResourcePool.getBuffer<uint32_t>(device, "GpuRadixSort::mHistograms", passCount*256, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+	// for each pass: partition counter + one descriptor per partition and digit
+	const Buffer::View<uint32_t> state      = mResourcePool.getBuffer<uint32_t>(device, "GpuRadixSort::mState", passCount*(1 + partitionCount*256), vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+
+	const Buffer::View<vk::DispatchIndirectCommand> dispatchArgs = mResourcePool.getBuffer<vk::DispatchIndirectCommand>(device, "GpuRadixSort::mDispatchArgs", 1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eIndirectBuffer);
+
+	// the count is copied so that countBuffer can be any view, regardless of storage buffer offset alignment
+	const Buffer::View<uint32_t> count = mResourcePool.getBuffer<uint32_t>(device, "GpuRadixSort::mCount", 1, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferDst);
+	if (countBuffer) {
+		const Buffer::View<uint32_t> src(countBuffer.buffer(), countBuffer.offset(), 1);
+		src.barrier(commandBuffer,
+			vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer,
+			vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+		Buffer::copy(commandBuffer, src, count);
+	} else
+		count.fill(commandBuffer, maxCount);
+	histograms.fill(commandBuffer, 0);
+	state.fill(commandBuffer, 0);
+	Buffer::barriers(commandBuffer, { count, histograms, state },
+		vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+
+	const Defines defs { { "KEY_WORDS", to_string(keyWords) } };
+
+	PushConstants pushConstants {
+		{ "mMaxCount", PushConstantValue(maxCount) },
+		{ "mPassCount", PushConstantValue(passCount) },
+		{ "mPass", PushConstantValue(0u) },
+		{ "mPartitionCount", PushConstantValue(partitionCount) },
+		{ "mKeyBits", PushConstantValue(bits) } };
+
+	Descriptors descriptors;
+	descriptors[{ "gCount", 0 }] = count;
+	descriptors[{ "gHistograms", 0 }] = histograms;
+	descriptors[{ "gState", 0 }] = state;
+
+	descriptors[{ "gDispatchArgs", 0 }] = dispatchArgs;
+	descriptors[{ "gKeysIn", 0 }] = keys;
+
+	mDispatchArgsPipeline.get(device, defs)->dispatch(commandBuffer, vk::Extent3D(1, 1, 1), descriptors, {}, pushConstants);
+	dispatchArgs.barrier(commandBuffer,
+		vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect,
+		vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eIndirectCommandRead);
+
+	// digit counts of every pass
+	mHistogramPipeline.get(device, defs)->dispatchIndirect(commandBuffer, dispatchArgs, descriptors, {}, pushConstants);
+	histograms.barrier(commandBuffer,
+		vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+
+	mScanHistogramsPipeline.get(device, defs)->dispatch(commandBuffer, vk::Extent3D(passCount, 1, 1), descriptors, {}, pushConstants);
+	histograms.barrier(commandBuffer,
+		vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+
+	const shared_ptr<ComputePipeline> onesweepPipeline = mOnesweepPipeline.get(device, defs);
+	for (uint32_t pass = 0; pass < passCount; pass++) {
+		const bool fromInput = (pass % 2) == 0;
+		descriptors[{ "gKeysIn", 0 }]    = fromInput ? keys : tmpKeys;
+		descriptors[{ "gValuesIn", 0 }]  = fromInput ? values : tmpValues;
+		descriptors[{ "gKeysOut", 0 }]   = fromInput ? tmpKeys : keys;
+		descriptors[{ "gValuesOut", 0 }] = fromInput ? tmpValues : values;
+		pushConstants["mPass"] = pass;
+		onesweepPipeline->dispatchIndirect(commandBuffer, dispatchArgs, descriptors, {}, pushConstants);
+
+		Buffer::barriers(commandBuffer, { fromInput ? tmpKeys : keys, fromInput ? tmpValues : values },
+			vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+			vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+	}
+}
+
+}
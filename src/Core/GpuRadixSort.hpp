@@ -0,0 +1,37 @@
+#pragma once
+
+#include "DeviceResourcePool.hpp"
+
+namespace stm2 {
+
+// Stable key/value radix sort with 8-bit digits (kernels/radix_sort.slang). The digit histograms of all passes are
+// built in one pass over the keys, then each digit is scattered by a single kernel using decoupled look-back.
+// Counts must fit in 30 bits.
+class GpuRadixSort {
+public:
+	static constexpr uint32_t gPartitionSize = 256*8; // GROUP_SIZE*ITEMS_PER_THREAD in radix_sort.slang
+
+	GpuRadixSort() = default;
+	GpuRadixSort(const GpuRadixSort&) = default;
+	GpuRadixSort(GpuRadixSort&&) = default;
+	GpuRadixSort(Device& device);
+
+	GpuRadixSort& operator=(const GpuRadixSort&) = default;
+	GpuRadixSort& operator=(GpuRadixSort&&) = default;
+
+	// Sorts the first count elements of keys and values in place, by the low keyBits bits of each key.
+	// If countBuffer is set, count is read from countBuffer[0] on the device and clamped to maxCount, and the
+	// dispatches are sized by it. countBuffer is written by compute shaders and needs eTransferSrc usage.
+	// Writes to the inputs must be visible to compute shaders. The results are visible to compute shaders on return.
+	void sort(CommandBuffer& commandBuffer, const Buffer::View<uint32_t>& keys, const Buffer::View<uint32_t>& values, const uint32_t maxCount, const uint32_t keyBits = 32, const Buffer::View<uint32_t>& countBuffer = {});
+	// 64-bit keys, stored as (low, high) words
+	void sort(CommandBuffer& commandBuffer, const Buffer::View<uint2>& keys, const Buffer::View<uint32_t>& values, const uint32_t maxCount, const uint32_t keyBits = 64, const Buffer::View<uint32_t>& countBuffer = {});
+
+private:
+	ComputePipelineCache mDispatchArgsPipeline, mHistogramPipeline, mScanHistogramsPipeline, mOnesweepPipeline;
+	DeviceResourcePool mResourcePool;
+
+	void sortKeys(CommandBuffer& commandBuffer, const Buffer::View<byte>& keys, const Buffer::View<uint32_t>& values, const uint32_t keyWords, const uint32_t maxCount, const uint32_t keyBits, const Buffer::View<uint32_t>& countBuffer);
+};
+
+}
@@ -0,0 +1,76 @@
+#include "GpuStats.hpp"
+#include "utils.hpp"
+
+#include <imgui/imgui.h>
+
+namespace stm2 {
+
+GpuStats::GpuStats(Device& device) : mDevice(device), mRateTimer(chrono::high_resolution_clock::now()) {
+	ranges::fill(mSums, 0);
+	ranges::fill(mRates, 0.f);
+}
+
+Buffer::View<uint32_t> GpuStats::counters(CommandBuffer& commandBuffer) {
+	if (mCurrent && mFrames[*mCurrent].mFrameIndex == mDevice.frameIndex())
+		return mFrames[*mCurrent].mCounters;
+
+	// reuse counters whose readback is done, so the ring grows only while the device lags behind
+	auto it = ranges::find_if(mFrames, [](const FrameCounters& f) { return !f.mPending; });
+	if (it == mFrames.end()) {
+		const string name = "GpuStats[" + to_string(mFrames.size()) + "]";
+		FrameCounters& f = mFrames.emplace_back();
+		f.mCounters = make_shared<Buffer>(mDevice, name, sizeof(uint32_t)*(size_t)GpuStat::eGpuStatCount, vk::BufferUsageFlagBits::eStorageBuffer|vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst);
+		f.mReadback = make_shared<Buffer>(mDevice, name + "/Readback", f.mCounters.sizeBytes(), vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent, true);
+		it = prev(mFrames.end());
+	}
+
+	it->mFrameIndex = mDevice.frameIndex();
+	it->mPending = true;
+	mCurrent = distance(mFrames.begin(), it);
+
+	it->mCounters.fill(commandBuffer, 0);
+	it->mCounters.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead|vk::AccessFlagBits::eShaderWrite);
+	return it->mCounters;
+}
+
+void GpuStats::resolve(CommandBuffer& commandBuffer) {
+	if (!mCurrent) return;
+	FrameCounters& f = mFrames[*mCurrent];
+	if (f.mFrameIndex != mDevice.frameIndex()) return;
+
+	f.mCounters.barrier(commandBuffer, vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+	Buffer::copy(commandBuffer, f.mCounters, f.mReadback);
+	f.mReadback.barrier(commandBuffer, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+}
+
+void GpuStats::update() {
+	for (FrameCounters& f : mFrames) {
+		if (!f.mPending || f.mFrameIndex > mDevice.lastFrameDone()) continue;
+		for (uint32_t i = 0; i < mSums.size(); i++)
+			mSums[i] += f.mReadback[i];
+		f.mPending = false;
+	}
+
+	const auto t = chrono::high_resolution_clock::now();
+	const float dt = chrono::duration_cast<chrono::duration<float>>(t - mRateTimer).count();
+	if (dt > 1) {
+		for (uint32_t i = 0; i < mSums.size(); i++)
+			mRates[i] = mSums[i] / dt;
+		ranges::fill(mSums, 0);
+		mRateTimer = t;
+	}
+}
+
+void GpuStats::drawGui() {
+	bool shown = false;
+	for (uint32_t i = 0; i < mRates.size(); i++) {
+		if (mRates[i] <= 0) continue;
+		const auto[r, unit] = formatNumber(mRates[i]);
+		ImGui::Text("%s: %.1f%s/s", to_string((GpuStat)i).c_str(), r, unit);
+		shown = true;
+	}
+	if (shown && rate(GpuStat::eShifts) > 0)
+		ImGui::Text("%.1f%% of shifts rejected", 100*rate(GpuStat::eReservoirRejections)/rate(GpuStat::eShifts));
+}
+
+}
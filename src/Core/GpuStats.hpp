@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Buffer.hpp"
+#include <Shaders/compat/gpu_stats.h>
+
+namespace stm2 {
+
+// Per-frame GPU counters (see compat/gpu_stats.h and SceneParameters::AddStat).
+// Each frame's counters are copied to a host visible buffer at the end of the frame and read once the
+// frame's fence has been waited on, so reading them never stalls the device. Rates update once per second.
+class GpuStats {
+public:
+	GpuStats(Device& device);
+
+	// Counters for the frame being recorded, cleared by the first call each frame.
+	// Kernels only write them when gGpuStats is defined.
+	Buffer::View<uint32_t> counters(CommandBuffer& commandBuffer);
+
+	// Records the copy of this frame's counters to the host. Called once per frame, after all work that writes them.
+	void resolve(CommandBuffer& commandBuffer);
+
+	// Accumulates the counters of finished frames. Called once per frame, after waiting on the oldest frame's fence.
+	void update();
+
+	// Average per second over the last update period
+	inline float rate(const GpuStat stat) const { return mRates[(uint32_t)stat]; }
+
+	void drawGui();
+
+private:
+	struct FrameCounters {
+		Buffer::View<uint32_t> mCounters;
+		Buffer::View<uint32_t> mReadback;
+		size_t mFrameIndex = 0;
+		bool mPending = false;
+	};
+
+	Device& mDevice;
+	vector<FrameCounters> mFrames;
+	optional<size_t> mCurrent; // index in mFrames of the counters of the frame being recorded
+
+	array<uint64_t, (size_t)GpuStat::eGpuStatCount> mSums;
+	array<float, (size_t)GpuStat::eGpuStatCount> mRates;
+	chrono::high_resolution_clock::time_point mRateTimer;
+};
+
+}
@@ -1,5 +1,6 @@
 #include "Image.hpp"
 #include "Buffer.hpp"
+#include "MappedFile.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -56,53 +57,70 @@ inline vk::Format dxgiToVulkan(tinyddsloader::DDSFile::DXGIFormat format, const
 
 Image::PixelData Image::loadFile(Device& device, const filesystem::path& filename, const bool srgb, int desiredChannels) {
 	if (!filesystem::exists(filename)) throw invalid_argument("File does not exist: " + filename.string());
-	if (filename.extension() == ".exr") {
-		float* data = nullptr;
+	// read the file once, and decode it from memory
+	const MappedFile file(filename);
+	PixelData pixels = loadMemory(device, filename.stem().string(), file.bytes(), srgb, desiredChannels);
+	const vk::Extent3D extent = get<vk::Extent3D>(pixels);
+	cout << "Loaded " << filename << " (" << extent.width << "x" << extent.height << ")" << endl;
+	return pixels;
+}
+
+Image::PixelData Image::loadMemory(Device& device, const string& name, const span<const byte> data, const bool srgb, int desiredChannels) {
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+	const size_t size = data.size();
+
+	if (size >= 4 && bytes[0] == 0x76 && bytes[1] == 0x2f && bytes[2] == 0x31 && bytes[3] == 0x01) {
+		// OpenEXR
+		float* pixels = nullptr;
 		int width;
 		int height;
 		const char* err = nullptr;
-		int ret = LoadEXR(&data, &width, &height, filename.string().c_str(), &err);
+		int ret = LoadEXRFromMemory(&pixels, &width, &height, bytes, size, &err);
 		if (ret != TINYEXR_SUCCESS) {
 			std::cerr << "OpenEXR error: " << err << std::endl;
 			FreeEXRErrorMessage(err);
-			throw runtime_error(std::string("Failure when loading image: ") + filename.string());
+			throw runtime_error(std::string("Failure when loading image: ") + name);
 		}
-		auto buf = make_shared<Buffer>(device, filename.stem().string() + "/Staging", width*height*sizeof(float)*4, vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
-		memcpy(buf->data(), data, buf->size());
-		free(data);
+		auto buf = make_shared<Buffer>(device, name + "/Staging", width*height*sizeof(float)*4, vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		memcpy(buf->data(), pixels, buf->size());
+		free(pixels);
 		return Image::PixelData{buf, vk::Format::eR32G32B32A32Sfloat, vk::Extent3D(width,height,1)};
-	} else if (filename.extension() == ".dds") {
+	} else if (size >= 4 && memcmp(bytes, "DDS ", 4) == 0) {
 		using namespace tinyddsloader;
 		DDSFile dds;
-    	auto ret = dds.Load(filename.string().c_str());
-		if (tinyddsloader::Result::tinydds_Success != ret) throw runtime_error("Failed to load " + filename.string());
+		auto ret = dds.Load(bytes, size);
+		if (tinyddsloader::Result::tinydds_Success != ret) throw runtime_error("Failed to load " + name);
 		dds.GetBitsPerPixel(dds.GetFormat());
 
 		dds.Flip();
 
 		const DDSFile::ImageData* img = dds.GetImageData(0, 0);
 
-		auto buf = make_shared<Buffer>(device, filename.stem().string() + "/Staging", img->m_memSlicePitch, vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		auto buf = make_shared<Buffer>(device, name + "/Staging", img->m_memSlicePitch, vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 		memcpy(buf->data(), img->m_mem, buf->size());
 		return Image::PixelData{buf, dxgiToVulkan(dds.GetFormat(), desiredChannels == 4), vk::Extent3D(dds.GetWidth(), dds.GetHeight(), dds.GetDepth())};
 	} else {
+		if (size > (size_t)numeric_limits<int>::max()) throw invalid_argument("Image is too large: " + name);
+		const int len = (int)size;
+
 		int x,y,channels;
-		stbi_info(filename.string().c_str(), &x, &y, &channels);
+		if (!stbi_info_from_memory(bytes, len, &x, &y, &channels))
+			throw invalid_argument("Could not decode " + name + ": " + stbi_failure_reason());
 
 		if (channels == 3) desiredChannels = 4;
 
 		byte* pixels = nullptr;
 		vk::Format format = vk::Format::eUndefined;
-		if (stbi_is_hdr(filename.string().c_str())) {
-			pixels = (byte*)stbi_loadf(filename.string().c_str(), &x, &y, &channels, desiredChannels);
+		if (stbi_is_hdr_from_memory(bytes, len)) {
+			pixels = (byte*)stbi_loadf_from_memory(bytes, len, &x, &y, &channels, desiredChannels);
 			switch(desiredChannels ? desiredChannels : channels) {
 				case 1: format = vk::Format::eR32Sfloat; break;
 				case 2: format = vk::Format::eR32G32Sfloat; break;
 				case 3: format = vk::Format::eR32G32B32Sfloat; break;
 				case 4: format = vk::Format::eR32G32B32A32Sfloat; break;
 			}
-		} else if (stbi_is_16_bit(filename.string().c_str())) {
-			pixels = (byte*)stbi_load_16(filename.string().c_str(), &x, &y, &channels, desiredChannels);
+		} else if (stbi_is_16_bit_from_memory(bytes, len)) {
+			pixels = (byte*)stbi_load_16_from_memory(bytes, len, &x, &y, &channels, desiredChannels);
 			switch(desiredChannels ? desiredChannels : channels) {
 				case 1: format = vk::Format::eR16Unorm; break;
 				case 2: format = vk::Format::eR16G16Unorm; break;
@@ -110,7 +128,7 @@ Image::PixelData Image::loadFile(Device& device, const filesystem::path& filenam
 				case 4: format = vk::Format::eR16G16B16A16Unorm; break;
 			}
 		} else {
-			pixels = (byte*)stbi_load(filename.string().c_str(), &x, &y, &channels, desiredChannels);
+			pixels = (byte*)stbi_load_from_memory(bytes, len, &x, &y, &channels, desiredChannels);
 			switch (desiredChannels ? desiredChannels : channels) {
 				case 1: format = srgb ? vk::Format::eR8Srgb : vk::Format::eR8Unorm; break;
 				case 2: format = srgb ? vk::Format::eR8G8Srgb : vk::Format::eR8G8Unorm; break;
@@ -118,18 +136,15 @@ Image::PixelData Image::loadFile(Device& device, const filesystem::path& filenam
 				case 4: format = srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm; break;
 			}
 		}
-		if (!pixels) throw invalid_argument("Could not load " + filename.string());
-		cout << "Loaded " << filename << " (" << x << "x" << y << ")" << endl;
-		if (desiredChannels) channels = desiredChannels;
+		if (!pixels) throw invalid_argument("Could not decode " + name + ": " + stbi_failure_reason());
 
-		auto buf = make_shared<Buffer>(device, filename.stem().string() + "/Staging", x*y*texelSize(format), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+		auto buf = make_shared<Buffer>(device, name + "/Staging", x*y*texelSize(format), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
 		memcpy(buf->data(), pixels, buf->size());
 		stbi_image_free(pixels);
 		return Image::PixelData{buf, format, vk::Extent3D(x,y,1)};
 	}
 }
 
-
 Image::Image(Device& device, const string& name, const Metadata& metadata, const vk::MemoryPropertyFlags memoryFlags) : Device::Resource(device, name), mImage(nullptr), mMetadata(metadata) {
 	VmaAllocationCreateInfo allocationCreateInfo;
 	allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
@@ -214,7 +229,7 @@ void Image::upload(CommandBuffer& commandBuffer, const PixelData& pixels) {
 	commandBuffer.trackResource(buf);
 
 	commandBuffer->copyBufferToImage(**buf, mImage, vk::ImageLayout::eTransferDstOptimal,
-		vk::BufferImageCopy(0, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), vk::Offset3D{0,0,0}, extent ));
+		vk::BufferImageCopy(buf->offset(), 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1), vk::Offset3D{0,0,0}, extent ));
 }
 
 void Image::barrier(CommandBuffer& commandBuffer, const vk::ImageSubresourceRange& subresource, const Image::SubresourceLayoutState& newState) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <bit>
+#include <span>
 
 #include "CommandBuffer.hpp"
 
@@ -32,6 +33,8 @@ public:
 
 	using PixelData = tuple<shared_ptr<Buffer>, vk::Format, vk::Extent3D>;
 	static PixelData loadFile(Device& device, const filesystem::path& filename, const bool srgb = true, int desiredChannels = 0);
+	// decodes an encoded image (exr, dds, or any format supported by stb_image) from memory
+	static PixelData loadMemory(Device& device, const string& name, const span<const byte> data, const bool srgb = true, int desiredChannels = 0);
 
 	Image(Device& device, const string& name, const Metadata& metadata, const vk::MemoryPropertyFlags memoryFlags = vk::MemoryPropertyFlagBits::eDeviceLocal);
 	Image(Device& device, const string& name, const vk::Image image, const Metadata& metadata);
@@ -0,0 +1,69 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace stm2 {
+
+MappedFile::MappedFile(const filesystem::path& filename) {
+#ifdef _WIN32
+	HANDLE file = CreateFileW(filename.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw runtime_error("Failed to open " + filename.string());
+	mFile = file;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		throw runtime_error("Failed to get size of " + filename.string());
+	}
+	mSize = (size_t)size.QuadPart;
+	if (mSize == 0) return;
+	mMapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mMapping) {
+		CloseHandle(file);
+		throw runtime_error("Failed to map " + filename.string());
+	}
+	mData = (const byte*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mData) {
+		CloseHandle(mMapping);
+		CloseHandle(file);
+		throw runtime_error("Failed to map " + filename.string());
+	}
+#else
+	mFile = open(filename.c_str(), O_RDONLY);
+	if (mFile < 0) throw runtime_error("Failed to open " + filename.string());
+	struct stat st;
+	if (fstat(mFile, &st) != 0) {
+		close(mFile);
+		throw runtime_error("Failed to get size of " + filename.string());
+	}
+	mSize = (size_t)st.st_size;
+	if (mSize == 0) return;
+	void* ptr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+	if (ptr == MAP_FAILED) {
+		close(mFile);
+		throw runtime_error("Failed to map " + filename.string());
+	}
+	mData = (const byte*)ptr;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile) CloseHandle(mFile);
+#else
+	if (mData) munmap((void*)mData, mSize);
+	if (mFile >= 0) close(mFile);
+#endif
+}
+
+}
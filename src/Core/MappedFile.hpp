@@ -0,0 +1,39 @@
+#pragma once
+
+#include <span>
+
+#include "fwd.hpp"
+#include "utils.hpp"
+
+namespace stm2 {
+
+// Read-only memory mapping of a file. Pages are loaded by the OS on first access,
+// so large files can be read from without copying them into memory up front.
+class MappedFile {
+public:
+	MappedFile(const filesystem::path& filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	inline const byte* data() const { return mData; }
+	inline size_t size() const { return mSize; }
+	inline span<const byte> bytes() const { return span<const byte>(mData, mSize); }
+	inline span<const byte> bytes(const size_t offset, const size_t size) const {
+		if (offset + size > mSize) throw out_of_range("MappedFile range exceeds file size");
+		return span<const byte>(mData + offset, size);
+	}
+
+private:
+	const byte* mData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+#else
+	int mFile = -1;
+#endif
+};
+
+}
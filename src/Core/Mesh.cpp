@@ -1,6 +1,9 @@
 #include "Mesh.hpp"
 #include "CommandBuffer.hpp"
+#include "Instance.hpp"
 
+#include <deque>
+#include <numeric>
 #include <imgui/imgui.h>
 
 namespace stm2 {
@@ -61,18 +64,551 @@ Mesh::VertexLayoutDescription Mesh::vertexLayout(const Shader& vertexShader) con
 	return layout;
 }
 
+namespace {
+
+// Orders the triangles of a meshlet for the post-transform vertex cache with Tipsify (Sander et al., "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw", 2007). Triangles hold three 8-bit indices into the meshlet's vertices.
+void tipsify(vector<uint32_t>& triangles, const uint32_t vertexCount, const int cacheSize) {
+	auto vertex = [&](const uint32_t t, const uint32_t j) { return (triangles[t] >> (8*j)) & 0xFF; };
+
+	vector<vector<uint32_t>> adjacency(vertexCount);
+	for (uint32_t t = 0; t < triangles.size(); t++)
+		for (uint32_t j = 0; j < 3; j++)
+			adjacency[vertex(t, j)].emplace_back(t);
+	vector<int> liveTriangles(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+		liveTriangles[v] = (int)adjacency[v].size();
+
+	vector<int> cacheTime(vertexCount, 0);
+	vector<bool> emitted(triangles.size(), false);
+	vector<uint32_t> deadEnds;
+	vector<uint32_t> candidates;
+	vector<uint32_t> ordered;
+	ordered.reserve(triangles.size());
+	int time = cacheSize + 1;
+	uint32_t cursor = 0;
+
+	int fanningVertex = 0;
+	while (fanningVertex >= 0) {
+		// emit the remaining triangles around the fanning vertex
+		candidates.clear();
+		for (const uint32_t t : adjacency[fanningVertex]) {
+			if (emitted[t]) continue;
+			ordered.emplace_back(triangles[t]);
+			emitted[t] = true;
+			for (uint32_t j = 0; j < 3; j++) {
+				const uint32_t v = vertex(t, j);
+				deadEnds.emplace_back(v);
+				candidates.emplace_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > cacheSize)
+					cacheTime[v] = time++;
+			}
+		}
+
+		// next, the candidate that is still in the cache after its remaining triangles are emitted, and entered it earliest
+		int next = -1;
+		int bestPriority = -1;
+		for (const uint32_t v : candidates) {
+			if (liveTriangles[v] <= 0) continue;
+			const int priority = (time - cacheTime[v] + 2*liveTriangles[v] <= cacheSize) ? time - cacheTime[v] : 0;
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				next = (int)v;
+			}
+		}
+		// dead end: a recently used vertex, then any vertex with remaining triangles
+		while (next < 0 && !deadEnds.empty()) {
+			const uint32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[v] > 0)
+				next = (int)v;
+		}
+		for (; next < 0 && cursor < vertexCount; cursor++)
+			if (liveTriangles[cursor] > 0)
+				next = (int)cursor;
+		fanningVertex = next;
+	}
+
+	triangles = move(ordered);
+}
+
+// kd-tree over triangle centroids, for finding the unemitted triangle nearest to a meshlet once no adjacent triangles remain
+class TriangleTree {
+public:
+	TriangleTree(vector<float3>&& centroids) : mCentroids(move(centroids)) {
+		mItems.resize(mCentroids.size());
+		iota(mItems.begin(), mItems.end(), 0u);
+		build(0, (uint32_t)mItems.size());
+	}
+
+	// Returns the triangle nearest to p that is not yet emitted, or ~0u if there is none. Emitted triangles are
+	// removed from the leaves they are found in.
+	inline uint32_t nearest(const float3& p, const vector<bool>& emitted) {
+		uint32_t best = ~0u;
+		float bestDist = numeric_limits<float>::infinity();
+		nearest(0, p, emitted, best, bestDist);
+		return best;
+	}
+
+private:
+	static const uint32_t gLeafSize = 8;
+
+	struct Node {
+		uint32_t mBegin; // range of mItems
+		uint32_t mEnd;
+		uint32_t mAxis; // 3 for leaves
+		float mSplit;
+		uint32_t mRight; // the left child follows its parent
+	};
+
+	vector<float3> mCentroids;
+	vector<uint32_t> mItems;
+	vector<Node> mNodes;
+
+	inline uint32_t build(const uint32_t begin, const uint32_t end) {
+		const uint32_t nodeIndex = (uint32_t)mNodes.size();
+		mNodes.emplace_back(Node{ begin, end, 3, 0, 0 });
+		if (end - begin <= gLeafSize) return nodeIndex;
+
+		float3 mn = float3::Constant( numeric_limits<float>::infinity());
+		float3 mx = float3::Constant(-numeric_limits<float>::infinity());
+		for (uint32_t i = begin; i < end; i++) {
+			mn = min(mn, mCentroids[mItems[i]]);
+			mx = max(mx, mCentroids[mItems[i]]);
+		}
+		Eigen::Index axis;
+		(mx - mn).maxCoeff(&axis);
+
+		const uint32_t mid = (begin + end) / 2;
+		nth_element(mItems.begin() + begin, mItems.begin() + mid, mItems.begin() + end, [&](const uint32_t a, const uint32_t b) {
+			return mCentroids[a][axis] < mCentroids[b][axis]; });
+		const float split = mCentroids[mItems[mid]][axis];
+
+		build(begin, mid);
+		const uint32_t right = build(mid, end);
+		mNodes[nodeIndex].mAxis = (uint32_t)axis;
+		mNodes[nodeIndex].mSplit = split;
+		mNodes[nodeIndex].mRight = right;
+		return nodeIndex;
+	}
+
+	inline void nearest(const uint32_t nodeIndex, const float3& p, const vector<bool>& emitted, uint32_t& best, float& bestDist) {
+		Node& node = mNodes[nodeIndex];
+		if (node.mAxis == 3) {
+			for (uint32_t i = node.mBegin; i < node.mEnd;) {
+				const uint32_t t = mItems[i];
+				if (emitted[t]) {
+					mItems[i] = mItems[--node.mEnd];
+					continue;
+				}
+				const float dist = (mCentroids[t] - p).matrix().squaredNorm();
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = t;
+				}
+				i++;
+			}
+			return;
+		}
+
+		const float d = p[node.mAxis] - node.mSplit;
+		nearest(d <= 0 ? nodeIndex + 1 : node.mRight, p, emitted, best, bestDist);
+		if (d*d < bestDist)
+			nearest(d <= 0 ? node.mRight : nodeIndex + 1, p, emitted, best, bestDist);
+	}
+};
+
+}
+
+optional<Mesh::MeshletData> Mesh::optimizeTriangles(const span<const float3> positions, const span<uint32_t> indices, const string& name, vector<uint32_t>* vertexRemap) {
+	const uint32_t vertexCount = (uint32_t)positions.size();
+	const uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+	if (triangleCount == 0) return nullopt;
+	for (const uint32_t i : indices)
+		if (i >= vertexCount) {
+			cerr << "Warning: " << name << " has out of range indices, skipping optimization" << endl;
+			return nullopt;
+		}
+
+	// triangles adjacent to each vertex
+	vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (const uint32_t i : indices)
+		adjacencyOffsets[i + 1]++;
+	inclusive_scan(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+	vector<uint32_t> adjacency(indices.size());
+	{
+		vector<uint32_t> counts(vertexCount, 0);
+		for (uint32_t t = 0; t < triangleCount; t++)
+			for (uint32_t j = 0; j < 3; j++) {
+				const uint32_t v = indices[3*t + j];
+				adjacency[adjacencyOffsets[v] + counts[v]++] = t;
+			}
+	}
+
+	struct Cluster {
+		MeshletInfo mInfo;
+		vector<uint32_t> mVertices;
+		vector<uint32_t> mTriangles; // three 8-bit indices into mVertices
+	};
+	vector<Cluster> clusters;
+	Cluster cluster;
+
+	vector<bool> emitted(triangleCount, false);
+	vector<uint8_t> localIndex(vertexCount, 0xFF);
+	deque<uint32_t> frontier;
+	float3 vertexSum = float3::Zero(); // sum of the current meshlet's vertex positions
+
+	vector<float3> centroids(triangleCount);
+	for (uint32_t t = 0; t < triangleCount; t++)
+		centroids[t] = (positions[indices[3*t]] + positions[indices[3*t + 1]] + positions[indices[3*t + 2]]) / 3;
+	// new meshlets start near the end of the previous one
+	float3 seedPosition = centroids[0];
+	TriangleTree triangleTree(move(centroids));
+
+	auto newVertexCount = [&](const uint32_t t) {
+		const uint32_t* tri = &indices[3*t];
+		uint32_t n = 0;
+		for (uint32_t j = 0; j < 3; j++)
+			if (localIndex[tri[j]] == 0xFF && (j == 0 || tri[j] != tri[0]) && (j < 2 || tri[j] != tri[1]))
+				n++;
+		return n;
+	};
+
+	auto addTriangle = [&](const uint32_t t) {
+		const uint32_t* tri = &indices[3*t];
+		uint32_t packed = 0;
+		for (uint32_t j = 0; j < 3; j++) {
+			if (localIndex[tri[j]] == 0xFF) {
+				localIndex[tri[j]] = (uint8_t)cluster.mVertices.size();
+				cluster.mVertices.emplace_back(tri[j]);
+				vertexSum += positions[tri[j]];
+			}
+			packed |= uint32_t(localIndex[tri[j]]) << (8*j);
+		}
+		cluster.mTriangles.emplace_back(packed);
+		emitted[t] = true;
+		for (uint32_t j = 0; j < 3; j++)
+			for (uint32_t a = adjacencyOffsets[tri[j]]; a < adjacencyOffsets[tri[j] + 1]; a++)
+				if (!emitted[adjacency[a]])
+					frontier.emplace_back(adjacency[a]);
+	};
+
+	auto flush = [&]() {
+		if (cluster.mTriangles.empty()) return;
+
+		MeshletInfo& m = cluster.mInfo;
+		m.mCounts = 0;
+		BF_SET(m.mCounts, (uint32_t)cluster.mVertices.size(), 0, 8);
+		BF_SET(m.mCounts, (uint32_t)cluster.mTriangles.size(), 8, 8);
+		m.pad = 0;
+
+		float3 mn = float3::Constant( numeric_limits<float>::infinity());
+		float3 mx = float3::Constant(-numeric_limits<float>::infinity());
+		for (const uint32_t v : cluster.mVertices) {
+			mn = min(mn, positions[v]);
+			mx = max(mx, positions[v]);
+		}
+		m.mCenter = (mn + mx) / 2;
+		m.mRadius = 0;
+		for (const uint32_t v : cluster.mVertices)
+			m.mRadius = max(m.mRadius, (positions[v] - m.mCenter).matrix().norm());
+
+		// normal cone, from the triangles' face normals
+		vector<float3> normals;
+		normals.reserve(cluster.mTriangles.size());
+		float3 axis = float3::Zero();
+		for (const uint32_t tri : cluster.mTriangles) {
+			const float3 p0 = positions[cluster.mVertices[ tri        & 0xFF]];
+			const float3 p1 = positions[cluster.mVertices[(tri >> 8)  & 0xFF]];
+			const float3 p2 = positions[cluster.mVertices[(tri >> 16) & 0xFF]];
+			const float3 n = (p1 - p0).matrix().cross((p2 - p0).matrix());
+			const float len = n.matrix().norm();
+			if (len > 0) {
+				normals.emplace_back(n / len);
+				axis += normals.back();
+			}
+		}
+		float minDot = 1;
+		if (axis.isZero())
+			minDot = -1;
+		else {
+			axis = axis.matrix().normalized();
+			for (const float3& n : normals)
+				minDot = min(minDot, n.matrix().dot(axis.matrix()));
+		}
+		m.mConeAxis = axis;
+		// wide cones rarely cull anything
+		m.mConeCutoff = minDot <= 0.1f ? 1.f : sqrt(1 - minDot*minDot);
+
+		tipsify(cluster.mTriangles, (uint32_t)cluster.mVertices.size(), 16);
+
+		for (const uint32_t v : cluster.mVertices)
+			localIndex[v] = 0xFF;
+		seedPosition = vertexSum / (float)cluster.mVertices.size();
+		vertexSum = float3::Zero();
+		clusters.emplace_back(move(cluster));
+		cluster = {};
+		frontier.clear();
+	};
+
+	while (true) {
+		// grow the current meshlet through adjacent triangles. once there are none, continue at the unemitted triangle
+		// nearest to the meshlet's centroid, and only start a new meshlet when that one doesn't fit.
+		uint32_t next = ~0u;
+		while (!frontier.empty() && next == ~0u) {
+			const uint32_t t = frontier.front();
+			frontier.pop_front();
+			if (!emitted[t] && cluster.mVertices.size() + newVertexCount(t) <= MESHLET_MAX_VERTICES)
+				next = t;
+		}
+		if (next == ~0u) {
+			next = triangleTree.nearest(cluster.mVertices.empty() ? seedPosition : vertexSum / (float)cluster.mVertices.size(), emitted);
+			if (next == ~0u) break;
+			if (cluster.mVertices.size() + newVertexCount(next) > MESHLET_MAX_VERTICES)
+				flush();
+		}
+		addTriangle(next);
+		if (cluster.mTriangles.size() == MESHLET_MAX_TRIANGLES)
+			flush();
+	}
+	flush();
+
+	// meshlets facing away from the mesh's center first, since they are the most likely to occlude the others
+	// (the cluster sort of Sander et al. 2007, with meshlets as clusters)
+	{
+		float3 mn = float3::Constant( numeric_limits<float>::infinity());
+		float3 mx = float3::Constant(-numeric_limits<float>::infinity());
+		for (const Cluster& c : clusters) {
+			mn = min(mn, c.mInfo.mCenter);
+			mx = max(mx, c.mInfo.mCenter);
+		}
+		const float3 meshCenter = (mn + mx) / 2;
+		vector<pair<float, uint32_t>> order(clusters.size());
+		for (uint32_t i = 0; i < clusters.size(); i++)
+			order[i] = { -(clusters[i].mInfo.mCenter - meshCenter).matrix().dot(clusters[i].mInfo.mConeAxis.matrix()), i };
+		ranges::stable_sort(order, {}, &pair<float, uint32_t>::first);
+		vector<Cluster> sorted;
+		sorted.reserve(clusters.size());
+		for (const auto&[key, i] : order)
+			sorted.emplace_back(move(clusters[i]));
+		clusters = move(sorted);
+	}
+
+	MeshletData result;
+	result.mMeshlets.reserve(clusters.size());
+	vector<uint32_t> orderedIndices;
+	vector<uint32_t> triangleTable;
+	orderedIndices.reserve(indices.size());
+	triangleTable.reserve(triangleCount);
+	for (Cluster& c : clusters) {
+		MeshletInfo& m = result.mMeshlets.emplace_back(c.mInfo);
+		m.mFirstTriangle = (uint32_t)triangleTable.size();
+		m.mVertexOffset = (uint32_t)result.mTables.size();
+		result.mTables.insert(result.mTables.end(), c.mVertices.begin(), c.mVertices.end());
+		for (const uint32_t tri : c.mTriangles) {
+			triangleTable.emplace_back(tri);
+			for (uint32_t j = 0; j < 3; j++)
+				orderedIndices.emplace_back(c.mVertices[(tri >> (8*j)) & 0xFF]);
+		}
+	}
+
+	// renumber vertices in order of first use. unused vertices are kept, after the used ones.
+	if (vertexRemap) {
+		vertexRemap->assign(vertexCount, ~0u);
+		uint32_t nextVertex = 0;
+		for (uint32_t& i : orderedIndices) {
+			if ((*vertexRemap)[i] == ~0u)
+				(*vertexRemap)[i] = nextVertex++;
+			i = (*vertexRemap)[i];
+		}
+		for (uint32_t& r : *vertexRemap)
+			if (r == ~0u)
+				r = nextVertex++;
+		for (uint32_t& v : result.mTables)
+			v = (*vertexRemap)[v];
+	}
+
+	ranges::copy(orderedIndices, indices.begin());
+
+	result.mTriangleTableOffset = (uint32_t)result.mTables.size();
+	result.mTables.insert(result.mTables.end(), triangleTable.begin(), triangleTable.end());
+	return result;
+}
+
+shared_ptr<const Mesh::Meshlets> Mesh::uploadMeshlets(CommandBuffer& commandBuffer, const MeshletData& meshlets, const string& name) {
+	shared_ptr<Meshlets> result = make_shared<Meshlets>();
+	result->mMeshlets = meshlets.mMeshlets;
+	result->mTriangleTableOffset = meshlets.mTriangleTableOffset;
+	Buffer::View<uint32_t> tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp " + name + " meshlets", meshlets.mTables.size()*sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	ranges::copy(meshlets.mTables, tmp.begin());
+	result->mTables = make_shared<Buffer>(commandBuffer.mDevice, name + " meshlets", tmp.sizeBytes(), vk::BufferUsageFlagBits::eTransferSrc|vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eStorageBuffer);
+	Buffer::copy(commandBuffer, tmp, result->mTables);
+	return result;
+}
+
+Mesh::VertexPrecision Mesh::vertexPrecision(Device& device) {
+	const auto arg = device.mInstance.findArgument("vertexPrecision");
+	if (!arg || *arg == "full") return VertexPrecision::eFull;
+	if (*arg == "compact") return VertexPrecision::eCompact;
+	if (*arg == "compressed") return VertexPrecision::eCompressed;
+	cerr << "Warning: unknown vertex precision " << *arg << ", using full precision" << endl;
+	return VertexPrecision::eFull;
+}
+
+vk::Format Mesh::positionFormat(Device& device, const VertexPrecision precision) {
+	if (precision != VertexPrecision::eCompressed)
+		return vk::Format::eR32G32B32Sfloat;
+	// positions are also BLAS input, so only quantize them if the device can build from them
+	if (device.accelerationStructureFeatures().accelerationStructure &&
+		!(device.physical().getFormatProperties(vk::Format::eR16G16B16A16Snorm).bufferFeatures & vk::FormatFeatureFlagBits::eAccelerationStructureVertexBufferKHR))
+		return vk::Format::eR32G32B32Sfloat;
+	return vk::Format::eR16G16B16A16Snorm;
+}
+vk::Format Mesh::normalFormat(const VertexPrecision precision) {
+	return precision == VertexPrecision::eFull ? vk::Format::eR32G32B32Sfloat : vk::Format::eR16G16Snorm;
+}
+vk::Format Mesh::texcoordFormat(const VertexPrecision precision, const span<const float2> texcoords) {
+	if (precision == VertexPrecision::eFull || texcoords.empty())
+		return vk::Format::eR32G32Sfloat;
+	// unorm16 has a step of 2^-16. half floats have a step of at most 2^-11 in [-1,1], and get too coarse outside of it.
+	float2 tmin = float2::Constant( numeric_limits<float>::infinity());
+	float2 tmax = float2::Constant(-numeric_limits<float>::infinity());
+	for (const float2& t : texcoords) {
+		tmin = min(tmin, t);
+		tmax = max(tmax, t);
+	}
+	if ((tmin >= 0).all() && (tmax <= 1).all())
+		return vk::Format::eR16G16Unorm;
+	if ((tmin >= -1).all() && (tmax <= 1).all())
+		return vk::Format::eR16G16Sfloat;
+	return vk::Format::eR32G32Sfloat;
+}
+
+pair<float3, float3> Mesh::positionQuantization(const vk::AabbPositionsKHR& aabb) {
+	const float3 mn(aabb.minX, aabb.minY, aabb.minZ);
+	const float3 mx(aabb.maxX, aabb.maxY, aabb.maxZ);
+	// flat meshes still need a nonzero scale to encode with
+	return make_pair((mn + mx)/2, ((mx - mn)/2).max(numeric_limits<float>::min()));
+}
+
+namespace {
+
+inline int16_t floatToSnorm16(const float x) {
+	return (int16_t)lround(clamp(x, -1.f, 1.f) * 32767);
+}
+
+// Same as packNormal2 in common.hlsli
+inline float2 octahedralEncode(const float3 v) {
+	const float l1 = v.abs().sum();
+	if (!(l1 > 0)) return float2::Zero();
+	const float2 p = v.head<2>() / l1;
+	if (v[2] > 0) return p;
+	return (1 - float2(p[1], p[0]).abs()) * float2(p[0] >= 0 ? 1.f : -1.f, p[1] >= 0 ? 1.f : -1.f);
+}
+
+template<typename F>
+Mesh::VertexAttributeData uploadEncoded(CommandBuffer& commandBuffer, const size_t count, const vk::Format format, const string& name, const vk::BufferUsageFlags usage, F&& encode) {
+	const uint32_t stride = texelSize(format);
+	Buffer::View<byte> tmp = make_shared<Buffer>(commandBuffer.mDevice, "tmp " + name, count*stride, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	encode(tmp.data());
+	Buffer::View<byte> buf = make_shared<Buffer>(commandBuffer.mDevice, name, tmp.sizeBytes(), usage|vk::BufferUsageFlagBits::eVertexBuffer);
+	Buffer::copy(commandBuffer, tmp, buf);
+	return { buf, Mesh::VertexAttributeDescription{ stride, format, 0, vk::VertexInputRate::eVertex } };
+}
+
+}
+
+void Mesh::encodePositions(const span<const float3> positions, const vk::AabbPositionsKHR& aabb, const vk::Format format, byte* dst) {
+	if (format == vk::Format::eR32G32B32Sfloat) {
+		memcpy(dst, positions.data(), positions.size_bytes());
+		return;
+	}
+	if (format != vk::Format::eR16G16B16A16Snorm) throw invalid_argument("Unsupported position format " + to_string(format));
+	const auto[offset, scale] = positionQuantization(aabb);
+	int16_t* q = reinterpret_cast<int16_t*>(dst);
+	for (size_t i = 0; i < positions.size(); i++) {
+		const float3 p = (positions[i] - offset) / scale;
+		q[4*i + 0] = floatToSnorm16(p[0]);
+		q[4*i + 1] = floatToSnorm16(p[1]);
+		q[4*i + 2] = floatToSnorm16(p[2]);
+		q[4*i + 3] = 0;
+	}
+}
+void Mesh::encodeNormals(const span<const float3> normals, const vk::Format format, byte* dst) {
+	if (format == vk::Format::eR32G32B32Sfloat) {
+		memcpy(dst, normals.data(), normals.size_bytes());
+		return;
+	}
+	if (format != vk::Format::eR16G16Snorm) throw invalid_argument("Unsupported normal format " + to_string(format));
+	int16_t* q = reinterpret_cast<int16_t*>(dst);
+	for (size_t i = 0; i < normals.size(); i++) {
+		const float2 p = octahedralEncode(normals[i]);
+		q[2*i + 0] = floatToSnorm16(p[0]);
+		q[2*i + 1] = floatToSnorm16(p[1]);
+	}
+}
+void Mesh::encodeTexcoords(const span<const float2> texcoords, const vk::Format format, byte* dst) {
+	switch (format) {
+	case vk::Format::eR32G32Sfloat:
+		memcpy(dst, texcoords.data(), texcoords.size_bytes());
+		break;
+	case vk::Format::eR16G16Unorm: {
+		uint16_t* q = reinterpret_cast<uint16_t*>(dst);
+		for (size_t i = 0; i < texcoords.size(); i++)
+			for (uint32_t c = 0; c < 2; c++)
+				q[2*i + c] = (uint16_t)lround(clamp(texcoords[i][c], 0.f, 1.f) * 65535);
+		break;
+	}
+	case vk::Format::eR16G16Sfloat: {
+		uint16_t* q = reinterpret_cast<uint16_t*>(dst);
+		for (size_t i = 0; i < texcoords.size(); i++)
+			for (uint32_t c = 0; c < 2; c++)
+				q[2*i + c] = bit_cast<uint16_t>(Eigen::half(texcoords[i][c]));
+		break;
+	}
+	default:
+		throw invalid_argument("Unsupported texcoord format " + to_string(format));
+	}
+}
+
+Mesh::VertexAttributeData Mesh::uploadPositions(CommandBuffer& commandBuffer, const span<const float3> positions, const vk::AabbPositionsKHR& aabb, const VertexPrecision precision, const string& name, const vk::BufferUsageFlags usage) {
+	const vk::Format format = positionFormat(commandBuffer.mDevice, precision);
+	return uploadEncoded(commandBuffer, positions.size(), format, name, usage, [&](byte* dst) { encodePositions(positions, aabb, format, dst); });
+}
+Mesh::VertexAttributeData Mesh::uploadNormals(CommandBuffer& commandBuffer, const span<const float3> normals, const VertexPrecision precision, const string& name, const vk::BufferUsageFlags usage) {
+	const vk::Format format = normalFormat(precision);
+	return uploadEncoded(commandBuffer, normals.size(), format, name, usage, [&](byte* dst) { encodeNormals(normals, format, dst); });
+}
+Mesh::VertexAttributeData Mesh::uploadTexcoords(CommandBuffer& commandBuffer, const span<const float2> texcoords, const VertexPrecision precision, const string& name, const vk::BufferUsageFlags usage) {
+	const vk::Format format = texcoordFormat(precision, texcoords);
+	return uploadEncoded(commandBuffer, texcoords.size(), format, name, usage, [&](byte* dst) { encodeTexcoords(texcoords, format, dst); });
+}
+
+size_t Mesh::sizeBytes() const {
+	size_t size = mIndices ? mIndices.sizeBytes() : 0;
+	for (const auto& [type, verts] : mVertices)
+		for (const auto&[buf, desc] : verts)
+			if (buf) size += buf.sizeBytes();
+	if (mMeshlets)
+		size += mMeshlets->mTables.sizeBytes() + mMeshlets->mMeshlets.size()*sizeof(MeshletInfo);
+	return size;
+}
+
 void Mesh::Vertices::bind(CommandBuffer& commandBuffer) const {
 	// TODO: bind mesh
 }
 void Mesh::bind(CommandBuffer& commandBuffer) const {
 	mVertices.bind(commandBuffer);
-	commandBuffer->bindIndexBuffer(**mIndices.buffer(), mIndices.offset(), indexType());
+	commandBuffer->bindIndexBuffer(**mIndices.buffer(), mIndices.absoluteOffset(), indexType());
 }
 
 void Mesh::drawGui() {
 	ImGui::LabelText("Topology", "%s", to_string(mTopology).c_str());
 	if (mIndices)
 		ImGui::LabelText("Index stride", "%s", to_string(mIndices.stride()).c_str());
+	if (mMeshlets)
+		ImGui::LabelText("Meshlets", "%u", (uint32_t)mMeshlets->mMeshlets.size());
 	for (const auto& [type, verts] : mVertices)
 		for (uint32_t i = 0; i < verts.size(); i++) {
 			const auto&[buf, desc] = verts[i];
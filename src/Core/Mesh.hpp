@@ -5,6 +5,8 @@
 #include "Buffer.hpp"
 #include "Shader.hpp"
 
+#include <Shaders/compat/meshlet.h>
+
 namespace stm2 {
 
 class Mesh {
@@ -56,6 +58,67 @@ public:
 		vk::AabbPositionsKHR mAabb;
 	};
 
+	struct Meshlets {
+		vector<MeshletInfo> mMeshlets;
+		// the meshlet vertex table, which holds indices into the vertex buffers, followed by the triangle
+		// table, which holds the three 8-bit indices into its meshlet's vertices of each triangle
+		Buffer::View<uint32_t> mTables;
+		uint32_t mTriangleTableOffset = 0; // in elements of mTables
+	};
+
+	// Meshlets of a triangle list before they are uploaded, see optimizeTriangles
+	struct MeshletData {
+		vector<MeshletInfo> mMeshlets;
+		vector<uint32_t> mTables; // the vertex table followed by the triangle table, as in Meshlets
+		uint32_t mTriangleTableOffset = 0;
+	};
+
+	// Load-time optimization of a triangle list for rasterization. Only touches host memory, so loaders may run it
+	// on worker threads. Triangles are split into meshlets, grown through adjacent triangles, and reordered so that
+	// each meshlet's triangles are contiguous. Triangles are ordered for the post-transform vertex cache within each
+	// meshlet (Tipsify), and meshlets are sorted outside-in to reduce overdraw.
+	// If vertexRemap is not null, vertices are also renumbered in order of first use, for vertex fetch locality.
+	// vertexRemap then holds the new index of each vertex, which vertex attributes must be reordered with (see remapVertices).
+	// Returns nullopt and leaves indices unchanged if they are out of range.
+	static optional<MeshletData> optimizeTriangles(const span<const float3> positions, const span<uint32_t> indices, const string& name, vector<uint32_t>* vertexRemap = nullptr);
+	static shared_ptr<const Meshlets> uploadMeshlets(CommandBuffer& commandBuffer, const MeshletData& meshlets, const string& name);
+
+	template<typename T>
+	inline static void remapVertices(const span<T> vertices, const span<const uint32_t> vertexRemap) {
+		const vector<T> tmp(vertices.begin(), vertices.end());
+		for (size_t i = 0; i < tmp.size(); i++)
+			vertices[vertexRemap[i]] = tmp[i];
+	}
+
+	// How loaders encode positions, normals and texcoords. Set with the vertexPrecision argument ("full", "compact"
+	// or "compressed"), and full by default. Encoded attributes are decoded in shaders by their format in
+	// MeshVertexInfo, see LoadVertexPosition, LoadVertexNormal and LoadVertexTexcoord in scene.hlsli.
+	enum class VertexPrecision {
+		eFull,      // float3 positions and normals, float2 texcoords
+		eCompact,   // octahedral 2x16-bit snorm normals, and 2x16-bit texcoords when they lose little precision
+		eCompressed // eCompact, and 4x16-bit snorm positions relative to the mesh's aabb if BLASes can be built from them
+	};
+	static VertexPrecision vertexPrecision(Device& device);
+
+	// Attribute formats chosen by the precision policy
+	static vk::Format positionFormat(Device& device, const VertexPrecision precision);
+	static vk::Format normalFormat(const VertexPrecision precision);
+	// unorm16 if every texcoord is in [0,1], half floats if they are in [-1,1], float otherwise
+	static vk::Format texcoordFormat(const VertexPrecision precision, const span<const float2> texcoords);
+
+	// Offset and scale that map 16-bit snorm positions to the aabb
+	static pair<float3, float3> positionQuantization(const vk::AabbPositionsKHR& aabb);
+
+	// Host-side encoding into dst, which must hold texelSize(format) bytes per element
+	static void encodePositions(const span<const float3> positions, const vk::AabbPositionsKHR& aabb, const vk::Format format, byte* dst);
+	static void encodeNormals(const span<const float3> normals, const vk::Format format, byte* dst);
+	static void encodeTexcoords(const span<const float2> texcoords, const vk::Format format, byte* dst);
+
+	// Encodes an attribute with the policy's format and uploads it to its own buffer
+	static VertexAttributeData uploadPositions(CommandBuffer& commandBuffer, const span<const float3> positions, const vk::AabbPositionsKHR& aabb, const VertexPrecision precision, const string& name, const vk::BufferUsageFlags usage);
+	static VertexAttributeData uploadNormals(CommandBuffer& commandBuffer, const span<const float3> normals, const VertexPrecision precision, const string& name, const vk::BufferUsageFlags usage);
+	static VertexAttributeData uploadTexcoords(CommandBuffer& commandBuffer, const span<const float2> texcoords, const VertexPrecision precision, const string& name, const vk::BufferUsageFlags usage);
+
 	Mesh() = default;
 	Mesh(const Mesh&) = default;
 	Mesh(Mesh&&) = default;
@@ -73,6 +136,24 @@ public:
 		return (mIndices.stride() == sizeof(uint32_t)) ? vk::IndexType::eUint32 : (mIndices.stride() == sizeof(uint16_t)) ? vk::IndexType::eUint16 : vk::IndexType::eUint8EXT;
 	}
 
+	// Hash of the position and index data, set by loaders which see it on the host. 0 if unknown.
+	// Used to key cached acceleration structures across runs.
+	inline size_t geometryHash() const { return mGeometryHash; }
+	inline void setGeometryHash(const size_t hash) { mGeometryHash = hash; }
+
+	// Hash of every vertex attribute and index as uploaded, with their formats and the topology, set by loaders.
+	// Zero if unknown. Meshes with equal content hashes are interchangeable, see MeshCache. 128 bits wide, since a
+	// collision would silently replace one mesh with another.
+	inline const Hash128& contentHash() const { return mContentHash; }
+	inline void setContentHash(const Hash128& hash) { mContentHash = hash; }
+
+	// Bytes of vertex, index and meshlet data the mesh references
+	size_t sizeBytes() const;
+
+	// Set by loaders for triangle lists, see optimizeTriangles. nullptr if the mesh has no meshlets.
+	inline const shared_ptr<const Meshlets>& meshlets() const { return mMeshlets; }
+	inline void setMeshlets(const shared_ptr<const Meshlets>& meshlets) { mMeshlets = meshlets; }
+
 	VertexLayoutDescription vertexLayout(const Shader& vertexShader) const;
 
 	void bind(CommandBuffer& commandBuffer) const;
@@ -83,6 +164,9 @@ private:
 	Vertices mVertices;
 	Buffer::StrideView mIndices;
 	vk::PrimitiveTopology mTopology = vk::PrimitiveTopology::eTriangleList;
+	size_t mGeometryHash = 0;
+	Hash128 mContentHash;
+	shared_ptr<const Meshlets> mMeshlets;
 };
 
 }
@@ -0,0 +1,44 @@
+#include "MeshCache.hpp"
+
+#include <imgui/imgui.h>
+
+namespace stm2 {
+
+shared_ptr<Mesh> MeshCache::find(const Hash128& contentHash) {
+	if (!contentHash) return nullptr;
+	scoped_lock l(mMutex);
+	auto it = mMeshes.find(contentHash);
+	if (it == mMeshes.end()) return nullptr;
+	shared_ptr<Mesh> mesh = it->second.lock();
+	if (!mesh) {
+		mMeshes.erase(it);
+		return nullptr;
+	}
+	mStats.mHits++;
+	mStats.mBytesSaved += mesh->sizeBytes();
+	return mesh;
+}
+
+shared_ptr<Mesh> MeshCache::intern(const shared_ptr<Mesh>& mesh) {
+	if (!mesh || !mesh->contentHash()) return mesh;
+	scoped_lock l(mMutex);
+	weak_ptr<Mesh>& entry = mMeshes[mesh->contentHash()];
+	if (shared_ptr<Mesh> registered = entry.lock()) {
+		if (registered != mesh) {
+			mStats.mHits++;
+			mStats.mBytesSaved += mesh->sizeBytes();
+		}
+		return registered;
+	}
+	entry = mesh;
+	mStats.mMeshes++;
+	return mesh;
+}
+
+void MeshCache::drawGui() {
+	const Stats s = stats();
+	ImGui::Text("%u unique meshes", s.mMeshes);
+	ImGui::Text("%u duplicates (%.2f MiB saved)", s.mHits, s.mBytesSaved / float(1 << 20));
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <mutex>
+
+#include "Mesh.hpp"
+
+namespace stm2 {
+
+// Content-addressed registry of meshes, shared by all loaded scenes. Loaders hash the vertex and index data they
+// upload (see Mesh::contentHash) on their worker threads, and look meshes up before uploading, so that identical
+// meshes loaded from different files, shapes or primitives share their buffers, and therefore a single BLAS.
+// Meshes are registered once the command buffer that uploaded them has completed, so lookups only return meshes
+// that any command buffer may use.
+class MeshCache {
+public:
+	struct Stats {
+		uint32_t mMeshes = 0; // unique meshes registered
+		uint32_t mHits = 0; // meshes replaced by a registered mesh, or never uploaded because of one
+		size_t mBytesSaved = 0; // vertex and index bytes of those meshes
+	};
+
+	// Returns the registered mesh with the content hash, or nullptr. A hit counts as a mesh the caller didn't upload.
+	shared_ptr<Mesh> find(const Hash128& contentHash);
+
+	// Counts a mesh that a loader didn't upload since an identical mesh was loaded earlier in the same file
+	inline void addDuplicate(const size_t sizeBytes) {
+		scoped_lock l(mMutex);
+		mStats.mHits++;
+		mStats.mBytesSaved += sizeBytes;
+	}
+
+	// Returns the registered mesh with mesh's content hash, or registers mesh and returns it.
+	// Meshes without a content hash are returned as is.
+	shared_ptr<Mesh> intern(const shared_ptr<Mesh>& mesh);
+
+	inline Stats stats() {
+		scoped_lock l(mMutex);
+		return mStats;
+	}
+
+	void drawGui();
+
+private:
+	mutex mMutex;
+	unordered_map<Hash128, weak_ptr<Mesh>> mMeshes;
+	Stats mStats;
+};
+
+}
@@ -77,7 +77,7 @@ void DescriptorSets::write(const Descriptors& descriptors) {
 				break;
 			}
 
-			info.buffer = vk::DescriptorBufferInfo(**v.buffer(), v.offset(), v.sizeBytes());
+			info.buffer = vk::DescriptorBufferInfo(**v.buffer(), v.absoluteOffset(), v.sizeBytes());
 			w.setBufferInfo(info.buffer);
 			break;
 		}
@@ -416,6 +416,16 @@ void ComputePipeline::dispatch(CommandBuffer& commandBuffer, const vk::Extent3D&
 	commandBuffer->dispatch(dim.width, dim.height, dim.depth);
 }
 
+void ComputePipeline::dispatchIndirect(CommandBuffer& commandBuffer, const Buffer::View<vk::DispatchIndirectCommand>& args, const shared_ptr<DescriptorSets>& descriptors, const unordered_map<string, uint32_t>& dynamicOffsets, const PushConstants& constants) {
+	commandBuffer.trackResource(descriptors);
+	commandBuffer.trackResource(args.buffer());
+
+	commandBuffer->bindPipeline(vk::PipelineBindPoint::eCompute, *mPipeline);
+	descriptors->bind(commandBuffer, dynamicOffsets);
+	pushConstants(commandBuffer, constants);
+	commandBuffer->dispatchIndirect(**args.buffer(), args.absoluteOffset());
+}
+
 
 shared_ptr<GraphicsPipeline> GraphicsPipelineCache::get(Device& device, const Defines& defines, const vector<shared_ptr<vk::raii::DescriptorSetLayout>>& descriptorSetLayouts, optional<pair<vk::RenderPass, uint32_t>> renderPass) {
 	size_t key = 0;
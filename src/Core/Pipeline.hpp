@@ -144,6 +144,13 @@ public:
 	inline void dispatchTiled(CommandBuffer& commandBuffer, const vk::Extent3D& dim, const Descriptors& descriptors = {}, const unordered_map<string, uint32_t>& dynamicOffsets = {}, const PushConstants& constants = {}) {
 		dispatch(commandBuffer, calculateDispatchDim(dim), descriptors, dynamicOffsets, constants);
 	}
+
+	// Dispatches with workgroup counts read from a vk::DispatchIndirectCommand in args, usually written by an earlier
+	// kernel. args must have eIndirectBuffer usage, and writes to it must be barriered to eDrawIndirect/eIndirectCommandRead.
+	void dispatchIndirect(CommandBuffer& commandBuffer, const Buffer::View<vk::DispatchIndirectCommand>& args, const shared_ptr<DescriptorSets>& descriptors, const unordered_map<string, uint32_t>& dynamicOffsets = {}, const PushConstants& constants = {});
+	inline void dispatchIndirect(CommandBuffer& commandBuffer, const Buffer::View<vk::DispatchIndirectCommand>& args, const Descriptors& descriptors = {}, const unordered_map<string, uint32_t>& dynamicOffsets = {}, const PushConstants& constants = {}) {
+		dispatchIndirect(commandBuffer, args, getDescriptorSets(descriptors), dynamicOffsets, constants);
+	}
 };
 
 
@@ -0,0 +1,260 @@
+#include "TextureCache.hpp"
+#include "MappedFile.hpp"
+#include "BlockCompression.hpp"
+
+#include <imgui/imgui.h>
+
+namespace stm2 {
+
+TextureCache::~TextureCache() {
+	unique_lock l(mMutex);
+	mJobsDone.wait(l, [&]() { return mJobCount == 0; });
+}
+
+bool TextureCache::isUsable(const TextureFuture& texture) {
+	if (texture.wait_for(0s) != future_status::ready) return true;
+	shared_ptr<Texture> t;
+	try {
+		t = texture.get();
+	} catch (...) {
+		return false;
+	}
+	if (get<shared_ptr<Buffer>>(t->mPixels)) return true;
+	return ranges::any_of(t->mImages, [](const weak_ptr<Image>& img) { return !img.expired(); });
+}
+
+bool TextureCache::useCompression(Device& device, const bool compress) const {
+	return compress && mCompressionEnabled && device.features().textureCompressionBC;
+}
+
+bool TextureCache::readCompressed(Device& device, Texture& t, const filesystem::path& cacheFile) {
+	if (cacheFile.empty()) return false;
+	optional<CompressedImage> image = readCompressedImage(cacheFile, hashArgs(t.mHash, gBlockCompressionVersion));
+	if (!image) return false;
+	auto buf = make_shared<Buffer>(device, t.mName + "/Staging", image->mData.size(), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	memcpy(buf->data(), image->mData.data(), image->mData.size());
+	t.mPixels = Image::PixelData{ buf, image->mFormat, image->mExtent };
+	t.mCopies = image->copies();
+	return true;
+}
+
+void TextureCache::compressPixels(Device& device, Texture& t, const filesystem::path& cacheFile) {
+	const auto&[src, format, extent] = t.mPixels;
+	if (blockCompressedFormat(format) == vk::Format::eUndefined) return;
+
+	const CompressedImage image = compressImage(span(reinterpret_cast<const byte*>(src->data()), src->size()), format, extent);
+	if (!cacheFile.empty()) {
+		try {
+			filesystem::create_directories(cacheFile.parent_path());
+			writeCompressedImage(cacheFile, image, hashArgs(t.mHash, gBlockCompressionVersion));
+		} catch (exception& e) {
+			cerr << "Warning: Failed to write " << cacheFile << ": " << e.what() << endl;
+		}
+	}
+
+	auto buf = make_shared<Buffer>(device, t.mName + "/Staging", image.mData.size(), vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible|vk::MemoryPropertyFlagBits::eHostCoherent);
+	memcpy(buf->data(), image.mData.data(), image.mData.size());
+	t.mPixels = Image::PixelData{ buf, image.mFormat, image.mExtent };
+	t.mCopies = image.copies();
+}
+
+TextureCache::TextureFuture TextureCache::decode(Device& device, const string& name, const filesystem::path& path, const span<const byte> data, const bool srgb, const int desiredChannels, const bool compress) {
+	auto result = make_shared<promise<shared_ptr<Texture>>>();
+	TextureFuture f = result->get_future().share();
+	const filesystem::path cacheDirectory = compress ? mCompressionCacheDirectory : filesystem::path();
+	mJobCount++;
+	mThreadPool.enqueue([=, this, &device]() {
+		try {
+			const auto t0 = chrono::high_resolution_clock::now();
+
+			// the file is read exactly once, and decoded from the mapping
+			unique_ptr<MappedFile> file;
+			span<const byte> bytes = data;
+			if (!path.empty()) {
+				file = make_unique<MappedFile>(path);
+				bytes = file->bytes();
+			}
+
+			const Hash128 hash = hashArgs128(hashBytes128(bytes.data(), bytes.size()), bytes.size(), srgb, desiredChannels, compress);
+
+			TextureFuture existing;
+			{
+				scoped_lock l(mMutex);
+				auto it = mContents.find(hash);
+				if (it != mContents.end() && isUsable(it->second)) {
+					existing = it->second;
+					mStats.mContentHits++;
+				} else
+					mContents[hash] = f;
+			}
+
+			if (existing.valid())
+				// the texture that registered this hash is already decoding, so waiting here can't deadlock the pool
+				result->set_value(existing.get());
+			else {
+				auto t = make_shared<Texture>(name, path, hash, srgb, desiredChannels, compress);
+				if (compress && !cacheDirectory.empty()) {
+					ostringstream cacheName;
+					cacheName << hex << setfill('0') << setw(16) << hash.mHigh << setw(16) << hash.mLow << "_" << gBlockCompressionVersion << ".bc";
+					t->mCacheFile = cacheDirectory / cacheName.str();
+				}
+
+				if (compress && readCompressed(device, *t, t->mCacheFile)) {
+					scoped_lock l(mMutex);
+					mStats.mCompressionCacheHits++;
+				} else {
+					t->mPixels = Image::loadMemory(device, name, bytes, srgb, desiredChannels);
+					const auto t1 = chrono::high_resolution_clock::now();
+					if (compress) compressPixels(device, *t, t->mCacheFile);
+
+					scoped_lock l(mMutex);
+					mStats.mDecoded++;
+					mStats.mDecodeTime += chrono::duration_cast<chrono::duration<float>>(t1 - t0).count();
+					if (!t->mCopies.empty()) {
+						mStats.mCompressed++;
+						mStats.mCompressTime += chrono::duration_cast<chrono::duration<float>>(chrono::high_resolution_clock::now() - t1).count();
+					}
+				}
+				result->set_value(t);
+			}
+		} catch (...) {
+			result->set_exception(current_exception());
+		}
+
+		scoped_lock l(mMutex);
+		mJobCount--;
+		mJobsDone.notify_all();
+	});
+	return f;
+}
+
+TextureCache::TextureFuture TextureCache::load(Device& device, const filesystem::path& filename, const bool srgb, const int desiredChannels, const bool compress) {
+	const filesystem::path path = filesystem::absolute(filename).lexically_normal();
+	scoped_lock l(mMutex);
+	mStats.mRequests++;
+	const bool c = useCompression(device, compress);
+	const auto key = make_tuple(path.string(), srgb, desiredChannels, c);
+	if (auto it = mFiles.find(key); it != mFiles.end() && isUsable(it->second)) {
+		mStats.mPathHits++;
+		return it->second;
+	}
+	if (!filesystem::exists(path)) throw invalid_argument("File does not exist: " + path.string());
+	return mFiles[key] = decode(device, path.stem().string(), path, {}, srgb, desiredChannels, c);
+}
+
+TextureCache::TextureFuture TextureCache::loadMemory(Device& device, const string& name, const span<const byte> data, const bool srgb, const int desiredChannels, const bool compress) {
+	scoped_lock l(mMutex);
+	mStats.mRequests++;
+	return decode(device, name, {}, data, srgb, desiredChannels, useCompression(device, compress));
+}
+
+Image::View TextureCache::getImage(CommandBuffer& commandBuffer, const TextureFuture& texture, const vk::ImageUsageFlags usage, const bool generateMipMaps) {
+	const shared_ptr<Texture> t = texture.get();
+	const auto key = make_tuple(t->mHash, usage, generateMipMaps);
+
+	Image::PixelData pixels;
+	vector<vk::BufferImageCopy> copies;
+	{
+		unique_lock l(mMutex);
+		auto it = mImages.find(key);
+		if (it != mImages.end())
+			if (const shared_ptr<Image> img = it->second.mImage.lock())
+				// images uploaded by another command buffer can only be shared once that upload has finished
+				if (it->second.mUploadComplete || it->second.mUploadCommandBuffer == &commandBuffer) {
+					mStats.mImageHits++;
+					return img;
+				}
+
+		// every Image with these contents was destroyed after the pixels were released, so they are read again.
+		// The first thread to get here claims the reload, and the others wait for it without holding the lock.
+		while (!get<shared_ptr<Buffer>>(t->mPixels)) {
+			if (t->mPath.empty()) throw logic_error("Texture " + t->mName + " was released before it was uploaded");
+			if (t->mReload.valid()) {
+				const shared_future<void> reload = t->mReload;
+				l.unlock();
+				reload.get();
+				l.lock();
+				continue;
+			}
+
+			promise<void> reload;
+			t->mReload = reload.get_future().share();
+			l.unlock();
+
+			Texture tmp;
+			try {
+				tmp.mName = t->mName;
+				tmp.mHash = t->mHash;
+				if (!t->mCompressed || !readCompressed(commandBuffer.mDevice, tmp, t->mCacheFile)) {
+					tmp.mPixels = Image::loadFile(commandBuffer.mDevice, t->mPath, t->mSrgb, t->mDesiredChannels);
+					if (t->mCompressed) compressPixels(commandBuffer.mDevice, tmp, t->mCacheFile);
+				}
+			} catch (...) {
+				l.lock();
+				t->mReload = {};
+				reload.set_exception(current_exception());
+				throw;
+			}
+
+			l.lock();
+			t->mPixels = tmp.mPixels;
+			t->mCopies = tmp.mCopies;
+			t->mReload = {};
+			reload.set_value();
+		}
+		pixels = t->mPixels;
+		copies = t->mCopies;
+	}
+
+	Image::Metadata md = {};
+	shared_ptr<Buffer> buf;
+	tie(buf, md.mFormat, md.mExtent) = pixels;
+	md.mUsage = usage;
+	if (!copies.empty())
+		md.mLevels = (uint32_t)copies.size();
+	else if (generateMipMaps)
+		md.mLevels = Image::maxMipLevels(md.mExtent);
+	const shared_ptr<Image> img = make_shared<Image>(commandBuffer.mDevice, t->mName, md);
+	commandBuffer.trackResource(img);
+	if (!copies.empty()) {
+		img->barrier(commandBuffer, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, md.mLevels, 0, 1), vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+		buf->copyToImage(commandBuffer, img, copies);
+		commandBuffer.trackResource(buf);
+	} else {
+		img->upload(commandBuffer, pixels);
+		if (generateMipMaps) img->generateMipMaps(commandBuffer);
+	}
+
+	scoped_lock l(mMutex);
+	ImageEntry& entry = mImages[key];
+	if (entry.mImage.expired())
+		entry = ImageEntry{ img, &commandBuffer, false };
+	t->mImages.emplace_back(img);
+	mPendingUploads[&commandBuffer].emplace_back(t);
+	return img;
+}
+
+void TextureCache::commandBufferCompleted(const CommandBuffer& commandBuffer) {
+	scoped_lock l(mMutex);
+	for (auto&[key, entry] : mImages)
+		if (entry.mUploadCommandBuffer == &commandBuffer)
+			entry.mUploadComplete = true;
+
+	auto it = mPendingUploads.find(&commandBuffer);
+	if (it == mPendingUploads.end()) return;
+	// the pixels are no longer needed once an Image holds them
+	for (const shared_ptr<Texture>& t : it->second)
+		if (ranges::any_of(t->mImages, [](const weak_ptr<Image>& img) { return !img.expired(); }))
+			t->mPixels = {};
+	mPendingUploads.erase(it);
+}
+
+void TextureCache::drawGui() {
+	const Stats s = stats();
+	ImGui::Text("%u requests", s.mRequests);
+	ImGui::Text("%u decoded (%.3fs)", s.mDecoded, s.mDecodeTime);
+	ImGui::Text("%u path hits, %u content hits, %u image hits", s.mPathHits, s.mContentHits, s.mImageHits);
+	ImGui::Text("%u compressed (%.3fs), %u read from the BC cache", s.mCompressed, s.mCompressTime, s.mCompressionCacheHits);
+}
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <future>
+#include <condition_variable>
+
+#include "Image.hpp"
+#include "ThreadPool.hpp"
+
+namespace stm2 {
+
+// Decodes textures on a worker pool. Requests are deduplicated by path, and decoded textures
+// with identical contents (by size and 128-bit hash) share a single Image. Loaders request every texture up front, and
+// only wait on the future when the Image is needed, so decoding overlaps mesh and material setup.
+// Textures requested with compress=true are block compressed on the worker pool (see BlockCompression.hpp),
+// and the compressed mip chain is cached on disk so that later loads skip both decoding and encoding.
+class TextureCache {
+public:
+	struct Texture {
+		string mName;
+		filesystem::path mPath; // empty if decoded from memory
+		Hash128 mHash; // hash of the encoded data and decode parameters
+		bool mSrgb;
+		int mDesiredChannels;
+		bool mCompressed;
+		filesystem::path mCacheFile; // empty if compressed images aren't cached
+		Image::PixelData mPixels; // released once the Image has finished uploading
+		vector<vk::BufferImageCopy> mCopies; // one copy per mip level of a block compressed texture, empty otherwise
+		vector<weak_ptr<Image>> mImages;
+		shared_future<void> mReload; // valid while a thread re-reads mPixels after they were released
+	};
+	using TextureFuture = shared_future<shared_ptr<Texture>>;
+
+	struct Stats {
+		uint32_t mRequests = 0;
+		uint32_t mPathHits = 0;
+		uint32_t mContentHits = 0;
+		uint32_t mDecoded = 0;
+		uint32_t mImageHits = 0;
+		uint32_t mCompressed = 0;
+		uint32_t mCompressionCacheHits = 0;
+		float mDecodeTime = 0; // seconds, summed over all worker threads
+		float mCompressTime = 0;
+	};
+
+	inline TextureCache(ThreadPool& threadPool = ThreadPool::global()) : mThreadPool(threadPool) {}
+	~TextureCache();
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// Enables block compression of textures loaded with compress=true, on devices that support BC formats.
+	// Compressed images are cached in cacheDirectory, unless it is empty.
+	inline void setCompression(const bool enable, const filesystem::path& cacheDirectory) {
+		scoped_lock l(mMutex);
+		mCompressionEnabled = enable;
+		mCompressionCacheDirectory = cacheDirectory;
+	}
+	inline bool compressionEnabled() {
+		scoped_lock l(mMutex);
+		return mCompressionEnabled;
+	}
+
+	// Reads and decodes the file on the worker pool
+	TextureFuture load(Device& device, const filesystem::path& filename, const bool srgb = true, const int desiredChannels = 0, const bool compress = false);
+	// Decodes encoded image data on the worker pool. data must remain valid until the returned future is ready.
+	TextureFuture loadMemory(Device& device, const string& name, const span<const byte> data, const bool srgb = true, const int desiredChannels = 0, const bool compress = false);
+
+	// Waits for the texture to decode, then returns an Image. The upload is recorded in commandBuffer,
+	// unless an Image with the same contents and usage was already uploaded.
+	// Compressed textures already contain a mip chain, so generateMipMaps is ignored for them.
+	Image::View getImage(CommandBuffer& commandBuffer, const TextureFuture& texture,
+		const vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eTransferSrc|vk::ImageUsageFlagBits::eTransferDst|vk::ImageUsageFlagBits::eSampled,
+		const bool generateMipMaps = true);
+
+	// Called once commandBuffer has finished executing, so that its uploads may be shared with other command buffers
+	void commandBufferCompleted(const CommandBuffer& commandBuffer);
+
+	inline Stats stats() {
+		scoped_lock l(mMutex);
+		return mStats;
+	}
+
+	void drawGui();
+
+private:
+	struct ImageEntry {
+		weak_ptr<Image> mImage;
+		const CommandBuffer* mUploadCommandBuffer;
+		bool mUploadComplete;
+	};
+
+	ThreadPool& mThreadPool;
+
+	mutex mMutex;
+	condition_variable mJobsDone;
+	uint32_t mJobCount = 0;
+	bool mCompressionEnabled = false;
+	filesystem::path mCompressionCacheDirectory;
+	unordered_map<tuple<string, bool, int, bool>, TextureFuture> mFiles;
+	unordered_map<Hash128, TextureFuture> mContents;
+	unordered_map<tuple<Hash128, vk::ImageUsageFlags, bool>, ImageEntry> mImages;
+	unordered_map<const CommandBuffer*, vector<shared_ptr<Texture>>> mPendingUploads;
+	Stats mStats;
+
+	// true if the texture is still decoding, its pixels are still held, or an Image with its contents is alive
+	bool isUsable(const TextureFuture& texture);
+
+	bool useCompression(Device& device, const bool compress) const;
+
+	TextureFuture decode(Device& device, const string& name, const filesystem::path& path, const span<const byte> data, const bool srgb, const int desiredChannels, const bool compress);
+
+	// Reads a compressed texture from the disk cache into t.mPixels. Returns false on a cache miss.
+	bool readCompressed(Device& device, Texture& t, const filesystem::path& cacheFile);
+	// Compresses t.mPixels in place, and writes the result to the disk cache
+	void compressPixels(Device& device, Texture& t, const filesystem::path& cacheFile);
+};
+
+}
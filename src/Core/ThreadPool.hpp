@@ -0,0 +1,83 @@
+#pragma once
+
+#include <thread>
+#include <future>
+#include <queue>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#include "utils.hpp"
+
+namespace stm2 {
+
+// Fixed-size pool of worker threads. Jobs are run in submission order.
+// The destructor finishes all queued jobs before joining the workers.
+class ThreadPool {
+public:
+	inline ThreadPool(const uint32_t threadCount = max(thread::hardware_concurrency(), 1u)) {
+		mThreads.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; i++)
+			mThreads.emplace_back([this]() { workerLoop(); });
+	}
+	inline ~ThreadPool() {
+		{
+			scoped_lock l(mMutex);
+			mStopping = true;
+		}
+		mCondition.notify_all();
+		for (thread& t : mThreads)
+			if (t.joinable())
+				t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool(ThreadPool&&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	ThreadPool& operator=(ThreadPool&&) = delete;
+
+	inline uint32_t threadCount() const { return (uint32_t)mThreads.size(); }
+
+	// shared pool for cpu-side work (decoding, parsing, etc.) that does not record commands
+	inline static ThreadPool& global() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	template<typename F> requires(invocable<F>)
+	inline future<invoke_result_t<F>> enqueue(F&& fn) {
+		using R = invoke_result_t<F>;
+		auto task = make_shared<packaged_task<R()>>(forward<F>(fn));
+		future<R> result = task->get_future();
+		{
+			scoped_lock l(mMutex);
+			if (mStopping) throw logic_error("enqueue called on a stopping ThreadPool");
+			mJobs.emplace([task]() { (*task)(); });
+		}
+		mCondition.notify_one();
+		return result;
+	}
+
+private:
+	vector<thread> mThreads;
+	queue<function<void()>> mJobs;
+	mutex mMutex;
+	condition_variable mCondition;
+	bool mStopping = false;
+
+	inline void workerLoop() {
+		for (;;) {
+			function<void()> job;
+			{
+				unique_lock l(mMutex);
+				mCondition.wait(l, [&]() { return mStopping || !mJobs.empty(); });
+				if (mJobs.empty()) return; // stopping and drained
+				job = move(mJobs.front());
+				mJobs.pop();
+			}
+			job();
+		}
+	}
+};
+
+}
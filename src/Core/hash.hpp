@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cstring>
 #include <functional>
+#include <string_view>
 
 #include <vulkan/vulkan_hash.hpp>
 #include <Eigen/Dense>
@@ -33,6 +36,10 @@ inline size_t hashRange(const R& r) {
 	return h;
 }
 
+inline size_t hashBytes(const void* data, const size_t size) {
+	return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(data), size));
+}
+
 template<hashable Tx, hashable... Ty>
 inline size_t hashArgs(const Tx& x, const Ty&... y) {
 	if constexpr (sizeof...(Ty) == 0)
@@ -41,6 +48,81 @@ inline size_t hashArgs(const Tx& x, const Ty&... y) {
 		return hashCombine(std::hash<Tx>()(x), hashArgs<Ty...>(y...));
 }
 
+// 128-bit hash, for content addressing where a collision would silently merge different data
+struct Hash128 {
+	uint64_t mLow = 0;
+	uint64_t mHigh = 0;
+
+	bool operator==(const Hash128&) const = default;
+	inline explicit operator bool() const { return mLow || mHigh; }
+};
+
+// MurmurHash3_x64_128
+inline Hash128 hashBytes128(const void* data, const size_t size, const uint64_t seed = 0) {
+	constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+	constexpr uint64_t c2 = 0x4cf5ad432745937full;
+	auto rotl = [](const uint64_t x, const int r) { return (x << r) | (x >> (64 - r)); };
+	auto fmix = [](uint64_t k) {
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdull;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ull;
+		k ^= k >> 33;
+		return k;
+	};
+
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	const size_t blockCount = size / 16;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+	for (size_t i = 0; i < blockCount; i++) {
+		uint64_t k1, k2;
+		std::memcpy(&k1, bytes + i*16, 8);
+		std::memcpy(&k2, bytes + i*16 + 8, 8);
+		k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+		k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+	}
+
+	const uint8_t* tail = bytes + blockCount*16;
+	const size_t tailSize = size & 15;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	for (size_t i = tailSize; i > 8; i--)
+		k2 ^= uint64_t(tail[i - 1]) << ((i - 9)*8);
+	if (tailSize > 8) {
+		k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+	}
+	for (size_t i = std::min<size_t>(tailSize, 8); i > 0; i--)
+		k1 ^= uint64_t(tail[i - 1]) << ((i - 1)*8);
+	if (tailSize > 0) {
+		k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= size;
+	h2 ^= size;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix(h1);
+	h2 = fmix(h2);
+	h1 += h2;
+	h2 += h1;
+	return Hash128{ h1, h2 };
+}
+inline Hash128 hashBytes128(const std::string_view str) {
+	return hashBytes128(str.data(), str.size());
+}
+
+// 128-bit hash of the bytes of trivially copyable values, such as other Hash128s, sizes and flags
+template<typename... Types> requires((std::is_trivially_copyable_v<Types> && ...) && sizeof...(Types) > 0)
+inline Hash128 hashArgs128(const Types&... args) {
+	std::array<std::byte, (sizeof(Types) + ...)> bytes;
+	size_t offset = 0;
+	((std::memcpy(bytes.data() + offset, &args, sizeof(Types)), offset += sizeof(Types)), ...);
+	return hashBytes128(bytes.data(), bytes.size());
+}
+
 }
 
 namespace std {
@@ -52,6 +134,13 @@ struct hash<pair<T0,T1>> {
 	}
 };
 
+template<>
+struct hash<stm2::Hash128> {
+	inline size_t operator()(const stm2::Hash128& h) const {
+		return stm2::hashCombine(h.mLow, h.mHigh);
+	}
+};
+
 template<stm2::hashable... Types>
 struct hash<tuple<Types...>> {
 	inline size_t operator()(const tuple<Types...>& v) const {
@@ -335,6 +335,8 @@ inline constexpr T channelCount(const vk::Format format) {
 	case vk::Format::eBc1RgbSrgbBlock:
 	case vk::Format::eBc3UnormBlock:
 	case vk::Format::eBc3SrgbBlock:
+	case vk::Format::eBc6HUfloatBlock:
+	case vk::Format::eBc6HSfloatBlock:
 		return 3;
 	case vk::Format::eR5G5B5A1UnormPack16:
 	case vk::Format::eB5G5R5A1UnormPack16:
@@ -390,6 +392,8 @@ inline constexpr T channelCount(const vk::Format format) {
 	case vk::Format::eBc1RgbaSrgbBlock:
 	case vk::Format::eBc2UnormBlock:
 	case vk::Format::eBc2SrgbBlock:
+	case vk::Format::eBc7UnormBlock:
+	case vk::Format::eBc7SrgbBlock:
 		return 4;
 	}
 }
@@ -21,6 +21,38 @@ float3 unpackNormal(const uint packed) {
 	return unpackNormal2(D3DX_R16G16_SNORM_to_FLOAT2(packed));
 }
 
+// Shared-exponent RGB (Ward's RGBE): 8-bit mantissas and an 8-bit exponent, for non-negative colors of any range
+uint packRGBE(const float3 c) {
+	const float m = max(c.r, max(c.g, c.b));
+	if (!(m > 1e-32)) return 0;
+	const int e = min(int(floor(log2(m))) + 1, 127);
+	const uint3 q = min(uint3(max(c, 0) * exp2(8 - e) + 0.5), 255);
+	return q.r | (q.g << 8) | (q.b << 16) | (uint(e + 128) << 24);
+}
+float3 unpackRGBE(const uint packed) {
+	if ((packed >> 24) == 0) return 0;
+	return float3(packed & 0xFF, (packed >> 8) & 0xFF, (packed >> 16) & 0xFF) * exp2(float(int(packed >> 24) - 136));
+}
+
+// bfloat16: the upper half of a float, rounded to nearest even. Keeps the full float range with 8 bits of precision.
+uint packBfloat16(const float x) {
+	const uint u = asuint(x);
+	return (u + 0x7FFF + ((u >> 16) & 1)) >> 16;
+}
+float unpackBfloat16(const uint packed) {
+	return asfloat((packed & 0xFFFF) << 16);
+}
+
+// Quantizes a position inside the cube around sceneSphere (center, radius) to 21 bits per axis
+uint2 packPosition(const float3 p, const float4 sceneSphere) {
+	const uint3 q = uint3(saturate((p - (sceneSphere.xyz - sceneSphere.w)) / (2*sceneSphere.w)) * 0x1FFFFF + 0.5);
+	return uint2(q.x | (q.y << 21), (q.y >> 11) | (q.z << 10));
+}
+float3 unpackPosition(const uint2 packed, const float4 sceneSphere) {
+	const uint3 q = uint3(packed[0] & 0x1FFFFF, (packed[0] >> 21) | ((packed[1] & 0x3FF) << 11), packed[1] >> 10);
+	return (sceneSphere.xyz - sceneSphere.w) + float3(q) * (2*sceneSphere.w / 0x1FFFFF);
+}
+
 float3x3 makeOrthonormal(const float3 N) {
     float3x3 r;
 	if (N[0] != N[1] || N[0] != N[2])
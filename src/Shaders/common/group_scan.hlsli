@@ -0,0 +1,35 @@
+#pragma once
+
+// Workgroup-wide scans built from wave intrinsics. GROUP_SIZE must be defined before including this file.
+
+groupshared uint gsGroupScanWaveSums[32];
+groupshared uint gsGroupScanTotal;
+
+// exclusive sum of value over the workgroup. the group total is returned in total.
+// must be called by all threads in the group.
+uint GroupExclusiveSum(const uint value, const uint threadIndex, out uint total) {
+    const uint laneCount = WaveGetLaneCount();
+    const uint waveIndex = threadIndex / laneCount;
+    const uint waveCount = (GROUP_SIZE + laneCount - 1) / laneCount;
+
+    const uint wavePrefix = WavePrefixSum(value);
+    if (WaveGetLaneIndex() == laneCount - 1)
+        gsGroupScanWaveSums[waveIndex] = wavePrefix + value;
+    GroupMemoryBarrierWithGroupSync();
+
+    // the first wave scans the per-wave sums (waveCount <= laneCount for lane counts >= 16)
+    if (threadIndex < waveCount) {
+        const uint waveSum = gsGroupScanWaveSums[threadIndex];
+        const uint prefix = WavePrefixSum(waveSum);
+        gsGroupScanWaveSums[threadIndex] = prefix;
+        if (threadIndex == waveCount - 1)
+            gsGroupScanTotal = prefix + waveSum;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    const uint result = gsGroupScanWaveSums[waveIndex] + wavePrefix;
+    total = gsGroupScanTotal;
+    // gsGroupScanWaveSums is reused by the next call
+    GroupMemoryBarrierWithGroupSync();
+    return result;
+}
@@ -11,19 +11,24 @@ struct HashGridConstants {
 	float mDistanceScale;
 };
 
+#ifdef gGpuStats
+// linear probing steps taken by FindCellIndex in this thread, reported by the caller as GpuStat::eHashGridProbes
+static uint sHashGridProbes = 0;
+#endif
+
 struct HashGrid<T> {
 	RWStructuredBuffer<uint> mChecksums;
     // mCellCounters[cellIndex] = number of items in cell
 	RWStructuredBuffer<uint> mCellCounters;
     // mOtherCounters[0] = number of appended items
-    // mOtherCounters[1] = prefix sum counter
+    // mOtherCounters[1..3] = Swizzle dispatch arguments
 	RWStructuredBuffer<uint> mOtherCounters;
 
 	// stores (cellIndex, indexInCell) in append-order.
 	RWStructuredBuffer<uint2> mAppendDataIndices;
 	RWStructuredBuffer<T> mAppendData;
 
-    // mIndices[cellIndex] = offset in mDataIndices
+    // mIndices[cellIndex] = offset in mDataIndices (exclusive prefix sum over mCellCounters, in cell order)
 	RWStructuredBuffer<uint> mIndices;
 	RWStructuredBuffer<uint> mDataIndices;
 
@@ -58,6 +63,9 @@ struct HashGrid<T> {
         // resolve hash collisions with linear probing
         for (uint i = 0; i < 32; i++) {
             const uint cellIndex = (baseCellIndex + i) % mConstants.mCellCount;
+            #ifdef gGpuStats
+            sHashGridProbes++;
+            #endif
             // find cell with matching checksum, or empty cell if inserting
             if (bInsert) {
                 uint prevChecksum;
@@ -97,19 +105,18 @@ struct HashGrid<T> {
 	}
 
 
-	// Prefix sum over cell counter values to determine indices. Should be called with 1 thread per cell.
-    void ComputeIndices(const uint aCellIndex) {
-        if (aCellIndex >= mConstants.mCellCount) return;
-
-        uint offset;
-        InterlockedAdd(mOtherCounters[1], mCellCounters[aCellIndex], offset);
-
-		mIndices[aCellIndex] = offset;
+	// Writes the Swizzle dispatch arguments for the number of appended items. Should be called with 1 thread.
+	// Workgroups are laid out as in Swizzle: 64 threads, 16 groups per row of 1024 items.
+    void WriteSwizzleDispatchArgs() {
+        const uint count = min(GetCurrentElementCount(), mConstants.mMaxSize);
+        mOtherCounters[1] = 16;
+        mOtherCounters[2] = (count + 1023) / 1024;
+        mOtherCounters[3] = 1;
 	}
 
 	// Sort items from append order into cells. Should be called with 1 thread per item.
     void Swizzle(const uint aAppendIndex) {
-        if (aAppendIndex >= GetCurrentElementCount()) return;
+        if (aAppendIndex >= min(GetCurrentElementCount(), mConstants.mMaxSize)) return;
 
 		const uint2 data = mAppendDataIndices[aAppendIndex];
 		const uint cellIndex   = data[0];
@@ -6,9 +6,6 @@
 #ifndef gAlphaTest
 #define gAlphaTest false
 #endif
-#ifndef gCountRays
-#define gCountRays false
-#endif
 
 #include "material.hlsli"
 #include "materials/medium.hlsli"
@@ -45,17 +42,17 @@ RayDesc makeRay(const float3 origin, const float3 direction, const float tmin =
 
 struct IntersectionResult {
 	ShadingData mShadingData;
-	uint mInstancePrimitiveIndex;
+	uint2 mInstancePrimitiveIndex; // instance index, primitive index
 	float mPrimitivePickPdf;
 	float mDistance;
 
 	property uint mInstanceIndex {
-        get { return BF_GET(mInstancePrimitiveIndex, 0, 16); }
-        set { BF_SET(mInstancePrimitiveIndex, newValue, 0, 16); }
+        get { return mInstancePrimitiveIndex[0]; }
+        set { mInstancePrimitiveIndex[0] = newValue; }
 	}
 	property uint mPrimitiveIndex {
-		get { return BF_GET(mInstancePrimitiveIndex, 16, 16); }
-		set { BF_SET(mInstancePrimitiveIndex, newValue, 16, 16); }
+		get { return mInstancePrimitiveIndex[1]; }
+		set { mInstancePrimitiveIndex[1] = newValue; }
 	}
 	InstanceData  getInstance  (const SceneParameters scene) { return scene.mInstances         [mInstanceIndex]; }
 	TransformData getTransform (const SceneParameters scene) { return scene.mInstanceTransforms[mInstanceIndex]; }
@@ -66,8 +63,7 @@ float AdjustIntersectionDistance(const float d) { return max(d * 0.99, d - 1e-2)
 
 extension SceneParameters {
     bool traceRay(const RayDesc ray, const bool closest, out IntersectionResult isect) {
-        if (gCountRays)
-            InterlockedAdd(mRayCount[0], 1);
+        AddStat(GpuStat::eRays);
 
 		// trace ray
 
@@ -89,6 +85,17 @@ extension SceneParameters {
 							break;
 						}
 
+						case InstanceType::ePointCloud: {
+							const float4 point = LoadPoint(reinterpret<PointCloudInstanceData>(instance), rayQuery.CandidatePrimitiveIndex());
+							const float2 st = raySphere(rayQuery.CandidateObjectRayOrigin(), rayQuery.CandidateObjectRayDirection(), point.xyz, point.w);
+							if (st.x < st.y) {
+								const float t = st.x > rayQuery.RayTMin() ? st.x : st.y;
+								if (t < rayQuery.CommittedRayT() && t > rayQuery.RayTMin())
+									rayQuery.CommitProceduralPrimitiveHit(t);
+							}
+							break;
+						}
+
 						case InstanceType::eVolume: {
 							float3 origin,direction, bbox_min, bbox_max;
 							const uint volumeIndex = reinterpret<VolumeInstanceData>(instance).volumeIndex();
@@ -139,7 +146,8 @@ extension SceneParameters {
                     }
 
                     TransformData tmp;
-                    const ShadingData sd = makeTriangleShadingData(instance, tmp, rayQuery.CandidatePrimitiveIndex(), rayQuery.CandidateTriangleBarycentrics());
+                    const uint triangle = GetMeshTriangle(mMeshVertexInfo[instance.vertexInfoIndex()], rayQuery.CandidateGeometryIndex(), rayQuery.CandidatePrimitiveIndex());
+                    const ShadingData sd = makeTriangleShadingData(instance, tmp, triangle, rayQuery.CandidateTriangleBarycentrics());
 
                     if (mImage1s[NonUniformResourceIndex(alphaMask)].SampleLevel(mStaticSampler, sd.mTexcoord, 0) >= alphaCutoff)
 						rayQuery.CommitNonOpaqueTriangleHit();
@@ -163,11 +171,11 @@ extension SceneParameters {
 			case COMMITTED_TRIANGLE_HIT: {
 				isect.mDistance = rayQuery.CommittedRayT();
 				isect.mInstanceIndex  = rayQuery.CommittedInstanceID();
-				isect.mPrimitiveIndex = rayQuery.CommittedPrimitiveIndex();
 
                 MeshInstanceData meshInstance = reinterpret<MeshInstanceData>(isect.getInstance(this));
+				isect.mPrimitiveIndex = GetMeshTriangle(mMeshVertexInfo[meshInstance.vertexInfoIndex()], rayQuery.CommittedGeometryIndex(), rayQuery.CommittedPrimitiveIndex());
                 isect.mPrimitivePickPdf = 1.0 / float(meshInstance.primitiveCount());
-				isect.mShadingData = makeTriangleShadingData(meshInstance, isect.getTransform(this), rayQuery.CommittedPrimitiveIndex(), rayQuery.CommittedTriangleBarycentrics());
+				isect.mShadingData = makeTriangleShadingData(meshInstance, isect.getTransform(this), isect.mPrimitiveIndex, rayQuery.CommittedTriangleBarycentrics());
 				break;
 			}
 			case COMMITTED_PROCEDURAL_PRIMITIVE_HIT: {
@@ -179,6 +187,10 @@ extension SceneParameters {
 					case InstanceType::eSphere:
 						isect.mShadingData = makeSphereShadingData(reinterpret<SphereInstanceData>(isect.getInstance(this)), isect.getTransform(this), rayQuery.CommittedObjectRayOrigin() + rayQuery.CommittedObjectRayDirection() * rayQuery.CommittedRayT());
 						break;
+					case InstanceType::ePointCloud:
+						isect.mPrimitiveIndex = rayQuery.CommittedPrimitiveIndex();
+						isect.mShadingData = makePointShadingData(reinterpret<PointCloudInstanceData>(isect.getInstance(this)), isect.getTransform(this), isect.mPrimitiveIndex, rayQuery.CommittedObjectRayOrigin() + rayQuery.CommittedObjectRayDirection() * rayQuery.CommittedRayT());
+						break;
 					case InstanceType::eVolume: {
 						const uint n = isect.mShadingData.mPackedGeometryNormal; // assigned in the rayQuery loop above
 						isect.mShadingData = makeVolumeShadingData(reinterpret<VolumeInstanceData>(isect.getInstance(this)), ray.Origin + ray.Direction * rayQuery.CommittedRayT());
@@ -260,8 +272,7 @@ extension SceneParameters {
 	}
 
     void traceVisibilityRay(RayDesc ray, inout RandomSampler rng, uint curMediumInstance, inout float3 beta, out float dirPdf, out float neePdf) {
-        if (gCountRays)
-            InterlockedAdd(mRayCount[1], 1);
+        AddStat(GpuStat::eShadowRays);
 
 		dirPdf = 1;
 		neePdf = 1;
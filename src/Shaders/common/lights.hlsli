@@ -15,17 +15,17 @@
 
 struct EmissionSampleRecord {
     ShadingData mShadingData;
-    uint mInstancePrimitiveIndex;
+    uint2 mInstancePrimitiveIndex; // instance index, primitive index
     float mPdf;
     bool isSingular; // unused (only area lights are implemented)
 
     property uint mInstanceIndex {
-        get { return BF_GET(mInstancePrimitiveIndex, 0, 16); }
-        set { BF_SET(mInstancePrimitiveIndex, newValue, 0, 16); }
+        get { return mInstancePrimitiveIndex[0]; }
+        set { mInstancePrimitiveIndex[0] = newValue; }
     }
     property uint mPrimitiveIndex {
-        get { return BF_GET(mInstancePrimitiveIndex, 16, 16); }
-        set { BF_SET(mInstancePrimitiveIndex, newValue, 16, 16); }
+        get { return mInstancePrimitiveIndex[1]; }
+        set { mInstancePrimitiveIndex[1] = newValue; }
     }
 };
 
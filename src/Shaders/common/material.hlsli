@@ -43,6 +43,12 @@ extension SceneParameters {
         return m;
     }
     PackedMaterialData LoadMaterial(const ShadingData shadingData) {
+        if (shadingData.hasPointColor()) {
+            uint4 imageIndices;
+            PackedMaterialData m = LoadMaterial(shadingData.getMaterialAddress(), imageIndices);
+            m.setBaseColor(m.getBaseColor() * D3DX_R8G8B8A8_UNORM_SRGB_to_FLOAT4(asuint(shadingData.mTexcoord.x)).rgb);
+            return m;
+        }
         return LoadMaterial(shadingData.getMaterialAddress(), shadingData.mTexcoord, shadingData.mTexcoordScreenSize);
     }
     PackedMaterialData LoadMaterialUniform(const uint address, const float2 uv) {
@@ -76,7 +82,7 @@ extension SceneParameters {
     }
 
     void ApplyNormalMap(inout ShadingData aoShadingData) {
-        if (!gNormalMaps) return;
+        if (!gNormalMaps || aoShadingData.hasPointColor()) return;
 
         const uint3 p = mMaterialData.Load<uint3>(int(aoShadingData.getMaterialAddress() + 36));
         if (p.x >= gImageCount) return;
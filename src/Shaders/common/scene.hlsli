@@ -2,6 +2,7 @@
 
 #include "compat/scene.h"
 #include "compat/material_data.h"
+#include "compat/gpu_stats.h"
 
 struct SceneParameters {
 	#ifndef NO_SCENE_ACCELERATION_STRUCTURE
@@ -20,7 +21,8 @@ struct SceneParameters {
 	StructuredBuffer<MeshVertexInfo> mMeshVertexInfo;
 	StructuredBuffer<VolumeInfo> mInstanceVolumeInfo;
 
-	RWStructuredBuffer<uint> mRayCount;
+	// indexed by GpuStat, only written when gGpuStats is defined
+	RWStructuredBuffer<uint> mGpuStats;
 	SamplerState mStaticSampler;
 
 	ByteAddressBuffer mVertexBuffers[gVertexBufferCount];
@@ -29,6 +31,15 @@ struct SceneParameters {
     Texture2D<float> mImage1s[gImageCount];
 	StructuredBuffer<uint> mVolumes[gVolumeCount];
 
+	// Summed over the active lanes of the wave first, so that each wave issues one atomic
+	void AddStat(const GpuStat stat, const uint value = 1) {
+		#ifdef gGpuStats
+		const uint sum = WaveActiveSum(value);
+		if (WaveIsFirstLane() && sum > 0)
+			InterlockedAdd(mGpuStats[(uint)stat], sum);
+		#endif
+	}
+
 	uint GetMediumIndex(const float3 position, const uint volumeInfoCount) {
 		for (uint i = 0; i < volumeInfoCount; i++) {
 			const VolumeInfo info = mInstanceVolumeInfo[i];
@@ -38,6 +49,15 @@ struct SceneParameters {
 		}
 		return INVALID_INSTANCE;
 	}
+
+	// center and radius of a point, see POINT_CLOUD_CHUNK_STRIDE
+	float4 LoadPoint(const PointCloudInstanceData instance, const uint primitiveIndex) {
+		return mVertexBuffers[NonUniformResourceIndex(instance.pointBuffer())].Load<float4>(int(instance.chunkIndex()*POINT_CLOUD_CHUNK_STRIDE + primitiveIndex*16));
+	}
+	// RGBA8 sRGB color of a point
+	uint LoadPointColor(const PointCloudInstanceData instance, const uint primitiveIndex) {
+		return mVertexBuffers[NonUniformResourceIndex(instance.pointBuffer())].Load(int(instance.chunkIndex()*POINT_CLOUD_CHUNK_STRIDE + POINT_CLOUD_CHUNK_SIZE*16 + primitiveIndex*4));
+	}
 };
 
 uint3 LoadTriangleIndices(const ByteAddressBuffer indices, const uint offset, const uint indexStride, const uint primitiveIndex) {
@@ -69,6 +89,51 @@ void LoadTriangleAttribute<T>(const ByteAddressBuffer vertexBuffer, const uint o
     v2 = LoadVertexAttribute<T>(vertexBuffer, offset, stride, tri[2]);
 }
 
+// Positions, normals and texcoords, decoded by their format in vertexInfo (see VERTEX_FORMAT_*)
+float3 LoadVertexPosition(const ByteAddressBuffer vertexBuffer, const MeshVertexInfo vertexInfo, const uint index) {
+    const uint address = vertexInfo.positionOffset() + vertexInfo.positionStride() * index;
+    if (vertexInfo.positionFormat() == VERTEX_FORMAT_SNORM16) {
+        const uint2 packed = vertexBuffer.Load2(address);
+        const float3 p = float3(D3DX_R16G16_SNORM_to_FLOAT2(packed.x), D3DX_R16G16_SNORM_to_FLOAT2(packed.y).x);
+        return vertexInfo.mPositionOffset + vertexInfo.mPositionScale * p;
+    }
+    return vertexBuffer.Load<float3>(address);
+}
+float3 LoadVertexNormal(const ByteAddressBuffer vertexBuffer, const MeshVertexInfo vertexInfo, const uint index) {
+    const uint address = vertexInfo.normalOffset() + vertexInfo.normalStride() * index;
+    if (vertexInfo.normalFormat() == VERTEX_FORMAT_SNORM16)
+        return unpackNormal(vertexBuffer.Load(address));
+    return vertexBuffer.Load<float3>(address);
+}
+float2 LoadVertexTexcoord(const ByteAddressBuffer vertexBuffer, const MeshVertexInfo vertexInfo, const uint index) {
+    const uint address = vertexInfo.texcoordOffset() + vertexInfo.texcoordStride() * index;
+    switch (vertexInfo.texcoordFormat()) {
+    case VERTEX_FORMAT_UNORM16:
+        return D3DX_R16G16_UNORM_to_FLOAT2(vertexBuffer.Load(address));
+    case VERTEX_FORMAT_HALF: {
+        const uint packed = vertexBuffer.Load(address);
+        return float2(f16tof32(packed & 0xFFFF), f16tof32(packed >> 16));
+    }
+    default:
+        return vertexBuffer.Load<float2>(address);
+    }
+}
+void LoadTrianglePositions(const ByteAddressBuffer vertexBuffer, const MeshVertexInfo vertexInfo, const uint3 tri, out float3 v0, out float3 v1, out float3 v2) {
+    v0 = LoadVertexPosition(vertexBuffer, vertexInfo, tri[0]);
+    v1 = LoadVertexPosition(vertexBuffer, vertexInfo, tri[1]);
+    v2 = LoadVertexPosition(vertexBuffer, vertexInfo, tri[2]);
+}
+void LoadTriangleNormals(const ByteAddressBuffer vertexBuffer, const MeshVertexInfo vertexInfo, const uint3 tri, out float3 n0, out float3 n1, out float3 n2) {
+    n0 = LoadVertexNormal(vertexBuffer, vertexInfo, tri[0]);
+    n1 = LoadVertexNormal(vertexBuffer, vertexInfo, tri[1]);
+    n2 = LoadVertexNormal(vertexBuffer, vertexInfo, tri[2]);
+}
+void LoadTriangleTexcoords(const ByteAddressBuffer vertexBuffer, const MeshVertexInfo vertexInfo, const uint3 tri, out float2 t0, out float2 t1, out float2 t2) {
+    t0 = LoadVertexTexcoord(vertexBuffer, vertexInfo, tri[0]);
+    t1 = LoadVertexTexcoord(vertexBuffer, vertexInfo, tri[1]);
+    t2 = LoadVertexTexcoord(vertexBuffer, vertexInfo, tri[2]);
+}
+
 extension SceneParameters {
 	float SampleImage1(const uint imageIndex, const float2 uv, const float uvScreenSize) {
 		float lod = 0;
@@ -104,6 +169,14 @@ extension SceneParameters {
     uint3 LoadTriangleIndicesUniform(const MeshVertexInfo vertexInfo, const uint primitiveIndex) {
         return LoadTriangleIndices(mVertexBuffers[vertexInfo.indexBuffer()], vertexInfo.indexOffset(), vertexInfo.indexStride(), primitiveIndex);
     }
+
+    // mesh triangle of a primitive of a BLAS geometry. alpha-tested meshes may have their alpha-tested and opaque
+    // triangles in separate geometries, see TriangleOpacity.
+    uint GetMeshTriangle(const MeshVertexInfo vertexInfo, const uint geometryIndex, const uint primitiveIndex) {
+        if (vertexInfo.mTriangleMap == 0xFFFF) return primitiveIndex;
+        const uint i = (geometryIndex > 0 ? vertexInfo.mFirstOpaquePrimitive : 0) + primitiveIndex;
+        return mVertexBuffers[NonUniformResourceIndex(vertexInfo.mTriangleMap)].Load(int(i*4));
+    }
 }
 
 uint getViewIndex(const uint2 index, const uint2 extent, const uint viewCount) {
@@ -7,6 +7,8 @@
 #include "scene.hlsli"
 
 #define SHADING_FLAG_FLIP_BITANGENT BIT(0)
+// mTexcoord.x holds the RGBA8 sRGB color of a point cloud point, which modulates the material's base color
+#define SHADING_FLAG_POINT_COLOR BIT(1)
 
 extension ShadingData {
     bool isSurface() { return mShapeArea > 0; }
@@ -16,6 +18,7 @@ extension ShadingData {
 
 	bool isBitangentFlipped() { return (bool)(mFlagsMaterialAddress & SHADING_FLAG_FLIP_BITANGENT); }
 	int getBitangentDirection() { return isBitangentFlipped() ? -1 : 1; }
+	bool hasPointColor() { return (bool)(mFlagsMaterialAddress & SHADING_FLAG_POINT_COLOR); }
 
 	float3 getGeometryNormal() { return unpackNormal(mPackedGeometryNormal); }
 	float3 getShadingNormal() { return unpackNormal(mPackedShadingNormal); }
@@ -71,7 +74,7 @@ extension SceneParameters {
 
 		float2 t0,t1,t2;
 		if (vertexInfo.texcoordBuffer() < gVertexBufferCount)
-			LoadTriangleAttribute(mVertexBuffers[NonUniformResourceIndex(vertexInfo.texcoordBuffer())], vertexInfo.texcoordOffset(), vertexInfo.texcoordStride(), tri, t0, t1, t2);
+			LoadTriangleTexcoords(mVertexBuffers[NonUniformResourceIndex(vertexInfo.texcoordBuffer())], vertexInfo, tri, t0, t1, t2);
         else
             t0 = t1 = t2 = 0;
 
@@ -109,7 +112,7 @@ extension SceneParameters {
         float3 shadingNormal;
         float3 n0, n1, n2;
         if (gShadingNormals && vertexInfo.normalBuffer() < gVertexBufferCount) {
-			LoadTriangleAttribute(mVertexBuffers[NonUniformResourceIndex(vertexInfo.normalBuffer())], vertexInfo.normalOffset(), vertexInfo.normalStride(), tri, n0, n1, n2);
+			LoadTriangleNormals(mVertexBuffers[NonUniformResourceIndex(vertexInfo.normalBuffer())], vertexInfo, tri, n0, n1, n2);
 
 			shadingNormal = n0 + (n1 - n0)*bary.x + (n2 - n0)*bary.y;
 			shadingNormalValid = !(all(shadingNormal.xyz == 0) || any(isnan(shadingNormal)));
@@ -144,18 +147,18 @@ extension SceneParameters {
         const uint3 tri = LoadTriangleIndices(vertexInfo, primitiveIndex);
 
 		float3 v0,v1,v2;
-		LoadTriangleAttribute(mVertexBuffers[NonUniformResourceIndex(vertexInfo.positionBuffer())], vertexInfo.positionOffset(), vertexInfo.positionStride(), tri, v0, v1, v2);
+		LoadTrianglePositions(mVertexBuffers[NonUniformResourceIndex(vertexInfo.positionBuffer())], vertexInfo, tri, v0, v1, v2);
 
 		ShadingData r = makeTriangleShadingDataWithoutPosition(instance.getMaterialAddress(), transform, vertexInfo, tri, bary, v0, v1, v2);
 		r.mPosition = transform.transformPoint(v0 + (v1 - v0)*bary.x + (v2 - v0)*bary.y);
 		return r;
 	}
-	ShadingData makeTriangleShadingData(const MeshInstanceData instance, const TransformData transform, const uint primitiveIndex, const float3 localPosition) {
+	ShadingData makeTriangleShadingData(const MeshInstanceData instance, const TransformData transform, const uint primitiveIndex, const float3 localPosition, const bool snapToTriangle = false) {
         const MeshVertexInfo vertexInfo = mMeshVertexInfo[instance.vertexInfoIndex()];
         const uint3 tri = LoadTriangleIndices(vertexInfo, primitiveIndex);
 
 		float3 v0,v1,v2;
-		LoadTriangleAttribute(mVertexBuffers[NonUniformResourceIndex(vertexInfo.positionBuffer())], vertexInfo.positionOffset(), vertexInfo.positionStride(), tri, v0, v1, v2);
+		LoadTrianglePositions(mVertexBuffers[NonUniformResourceIndex(vertexInfo.positionBuffer())], vertexInfo, tri, v0, v1, v2);
 
 		const float3 v1v0 = v1 - v0;
 		const float3 v2v0 = v2 - v0;
@@ -168,7 +171,8 @@ extension SceneParameters {
 		const float2 bary = float2(d11 * d20 - d01 * d21, d00 * d21 - d01 * d20) / (d00 * d11 - d01 * d01);
 
 		ShadingData r = makeTriangleShadingDataWithoutPosition(instance.getMaterialAddress(), transform, vertexInfo, tri, bary, v0, v1, v2);
-		r.mPosition = transform.transformPoint(localPosition);
+		// snapToTriangle reconstructs the position from the barycentrics, so that quantized positions land on the triangle
+		r.mPosition = transform.transformPoint(snapToTriangle ? v0 + v1v0*bary.x + v2v0*bary.y : localPosition);
 		return r;
 	}
 	ShadingData makeSphereShadingData  (const SphereInstanceData instance, const TransformData transform, const float3 localPosition) {
@@ -188,6 +192,22 @@ extension SceneParameters {
 		r.mTexcoordScreenSize = 1/max(length(dpdu), length(dpdv));
 		return r;
 	}
+	ShadingData makePointShadingData   (const PointCloudInstanceData instance, const TransformData transform, const uint primitiveIndex, const float3 localPosition) {
+		const float4 point = LoadPoint(instance, primitiveIndex);
+		ShadingData r;
+		const float3 normal = normalize(transform.transformVector(localPosition - point.xyz));
+		r.mPosition = transform.transformPoint(localPosition);
+		r.mFlagsMaterialAddress = SHADING_FLAG_POINT_COLOR;
+		BF_SET(r.mFlagsMaterialAddress, instance.getMaterialAddress(), 4, 28);
+		r.mPackedGeometryNormal = r.mPackedShadingNormal = packNormal(normal);
+		r.mPackedTangent = packNormal(makeOrthonormal(normal)[0]);
+		r.mShapeArea = 4*M_PI*point.w*point.w;
+		r.mMeanCurvature = 1/point.w;
+		// points have no texture coordinates
+		r.mTexcoord = float2(asfloat(LoadPointColor(instance, primitiveIndex)), 0);
+		r.mTexcoordScreenSize = 0;
+		return r;
+	}
 	ShadingData makeVolumeShadingData  (const VolumeInstanceData instance, const float3 position) {
 		ShadingData r;
 		r.mPosition = position;
@@ -204,9 +224,17 @@ extension SceneParameters {
             return makeTriangleShadingData(reinterpret<MeshInstanceData>(instance), transform, primitiveIndex, localPosition);
         case InstanceType::eSphere:
             return makeSphereShadingData(reinterpret<SphereInstanceData>(instance), transform, localPosition);
+        case InstanceType::ePointCloud:
+            return makePointShadingData(reinterpret<PointCloudInstanceData>(instance), transform, primitiveIndex, localPosition);
 		default:
 		case InstanceType::eVolume:
 			return makeVolumeShadingData(reinterpret<VolumeInstanceData>(instance), transform.transformPoint(localPosition));
 		}
     }
+    // for positions decoded from a quantized encoding (see packPosition): triangle hits are moved back onto the surface
+    ShadingData makeQuantizedShadingData(const InstanceData instance, const TransformData transform, const float3 localPosition, const uint primitiveIndex) {
+        if (instance.getType() == InstanceType::eMesh)
+            return makeTriangleShadingData(reinterpret<MeshInstanceData>(instance), transform, primitiveIndex, localPosition, true);
+        return makeShadingData(instance, transform, localPosition, primitiveIndex);
+    }
 }
\ No newline at end of file
@@ -64,11 +64,13 @@ struct RenderParams {
     RWTexture2D<float4> mOutput;
 	RWTexture2D<float4> mAlbedo;
 	RWTexture2D<float2> mPrevUVs;
-	RWTexture2D<uint2> mVisibility;
+	RWTexture2D<uint4> mVisibility;
     RWTexture2D<float4> mDepth;
 
     RWStructuredBuffer<PackedVcmVertex> mLightVertices;
     RWStructuredBuffer<uint> mLightPathLengths;
+    // mLightVertices in mLightHashGrid cell order, for merging. Written by SortLightVertices.
+    RWStructuredBuffer<PackedVcmVertex> mSortedLightVertices;
 
     ConstantBuffer<VcmConstants> mVcmConstants;
 
@@ -92,15 +94,6 @@ ParameterBlock<RenderParams> gRenderParams;
 // useful struct properties
 
 extension PackedVcmVertex {
-    property uint mInstanceIndex {
-		get { return BF_GET(mInstancePrimitiveIndex, 0, 16); }
-		set { BF_SET(mInstancePrimitiveIndex, newValue, 0, 16); }
-	}
-    property uint mPrimitiveIndex {
-		get { return BF_GET(mInstancePrimitiveIndex, 16, 16); }
-		set { BF_SET(mInstancePrimitiveIndex, newValue, 16, 16); }
-    }
-
     property uint mPathLength {
         get { return BF_GET(mPackedData, 0, 16); }
         set { BF_SET(mPackedData, newValue, 0, 16); }
@@ -110,15 +103,24 @@ extension PackedVcmVertex {
         set { BF_SET(mPackedData, f32tof16(newValue), 16, 16); }
     }
 
-    __init(const VcmVertex v, const uint instancePrimitiveIndex) {
-        mLocalPosition = gScene.mInstanceInverseTransforms[BF_GET(instancePrimitiveIndex, 0, 16)].transformPoint(v.mShadingData.mPosition);
-        mInstancePrimitiveIndex = instancePrimitiveIndex;
-        mThroughput = v.mThroughput;
+    property float3 mThroughput { get { return unpackRGBE(mPackedThroughput); } }
+    property float dVCM { get { return unpackBfloat16(mPackedDVCM_DVC); } }
+    property float dVC  { get { return unpackBfloat16(mPackedDVCM_DVC >> 16); } }
+
+    float3 getPosition() {
+        return unpackPosition(mPackedPosition, gRenderParams.mVcmConstants.mSceneSphere);
+    }
+
+    __init(const VcmVertex v, const uint2 instancePrimitiveIndex) {
+        mPackedPosition = packPosition(v.mShadingData.mPosition, gRenderParams.mVcmConstants.mSceneSphere);
+        mInstanceIndex = instancePrimitiveIndex[0];
+        mPackedThroughput = packRGBE(v.mThroughput);
         mPackedData = v.mPackedData;
-        dVCM = v.dVCM;
-        dVC = v.dVC;
-        dVM = v.dVM;
         mLocalDirectionIn = v.mLocalDirectionIn;
+        mPackedDVCM_DVC = packBfloat16(v.dVCM) | (packBfloat16(v.dVC) << 16);
+        dVM = v.dVM;
+        mPrimitiveIndex = instancePrimitiveIndex[1];
+        pad = 0;
     }
 }
 
@@ -136,7 +138,8 @@ extension VcmVertex {
         mThroughput = 0;
     }
     __init(PackedVcmVertex v) {
-        mShadingData = gScene.makeShadingData(gScene.mInstances[v.mInstanceIndex], gScene.mInstanceTransforms[v.mInstanceIndex], v.mLocalPosition, v.mPrimitiveIndex);
+        const float3 localPosition = gScene.mInstanceInverseTransforms[v.mInstanceIndex].transformPoint(v.getPosition());
+        mShadingData = gScene.makeQuantizedShadingData(gScene.mInstances[v.mInstanceIndex], gScene.mInstanceTransforms[v.mInstanceIndex], localPosition, v.mPrimitiveIndex);
         mThroughput = v.mThroughput;
         mPackedData = v.mPackedData;
         dVCM = v.dVCM;
@@ -150,17 +153,6 @@ extension VcmVertex {
     }
 }
 
-extension DirectIlluminationReservoir {
-    property uint mInstanceIndex {
-        get { return BF_GET(mInstancePrimitiveIndex, 0, 16); }
-        set { BF_SET(mInstancePrimitiveIndex, newValue, 0, 16); }
-    }
-    property uint mPrimitiveIndex {
-        get { return BF_GET(mInstancePrimitiveIndex, 16, 16); }
-        set { BF_SET(mInstancePrimitiveIndex, newValue, 16, 16); }
-    }
-}
-
 // light sampling
 
 struct IlluminationSampleRecord {
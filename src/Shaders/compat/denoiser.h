@@ -36,8 +36,8 @@ inline string to_string(const stm2::DenoiserDebugMode& m) {
 struct DenoiserParameters {
 	StructuredBuffer<ViewData> mViews;
 	StructuredBuffer<uint> mInstanceIndexMap;
-	Texture2D<uint2> mVisibility;
-	Texture2D<uint2> mPrevVisibility;
+	Texture2D<uint4> mVisibility;
+	Texture2D<uint4> mPrevVisibility;
 	Texture2D<float4> mDepth;
 	Texture2D<float4> mPrevDepth;
 	Texture2D<float2> mPrevUVs;
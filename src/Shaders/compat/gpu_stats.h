@@ -0,0 +1,40 @@
+#pragma once
+
+#include "hlslcompat.h"
+
+STM_NAMESPACE_BEGIN
+
+// Counters in SceneParameters::mGpuStats, see GpuStats.hpp
+enum class GpuStat {
+	eRays,
+	eShadowRays,
+	eNullCollisions,
+	eHashGridProbes,
+	ePaths,
+	ePathReconnections,
+	eShifts,
+	eShiftReconnections,
+	eReservoirRejections,
+	eGpuStatCount
+};
+
+STM_NAMESPACE_END
+
+#ifdef __cplusplus
+namespace std {
+inline string to_string(const stm2::GpuStat& s) {
+	switch (s) {
+		default: return "Unknown";
+		case stm2::GpuStat::eRays: return "Rays";
+		case stm2::GpuStat::eShadowRays: return "Shadow rays";
+		case stm2::GpuStat::eNullCollisions: return "Null collisions";
+		case stm2::GpuStat::eHashGridProbes: return "Hash grid probes";
+		case stm2::GpuStat::ePaths: return "Paths";
+		case stm2::GpuStat::ePathReconnections: return "Paths with reconnection vertex";
+		case stm2::GpuStat::eShifts: return "Shifts";
+		case stm2::GpuStat::eShiftReconnections: return "Reconnection shifts";
+		case stm2::GpuStat::eReservoirRejections: return "Reservoir rejections";
+	}
+}
+}
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "hlslcompat.h"
+#include "bitfield.h"
+
+STM_NAMESPACE_BEGIN
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define INVALID_MESHLET 0xFFFFFFFF
+
+// A cluster of up to MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles of a mesh.
+// Meshes with meshlets have their index buffer ordered so that each meshlet's triangles are contiguous.
+struct MeshletInfo {
+	// bounding sphere, in object space
+	float3 mCenter;
+	float mRadius;
+	// normal cone. every triangle faces away from viewers at v with
+	// dot(mCenter - v, mConeAxis) >= mConeCutoff * length(mCenter - v) + mRadius. mConeCutoff is 1 if the cone is too wide.
+	float3 mConeAxis;
+	float mConeCutoff;
+	uint mFirstTriangle;
+	uint mVertexOffset; // first entry of the meshlet's vertices in the meshlet vertex table
+	uint mCounts;
+	uint pad;
+
+	inline uint vertexCount() CONST_CPP { return BF_GET(mCounts, 0, 8); }
+	inline uint triangleCount() CONST_CPP { return BF_GET(mCounts, 8, 8); }
+};
+
+STM_NAMESPACE_END
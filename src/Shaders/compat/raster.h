@@ -0,0 +1,41 @@
+#pragma once
+
+#include "hlslcompat.h"
+#include "meshlet.h"
+
+STM_NAMESPACE_BEGIN
+
+// Number of draw streams written by the culling pass: opaque and alpha-masked draws for the vertex pipeline,
+// then opaque and alpha-masked meshlets for the mesh shader pipeline
+#define RASTER_STREAM_COUNT 4
+// mesh shader draws are launched with up to this many workgroups in x, and as many rows as needed in y
+#define RASTER_MAX_MESH_GROUPS_X 65535
+
+// Per-draw data for indirect draws. Vertex pipeline draws are indexed by their firstInstance, and mesh shader
+// workgroups by their workgroup index. Whole instances and single meshlets are both drawn as a range of triangles,
+// which the vertex pipeline draws from the scene's concatenated index buffer.
+struct DrawData {
+	uint mInstanceIndex;
+	uint mMaterialAddress;
+	uint mFirstTriangle;
+	uint mTriangleCount;
+	uint mMeshletTables;         // index of the mesh's meshlet tables in gScene.mVertexBuffers, or INVALID_MESHLET for whole instances
+	uint mMeshletVertexOffset;   // byte offset of the meshlet's vertex table
+	uint mMeshletTriangleOffset; // byte offset of the meshlet's triangle table
+	uint mMeshletVertexCount;
+	uint mFirstIndex;            // first index of the mesh in the scene's concatenated index buffer
+};
+
+// A mesh instance, or a meshlet of one, that RasterRenderer may draw, tested against the view by the culling pass.
+// Instanced meshes have a single candidate, which covers instances [mDraw.mInstanceIndex, mDraw.mInstanceIndex + mInstanceCount).
+// mInstanceCount is 0 for other candidates.
+struct DrawCandidate {
+	DrawData mDraw;
+	uint mAlphaMask; // 1 to draw with the alpha-masked pipeline
+	uint mInstanceCount;
+	uint pad1;
+	float4 mSphere; // object-space bounding sphere of meshlets
+	float4 mCone;   // object-space normal cone axis and cutoff of meshlets, see MeshletInfo
+};
+
+STM_NAMESPACE_END
@@ -14,13 +14,15 @@ STM_NAMESPACE_BEGIN
 #define gImageCount 2048
 #define gVolumeCount 8
 
-#define INVALID_INSTANCE 0xFFFF
+// instance indices are limited by the 24-bit instanceCustomIndex of TLAS instances
+#define INVALID_INSTANCE 0xFFFFFF
 #define INVALID_PRIMITIVE 0xFFFF
 
 enum class InstanceType {
 	eMesh = 0,
 	eSphere = 1,
     eVolume = 2,
+    ePointCloud = 3,
 };
 
 inline static TransformData makeMotionTransform(const TransformData worldToObject, const TransformData prevObjectToWorld) {
@@ -43,6 +45,14 @@ struct InstanceData {
 #endif
 };
 
+// world-space bounds of an instance. unbounded instances use an infinite box.
+struct InstanceAabb {
+	float3 mMin;
+	uint pad0;
+	float3 mMax;
+	uint pad1;
+};
+
 struct MeshInstanceData : InstanceData {
 	inline uint vertexInfoIndex() CONST_CPP { return BF_GET(mData,  0, 16); }
 	inline uint primitiveCount() CONST_CPP  { return BF_GET(mData, 16, 16); }
@@ -79,6 +89,27 @@ struct VolumeInstanceData : InstanceData {
 #endif
 };
 
+// Point clouds are split into chunks of POINT_CLOUD_CHUNK_SIZE points, since primitive indices are 16 bits.
+// Chunk c of a point buffer starts at byte c*POINT_CLOUD_CHUNK_STRIDE, and holds POINT_CLOUD_CHUNK_SIZE float4
+// centers and radii, followed by POINT_CLOUD_CHUNK_SIZE RGBA8 sRGB colors.
+#define POINT_CLOUD_CHUNK_SIZE 65535
+#define POINT_CLOUD_CHUNK_STRIDE (POINT_CLOUD_CHUNK_SIZE*20)
+
+// one chunk of a point cloud
+struct PointCloudInstanceData : InstanceData {
+	inline uint pointBuffer() CONST_CPP { return BF_GET(mData,  0, 16); } // index in SceneParameters::mVertexBuffers
+	inline uint chunkIndex() CONST_CPP  { return BF_GET(mData, 16, 16); }
+
+#ifdef __cplusplus
+    inline PointCloudInstanceData(const uint materialAddress, const uint pointBuffer, const uint chunkIndex)
+        : InstanceData(InstanceType::ePointCloud, materialAddress) {
+		mData = 0;
+		BF_SET(mData, pointBuffer,  0, 16);
+		BF_SET(mData, chunkIndex , 16, 16);
+	}
+#endif
+};
+
 struct VolumeInfo {
 	float3 mMin;
 	uint mInstanceIndex;
@@ -86,11 +117,43 @@ struct VolumeInfo {
 	uint pad;
 };
 
+// A mesh drawn at many transforms, which kernels/expand_instances.slang writes into the instance buffers.
+// Instance i of the batch becomes instance mFirstInstance + i, with transform mObjectToWorld * mTransforms[i].
+struct InstanceBatch {
+	TransformData mObjectToWorld;
+	TransformData mPrevObjectToWorld;
+	uint2 mAccelerationStructureAddress;
+	uint2 mInstanceData; // the InstanceData every instance of the batch shares
+	float3 mAabbMin; // object-space bounds of the mesh
+	uint mFirstInstance;
+	float3 mAabbMax;
+	uint mInstanceCount;
+	uint mPrevFirstInstance; // first instance of the batch in the previous update, or -1
+	uint mMask; // BVH_FLAG_*
+	uint pad0;
+	uint pad1;
+};
+
+// MeshVertexInfo attribute encodings, chosen by loaders with Mesh::VertexPrecision
+#define VERTEX_FORMAT_FLOAT   0 // float3 positions and normals, float2 texcoords
+#define VERTEX_FORMAT_SNORM16 1 // positions: 4x16-bit snorm, dequantized with mPositionScale and mPositionOffset. normals: octahedral 2x16-bit snorm
+#define VERTEX_FORMAT_UNORM16 2 // texcoords: 2x16-bit unorm
+#define VERTEX_FORMAT_HALF    3 // texcoords: 2x16-bit float
+
+// opacity of a triangle of an alpha-tested mesh, against its material's alpha mask. see Scene::classifyTriangleOpacity
+#define TRIANGLE_TRANSPARENT 0
+#define TRIANGLE_OPAQUE 1
+#define TRIANGLE_ALPHA_TESTED 2
+
 struct MeshVertexInfo {
 	uint2 mPackedBufferIndices;
 	uint mPackedStrides;
-	uint pad;
+	uint mPackedFormats;
 	uint4 mPackedOffsets;
+	float3 mPositionOffset;
+	uint mTriangleMap; // buffer of the mesh triangle of each BLAS primitive, or 0xFFFF if they are the same. see TriangleOpacity
+	float3 mPositionScale;
+	uint mFirstOpaquePrimitive; // index in mTriangleMap of the first primitive of the BLAS's opaque geometry
 
 	inline uint indexBuffer()    CONST_CPP { return BF_GET(mPackedBufferIndices[0],  0, 16); }
 	inline uint positionBuffer() CONST_CPP { return BF_GET(mPackedBufferIndices[0], 16, 16); }
@@ -107,12 +170,18 @@ struct MeshVertexInfo {
 	inline uint normalStride()   CONST_CPP { return BF_GET(mPackedStrides, 16, 8); }
 	inline uint texcoordStride() CONST_CPP { return BF_GET(mPackedStrides, 24, 8); }
 
+	inline uint positionFormat() CONST_CPP { return BF_GET(mPackedFormats, 0, 4); }
+	inline uint normalFormat()   CONST_CPP { return BF_GET(mPackedFormats, 4, 4); }
+	inline uint texcoordFormat() CONST_CPP { return BF_GET(mPackedFormats, 8, 4); }
+
 #ifdef __cplusplus
 	inline MeshVertexInfo(
 		const uint _indexBuffer   , const uint _indexOffset   , const uint _indexStride,
 		const uint _positionBuffer, const uint _positionOffset, const uint _positionStride,
 		const uint _normalBuffer  , const uint _normalOffset  , const uint _normalStride,
-		const uint _texcoordBuffer, const uint _texcoordOffset, const uint _texcoordStride) {
+		const uint _texcoordBuffer, const uint _texcoordOffset, const uint _texcoordStride,
+		const uint _positionFormat = VERTEX_FORMAT_FLOAT, const uint _normalFormat = VERTEX_FORMAT_FLOAT, const uint _texcoordFormat = VERTEX_FORMAT_FLOAT,
+		const float3 _positionOffset = float3::Zero(), const float3 _positionScale = float3::Ones()) {
 		BF_SET(mPackedBufferIndices[0], _indexBuffer   ,  0, 16);
 		BF_SET(mPackedBufferIndices[0], _positionBuffer, 16, 16);
 		BF_SET(mPackedBufferIndices[1], _normalBuffer  ,  0, 16);
@@ -127,6 +196,16 @@ struct MeshVertexInfo {
 		mPackedOffsets[1] = _positionOffset;
 		mPackedOffsets[2] = _normalOffset;
 		mPackedOffsets[3] = _texcoordOffset;
+
+		mPackedFormats = 0;
+		BF_SET(mPackedFormats, _positionFormat, 0, 4);
+		BF_SET(mPackedFormats, _normalFormat  , 4, 4);
+		BF_SET(mPackedFormats, _texcoordFormat, 8, 4);
+
+		mPositionOffset = _positionOffset;
+		mPositionScale = _positionScale;
+		mTriangleMap = 0xFFFF;
+		mFirstOpaquePrimitive = 0;
 	}
 #endif
 };
@@ -167,11 +246,11 @@ struct ViewData {
 };
 
 struct VisibilityData {
-	uint mInstancePrimitiveIndex;
+	uint mInstanceIndex;
+	uint mPrimitiveIndex;
 	uint mPackedNormal;
+	uint pad;
 
-    inline uint instanceIndex()  { return BF_GET(mInstancePrimitiveIndex,  0, 16); }
-    inline uint primitiveIndex() { return BF_GET(mInstancePrimitiveIndex, 16, 16); }
 #ifdef __SLANG_COMPILER__
 	inline float3 normal()       { return unpackNormal(mPackedNormal); }
 #endif
@@ -24,10 +24,10 @@ enum class TonemapMode {
 
 #ifdef __cplusplus
 static const std::unordered_set<TonemapMode> gTonemapModeNeedsMax = {
-	TonemapMode::eViridisR,
 	TonemapMode::eReinhardExtended,
 	TonemapMode::eReinhardLuminanceExtended,
-	TonemapMode::eUncharted2
+	TonemapMode::eUncharted2,
+	TonemapMode::eViridisLengthRGB
 };
 #endif
 
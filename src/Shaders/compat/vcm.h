@@ -65,16 +65,17 @@ struct VcmVertex {
     float dVM;                // MIS quantity used for vertex merging
     uint mLocalDirectionIn;
 };
-// 48 bytes
+// 40 bytes
 struct PackedVcmVertex {
-    float3 mLocalPosition;
-    uint mInstancePrimitiveIndex;
-    float3 mThroughput;       // Path throughput (including emission)
+    uint2 mPackedPosition;    // World space position, quantized in the scene bounds
+    uint mInstanceIndex;
+    uint mPackedThroughput;   // RGBE path throughput (including emission)
     uint mPackedData;         // mPathLength and mPathSamplePdfA
-    float dVCM;               // MIS quantity used for vertex connection and merging
-    float dVC;                // MIS quantity used for vertex connection
-    float dVM;                // MIS quantity used for vertex merging
     uint mLocalDirectionIn;
+    uint mPackedDVCM_DVC;     // bfloat16 dVCM and dVC
+    float dVM;                // MIS quantity used for vertex merging
+    uint mPrimitiveIndex;
+    uint pad;
 };
 
 // 48 bytes
@@ -82,16 +83,15 @@ struct DirectIlluminationReservoir {
     float4 mRnd;
 	// source domain location
     float3 mLocalPosition;
-    uint mInstancePrimitiveIndex;
+    uint mInstanceIndex;
     float M;
     float mIntegrationWeight;
     float mCachedTargetPdf;
-	float pad;
+	uint mPrimitiveIndex;
 };
-// pad to 128 bytes
+// 96 bytes
 struct LVCReservoir {
     PackedVcmVertex mLightVertex;
-    float4 pad1;
     PackedVcmVertex mCameraVertex;
     float M;
 	float mIntegrationWeight;
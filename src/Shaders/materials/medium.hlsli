@@ -143,6 +143,7 @@ struct Medium {
         const float invMajorantChannel = 1 / majorant[channel];
         const float invMajorantMax = 1 / max3(majorant);
 
+        uint nullCollisions = 0;
         for (uint iteration = 0; iteration < gMaxNullCollisions && any(beta > 0); iteration++) {
             const float t = -log(1 - rng.nextFloat().x) * invMajorantChannel;
 
@@ -168,15 +169,18 @@ struct Medium {
                 beta   *= tr * sigma_t * sigma_s; // note: multiplication by localSigmaS is really part of BSDF computation
                 dirPdf *= tr * sigma_t;
                 scattered = true;
+                scene.AddStat(GpuStat::eNullCollisions, nullCollisions);
                 return pnanovdb_grid_index_to_worldf(densityVolume, { 0 }, origin);
 			} else {
 				// fake particle
 				beta   *= tr * (majorant - sigma_t);
 				dirPdf *= tr * (majorant - sigma_t);
                 neePdf *= tr * majorant;
+                nullCollisions++;
 			}
 		}
 
+        scene.AddStat(GpuStat::eNullCollisions, nullCollisions);
         return 0;
 	}
 };
@@ -2,6 +2,7 @@
 #include <Core/Window.hpp>
 #include <Core/Swapchain.hpp>
 #include <Core/Profiler.hpp>
+#include <Core/GpuStats.hpp>
 
 #include <App/Gui.hpp>
 #include <App/Scene.hpp>
@@ -40,6 +41,7 @@ struct App {
 	shared_ptr<Instance> mInstance;
 	shared_ptr<Window> mWindow;
 	shared_ptr<Device> mDevice;
+	shared_ptr<GpuStats> mGpuStats;
 	uint32_t mPresentQueueFamily;
 	vk::raii::Queue mPresentQueue;
 
@@ -77,6 +79,7 @@ struct App {
 
 		mDevice       = deviceNode->makeComponent<Device>(*mInstance, physicalDevice);
 		mPresentQueue = vk::raii::Queue(**mDevice, mPresentQueueFamily, 0);
+		mGpuStats     = deviceNode->makeComponent<GpuStats>(*mDevice);
 
 		uint32_t minImages = 2;
 		if (auto arg = mInstance->findArgument("minImages"); arg) minImages = stoi(*arg);
@@ -189,6 +192,9 @@ struct App {
 			if (ImGui::Button(Profiler::hasHistory() ? "Hide timeline" : "Show timeline"))
 				Profiler::resetHistory(Profiler::hasHistory() ? 0 : mProfilerHistoryCount);
 			ImGui::PopID();
+
+			if (ImGui::CollapsingHeader("GPU stats"))
+				mGpuStats->drawGui();
 		}
 		ImGui::End();
 
@@ -248,6 +254,7 @@ struct App {
 				throw runtime_error("Error: waitForFences failed");
 			mDevice->updateLastFrameDone(commandBuffer.frameIndex());
 		}
+		mGpuStats->update();
 
 		// Record commands
 
@@ -256,6 +263,7 @@ struct App {
 
 		update(commandBuffer);
 		render(commandBuffer, Image::View(mSwapchain->image(), vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+		mGpuStats->resolve(commandBuffer);
 
 		commandBuffer->end();
 